@@ -19,6 +19,29 @@ classdef dotsClientEnsemble < topsEnsemble
       
       % whether to use strong (true) or weak (false) synchrony
       isSynchronized = false;
+      
+      % whether to queue transactions and send them a window at a time
+      % @details
+      % If true, transactions that need no result or synchronization are
+      % queued instead of sent right away.  Queued transactions are sent
+      % together, a window at a time, by flush().  This happens
+      % automatically when the queue reaches the dotsTheMessenger
+      % windowSize, and before any transaction that needs a result or
+      % synchronization, or starts or finishes the server-side ensemble.
+      % The server runs queued transactions in the order they were
+      % queued, even if some had to be resent.
+      isPipelined = false;
+      
+      % whether updateServerObject() sends only properties that changed
+      % @details
+      % If false, updateServerObject() sends every public property, so
+      % the server-side object matches the client-side object even if the
+      % server changed it.  If true, only sends properties that changed
+      % since the last update.  Transactions that may change objects on
+      % the server side, like callObjectMethod(), make the next update
+      % send every property again.  So do updates while the server-side
+      % ensemble is running its calls.
+      isDeltaUpdate = false;
    end
    
    properties (SetAccess = protected)
@@ -52,6 +75,9 @@ classdef dotsClientEnsemble < topsEnsemble
       
       % data returned from the Matlab profiler
       profilingInfo;
+      
+      % transactions queued while isPipelined, waiting for flush()
+      pendingTxns = {};
    end
    
    methods
@@ -147,6 +173,117 @@ classdef dotsClientEnsemble < topsEnsemble
          profview(0, self.profilingInfo);
       end
       
+      % Send any queued transactions and wait until they're acknowledged.
+      % @details
+      % Sends all the transactions queued while isPipelined, a window at
+      % a time, with dotsTheMessenger sendMessagesFromSocket().  Blocks
+      % until the server has acknowledged them all, which takes about
+      % one round trip per window instead of one per transaction.
+      % @details
+      % Returns a negative status if any queued transaction was not
+      % acknowledged, in which case later transactions may not have been
+      % sent.  Either way, empties the queue.
+      function status = flush(self)
+         status = 0;
+         if isempty(self.pendingTxns)
+            return;
+         end
+         
+         txns = self.pendingTxns;
+         self.pendingTxns = {};
+         
+         if self.isProfiling
+            profile('resume');
+         end
+         
+         m = dotsTheMessenger.theObject();
+         startTime = feval(m.clockFunction);
+         
+         % send all the commands and wait for acknowledgements
+         commands = cell(size(txns));
+         for ii = 1:numel(txns)
+            commands{ii} = ...
+               dotsEnsembleUtilities.getTransactionParts(txns{ii});
+         end
+         [status, ackTime] = ...
+            m.sendMessagesFromSocket(commands, self.socket);
+         
+         % the server may have missed some object properties
+         if status < 0
+            mxGram('deltaClear', dotsEnsembleUtilities.getDeltaKey(self));
+         end
+         
+         % report timing with the last transaction
+         txn = txns{end};
+         txn.startTime = startTime;
+         txn.acknowledgeTime = ackTime;
+         txn.finishTime = feval(m.clockFunction);
+         self.txnStatus = status;
+         self.txnData = txn;
+         
+         if self.isProfiling
+            profile('off');
+         end
+      end
+      
+      % Update the indexed object, from client to server.
+      % @param index ensemble object index
+      % @details
+      % Sends the public properties of the indexed object to the server
+      % side as one transaction, which the server applies in one pass.
+      % If isDeltaUpdate is true, only sends properties that changed
+      % since the last update, as found with mxGram('deltaEncode').  If
+      % nothing changed, sends nothing.  So mirroring changes to a
+      % client-side object, for example once per frame, costs at most one
+      % message.
+      % @details
+      % If the changed properties won't fit in one message, or some
+      % property can't be serialized, sends them one at a time instead.
+      % If any transaction fails, forgets what was sent, so that the next
+      % update sends every property, and returns the failure status.
+      % Check txnStatus and txnData for details of the bad transaction.
+      function status = updateServerObject(self, index)
+         % resolve the indexed object
+         object = self.getObject(index);
+         
+         % get public properties that changed since the last update
+         %   server-side calls may change objects while running
+         state = dotsEnsembleUtilities.getManyObjectProperties(object);
+         key = dotsEnsembleUtilities.getDeltaKey(self, index);
+         if ~self.isDeltaUpdate || self.isRunning
+            mxGram('deltaClear', key);
+         end
+         [delta, nChanged] = mxGram('deltaEncode', key, state);
+         if nChanged == 0
+            status = 0;
+            return;
+         end
+         
+         if nChanged < 0
+            % send until the first property that fails
+            [status, txn] = self.sendObjectProperties(index, state);
+            
+         else
+            m = dotsTheMessenger.theObject();
+            txn = dotsEnsembleUtilities.makePropertiesTransaction( ...
+               self, index, delta);
+            command = dotsEnsembleUtilities.getTransactionParts(txn);
+            if mxGram('size', command) <= m.maxMessageBytes
+               % send all the changed properties together
+               [status, txn] = self.doTransaction(txn);
+            else
+               % send the changed properties one at a time
+               [status, txn] = self.sendObjectProperties(index, delta);
+            end
+         end
+         self.txnStatus = status;
+         self.txnData = txn;
+         
+         if status < 0
+            mxGram('deltaClear', key);
+         end
+      end
+      
       % Enable calls to the call list.
       % @details
       % Redefines this topsRunnable list method to work with a remote
@@ -155,9 +292,7 @@ classdef dotsClientEnsemble < topsEnsemble
          % invoke start() on the server side
          txn = dotsEnsembleUtilities.makeMethodTransaction( ...
             self, @start, {}, false);
-         [status, txn] = ...
-            dotsClientEnsemble.doSynchronousTransaction( ...
-            txn, self.socket, self.timeout, self.isProfiling);
+         [status, txn] = self.doTransaction(txn, false);
          self.txnStatus = status;
          self.txnData = txn;
          
@@ -172,12 +307,13 @@ classdef dotsClientEnsemble < topsEnsemble
          % invoke finish() on the server side
          txn = dotsEnsembleUtilities.makeMethodTransaction( ...
             self, @finish, {}, false);
-         [status, txn] = ...
-            dotsClientEnsemble.doSynchronousTransaction( ...
-            txn, self.socket, self.timeout, self.isProfiling);
+         [status, txn] = self.doTransaction(txn, false);
          self.txnStatus = status;
          self.txnData = txn;
          
+         % server-side calls may have changed any object
+         self.forgetServerObjects();
+         
          self.finish@topsCallList();
       end
       
@@ -226,9 +362,7 @@ classdef dotsClientEnsemble < topsEnsemble
          isResult = nargout > 0;
          txn = dotsEnsembleUtilities.makeMethodTransaction( ...
             self, @addCall, varargin, isResult);
-         [status, txn] = ...
-            dotsClientEnsemble.doSynchronousTransaction( ...
-            txn, self.socket, self.timeout, self.isProfiling);
+         [status, txn] = self.doTransaction(txn);
          index = txn.result;
          self.txnStatus = status;
          self.txnData = txn;
@@ -246,9 +380,7 @@ classdef dotsClientEnsemble < topsEnsemble
       function setActiveByName(self, varargin)
          txn = dotsEnsembleUtilities.makeMethodTransaction( ...
             self, @setActiveByName, varargin, false);
-         [status, txn] = ...
-            dotsClientEnsemble.doSynchronousTransaction( ...
-            txn, self.socket, self.timeout, self.isProfiling);
+         [status, txn] = self.doTransaction(txn);
          self.txnStatus = status;
          self.txnData = txn;
          
@@ -266,13 +398,14 @@ classdef dotsClientEnsemble < topsEnsemble
          isResult = nargout > 0;
          txn = dotsEnsembleUtilities.makeMethodTransaction( ...
             self, @callByName, varargin, isResult);
-         [status, txn] = ...
-            dotsClientEnsemble.doSynchronousTransaction( ...
-            txn, self.socket, self.timeout, self.isProfiling);
+         [status, txn] = self.doTransaction(txn);
          result = txn.result;
          self.txnStatus = status;
          self.txnData = txn;
          
+         % the call may change any object on the server side
+         self.forgetServerObjects();
+         
          % no call on the client side
       end
       
@@ -285,15 +418,21 @@ classdef dotsClientEnsemble < topsEnsemble
       function index = addObject(self, varargin)
          txn = dotsEnsembleUtilities.makeObjectTransaction( ...
             self, varargin{:});
-         [status, txn] = ...
-            dotsClientEnsemble.doSynchronousTransaction( ...
-            txn, self.socket, self.timeout, self.isProfiling);
+         [status, txn] = self.doTransaction(txn);
          index = txn.result;
          self.txnStatus = status;
          self.txnData = txn;
          
          self.addObject@topsEnsemble(varargin{:});
          
+         % inserting shifts indexes, so forget properties sent before
+         if numel(varargin) >= 2 && ~isempty(varargin{2})
+            mxGram('deltaClear', dotsEnsembleUtilities.getDeltaKey(self));
+         else
+            mxGram('deltaClear', ...
+               dotsEnsembleUtilities.getDeltaKey(self, index));
+         end
+         
          % transmit the public properties of the new object
          self.updateServerObject(index);
       end
@@ -306,14 +445,15 @@ classdef dotsClientEnsemble < topsEnsemble
       function object = removeObject(self, varargin)
          txn = dotsEnsembleUtilities.makeMethodTransaction( ...
             self, @removeObject, varargin, false);
-         [status, txn] = ...
-            dotsClientEnsemble.doSynchronousTransaction( ...
-            txn, self.socket, self.timeout, self.isProfiling);
+         [status, txn] = self.doTransaction(txn);
          self.txnStatus = status;
          self.txnData = txn;
          
          % can't transmit object from server
          object = self.removeObject@topsEnsemble(varargin{:});
+         
+         % removing shifts indexes, so forget properties sent before
+         mxGram('deltaClear', dotsEnsembleUtilities.getDeltaKey(self));
       end
       
       % Assign one object to a property of one other object.
@@ -326,12 +466,13 @@ classdef dotsClientEnsemble < topsEnsemble
       function assignObject(self, varargin)
          txn = dotsEnsembleUtilities.makeMethodTransaction( ...
             self, @assignObject, varargin, false);
-         [status, txn] = ...
-            dotsClientEnsemble.doSynchronousTransaction( ...
-            txn, self.socket, self.timeout, self.isProfiling);
+         [status, txn] = self.doTransaction(txn);
          self.txnStatus = status;
          self.txnData = txn;
          
+         % the outer object changes on the server side
+         self.forgetServerObjects(varargin{2});
+         
          self.assignObject@topsEnsemble(varargin{:});
       end
       
@@ -347,12 +488,13 @@ classdef dotsClientEnsemble < topsEnsemble
       function passObject(self, varargin)
          txn = dotsEnsembleUtilities.makeMethodTransaction( ...
             self, @passObject, varargin, false);
-         [status, txn] = ...
-            dotsClientEnsemble.doSynchronousTransaction( ...
-            txn, self.socket, self.timeout, self.isProfiling);
+         [status, txn] = self.doTransaction(txn);
          self.txnStatus = status;
          self.txnData = txn;
          
+         % the method may change either object on the server side
+         self.forgetServerObjects([varargin{1:2}]);
+         
          % no call on client side
       end
       
@@ -366,9 +508,7 @@ classdef dotsClientEnsemble < topsEnsemble
       function setObjectProperty(self, varargin)
          txn = dotsEnsembleUtilities.makeMethodTransaction( ...
             self, @setObjectProperty, varargin, false);
-         [status, txn] = ...
-            dotsClientEnsemble.doSynchronousTransaction( ...
-            txn, self.socket, self.timeout, self.isProfiling);
+         [status, txn] = self.doTransaction(txn);
          self.txnStatus = status;
          self.txnData = txn;
          
@@ -385,9 +525,7 @@ classdef dotsClientEnsemble < topsEnsemble
          isResult = nargout > 0;
          txn = dotsEnsembleUtilities.makeMethodTransaction( ...
             self, @getObjectProperty, varargin, isResult);
-         [status, txn] = ...
-            dotsClientEnsemble.doSynchronousTransaction( ...
-            txn, self.socket, self.timeout, self.isProfiling);
+         [status, txn] = self.doTransaction(txn);
          value = txn.result;
          self.txnStatus = status;
          self.txnData = txn;
@@ -407,13 +545,18 @@ classdef dotsClientEnsemble < topsEnsemble
          isResult = nargout > 0;
          txn = dotsEnsembleUtilities.makeMethodTransaction( ...
             self, @callObjectMethod, varargin, isResult);
-         [status, txn] = ...
-            dotsClientEnsemble.doSynchronousTransaction( ...
-            txn, self.socket, self.timeout, self.isProfiling);
+         [status, txn] = self.doTransaction(txn);
          result = txn.result;
          self.txnStatus = status;
          self.txnData = txn;
          
+         % the method may change the objects on the server side
+         if numel(varargin) >= 3
+            self.forgetServerObjects(varargin{3});
+         else
+            self.forgetServerObjects();
+         end
+         
          % no call on client side
       end
       
@@ -431,13 +574,18 @@ classdef dotsClientEnsemble < topsEnsemble
          isResult = nargout > 0;
          txn = dotsEnsembleUtilities.makeMethodTransaction( ...
             self, @automateObjectMethod, varargin, isResult);
-         [status, txn] = ...
-            dotsClientEnsemble.doSynchronousTransaction( ...
-            txn, self.socket, self.timeout, self.isProfiling);
+         [status, txn] = self.doTransaction(txn);
          index = txn.result;
          self.txnStatus = status;
          self.txnData = txn;
          
+         % the method may already have changed objects on the server side
+         if numel(varargin) >= 4
+            self.forgetServerObjects(varargin{4});
+         else
+            self.forgetServerObjects();
+         end
+         
          % no automation on client side
       end
    end
@@ -465,36 +613,88 @@ classdef dotsClientEnsemble < topsEnsemble
       % Tell the server to create a mirror of this ensemble.
       function [status, txn] = requestServerCounterpart(self)
          txn = dotsEnsembleUtilities.makeEnsembleTransaction(self);
-         [status, txn] = ...
-            dotsClientEnsemble.doSynchronousTransaction( ...
-            txn, self.socket, self.timeout, self.isProfiling);
+         [status, txn] = self.doTransaction(txn, false);
+         
+         % the new counterpart has no object properties yet
+         mxGram('deltaClear', dotsEnsembleUtilities.getDeltaKey(self));
       end
       
-      % Update the indexed object, from client to server.
+      % Forget object properties sent before, for delta updates.
+      % @param index optional ensemble object index or indexes
+      % @details
+      % Server-side calls may change objects without the client seeing
+      % it.  Makes the next updateServerObject() send every property of
+      % the indexed objects, or of all objects if @a index is omitted or
+      % empty.
+      function forgetServerObjects(self, index)
+         if nargin < 2 || isempty(index) || ~isnumeric(index)
+            mxGram('deltaClear', dotsEnsembleUtilities.getDeltaKey(self));
+         else
+            for ii = index(:)'
+               mxGram('deltaClear', ...
+                  dotsEnsembleUtilities.getDeltaKey(self, ii));
+            end
+         end
+      end
+      
+      % Send object properties one at a time, a window at a time.
       % @param index ensemble object index
+      % @param propStruct properties and values in struct form
       % @details
-      % Iterates the public properties of the indexed object and sends
-      % them one at a time to the server side.  If any transaction fails,
-      % returns immediately with the failure status.  Check txnStatus and
-      % txnData for details of the bad transaction.
-      function status = updateServerObject(self, index)
-         % resolve the indexed object
-         object = self.getObject(index);
-         
-         % get public properties of the object
-         state = dotsEnsembleUtilities.getManyObjectProperties(object);
-         props = fieldnames(state);
+      % Queues a setObjectProperty transaction for each field of @a
+      % propStruct, and sends them a window at a time, whether or not
+      % isPipelined is true.  Only the last one is synchronized.  Returns
+      % the status of the first transaction that fails, or of the last.
+      function [status, txn] = sendObjectProperties(self, index, propStruct)
+         props = fieldnames(propStruct);
          nFields = numel(props);
          status = 0;
+         txn = [];
          for ii = 1:nFields
-            % send each property value to the server
             p = props{ii};
-            self.setObjectProperty(p, state.(p), index);
+            txn = dotsEnsembleUtilities.makeMethodTransaction( ...
+               self, @setObjectProperty, {p, propStruct.(p), index}, false);
+            if ii < nFields
+               txn.isSynchronized = false;
+               self.pendingTxns{end+1} = txn;
+            else
+               % send the queue, then the last one as a barrier
+               [status, txn] = self.doTransaction(txn, false);
+            end
+         end
+      end
+      
+      % Do a transaction now, or queue it while pipelining.
+      % @param txn formatted transaction struct
+      % @param isQueueable whether @a txn may wait in the queue
+      % @details
+      % If isPipelined and @a isQueueable are true, and @a txn needs no
+      % result or synchronization, adds @a txn to the queue and returns
+      % zero status.  Flushes the queue once it reaches the
+      % dotsTheMessenger windowSize.  Otherwise, flushes the queue, then
+      % does @a txn with doSynchronousTransaction().  @a isQueueable
+      % defaults to true.
+      function [status, txn] = doTransaction(self, txn, isQueueable)
+         if nargin < 3
+            isQueueable = true;
+         end
+         
+         if isQueueable && self.isPipelined ...
+               && ~(txn.isSynchronized || txn.isResult)
+            self.pendingTxns{end+1} = txn;
+            status = 0;
+            m = dotsTheMessenger.theObject();
+            if numel(self.pendingTxns) >= m.windowSize
+               status = self.flush();
+            end
             
-            % fail as soon as the first property fails
-            status = self.txnStatus;
-            if status < 0
-               return;
+         else
+            % earlier transactions go first
+            status = self.flush();
+            if status >= 0
+               [status, txn] = ...
+                  dotsClientEnsemble.doSynchronousTransaction( ...
+                  txn, self.socket, self.timeout, self.isProfiling);
             end
          end
       end
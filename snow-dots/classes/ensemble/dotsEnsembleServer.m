@@ -27,9 +27,15 @@ classdef dotsEnsembleServer < handle
         % seconds to allow for network communications
         timeout = 1.0;
         
-        % seconds to yield periodically to the operating system
+        % seconds between runBriefly() for running ensembles
+        % @details
+        % The server sleeps on its socket in between, and wakes up early
+        % for client messages.
         waitTime = 0.0001;
         
+        % seconds to sleep on the socket when no ensemble is running
+        idleWaitTime = 0.1;
+        
         % function that returns the current time as a number
         clockFunction;
     end
@@ -127,7 +133,9 @@ classdef dotsEnsembleServer < handle
             
             wt = self.waitTime;
             cf = self.clockFunction;
-            endTime = duration + feval(cf);
+            m = dotsTheMessenger.theObject();
+            nextRunTime = feval(cf);
+            endTime = duration + nextRunTime;
             while feval(cf) < endTime
                 % Do all pending transactions.
                 %   Doing multiple transactions now means the next
@@ -140,11 +148,20 @@ classdef dotsEnsembleServer < handle
                     status = self.doNextTransaction();
                 end
                 
-                % let ensembles do concurrent behaviors
-                self.runEnsemblesBriefly()
+                % let ensembles do concurrent behaviors, when they're due
+                isAnyRunning = self.runEnsemblesBriefly(nextRunTime);
+                if isAnyRunning && feval(cf) >= nextRunTime
+                    nextRunTime = feval(cf) + wt;
+                end
                 
-                % yield time to the operating system
-                mglWaitSecs(wt)
+                % sleep on the socket until the next run is due
+                %   a client message wakes the server right away
+                if isAnyRunning
+                    deadline = min(nextRunTime, endTime);
+                else
+                    deadline = min(feval(cf) + self.idleWaitTime, endTime);
+                end
+                m.waitForMessageAtSocket(self.socket, deadline - feval(cf));
             end
         end
         
@@ -241,6 +258,13 @@ classdef dotsEnsembleServer < handle
                         index = ensemble.addObject(object, txn.args);
                         txn.result = index;
                         
+                    case 'properties'
+                        % assign many properties in one pass
+                        ensemble = self.ensembles(txn.target);
+                        object = ensemble.getObject(txn.args{1});
+                        dotsEnsembleUtilities.setManyObjectProperties( ...
+                            object, txn.args{2});
+                        
                     case 'method'
                         ensemble = self.ensembles(txn.target);
                         if txn.isResult
@@ -270,11 +294,21 @@ classdef dotsEnsembleServer < handle
         end
         
         % Let each ensemble that isRunning runBriefly().
-        function runEnsemblesBriefly(self)
+        % @param nextRunTime when the next runBriefly() is due
+        % @details
+        % Only invokes runBriefly() if @a nextRunTime has come, in units of
+        % clockFunction.  Returns true if any ensemble isRunning, whether
+        % or not it was due.
+        function isAnyRunning = runEnsemblesBriefly(self, nextRunTime)
+            isDue = nargin < 2 || feval(self.clockFunction) >= nextRunTime;
+            isAnyRunning = false;
             nEnsembles = numel(self.ensembleCell);
             for ii = 1:nEnsembles
                 if self.ensembleCell{ii}.isRunning;
-                    self.ensembleCell{ii}.runBriefly();
+                    isAnyRunning = true;
+                    if isDue
+                        self.ensembleCell{ii}.runBriefly();
+                    end
                 end
             end
         end
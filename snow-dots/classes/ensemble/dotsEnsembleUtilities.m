@@ -183,6 +183,41 @@ classdef dotsEnsembleUtilities
          txn.isSynchronized = ensemble.isSynchronized;
       end
       
+      % Make a set-many-properties transaction.
+      % @param ensemble a client-side ensemble object
+      % @param index ensemble index of one object
+      % @param propStruct properties and values in struct form
+      % @details
+      % Returns a struct which defines a transaction, telling an ensemble
+      % server to assign the fields of @a propStruct to the properties of
+      % the indexed object, all in one pass, with
+      % setManyObjectProperties().  @a propStruct may have just the
+      % properties that changed, as from mxGram('deltaEncode').
+      function txn = makePropertiesTransaction(ensemble, index, propStruct)
+         txn = dotsEnsembleUtilities.getTransactionTemplate();
+         txn.type = 'properties';
+         txn.target = ensemble.name;
+         txn.args = {index, propStruct};
+         txn.isSynchronized = ensemble.isSynchronized;
+      end
+      
+      % Get a key for tracking the properties sent for an object.
+      % @param ensemble a client-side ensemble object
+      % @param index optional ensemble index of one object
+      % @details
+      % Returns a string key to pass to mxGram('deltaEncode'), which is
+      % unique to the given @a ensemble and object @a index.  If @a index
+      % is omitted, returns the prefix shared by all keys for @a
+      % ensemble, to pass to mxGram('deltaClear').  Keys end with a
+      % colon, so the key for one index is not a prefix of another.
+      function key = getDeltaKey(ensemble, index)
+         if nargin < 2
+            key = sprintf('%s:', ensemble.name);
+         else
+            key = sprintf('%s:%d:', ensemble.name, index);
+         end
+      end
+      
       % Make a method-call transaction.
       % @param ensemble a client-side ensemble object
       % @param funciton handle of a method to call on @a ensemble
@@ -47,6 +47,10 @@ classdef dotsTheMessenger < dotsAllSingletonObjects
         % named dotsAllSocketObjects subclass should be appropriate for the
         % local hardware, operating system, etc.
         % @details
+        % dotsSocketMexStream and dotsSocketMexUnix send over TCP or Unix
+        % domain streams, which don't need ack codes or resends.  Both
+        % peers must use the same class.
+        % @details
         % Automatically gets the machine-specific default from
         % dotsTheMachineConfiguration.
         socketClassName;
@@ -80,6 +84,68 @@ classdef dotsTheMessenger < dotsAllSingletonObjects
         
         % status code indicating no message was received
         notReceivedStatus = -222;
+        
+        % status code indicating a message was too large to send
+        tooLargeStatus = -333;
+        
+        % largest serialized message to send in one piece
+        % @details
+        % dotsTheMessenger checks the exact serialized size of each
+        % message before sending it.  Messages larger than maxMessageBytes
+        % are not sent.  The default leaves room for the 1-byte ack code
+        % prefix in an 8192-byte datagram.
+        maxMessageBytes = 8191;
+        
+        % serialized message size at which to try compression
+        % @details
+        % Messages whose serialized size is at least compressThreshold
+        % bytes are sent compressed, if that makes them smaller.
+        % Compressed messages must fit in maxMessageBytes.  The default,
+        % inf, never compresses, since peers running older versions of
+        % mxGram can't decode compressed messages.  Set to a finite size,
+        % like 1024, to opt in.
+        compressThreshold = inf;
+        
+        % whether to send repeated message layouts as schema IDs
+        % @details
+        % If true, messages are sent with mxGram('schemaEncode').  The
+        % first message with a given layout of classes, sizes, and field
+        % names carries the layout, and later messages with the same
+        % layout carry only a schema ID and data values.  This suits
+        % ensemble transactions, which have the same layout over and
+        % over.  Layouts are kept separately for each peer, as identified
+        % by the socket object's getPeerKey(), so a server with several
+        % clients sends each client its own layouts.  A peer's layouts are
+        % forgotten after any message to it goes unacknowledged, or its
+        % socket is opened.  Receivers don't acknowledge messages whose
+        % layout they never got, so an unacknowledged message that left
+        % out its layout is sent once more with the layout.  Stream
+        % sockets don't acknowledge anything, but their peer key changes
+        % when they connect to a restarted peer, so a message sent over
+        % a new connection is encoded again, with its layout, and sent
+        % once more.  Messages sent without waiting for acknowledgement
+        % might leave the receiver without a layout, so don't combine
+        % them with schema encoding.
+        % @details
+        % Schema encoding also packs struct arrays, with field names
+        % sent once and scalar fields sent as columns.  Peers running
+        % older versions of mxGram can't decode schemas or packed
+        % structs, so only set isSchemaEncoded when both peers are up to
+        % date.  Otherwise, structs go in the original per-element
+        % layout.
+        isSchemaEncoded = false;
+        
+        % number of messages to send before waiting for acknowledgements
+        % @details
+        % sendMessagesFromSocket() sends up to windowSize messages at a
+        % time, each with its own ack code prefix, then waits for all of
+        % their acknowledgements.  Receivers remember the last windowSize
+        % prefixes at each socket, to recognize resends that arrive out
+        % of order, and hold messages that arrive less than windowSize
+        % ahead of a missing one, to deliver them in order.  So senders
+        % and receivers should agree on windowSize, and it must be less
+        % than half of prefixModulus.  Takes effect at initialize().
+        windowSize = 32;
     end
     
     properties (SetAccess = protected)
@@ -90,12 +156,24 @@ classdef dotsTheMessenger < dotsAllSingletonObjects
         % messages.
         socketObject;
         
-        % 1-byte prefix for the previous sent message
+        % 1-byte prefix for the previous sent message from each socket
         sentPrefix;
         
-        % 1-byte prefixs for the previous received message at each socket
+        % 1-byte prefixes for recent received messages at each socket
+        % @details
+        % Has one row per socket, with the last windowSize prefixes
+        % received at that socket, newest first.
         receivedPrefix;
         
+        % messages that arrived ahead of a missing prefix, per socket
+        % @details
+        % Has one struct array per socket, with fields prefix, msg,
+        % status, and time.  receiveMessageAtSocket() acknowledges
+        % messages that arrive ahead of a missing prefix, but holds them
+        % until the missing message arrives, so that messages are
+        % delivered in the order they were sent.
+        heldMessages;
+        
         % roll-over value for 1-byte message prefixes
         % @details
         % prefixModulus wants to be 256, but because of Matlab clips
@@ -120,23 +198,129 @@ classdef dotsTheMessenger < dotsAllSingletonObjects
     end
     
     methods (Access = protected)
-        % Keep track of the last message prefix received at a socket.
+        % Keep track of recent message prefixes received at a socket.
+        % @details
+        % prefixModulus forgets all the recent prefixes, and any held
+        % messages.
         function setSocketReceivedPrefix(self, sock, prefix)
             ii = sock+1;
             if ii > 0
-                self.receivedPrefix(ii) = prefix;
-                %disp(sprintf('set receivedPrefix(%d) = %d', ...
-                %    ii, self.receivedPrefix(ii)))
+                if prefix == self.prefixModulus
+                    self.receivedPrefix(ii,:) = prefix;
+                    self.heldMessages{ii} = [];
+                else
+                    recent = self.getSocketReceivedPrefix(sock);
+                    self.receivedPrefix(ii,:) = [prefix, recent(1:end-1)];
+                end
             end
         end
         
-        % Get the last message prefix received at a socket.
+        % Get recent message prefixes received at a socket, newest first.
         function prefix = getSocketReceivedPrefix(self, sock)
             ii = sock+1;
-            if ii > 0 && ii <= length(self.receivedPrefix)
-                prefix = self.receivedPrefix(ii);
+            if ii > 0 && ii <= size(self.receivedPrefix, 1)
+                prefix = self.receivedPrefix(ii,:);
+            else
+                prefix = repmat(uint8(self.prefixModulus), ...
+                    1, size(self.receivedPrefix, 2));
+            end
+        end
+        
+        % Get the prefixes of messages held at a socket.
+        function prefix = getSocketHeldPrefix(self, sock)
+            ii = sock+1;
+            if ii > 0 && ii <= numel(self.heldMessages) ...
+                    && ~isempty(self.heldMessages{ii})
+                prefix = [self.heldMessages{ii}.prefix];
             else
-                prefix = self.prefixModulus;
+                prefix = uint8([]);
+            end
+        end
+        
+        % Is a received prefix ahead of the next one expected?
+        % @details
+        % Prefixes less than a window ahead of the next expected prefix
+        % must have overtaken a missing message.  Others are in order, or
+        % old, or from a peer that started over, and can be delivered.
+        function isAhead = isSocketPrefixAhead(self, sock, prefix)
+            newest = self.getSocketReceivedPrefix(sock);
+            newest = double(newest(1));
+            if newest == self.prefixModulus
+                isAhead = false;
+            else
+                ahead = mod(double(prefix) - newest - 1, ...
+                    self.prefixModulus);
+                isAhead = ahead > 0 && ahead < self.windowSize;
+            end
+        end
+        
+        % Hold a message that arrived ahead of a missing prefix.
+        function holdSocketMessage(self, sock, prefix, msg, status)
+            ii = sock+1;
+            if ii > numel(self.heldMessages)
+                self.heldMessages{ii} = [];
+            end
+            held.prefix = uint8(prefix);
+            held.msg = msg;
+            held.status = status;
+            held.time = feval(self.clockFunction);
+            self.heldMessages{ii} = [self.heldMessages{ii}, held];
+        end
+        
+        % Take the next held message, if it's ready for delivery.
+        % @details
+        % A held message is ready when the missing prefixes before it
+        % have been delivered.  If the missing message never arrives,
+        % held messages are delivered anyway, in prefix order, once the
+        % oldest one has been held longer than a sender would keep
+        % resending.
+        function [msg, status, prefix] = takeSocketHeldMessage(self, sock)
+            msg = [];
+            status = self.notReceivedStatus;
+            prefix = [];
+            
+            ii = sock+1;
+            if ii < 1 || ii > numel(self.heldMessages) ...
+                    || isempty(self.heldMessages{ii})
+                return;
+            end
+            
+            held = self.heldMessages{ii};
+            newest = self.getSocketReceivedPrefix(sock);
+            ahead = mod(double([held.prefix]) - double(newest(1)) - 1, ...
+                self.prefixModulus);
+            [nextAhead, next] = min(ahead);
+            
+            holdTimeout = max(self.ackTimeout, 0) * (1 + self.sendRetries);
+            heldTime = feval(self.clockFunction) - min([held.time]);
+            if nextAhead == 0 || heldTime > holdTimeout
+                msg = held(next).msg;
+                status = held(next).status;
+                prefix = held(next).prefix;
+                held(next) = [];
+                self.heldMessages{ii} = held;
+            end
+        end
+        
+        % Choose the next message prefix to send from a socket.
+        function prefix = nextSocketSentPrefix(self, sock)
+            ii = sock+1;
+            if ii > 0 && ii <= length(self.sentPrefix)
+                prefix = mod(1+self.sentPrefix(ii), self.prefixModulus);
+            else
+                prefix = uint8(0);
+            end
+            if ii > 0
+                self.sentPrefix(ii) = prefix;
+            end
+        end
+        
+        % Serialize a message with the given peer's schema layouts.
+        function [bytes, status, isNewLayout] = schemaEncodeMessage( ...
+                self, msg, key)
+            [bytes, status, isNewLayout] = mxGram('schemaEncode', msg, key);
+            if status > self.maxMessageBytes
+                status = self.tooLargeStatus;
             end
         end
     end
@@ -191,7 +375,9 @@ classdef dotsTheMessenger < dotsAllSingletonObjects
             self.socketObject.closeAll();
             
             self.sentPrefix = uint8(self.prefixModulus);
-            self.receivedPrefix = uint8(self.prefixModulus);
+            self.receivedPrefix = repmat(uint8(self.prefixModulus), ...
+                1, self.windowSize);
+            self.heldMessages = {};
         end
         
         % Send a message from the given socket.
@@ -205,7 +391,8 @@ classdef dotsTheMessenger < dotsAllSingletonObjects
         % sock, to whatever address and port were specified in the call to
         % openSocket().  @a msg must be one of the following variable
         % types:
-        %   - double
+        %   - double, single, or any integer type, real or complex
+        %   - sparse double or logical
         %   - char
         %   - logical
         %   - cell
@@ -216,7 +403,8 @@ classdef dotsTheMessenger < dotsAllSingletonObjects
         % types.  Nested cells and structs are supported.  Any @a msg or
         % element that is an array, including cell arrays, should be at
         % most two-dimensional (mxn).  struct arrays should be
-        % one-dimenstional (1xn) but may have any number of fields.
+        % one-dimenstional (1xn), unless isSchemaEncoded is true, but may
+        % have any number of fields.
         % @details
         % If @a ackTimeout is non-negative, waits for the receiver to send
         % back an acknowledgement of @a msg.  If no acknowledgement arrives
@@ -227,8 +415,11 @@ classdef dotsTheMessenger < dotsAllSingletonObjects
         % and sendRetries properties are used.
         % @details
         % Returns a status code.  May return notAcknowledgedStatus if the
-        % message was sent but never acknowledged. Other negative status
-        % indicates an error and that @a msg may not have been sent.
+        % message was sent but never acknowledged.  May return
+        % tooLargeStatus if @a msg would serialize to more than
+        % maxMessageBytes, even after compression, in which case it was
+        % not sent.  Other negative status indicates an error and that @a
+        % msg may not have been sent.
         % @details
         % Also returns as a second output the amount of time spent waiting
         % for message acknowledgement, whether or not it was ever
@@ -247,44 +438,161 @@ classdef dotsTheMessenger < dotsAllSingletonObjects
             startTime = feval(self.clockFunction);
             ackTime = 0;
             
-            % serialize the message
-            [bytes, status] = mxGram('mxToBytes', msg);
-            if status < 0
-                return;
+            % schema messages are serialized here, once
+            %   with layouts kept for the socket's current peer
+            %   others are serialized by the socket object, with the prefix
+            if self.isSchemaEncoded
+                key = self.socketObject.getPeerKey(sock);
+                [bytes, status, isNewLayout] = ...
+                    self.schemaEncodeMessage(msg, key);
+                if status < 0
+                    return;
+                end
             end
             
             % send the message prefixed with a 1-byte ack code
-            prefix = mod(1+self.sentPrefix, self.prefixModulus);
-            self.sentPrefix = prefix;
-            prefixedBytes = cat(2, prefix, bytes);
+            prefix = self.nextSocketSentPrefix(sock);
             
             % send and wait for ack code up to (sendRetries + 1) times
-            nTries = 0;
-            while nTries <= sendRetries
-                % send to receiver
-                status = self.socketObject.writeBytes(sock, prefixedBytes);
-                if status < 0 || ackTimeout < 0
-                    return;
-                end
-                nTries = nTries + 1;
+            %   the socket object does the whole loop, maybe natively
+            if self.isSchemaEncoded
+                [status, isAcked] = self.socketObject.writeBytesAcked( ...
+                    sock, cat(2, prefix, bytes), ackTimeout, sendRetries);
                 
-                % wait for a reply from the receiver
-                hasReply = self.socketObject.check(sock, ackTimeout);
-                
-                % is the correct ack code waiting at the socket?
-                while hasReply
-                    reply = self.socketObject.readBytes(sock);
-                    if (numel(reply) == 1) && (reply == prefix)
-                        % got ack code, all done
-                        ackTime = feval(self.clockFunction) - startTime;
+                % a stream socket may have connected to a restarted peer,
+                %   which can't decode layouts kept for the old connection
+                %   so encode again for the new connection and resend
+                newKey = self.socketObject.getPeerKey(sock);
+                if ~isequal(newKey, key)
+                    mxGram('schemaClear', key);
+                    key = newKey;
+                    [bytes, status, isNewLayout] = ...
+                        self.schemaEncodeMessage(msg, key);
+                    if status < 0
                         return;
                     end
-                    hasReply = self.socketObject.check(sock, 0);
+                    [status, isAcked] = self.socketObject.writeBytesAcked( ...
+                        sock, cat(2, prefix, bytes), ackTimeout, sendRetries);
+                end
+            else
+                [status, isAcked, ~, nBytes] = ...
+                    self.socketObject.writeMxAcked(sock, prefix, msg, ...
+                    ackTimeout, sendRetries, ...
+                    self.compressThreshold, self.maxMessageBytes);
+                if status < 0 && nBytes > self.maxMessageBytes
+                    status = self.tooLargeStatus;
                 end
             end
+            ackTime = feval(self.clockFunction) - startTime;
+            if status < 0 || ackTimeout < 0 || isAcked
+                return;
+            end
             
             % never got an acknowledgement
+            %   the receiver may have missed a schema layout
+            %   so forget this peer's layouts and send once more with one
+            if self.isSchemaEncoded
+                mxGram('schemaClear', key);
+                if ~isNewLayout
+                    [bytes, status] = self.schemaEncodeMessage(msg, key);
+                    if status < 0
+                        return;
+                    end
+                    [status, isAcked] = ...
+                        self.socketObject.writeBytesAcked(sock, ...
+                        cat(2, prefix, bytes), ackTimeout, sendRetries);
+                    ackTime = feval(self.clockFunction) - startTime;
+                    if status < 0 || isAcked
+                        return;
+                    end
+                    mxGram('schemaClear', key);
+                end
+            end
             status = self.notAcknowledgedStatus;
+        end
+        
+        % Send several messages from the given socket, a window at a time.
+        % @param msgs cell array of variables to send as messages
+        % @param sock numeric identifier for a socket, as returned by
+        % openSocket()
+        % @param ackTimeout seconds to wait for message acknowledgements
+        % @param sendRetries number of times to resend if unacknowledged
+        % @details
+        % Like sendMessageFromSocket(), but sends up to windowSize of @a
+        % msgs before waiting for any acknowledgement.  Each message gets
+        % its own ack code prefix, and the receiver may acknowledge them
+        % in any order.  Sends the next window once every message in the
+        % current window is acknowledged.  So sending n messages takes
+        % about one round trip per window, instead of one per message.
+        % @details
+        % Returns the number of messages sent, or a status code.  May
+        % return notAcknowledgedStatus if any message was sent but never
+        % acknowledged, in which case later windows were not sent.  May
+        % return tooLargeStatus if any message would serialize to more
+        % than maxMessageBytes, in which case none of its window was
+        % sent.  Other negative status indicates an error.
+        % @details
+        % Schema-encoded messages depend on the layouts sent before them,
+        % so if isSchemaEncoded is true, sends one message at a time with
+        % sendMessageFromSocket().
+        % @details
+        % Also returns as a second output the amount of time spent sending
+        % and waiting for acknowledgements, in units of clockFunction.
+        function [status, ackTime] = sendMessagesFromSocket( ...
+                self, msgs, sock, ackTimeout, sendRetries)
+            
+            if nargin < 4 || isempty(ackTimeout)
+                ackTimeout = self.ackTimeout;
+            end
+            
+            if nargin < 5 || isempty(sendRetries)
+                sendRetries = self.sendRetries;
+            end
+            
+            startTime = feval(self.clockFunction);
+            nMessages = numel(msgs);
+            status = nMessages;
+            
+            if self.isSchemaEncoded
+                for ii = 1:nMessages
+                    status = self.sendMessageFromSocket( ...
+                        msgs{ii}, sock, ackTimeout, sendRetries);
+                    if status < 0
+                        break;
+                    end
+                end
+                ackTime = feval(self.clockFunction) - startTime;
+                if status >= 0
+                    status = nMessages;
+                end
+                return;
+            end
+            
+            for first = 1:self.windowSize:nMessages
+                window = first:min(first+self.windowSize-1, nMessages);
+                prefixes = zeros(size(window), 'uint8');
+                for ii = 1:numel(window)
+                    prefixes(ii) = self.nextSocketSentPrefix(sock);
+                end
+                
+                % send the window and wait for all its ack codes
+                %   the socket object does the whole loop, maybe natively
+                [windowStatus, isAcked, ~, nBytes] = ...
+                    self.socketObject.writeMxWindow(sock, ...
+                    prefixes, msgs(window), ackTimeout, sendRetries, ...
+                    self.compressThreshold, self.maxMessageBytes);
+                if windowStatus < 0
+                    if any(nBytes > self.maxMessageBytes)
+                        status = self.tooLargeStatus;
+                    else
+                        status = windowStatus;
+                    end
+                    break;
+                elseif ackTimeout >= 0 && ~all(isAcked)
+                    status = self.notAcknowledgedStatus;
+                    break;
+                end
+            end
             ackTime = feval(self.clockFunction) - startTime;
         end
         
@@ -303,6 +611,12 @@ classdef dotsTheMessenger < dotsAllSingletonObjects
         % notReceivedStatus if no message was available.  May return other
         % negative status codes if there was an error reading from @a sock
         % or decoding message bytes into a variable.
+        % @details
+        % Delivers messages in the order they were sent, even when
+        % several were sent at once with sendMessagesFromSocket() and a
+        % resend arrives after later messages.  Messages that overtake a
+        % missing one are acknowledged right away, but held until the
+        % missing one arrives.
         function [msg, status] = receiveMessageAtSocket( ...
                 self, sock, receiveTimeout)
             
@@ -310,35 +624,67 @@ classdef dotsTheMessenger < dotsAllSingletonObjects
                 receiveTimeout = self.receiveTimeout;
             end
             
-            % wait for a message
-            recentPrefix = self.getSocketReceivedPrefix(sock);
-            while self.socketObject.check(sock, receiveTimeout);
-                % read the next message
-                %   it must be the right type
-                %   it must not have a recent ack code prefix
-                % otherwise ignore it
-                prefixedBytes = self.socketObject.readBytes(sock);
-                if isa(prefixedBytes, 'uint8') ...
-                        && numel(prefixedBytes) > 1 ...
-                        && prefixedBytes(1) ~= recentPrefix
-                    % this is a substantial message
+            startTime = feval(self.clockFunction);
+            while true
+                % a held message may be next in line
+                [msg, status, prefix] = self.takeSocketHeldMessage(sock);
+                if ~isempty(prefix)
+                    self.setSocketReceivedPrefix(sock, prefix);
+                    return;
+                end
+                
+                % wait for a message
+                %   it must not have any recent or held ack code prefix
+                %   the socket object replies with the new ack code
+                recentPrefix = [self.getSocketReceivedPrefix(sock), ...
+                    self.getSocketHeldPrefix(sock)];
+                waitTime = receiveTimeout ...
+                    - (feval(self.clockFunction) - startTime);
+                [msg, status, prefix] = self.socketObject.readMx( ...
+                    sock, recentPrefix, max(waitTime, 0));
+                if isempty(prefix)
+                    % never got a message
+                    %   but held messages may have waited long enough
+                    [msg, status, prefix] = ...
+                        self.takeSocketHeldMessage(sock);
+                    if ~isempty(prefix)
+                        self.setSocketReceivedPrefix(sock, prefix);
+                    end
+                    return;
                     
-                    % reply with the ack code to the sender
-                    self.socketObject.writeBytes(sock, prefixedBytes(1));
-                    self.setSocketReceivedPrefix(sock, prefixedBytes(1));
+                elseif self.isSocketPrefixAhead(sock, prefix)
+                    % overtook a missing message
+                    self.holdSocketMessage(sock, prefix, msg, status);
                     
-                    % decode the message
-                    [msg, status] = ...
-                        mxGram('bytesToMx', prefixedBytes(2:end));
+                else
+                    self.setSocketReceivedPrefix(sock, prefix);
                     return;
                 end
             end
-            
-            % never got a message
-            status = self.notReceivedStatus;
-            msg = [];
         end
-        
+
+        % Sleep until a message arrives at the given socket.
+        % @param sock a numeric identifier for a socket, as returned by
+        % openSocket()
+        % @param waitTimeout seconds to wait for a message to arrive
+        % @details
+        % Blocks for up to @a waitTimeout seconds, or until data arrives
+        % at @a sock, whichever comes first.  Does not read or acknowledge
+        % anything, so the next receiveMessageAtSocket() will find the
+        % message.  @a waitTimeout may be omitted, in which case the
+        % receiveTimeout property is used.
+        % @details
+        % Returns true if @a sock has data ready to read.
+        function isReady = waitForMessageAtSocket( ...
+                self, sock, waitTimeout)
+
+            if nargin < 3 || isempty(waitTimeout)
+                waitTimeout = self.receiveTimeout;
+            end
+            isReady = self.socketObject.waitForData( ...
+                sock, max(waitTimeout, 0));
+        end
+
         % Open a socket for communicating via Ethernet and UDP.
         % @param localIP string IP address for this machine
         % @param localPort integer port number to go with the local IP
@@ -386,6 +732,12 @@ classdef dotsTheMessenger < dotsAllSingletonObjects
                 
                 self.setSocketReceivedPrefix(sock, self.prefixModulus);
                 
+                % a new receiver hasn't seen any schema layouts
+                if self.isSchemaEncoded
+                    mxGram('schemaClear', ...
+                        self.socketObject.getPeerKey(sock));
+                end
+                
             else
                 ID = sprintf('%s:%s', class(self), 'openSocket');
                 warning(ID, 'failed(%d) to open socket from %s: to %s', ...
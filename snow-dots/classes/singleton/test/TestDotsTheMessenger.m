@@ -119,20 +119,86 @@ classdef TestDotsTheMessenger < dotsTestCase
             end
         end
         
+        function testWindowToClient(self)
+            % more messages than fit in one window
+            self.theMessenger.windowSize = 4;
+            status = self.theMessenger.sendMessagesFromSocket( ...
+                self.nonNumerics, ...
+                self.serverSock, ...
+                self.ackTimeout);
+            assertEqual(status, length(self.nonNumerics), ...
+                'send messages error');
+            
+            for ii = 1:length(self.nonNumerics)
+                [received, status] = ...
+                    self.theMessenger.receiveMessageAtSocket( ...
+                    self.clientSock, ...
+                    self.receiveTimeout);
+                assertTrue(status > 0, 'receive message error');
+                assertEqual(self.nonNumerics{ii}, received, ...
+                    'received value should equal sent value');
+            end
+        end
+        
+        function testOutOfOrderToServer(self)
+            % a resend can arrive after later messages in its window
+            socketObject = self.theMessenger.socketObject;
+            messages = {'first', 'second', 'third'};
+            for ii = [1 3 2]
+                socketObject.writeMx(self.clientSock, ii-1, ...
+                    messages{ii}, inf, 8191);
+            end
+            
+            for ii = 1:length(messages)
+                [received, status] = ...
+                    self.theMessenger.receiveMessageAtSocket( ...
+                    self.serverSock, ...
+                    self.receiveTimeout);
+                assertTrue(status > 0, 'receive message error');
+                assertEqual(messages{ii}, received, ...
+                    'should receive messages in the order sent');
+            end
+        end
+        
+        function testSchemaEncoded(self)
+            % messages with the same layout, but different values
+            self.theMessenger.isSchemaEncoded = true;
+            messages = {{'method', 'dots', 1:3, true}, ...
+                {'method', 'dots', 4:6, false}, ...
+                {'method', 'dots', 7:9, true}};
+            for ii = 1:length(messages)
+                status = self.theMessenger.sendMessageFromSocket( ...
+                    messages{ii}, ...
+                    self.clientSock, ...
+                    self.ackTimeout);
+                assertTrue(status > 0, 'send message error');
+            end
+            
+            for ii = 1:length(messages)
+                [received, status] = ...
+                    self.theMessenger.receiveMessageAtSocket( ...
+                    self.serverSock, ...
+                    self.receiveTimeout);
+                assertTrue(status > 0, 'receive message error');
+                assertEqual(messages{ii}, received, ...
+                    'received value should equal sent value');
+            end
+        end
+        
         function testUnreasonable(self)
             unreasonable = char('a'*ones(1,1e7));
             status = self.theMessenger.sendMessageFromSocket( ...
                 unreasonable, ...
                 self.clientSock, ...
                 self.ackTimeout);
-            assertTrue(status < 0, ...
+            assertEqual(status, self.theMessenger.tooLargeStatus, ...
                 'should not even try to send a gigantic message')
             
             status = self.theMessenger.sendMessageFromSocket( ...
                 unreasonable, ...
                 self.serverSock, ...
                 self.ackTimeout);
-            assertTrue(status < 0, ...
+            assertEqual(status, self.theMessenger.tooLargeStatus, ...
                 'should not even try to send a gigantic message')
         end
     end
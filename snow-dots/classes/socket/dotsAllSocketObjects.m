@@ -27,6 +27,311 @@ classdef dotsAllSocketObjects < handle
     % name = dotsTheMachineConfiguration.getDefaultValue('socketClassName')
     % mySocketObject = feval(name);
     % @endcode
+    % @details
+    % dotsAllSocketObjects also defines writeMx() and readMx(), which send
+    % and receive whole Matlab variables with the 1-byte ack code prefix
+    % used by dotsTheMessenger.  These work with any subclass, using
+    % mxGram(), writeBytes(), and readBytes().  Subclasses may redefine
+    % them to do the same work natively, with fewer copies.
+    % @details
+    % Likewise, writeBytesAcked() and writeMxAcked() send with an ack code
+    % prefix, then wait for the receiver to reply with the same code, and
+    % resend as needed.  writeMxWindow() sends several variables at once,
+    % then waits for all of their ack codes.  Subclasses may redefine
+    % these to wait natively.
+    methods
+        % Serialize a variable and send it with an ack code prefix.
+        % @param id a socket identifier as returned from open()
+        % @param prefix 1-byte ack code to send before the variable
+        % @param msg variable to serialize with mxGram()
+        % @param compressThreshold serialized size at which to try
+        % compression
+        % @param maxBytes largest serialized size to send
+        % @details
+        % Serializes @a msg with mxGram('mxToBytes') and sends it from the
+        % @a id socket, after the 1-byte @a prefix, in a single packet.
+        % Does not send @a msg if it would serialize to more than
+        % @a maxBytes, even after compression.
+        % @details
+        % Returns a nonnegative scalar if @a msg was sent, or a negative
+        % scalar to indicate an error.  Also returns as a second output
+        % the serialized size of @a msg, whether or not it was sent.
+        function [status, nBytes] = writeMx( ...
+                self, id, prefix, msg, compressThreshold, maxBytes)
+            
+            % check the size before serializing
+            %   messages that will be compressed might still fit
+            nBytes = mxGram('size', msg);
+            if nBytes < 0
+                status = nBytes;
+                return;
+            elseif nBytes > maxBytes && nBytes < compressThreshold
+                status = -1;
+                return;
+            end
+            
+            [bytes, nBytes] = mxGram('mxToBytes', msg, compressThreshold);
+            if nBytes < 0
+                status = nBytes;
+            elseif nBytes > maxBytes
+                status = -1;
+            else
+                status = self.writeBytes(id, cat(2, uint8(prefix), bytes));
+            end
+        end
+        
+        % Send prefixed bytes and wait for the prefix to come back.
+        % @param id a socket identifier as returned from open()
+        % @param data bytes to send, starting with a 1-byte ack code
+        % @param ackTimeout seconds to wait for each acknowledgement
+        % @param sendRetries number of times to resend if unacknowledged
+        % @details
+        % Sends @a data from the @a id socket, then waits up to
+        % @a ackTimeout seconds for a 1-byte reply equal to the first byte
+        % of @a data.  Ignores other replies.  Resends @a data and waits
+        % again, up to @a sendRetries times.  If @a ackTimeout is
+        % negative, sends @a data once and doesn't wait.
+        % @details
+        % Returns the status of the last writeBytes().  Also returns as a
+        % second output whether the ack code arrived, and as a third
+        % output the seconds spent sending and waiting.
+        function [status, isAcked, ackTime] = writeBytesAcked( ...
+                self, id, data, ackTimeout, sendRetries)
+            
+            startTime = clock();
+            isAcked = false;
+            prefix = data(1);
+            for nTries = 0:sendRetries
+                status = self.writeBytes(id, data);
+                if status < 0 || ackTimeout < 0
+                    break;
+                end
+                
+                % is the correct ack code waiting at the socket?
+                hasReply = self.check(id, ackTimeout);
+                while hasReply
+                    reply = self.readBytes(id);
+                    if (numel(reply) == 1) && (reply == prefix)
+                        isAcked = true;
+                        ackTime = etime(clock(), startTime);
+                        return;
+                    end
+                    hasReply = self.check(id, 0);
+                end
+            end
+            ackTime = etime(clock(), startTime);
+        end
+        
+        % Serialize and send a variable, and wait for the prefix to come
+        % back.
+        % @param id a socket identifier as returned from open()
+        % @param prefix 1-byte ack code to send before the variable
+        % @param msg variable to serialize with mxGram()
+        % @param ackTimeout seconds to wait for each acknowledgement
+        % @param sendRetries number of times to resend if unacknowledged
+        % @param compressThreshold serialized size at which to try
+        % compression
+        % @param maxBytes largest serialized size to send
+        % @details
+        % Combines writeMx() and writeBytesAcked().  Serializes @a msg
+        % once, even if it needs to be resent.  Returns the outputs of
+        % writeBytesAcked(), plus the serialized size of @a msg as a
+        % fourth output.
+        function [status, isAcked, ackTime, nBytes] = writeMxAcked(self, ...
+                id, prefix, msg, ackTimeout, sendRetries, ...
+                compressThreshold, maxBytes)
+            
+            isAcked = false;
+            ackTime = 0;
+            nBytes = mxGram('size', msg);
+            if nBytes < 0
+                status = nBytes;
+                return;
+            elseif nBytes > maxBytes && nBytes < compressThreshold
+                status = -1;
+                return;
+            end
+            
+            [bytes, nBytes] = mxGram('mxToBytes', msg, compressThreshold);
+            if nBytes < 0
+                status = nBytes;
+            elseif nBytes > maxBytes
+                status = -1;
+            else
+                [status, isAcked, ackTime] = self.writeBytesAcked(id, ...
+                    cat(2, uint8(prefix), bytes), ackTimeout, sendRetries);
+            end
+        end
+        
+        % Serialize and send several variables at once, and wait for
+        % all their prefixes to come back.
+        % @param id a socket identifier as returned from open()
+        % @param prefixes distinct 1-byte ack codes, one per variable
+        % @param msgs cell array of variables to serialize with mxGram()
+        % @param ackTimeout seconds to wait for acknowledgements
+        % @param sendRetries number of times to resend if unacknowledged
+        % @param compressThreshold serialized size at which to try
+        % compression
+        % @param maxBytes largest serialized size to send
+        % @details
+        % Like writeMxAcked(), but sends all of @a msgs before waiting for
+        % any acknowledgement.  The receiver may acknowledge them in any
+        % order.  Waits up to @a ackTimeout seconds for each ack code, and
+        % then resends just the unacknowledged variables, up to @a
+        % sendRetries times.  If any of @a msgs is too large to send, or
+        % can't be serialized, sends none of them.
+        % @details
+        % Returns a negative scalar to indicate an error, or else the
+        % number of variables acknowledged, or sent if @a ackTimeout is
+        % negative.  Also returns as additional outputs arrays with
+        % whether each variable was acknowledged, the seconds until each
+        % acknowledgement, and each serialized size.
+        function [status, isAcked, ackTimes, nBytes] = writeMxWindow( ...
+                self, id, prefixes, msgs, ackTimeout, sendRetries, ...
+                compressThreshold, maxBytes)
+            
+            nMessages = numel(msgs);
+            isAcked = false(1, nMessages);
+            ackTimes = zeros(1, nMessages);
+            nBytes = zeros(1, nMessages);
+            
+            % serialize everything before sending anything
+            packets = cell(1, nMessages);
+            for ii = 1:nMessages
+                nBytes(ii) = mxGram('size', msgs{ii});
+                if nBytes(ii) < 0
+                    status = nBytes(ii);
+                    return;
+                elseif nBytes(ii) > maxBytes ...
+                        && nBytes(ii) < compressThreshold
+                    status = -1;
+                    return;
+                end
+                
+                [bytes, nBytes(ii)] = ...
+                    mxGram('mxToBytes', msgs{ii}, compressThreshold);
+                if nBytes(ii) < 0
+                    status = nBytes(ii);
+                    return;
+                elseif nBytes(ii) > maxBytes
+                    status = -1;
+                    return;
+                end
+                packets{ii} = cat(2, uint8(prefixes(ii)), bytes);
+            end
+            
+            startTime = clock();
+            for nTries = 0:sendRetries
+                % send whatever hasn't been acknowledged yet
+                for ii = find(~isAcked)
+                    status = self.writeBytes(id, packets{ii});
+                    if status < 0
+                        return;
+                    end
+                end
+                
+                if ackTimeout < 0
+                    status = nMessages;
+                    return;
+                end
+                
+                % match ack codes in any order
+                hasReply = self.check(id, ackTimeout);
+                while hasReply && ~all(isAcked)
+                    reply = self.readBytes(id);
+                    if numel(reply) == 1
+                        ii = find(~isAcked & (prefixes == reply), 1);
+                        isAcked(ii) = true;
+                        ackTimes(ii) = etime(clock(), startTime);
+                    end
+                    hasReply = self.check(id, ackTimeout);
+                end
+                
+                if all(isAcked)
+                    break;
+                end
+            end
+            status = sum(isAcked);
+        end
+        
+        % Receive and acknowledge a variable sent with writeMx().
+        % @param id a socket identifier as returned from open()
+        % @param recentPrefix ack codes of recently received variables
+        % @param timeoutSecs time to wait for a packet
+        % @details
+        % Waits up to @a timeoutSecs for a packet with a new ack code
+        % prefix to arrive at the @a id socket.  Ignores packets that are
+        % empty or have any of @a recentPrefix, which are likely to be
+        % resends.
+        % Decodes the rest of the packet with mxGram('bytesToMx'), using
+        % schema layouts from getPeerKey(), then replies to the sender with
+        % the new ack code.  Doesn't reply to packets that fail to decode,
+        % so the sender can find out.  Also replies to packets with a
+        % recent prefix, since they may be resends whose first reply was
+        % lost.
+        % @details
+        % Returns the decoded variable, or [] if none arrived.  Also
+        % returns as a second output the status from mxGram('bytesToMx'),
+        % or a negative scalar if none arrived.  Also returns as a third
+        % output the new ack code, or [] if none arrived or it failed to
+        % decode.
+        function [msg, status, prefix] = readMx( ...
+                self, id, recentPrefix, timeoutSecs)
+            
+            while self.check(id, timeoutSecs)
+                bytes = self.readBytes(id);
+                if isa(bytes, 'uint8') && numel(bytes) > 1
+                    if any(bytes(1) == recentPrefix)
+                        self.writeBytes(id, bytes(1));
+                        continue;
+                    end
+                    
+                    [msg, status] = mxGram('bytesToMx', ...
+                        bytes(2:end), self.getPeerKey(id));
+                    if status > 0
+                        self.writeBytes(id, bytes(1));
+                        prefix = bytes(1);
+                    else
+                        prefix = [];
+                    end
+                    return;
+                end
+            end
+            
+            msg = [];
+            status = -1;
+            prefix = [];
+        end
+
+        % Identify the peer that a socket talks to now.
+        % @param id a socket identifier as returned from open()
+        % @details
+        % Returns a nonnegative scalar that mxGram() uses to keep schema
+        % layouts for each peer apart.  The key should change whenever
+        % the socket starts talking to a different peer, or a fresh
+        % instance of the same peer.
+        % @details
+        % By default, returns @a id.  Subclasses may redefine it for
+        % sockets that can talk to several peers.
+        function key = getPeerKey(self, id)
+            key = id;
+        end
+        
+        % Sleep until a socket has a packet to read.
+        % @param id a socket identifier as returned from open()
+        % @param timeoutSecs time to wait for a packet
+        % @details
+        % Blocks for up to @a timeoutSecs, but returns as soon as a packet
+        % arrives at the @a id socket.  Returns true if the socket has a
+        % packet to read.  Leaves any packet in place, like check().
+        % @details
+        % By default, this is the same as check() with a timeout.
+        % Subclasses may redefine it to sleep with a finer deadline.
+        function isReady = waitForData(self, id, timeoutSecs)
+            isReady = self.check(id, timeoutSecs);
+        end
+    end
+    
     methods (Abstract)
         % Open a new socket and return an identifier for it.
         % @param localIP string IP address to bind on this host
@@ -0,0 +1,154 @@
+classdef dotsSocketMexStream < dotsAllSocketObjects
+    % @class dotsSocketMexStream
+    % Implement socket behavior with TCP streams, using the mexStream mex
+    % function, which is a part of Snow Dots.
+    % @details
+    % mexStream sends each message as one length-prefixed frame.  TCP
+    % delivers frames reliably and in order, so dotsSocketMexStream
+    % doesn't wait for ack codes.  The "acked" methods report each frame
+    % as acknowledged as soon as it's written, and readMx() doesn't reply
+    % with ack codes.  dotsTheMessenger can use it just like
+    % dotsSocketMexUDP, and both peers must use the same socket class.
+    % @details
+    % mexStream disables Nagle's algorithm, so small messages go out
+    % right away.  If the peer stops reading, a write gives up once no
+    % bytes have gone out for one second, and the next write reconnects.
+    % So large frames to a slow reader still go through.  For peers on
+    % the same machine, dotsSocketMexUnix uses Unix domain streams
+    % instead.
+    % @details
+    % Each socket listens at its local address and port, and connects to
+    % its remote address and port the first time it writes.  So either
+    % peer may open first, and a peer that restarts gets a fresh
+    % connection.
+    properties
+        % 'tcp' or 'unix', which kind of stream to open
+        mode = 'tcp';
+    end
+
+    methods
+        % Open a stream socket with mexStream().
+        function id = open(self, localIP, localPort, remoteIP, remotePort)
+            id = mexStream('open', ...
+                localIP, remoteIP, localPort, remotePort, self.mode);
+        end
+
+        % Close the given stream socket with mexStream().
+        function status = close(self, id)
+            status = mexStream('close', id);
+        end
+
+        % Close all mexStream() sockets.
+        function status = closeAll(self)
+            status = mexStream('closeAll');
+        end
+
+        % Check whether the given mexStream() socket has a whole frame to
+        % read.
+        function hasData = check(self, id, timeoutSecs)
+            if nargin < 3 || isempty(timeoutSecs)
+                timeoutSecs = 0;
+            end
+            hasData = mexStream('check', id, timeoutSecs) > 0;
+        end
+
+        % Read the next whole frame from the given mexStream() socket.
+        function data = readBytes(self, id)
+            data = mexStream('receiveBytes', id);
+        end
+
+        % Write one frame to the given mexStream() socket.
+        function status = writeBytes(self, id, data)
+            status = mexStream('sendBytes', id, data);
+        end
+
+        % Serialize a variable straight into a mexStream() frame.
+        % @details
+        % Redefines dotsAllSocketObjects.writeMx() so that mexStream()
+        % serializes @a msg into its own buffer, after @a prefix, without
+        % creating any intermediate Matlab arrays.
+        function [status, nBytes] = writeMx( ...
+                self, id, prefix, msg, compressThreshold, maxBytes)
+            [status, nBytes] = mexStream('sendMx', ...
+                id, prefix, msg, compressThreshold, maxBytes);
+        end
+
+        % Send prefixed bytes without waiting for an ack code.
+        % @details
+        % Redefines dotsAllSocketObjects.writeBytesAcked().  The stream
+        % delivers whatever it accepts, so @a data is acknowledged as soon
+        % as it's written.  Ignores @a ackTimeout and @a sendRetries.
+        function [status, isAcked, ackTime] = writeBytesAcked( ...
+                self, id, data, ackTimeout, sendRetries)
+            status = mexStream('sendBytes', id, data);
+            isAcked = status >= 0;
+            ackTime = 0;
+        end
+
+        % Serialize and send a variable without waiting for an ack code.
+        % @details
+        % Redefines dotsAllSocketObjects.writeMxAcked(), like
+        % writeBytesAcked().
+        function [status, isAcked, ackTime, nBytes] = writeMxAcked(self, ...
+                id, prefix, msg, ackTimeout, sendRetries, ...
+                compressThreshold, maxBytes)
+            [status, nBytes] = mexStream('sendMx', ...
+                id, prefix, msg, compressThreshold, maxBytes);
+            isAcked = status >= 0;
+            ackTime = 0;
+        end
+
+        % Serialize and send several variables without waiting for ack
+        % codes.
+        % @details
+        % Redefines dotsAllSocketObjects.writeMxWindow(), like
+        % writeBytesAcked().  Stops at the first variable that can't be
+        % sent.
+        function [status, isAcked, ackTimes, nBytes] = writeMxWindow( ...
+                self, id, prefixes, msgs, ackTimeout, sendRetries, ...
+                compressThreshold, maxBytes)
+            nMessages = numel(msgs);
+            isAcked = false(1, nMessages);
+            ackTimes = zeros(1, nMessages);
+            nBytes = zeros(1, nMessages);
+            for ii = 1:nMessages
+                [status, nBytes(ii)] = mexStream('sendMx', ...
+                    id, prefixes(ii), msgs{ii}, compressThreshold, maxBytes);
+                if status < 0
+                    return;
+                end
+                isAcked(ii) = true;
+            end
+            status = sum(isAcked);
+        end
+
+        % Decode a variable straight from a mexStream() frame.
+        % @details
+        % Redefines dotsAllSocketObjects.readMx() so that mexStream()
+        % decodes frames in its own buffer, without creating any
+        % intermediate Matlab arrays.  Streams don't repeat frames, so
+        % ignores @a recentPrefix and doesn't reply with ack codes.
+        function [msg, status, prefix] = readMx( ...
+                self, id, recentPrefix, timeoutSecs)
+            [msg, status, prefix] = mexStream('receiveMx', id, timeoutSecs);
+        end
+
+        % Identify the connection a mexStream() socket writes to next.
+        % @details
+        % Redefines dotsAllSocketObjects.getPeerKey().  The key changes
+        % when the peer reconnects, so a restarted peer gets fresh schema
+        % layouts.
+        function key = getPeerKey(self, id)
+            key = mexStream('peerKey', id);
+        end
+
+        % Sleep on the given mexStream() socket until a frame arrives.
+        % @details
+        % Redefines dotsAllSocketObjects.waitForData() so that mexStream()
+        % sleeps in the kernel, and wakes as soon as a whole frame
+        % arrives.
+        function isReady = waitForData(self, id, timeoutSecs)
+            isReady = mexStream('wait', id, timeoutSecs) > 0;
+        end
+    end
+end
@@ -28,13 +28,94 @@ classdef dotsSocketMexUDP < dotsAllSocketObjects
         end
         
         % Read the next available packet from the given mexUDP() socket.
-        function data = readBytes(self, id)
-            data = mexUDP('receiveBytes', id);
+        % @details
+        % Also returns the kernel's arrival time for the packet, in
+        % seconds, as a second output.
+        function [data, arrivalTime] = readBytes(self, id)
+            [data, arrivalTime] = mexUDP('receiveBytes', id);
         end
         
         % Write a packet to the given mexUDP() socket.
         function status = writeBytes(self, id, data)
             status = mexUDP('sendBytes', id, data);
         end
+        
+        % Serialize a variable straight into a mexUDP() packet.
+        % @details
+        % Redefines dotsAllSocketObjects.writeMx() so that mexUDP()
+        % serializes @a msg into its own buffer, after @a prefix, without
+        % creating any intermediate Matlab arrays.
+        function [status, nBytes] = writeMx( ...
+                self, id, prefix, msg, compressThreshold, maxBytes)
+            [status, nBytes] = mexUDP('sendMx', ...
+                id, prefix, msg, compressThreshold, maxBytes);
+        end
+        
+        % Send prefixed bytes and wait natively for the ack code.
+        % @details
+        % Redefines dotsAllSocketObjects.writeBytesAcked() so that the
+        % whole send, wait, and resend loop happens in one mexUDP() call.
+        function [status, isAcked, ackTime] = writeBytesAcked( ...
+                self, id, data, ackTimeout, sendRetries)
+            [status, isAcked, ackTime] = mexUDP('sendAcked', ...
+                id, data, ackTimeout, sendRetries);
+        end
+        
+        % Serialize and send a variable and wait natively for the ack
+        % code.
+        % @details
+        % Redefines dotsAllSocketObjects.writeMxAcked() so that
+        % serializing, sending, waiting, and resending all happen in one
+        % mexUDP() call.
+        function [status, isAcked, ackTime, nBytes] = writeMxAcked(self, ...
+                id, prefix, msg, ackTimeout, sendRetries, ...
+                compressThreshold, maxBytes)
+            [status, isAcked, ackTime, nBytes] = mexUDP('sendMxAcked', ...
+                id, prefix, msg, ackTimeout, sendRetries, ...
+                compressThreshold, maxBytes);
+        end
+        
+        % Serialize and send several variables, and wait natively for
+        % their ack codes.
+        % @details
+        % Redefines dotsAllSocketObjects.writeMxWindow() so that mexUDP()
+        % sends the whole window in one batch and matches ack codes in
+        % one call.
+        function [status, isAcked, ackTimes, nBytes] = writeMxWindow( ...
+                self, id, prefixes, msgs, ackTimeout, sendRetries, ...
+                compressThreshold, maxBytes)
+            [status, isAcked, ackTimes, nBytes] = mexUDP('sendMxWindow', ...
+                id, prefixes, msgs, ackTimeout, sendRetries, ...
+                compressThreshold, maxBytes);
+        end
+        
+        % Decode a variable straight from a mexUDP() packet.
+        % @details
+        % Redefines dotsAllSocketObjects.readMx() so that mexUDP()
+        % decodes and acknowledges packets in its own buffer, without
+        % creating any intermediate Matlab arrays.
+        function [msg, status, prefix] = readMx( ...
+                self, id, recentPrefix, timeoutSecs)
+            [msg, status, prefix] = mexUDP('receiveMx', ...
+                id, recentPrefix, timeoutSecs);
+        end
+
+        % Identify the peer that a mexUDP() socket sends to now.
+        % @details
+        % Redefines dotsAllSocketObjects.getPeerKey().  A server socket
+        % replies to whichever client sent to it last, so the key
+        % combines the socket with the remote address and port.
+        function key = getPeerKey(self, id)
+            key = mexUDP('peerKey', id);
+        end
+
+        % Sleep on the given mexUDP() socket until a packet arrives.
+        % @details
+        % Redefines dotsAllSocketObjects.waitForData() so that mexUDP()
+        % sleeps in the kernel with a sub-millisecond deadline, and wakes
+        % as soon as a packet arrives.
+        function isReady = waitForData(self, id, timeoutSecs)
+            isReady = mexUDP('wait', id, timeoutSecs) > 0;
+        end
     end
 end
\ No newline at end of file
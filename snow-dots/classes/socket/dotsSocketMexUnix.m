@@ -0,0 +1,20 @@
+classdef dotsSocketMexUnix < dotsSocketMexStream
+    % @class dotsSocketMexUnix
+    % Implement socket behavior with Unix domain streams, using the
+    % mexStream mex function, which is a part of Snow Dots.
+    % @details
+    % dotsSocketMexUnix works like dotsSocketMexStream, but its peers must
+    % be on the same machine.  Unix domain streams skip the network stack,
+    % so they have less latency than TCP over the loopback address.
+    % @details
+    % IP addresses and ports still identify sockets.  mexStream makes a
+    % file path from each address and port, like
+    % /tmp/snowDots-127.0.0.1-49200.sock, and listens there.  It takes over
+    % a path left by a session that crashed, but like a TCP port, a path
+    % where another socket is still listening is in use.
+    methods
+        function self = dotsSocketMexUnix()
+            self.mode = 'unix';
+        end
+    end
+end
@@ -195,6 +195,45 @@ classdef TestDotsAllSocketObjects < TestCase
                 'socket 2 should have nothing again')
         end
         
+        function testWriteReadMx(self)
+            if ~isobject(self.socketObject)
+                return;
+            end
+            
+            id(1) = self.socketObject.open( ...
+                self.address, self.ports(1), ...
+                self.address, self.ports(2));
+            
+            id(2) = self.socketObject.open( ...
+                self.address, self.ports(2), ...
+                self.address, self.ports(1));
+            
+            msg = {'hello', 1:10, struct('a', 1)};
+            status = self.socketObject.writeMx(id(1), 3, msg, inf, 8191);
+            assertTrue(status >= 0, ...
+                'should get nonnegative write status')
+            
+            timeoutSecs = 0.1;
+            [readMsg, status, prefix] = ...
+                self.socketObject.readMx(id(2), 2, timeoutSecs);
+            assertTrue(status >= 0, ...
+                'should get nonnegative read status')
+            assertEqual(double(prefix), 3, ...
+                'socket 2 should read prefix sent from socket 1')
+            assertEqual(msg, readMsg, ...
+                'socket 2 should read message sent from socket 1')
+            
+            TestDotsAllSocketObjects.waitSeveralMiliseconds;
+            ack = self.socketObject.readBytes(id(1));
+            assertEqual(double(ack), 3, ...
+                'socket 1 should read ack code from socket 2')
+            
+            [status, nBytes] = ...
+                self.socketObject.writeMx(id(1), 4, msg, inf, 10);
+            assertTrue(status < 0 && nBytes > 10, ...
+                'should not write message larger than maxBytes')
+        end
+        
         function testOpenSeveralSockets(self)
             if ~isobject(self.socketObject)
                 return;
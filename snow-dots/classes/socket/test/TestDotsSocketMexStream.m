@@ -0,0 +1,50 @@
+classdef TestDotsSocketMexStream < TestDotsAllSocketObjects
+    % @class TestDotsSocketMexStream
+    % Include dotsSocketMexStream in Snow Dots socket tests
+    methods
+        function self = TestDotsSocketMexStream(name)
+            self = self@TestDotsAllSocketObjects(name);
+            self.classname = 'dotsSocketMexStream';
+        end
+        
+        % Streams don't reply with ack codes.
+        function testWriteReadMx(self)
+            if ~isobject(self.socketObject)
+                return;
+            end
+            
+            id(1) = self.socketObject.open( ...
+                self.address, self.ports(1), ...
+                self.address, self.ports(2));
+            
+            id(2) = self.socketObject.open( ...
+                self.address, self.ports(2), ...
+                self.address, self.ports(1));
+            
+            msg = {'hello', 1:10, struct('a', 1)};
+            [status, isAcked] = self.socketObject.writeMxAcked( ...
+                id(1), 3, msg, 0.1, 0, inf, 8191);
+            assertTrue(status >= 0 && isAcked, ...
+                'should count written message as acknowledged')
+            
+            timeoutSecs = 0.1;
+            [readMsg, status, prefix] = ...
+                self.socketObject.readMx(id(2), 3, timeoutSecs);
+            assertTrue(status >= 0, ...
+                'should get nonnegative read status')
+            assertEqual(double(prefix), 3, ...
+                'socket 2 should read prefix sent from socket 1')
+            assertEqual(msg, readMsg, ...
+                'socket 2 should read message sent from socket 1')
+            
+            TestDotsAllSocketObjects.waitSeveralMiliseconds;
+            assertFalse(self.socketObject.check(id(1)), ...
+                'socket 1 should not get an ack code')
+            
+            [status, nBytes] = ...
+                self.socketObject.writeMx(id(1), 4, msg, inf, 10);
+            assertTrue(status < 0 && nBytes > 10, ...
+                'should not write message larger than maxBytes')
+        end
+    end
+end
@@ -0,0 +1,10 @@
+classdef TestDotsSocketMexUnix < TestDotsSocketMexStream
+    % @class TestDotsSocketMexUnix
+    % Include dotsSocketMexUnix in Snow Dots socket tests
+    methods
+        function self = TestDotsSocketMexUnix(name)
+            self = self@TestDotsSocketMexStream(name);
+            self.classname = 'dotsSocketMexUnix';
+        end
+    end
+end
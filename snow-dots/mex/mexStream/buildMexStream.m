@@ -0,0 +1,7 @@
+% Script to build the mex function "mexStream".
+%   mexStream can open, close, and use TCP or Unix domain stream sockets,
+%   sending and receiving length-prefixed frames.  Like mexUDP, it can
+%   also send and receive Matlab variables directly, so it compiles its
+%   own copy of the mxGram routines.
+
+mex -I../mxGram mexStreamInterface.c mexStream.c mexStreamMx.c ../mxGram/mxGram.c ../mxGram/mxGramCompress.c ../mxGram/mxGramSchema.c ../mxGram/mxGramFunctionCache.c -output mexStream
\ No newline at end of file
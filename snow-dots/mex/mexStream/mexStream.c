@@ -0,0 +1,572 @@
+/* mexStream.c
+ *
+ * Open, close, and use stream sockets, with messages framed by length.
+ *
+ */
+
+#include "mexStream.h"
+
+static mexStream_socket mexStream_sockets[MEXSTREAM_MAX_NUM_SOCKETS];
+
+static void mexStream_readAhead(int sockID);
+
+// like mexUDP, wait at least the timeout
+static int mexStream_getPollMsecs(double timeoutSecs) {
+    if (timeoutSecs <= 0)
+        return(0);
+    if (timeoutSecs > INT_MAX/1000)
+        return(-1);
+    return((int)ceil(1000*timeoutSecs));
+}
+
+static void mexStream_setBlocking(int fd, int isBlocking) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (isBlocking)
+        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+    else
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// fill in a TCP or Unix domain address
+static socklen_t mexStream_makeAddress(mexStream_mode mode, const char* IP, int port,
+        struct sockaddr_storage* address) {
+
+    struct sockaddr_in *inAddress = (struct sockaddr_in*)address;
+    struct sockaddr_un *unAddress = (struct sockaddr_un*)address;
+
+    memset(address, 0, sizeof(struct sockaddr_storage));
+    if (mode == mexStreamUnix) {
+        unAddress->sun_family = AF_UNIX;
+        snprintf(unAddress->sun_path, sizeof(unAddress->sun_path),
+                MEXSTREAM_UNIX_PATH_FORMAT, IP, port);
+        return(sizeof(struct sockaddr_un));
+    }
+
+    inAddress->sin_family = AF_INET;
+    inAddress->sin_port = htons(port);
+    inAddress->sin_addr.s_addr = inet_addr(IP);
+    return(sizeof(struct sockaddr_in));
+}
+
+// connected sockets shouldn't wait to send, or raise SIGPIPE
+static void mexStream_configureConnected(int fd, mexStream_mode mode) {
+    int isSet = 1;
+
+    if (mode == mexStreamTCP)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &isSet, sizeof(isSet));
+#if defined(SO_NOSIGPIPE)
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &isSet, sizeof(isSet));
+#endif
+}
+
+// whether a socket's peer is its own listener
+static int mexStream_isSelf(const mexStream_socket* s) {
+    return(s->localPort == s->remotePort && !strcmp(s->localIP, s->remoteIP));
+}
+
+// whether a Unix domain path is left over from an earlier session
+//  a stale path refuses connections, but a live listener takes them
+static int mexStream_isStalePath(const struct sockaddr_storage* address, socklen_t addressLength) {
+    int fd, error = 0;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return(0);
+    mexStream_setBlocking(fd, 0);
+    if (connect(fd, (const struct sockaddr*)address, addressLength) < 0)
+        error = errno;
+    close(fd);
+    return(error == ECONNREFUSED || error == ENOENT);
+}
+
+int mexStream_open(const char* localIP, const char* remoteIP, int localPort, int remotePort, mexStream_mode mode) {
+
+    struct sockaddr_storage address;
+    socklen_t addressLength;
+    mexStream_socket *s;
+    int sockID, listenFD, isReused = 1;
+
+    if (strlen(localIP) >= MEXSTREAM_MAX_IP_LENGTH || strlen(remoteIP) >= MEXSTREAM_MAX_IP_LENGTH)
+        return(-1);
+
+    for (sockID=0; sockID<MEXSTREAM_MAX_NUM_SOCKETS; sockID++)
+        if (!mexStream_sockets[sockID].isOpen)
+            break;
+    if (sockID == MEXSTREAM_MAX_NUM_SOCKETS) {
+        mexPrintf("too many sockets are open (max of %d)\n", MEXSTREAM_MAX_NUM_SOCKETS);
+        return(-1);
+    }
+
+    listenFD = socket(mode == mexStreamUnix ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+    if (listenFD < 0) {
+        mexPrintf("socket() failed with return %d, (google errno %d)\n", listenFD, errno);
+        return(listenFD);
+    }
+
+    // a path or port left over from an earlier session is fair game
+    //  but like a TCP port, a path with a live listener is in use
+    addressLength = mexStream_makeAddress(mode, localIP, localPort, &address);
+    if (mode == mexStreamUnix) {
+        if (mexStream_isStalePath(&address, addressLength))
+            unlink(((struct sockaddr_un*)&address)->sun_path);
+    } else
+        setsockopt(listenFD, SOL_SOCKET, SO_REUSEADDR, &isReused, sizeof(isReused));
+
+    if (bind(listenFD, (struct sockaddr*)&address, addressLength) < 0
+            || listen(listenFD, MEXSTREAM_LISTEN_BACKLOG) < 0) {
+        mexPrintf("failed to bind() and listen() local %s:%d (errno=%d)\n",
+                localIP, localPort, errno);
+        close(listenFD);
+        return(-1);
+    }
+    mexStream_setBlocking(listenFD, 0);
+
+    s = &mexStream_sockets[sockID];
+    memset(s, 0, sizeof(mexStream_socket));
+    s->isOpen = 1;
+    s->mode = mode;
+    strcpy(s->localIP, localIP);
+    strcpy(s->remoteIP, remoteIP);
+    s->localPort = localPort;
+    s->remotePort = remotePort;
+    s->listenFD = listenFD;
+    s->inFD = -1;
+    s->outFD = -1;
+    if (mode == mexStreamUnix)
+        strcpy(s->listenPath, ((struct sockaddr_un*)&address)->sun_path);
+
+    s->maxInBytes = MEXSTREAM_DEFAULT_BUFFER_LENGTH;
+    s->inBytes = mxMalloc(s->maxInBytes);
+    mexMakeMemoryPersistent(s->inBytes);
+    s->maxOutBytes = MEXSTREAM_DEFAULT_BUFFER_LENGTH;
+    s->outBytes = mxMalloc(s->maxOutBytes);
+    mexMakeMemoryPersistent(s->outBytes);
+
+    return(sockID);
+}
+
+int mexStream_find(const char* localIP, const char* remoteIP, int localPort, int remotePort, mexStream_mode mode) {
+    int sockID;
+    mexStream_socket *s;
+    for (sockID=0; sockID<MEXSTREAM_MAX_NUM_SOCKETS; sockID++) {
+        s = &mexStream_sockets[sockID];
+        if (s->isOpen && s->mode == mode
+                && s->localPort == localPort && s->remotePort == remotePort
+                && !strcmp(s->localIP, localIP) && !strcmp(s->remoteIP, remoteIP))
+            return(sockID);
+    }
+    return(-1);
+}
+
+// connect to the remote listener, giving up quickly if it's not there
+static int mexStream_connect(int sockID) {
+
+    mexStream_socket *s = &mexStream_sockets[sockID];
+    struct sockaddr_storage address;
+    socklen_t addressLength, errorLength = sizeof(int);
+    struct pollfd pollFD;
+    int fd, status, error = 0;
+
+    fd = socket(s->mode == mexStreamUnix ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return(-1);
+
+    addressLength = mexStream_makeAddress(s->mode, s->remoteIP, s->remotePort, &address);
+    mexStream_setBlocking(fd, 0);
+    status = connect(fd, (struct sockaddr*)&address, addressLength);
+    if (status < 0 && (errno == EINPROGRESS || errno == EAGAIN)) {
+        pollFD.fd = fd;
+        pollFD.events = POLLOUT;
+        pollFD.revents = 0;
+        if (poll(&pollFD, 1, mexStream_getPollMsecs(MEXSTREAM_CONNECT_TIMEOUT_SECS)) > 0
+                && !getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) && error == 0)
+            status = 0;
+    }
+    if (status < 0) {
+        close(fd);
+        return(-1);
+    }
+
+    mexStream_setBlocking(fd, 1);
+    mexStream_configureConnected(fd, s->mode);
+    s->outFD = fd;
+    s->numConnects++;
+    return(fd);
+}
+
+// write the whole frame, header and all, maybe in pieces
+//  give up when no bytes go out for timeoutSecs, so big frames to a slow
+//  reader still go through
+//  a socket that sends to itself reads as it goes, or a frame bigger
+//  than the kernel buffers could never go out
+static int mexStream_writeAll(int sockID, struct iovec* pieces, int numPieces, double timeoutSecs) {
+    mexStream_socket *s = &mexStream_sockets[sockID];
+    struct msghdr header;
+    struct pollfd pollFDs[3];
+    ssize_t nBytes;
+    double deadline = mexStream_getSeconds() + timeoutSecs;
+    double remaining;
+    int numFDs, flags = MSG_DONTWAIT;
+#if defined(MSG_NOSIGNAL)
+    flags |= MSG_NOSIGNAL;
+#endif
+
+    memset(&header, 0, sizeof(header));
+    while (numPieces > 0) {
+        header.msg_iov = pieces;
+        header.msg_iovlen = numPieces;
+        nBytes = sendmsg(s->outFD, &header, flags);
+        if (nBytes < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return(MEXSTREAM_SEND_FAILED);
+
+            // sleep until there's room, or there's something to read
+            remaining = deadline - mexStream_getSeconds();
+            if (remaining <= 0)
+                return(MEXSTREAM_SEND_TIMED_OUT);
+            pollFDs[0].fd = s->outFD;
+            pollFDs[0].events = POLLOUT;
+            numFDs = 1;
+            if (mexStream_isSelf(s)) {
+                pollFDs[numFDs].fd = s->listenFD;
+                pollFDs[numFDs++].events = POLLIN;
+                if (s->inFD >= 0) {
+                    pollFDs[numFDs].fd = s->inFD;
+                    pollFDs[numFDs++].events = POLLIN;
+                }
+            }
+            poll(pollFDs, numFDs, mexStream_getPollMsecs(remaining));
+            if (numFDs > 1)
+                mexStream_readAhead(sockID);
+            continue;
+        }
+
+        // skip past whatever went out, and allow more time for the rest
+        deadline = mexStream_getSeconds() + timeoutSecs;
+        while (numPieces > 0 && (size_t)nBytes >= pieces->iov_len) {
+            nBytes -= pieces->iov_len;
+            pieces++;
+            numPieces--;
+        }
+        if (numPieces > 0) {
+            pieces->iov_base = (char*)pieces->iov_base + nBytes;
+            pieces->iov_len -= nBytes;
+        }
+    }
+    return(0);
+}
+
+static void mexStream_writeLength(unsigned int length, char* bytes) {
+    // little endian, like mxGram
+    bytes[0] = (char)(length & 0xff);
+    bytes[1] = (char)((length >> 8) & 0xff);
+    bytes[2] = (char)((length >> 16) & 0xff);
+    bytes[3] = (char)((length >> 24) & 0xff);
+}
+
+static unsigned int mexStream_readLength(const char* bytes) {
+    return((unsigned int)(unsigned char)bytes[0]
+            | ((unsigned int)(unsigned char)bytes[1] << 8)
+            | ((unsigned int)(unsigned char)bytes[2] << 16)
+            | ((unsigned int)(unsigned char)bytes[3] << 24));
+}
+
+// peers never write back on the outgoing connection
+//  so if it's readable, the peer closed it
+static int mexStream_isPeerGone(int fd) {
+    struct pollfd pollFD;
+    pollFD.fd = fd;
+    pollFD.events = POLLIN;
+    pollFD.revents = 0;
+    return(poll(&pollFD, 1, 0) != 0);
+}
+
+// the socket and which connection the next frame will go out on
+//  so schema layouts get resent to a peer that restarted
+int mexStream_getPeerKey(int sockID) {
+    mexStream_socket *s = &mexStream_sockets[sockID];
+    unsigned int numConnects = s->numConnects;
+    if (s->outFD < 0 || mexStream_isPeerGone(s->outFD))
+        numConnects++;
+    return(sockID + MEXSTREAM_MAX_NUM_SOCKETS*(int)(numConnects & 0xffffff));
+}
+
+int mexStream_send(int sockID, const char* message, int messageLength) {
+
+    mexStream_socket *s = &mexStream_sockets[sockID];
+    char header[MEXSTREAM_HEADER_LENGTH];
+    struct iovec pieces[2];
+    int status;
+
+    if (messageLength < 0 || messageLength > MEXSTREAM_MAX_FRAME_LENGTH)
+        return(-1);
+    mexStream_writeLength(messageLength, header);
+
+    // a peer that restarted gets a fresh connection
+    if (s->outFD >= 0 && mexStream_isPeerGone(s->outFD)) {
+        close(s->outFD);
+        s->outFD = -1;
+    }
+    if (s->outFD < 0 && mexStream_connect(sockID) < 0)
+        return(-1);
+
+    pieces[0].iov_base = header;
+    pieces[0].iov_len = MEXSTREAM_HEADER_LENGTH;
+    pieces[1].iov_base = (char*)message;
+    pieces[1].iov_len = messageLength;
+    status = mexStream_writeAll(sockID, pieces, 2, MEXSTREAM_SEND_TIMEOUT_SECS);
+    if (status == 0) {
+        s->numSent++;
+        return(messageLength);
+    }
+
+    // the peer drops any partial frame when the connection closes
+    //  don't resend over a new connection here, since the frame might
+    //  use schema layouts kept for this one, and the peer key changes
+    close(s->outFD);
+    s->outFD = -1;
+    return(-1);
+}
+
+// discard any partial frame from a connection that went away
+static void mexStream_closeInput(mexStream_socket* s) {
+    if (s->inFD >= 0)
+        close(s->inFD);
+    s->inFD = -1;
+    s->inStart = 0;
+    s->inEnd = 0;
+}
+
+static int mexStream_hasFrame(const mexStream_socket* s) {
+    int nBytes = s->inEnd - s->inStart;
+    return(nBytes >= MEXSTREAM_HEADER_LENGTH
+            && nBytes - MEXSTREAM_HEADER_LENGTH >= (int)mexStream_readLength(s->inBytes + s->inStart));
+}
+
+// make room for a whole frame after what's already buffered
+static int mexStream_reserve(mexStream_socket* s) {
+    int nNeeded = MEXSTREAM_DEFAULT_BUFFER_LENGTH;
+    int nBuffered = s->inEnd - s->inStart;
+
+    if (nBuffered >= MEXSTREAM_HEADER_LENGTH) {
+        unsigned int frameLength = mexStream_readLength(s->inBytes + s->inStart);
+        if (frameLength > MEXSTREAM_MAX_FRAME_LENGTH)
+            return(-1);
+        if ((int)frameLength + MEXSTREAM_HEADER_LENGTH > nNeeded)
+            nNeeded = frameLength + MEXSTREAM_HEADER_LENGTH;
+    }
+
+    if (s->inStart > 0) {
+        memmove(s->inBytes, s->inBytes + s->inStart, nBuffered);
+        s->inStart = 0;
+        s->inEnd = nBuffered;
+    }
+    if (nNeeded > s->maxInBytes) {
+        s->inBytes = mxRealloc(s->inBytes, nNeeded);
+        mexMakeMemoryPersistent(s->inBytes);
+        s->maxInBytes = nNeeded;
+    }
+    return(0);
+}
+
+// read whatever is available now, and take new connections
+static void mexStream_fill(int sockID) {
+
+    mexStream_socket *s = &mexStream_sockets[sockID];
+    struct pollfd pollFD;
+    ssize_t nBytes;
+    int fd;
+    char peek;
+
+    while (s->inFD >= 0 && !mexStream_hasFrame(s)) {
+        if (mexStream_reserve(s) < 0) {
+            mexStream_closeInput(s);
+            break;
+        }
+        nBytes = recv(s->inFD, s->inBytes + s->inEnd, s->maxInBytes - s->inEnd, MSG_DONTWAIT);
+        if (nBytes > 0)
+            s->inEnd += nBytes;
+        else if (nBytes == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            mexStream_closeInput(s);
+        else
+            break;
+    }
+
+    // a new connection means the peer reconnected, so switch to it
+    //  unless there's a whole frame to read first
+    if (mexStream_hasFrame(s))
+        return;
+    pollFD.fd = s->listenFD;
+    pollFD.events = POLLIN;
+    pollFD.revents = 0;
+    if (poll(&pollFD, 1, 0) > 0) {
+        fd = accept(s->listenFD, NULL, NULL);
+
+        // a connection that closed without sending, like the probe from
+        //  another open() of this path, isn't a reconnect
+        if (fd >= 0 && recv(fd, &peek, 1, MSG_PEEK | MSG_DONTWAIT) == 0) {
+            close(fd);
+            fd = -1;
+        }
+        if (fd >= 0) {
+            mexStream_closeInput(s);
+            mexStream_setBlocking(fd, 1);
+            mexStream_configureConnected(fd, s->mode);
+            s->inFD = fd;
+            s->numAccepts++;
+            mexStream_fill(sockID);
+        }
+    }
+}
+
+// read everything that's arrived, not just the next frame
+//  so a socket that sends to itself can make room as it writes
+static void mexStream_readAhead(int sockID) {
+
+    mexStream_socket *s = &mexStream_sockets[sockID];
+    ssize_t nBytes;
+
+    mexStream_fill(sockID);
+    while (s->inFD >= 0) {
+        if (s->inEnd == s->maxInBytes) {
+            s->maxInBytes *= 2;
+            s->inBytes = mxRealloc(s->inBytes, s->maxInBytes);
+            mexMakeMemoryPersistent(s->inBytes);
+        }
+        nBytes = recv(s->inFD, s->inBytes + s->inEnd, s->maxInBytes - s->inEnd, MSG_DONTWAIT);
+        if (nBytes > 0)
+            s->inEnd += nBytes;
+        else if (nBytes == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            mexStream_closeInput(s);
+        else
+            break;
+    }
+}
+
+int mexStream_check(int sockID, double timeoutSecs) {
+
+    mexStream_socket *s = &mexStream_sockets[sockID];
+    struct pollfd pollFDs[2];
+    double deadline = mexStream_getSeconds() + timeoutSecs;
+    int numFDs;
+
+    mexStream_fill(sockID);
+    while (!mexStream_hasFrame(s)) {
+        if (timeoutSecs <= 0 || mexStream_getSeconds() >= deadline)
+            return(0);
+
+        // sleep until the peer sends or connects
+        pollFDs[0].fd = s->listenFD;
+        pollFDs[0].events = POLLIN;
+        pollFDs[0].revents = 0;
+        numFDs = 1;
+        if (s->inFD >= 0) {
+            pollFDs[1].fd = s->inFD;
+            pollFDs[1].events = POLLIN;
+            pollFDs[1].revents = 0;
+            numFDs = 2;
+        }
+        poll(pollFDs, numFDs, mexStream_getPollMsecs(deadline - mexStream_getSeconds()));
+        mexStream_fill(sockID);
+    }
+    return(1);
+}
+
+int mexStream_peekLength(int sockID) {
+    mexStream_socket *s = &mexStream_sockets[sockID];
+    if (!mexStream_check(sockID, 0))
+        return(-1);
+    return((int)mexStream_readLength(s->inBytes + s->inStart));
+}
+
+int mexStream_receive(int sockID, char* message, int messageLength) {
+
+    mexStream_socket *s = &mexStream_sockets[sockID];
+    int frameLength = mexStream_peekLength(sockID);
+    if (frameLength < 0)
+        return(-1);
+
+    // consume the whole frame, even if the message is truncated
+    if (messageLength > frameLength)
+        messageLength = frameLength;
+    memcpy(message, s->inBytes + s->inStart + MEXSTREAM_HEADER_LENGTH, messageLength);
+    s->inStart += MEXSTREAM_HEADER_LENGTH + frameLength;
+    s->numReceived++;
+    return(messageLength);
+}
+
+// let the mxGram routines work in place, in the socket's buffers
+char* mexStream_getFrame(int sockID, int* frameLength) {
+    mexStream_socket *s = &mexStream_sockets[sockID];
+    *frameLength = mexStream_peekLength(sockID);
+    if (*frameLength < 0)
+        return(NULL);
+    return(s->inBytes + s->inStart + MEXSTREAM_HEADER_LENGTH);
+}
+
+void mexStream_consumeFrame(int sockID) {
+    mexStream_socket *s = &mexStream_sockets[sockID];
+    int frameLength = mexStream_peekLength(sockID);
+    if (frameLength >= 0) {
+        s->inStart += MEXSTREAM_HEADER_LENGTH + frameLength;
+        s->numReceived++;
+    }
+}
+
+char* mexStream_getSendBuffer(int sockID, int messageLength) {
+    mexStream_socket *s = &mexStream_sockets[sockID];
+    if (messageLength > s->maxOutBytes) {
+        s->outBytes = mxRealloc(s->outBytes, messageLength);
+        mexMakeMemoryPersistent(s->outBytes);
+        s->maxOutBytes = messageLength;
+    }
+    return(s->outBytes);
+}
+
+int mexStream_getStats(int sockID, unsigned int* numSent, unsigned int* numReceived,
+        unsigned int* numConnects, unsigned int* numAccepts) {
+    mexStream_socket *s = &mexStream_sockets[sockID];
+    *numSent = s->numSent;
+    *numReceived = s->numReceived;
+    *numConnects = s->numConnects;
+    *numAccepts = s->numAccepts;
+    return(s->inFD >= 0 || s->outFD >= 0);
+}
+
+double mexStream_getSeconds() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return(now.tv_sec + 1e-6*now.tv_usec);
+}
+
+int mexStream_close(int sockID) {
+
+    mexStream_socket *s = &mexStream_sockets[sockID];
+    int status = 0;
+
+    mexStream_closeInput(s);
+    if (s->outFD >= 0)
+        close(s->outFD);
+    if (s->listenFD >= 0)
+        status = close(s->listenFD);
+    if (s->listenPath[0])
+        unlink(s->listenPath);
+
+    mxFree(s->inBytes);
+    mxFree(s->outBytes);
+    memset(s, 0, sizeof(mexStream_socket));
+    return(status);
+}
+
+void mexStream_closeAll() {
+    int sockID;
+    for (sockID=0; sockID<MEXSTREAM_MAX_NUM_SOCKETS; sockID++)
+        if (mexStream_sockets[sockID].isOpen)
+            mexStream_close(sockID);
+}
+
+int mexStream_isValidSocketIndex(int sockID) {
+    return(sockID >= 0 && sockID < MEXSTREAM_MAX_NUM_SOCKETS && mexStream_sockets[sockID].isOpen);
+}
@@ -0,0 +1,120 @@
+/* mexStream.h
+ *
+ * mexStream defines a few c-routines for managing stream sockets which
+ * Matlab can use and reference by index, like mexUDP does for datagram
+ * sockets.  Each message goes as one frame, a 4-byte little endian
+ * length followed by that many bytes.
+ *
+ * Streams may use TCP, with Nagle's algorithm disabled, or Unix domain
+ * sockets, for peers on the same host.  Either way the stream is
+ * reliable and in order, so senders don't need to wait for ack codes.
+ *
+ * Each socket listens at its local address and connects to its remote
+ * address the first time it sends.  So neither peer has to start first,
+ * and a socket may send to itself.  A Unix domain socket listens at a
+ * file path made from its IP address and port.
+ *
+ */
+
+#ifndef _MEX_STREAM_H_
+#define _MEX_STREAM_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <math.h>
+#include <limits.h>
+
+#include "mex.h"
+
+#define MEXSTREAM_MAX_COMMAND_LENGTH 64
+#define MEXSTREAM_MAX_NUM_SOCKETS 64
+#define MEXSTREAM_MAX_IP_LENGTH 64
+
+// each frame starts with its length, which can't be too big
+#define MEXSTREAM_HEADER_LENGTH 4
+#define MEXSTREAM_MAX_FRAME_LENGTH (1<<24)
+#define MEXSTREAM_DEFAULT_BUFFER_LENGTH 8192
+
+// don't let a peer that stopped reading hang Matlab
+//  a send gives up when no bytes go out for the whole send timeout
+#define MEXSTREAM_CONNECT_TIMEOUT_SECS 1.0
+#define MEXSTREAM_SEND_TIMEOUT_SECS 1.0
+#define MEXSTREAM_SEND_FAILED -1
+#define MEXSTREAM_SEND_TIMED_OUT -2
+#define MEXSTREAM_LISTEN_BACKLOG 4
+
+// Unix domain sockets listen at a path made from IP and port
+#define MEXSTREAM_UNIX_PATH_FORMAT "/tmp/snowDots-%s-%d.sock"
+
+typedef enum {
+    mexStreamTCP,
+    mexStreamUnix
+} mexStream_mode;
+
+typedef struct {
+    int isOpen;
+    mexStream_mode mode;
+    char localIP[MEXSTREAM_MAX_IP_LENGTH];
+    char remoteIP[MEXSTREAM_MAX_IP_LENGTH];
+    int localPort;
+    int remotePort;
+
+    // accepts the peer's connection, then reads frames from it
+    int listenFD;
+    int inFD;
+    char listenPath[sizeof(((struct sockaddr_un*)0)->sun_path)];
+
+    // writes frames to the peer, connected on demand
+    int outFD;
+
+    // received bytes, which may hold partial and whole frames
+    char *inBytes;
+    int inStart;
+    int inEnd;
+    int maxInBytes;
+
+    // room to serialize outgoing frames
+    char *outBytes;
+    int maxOutBytes;
+
+    unsigned int numSent;
+    unsigned int numReceived;
+    unsigned int numConnects;
+    unsigned int numAccepts;
+} mexStream_socket;
+
+int mexStream_open(const char* localIP, const char* remoteIP, int localPort, int remotePort, mexStream_mode mode);
+int mexStream_find(const char* localIP, const char* remoteIP, int localPort, int remotePort, mexStream_mode mode);
+int mexStream_send(int sock, const char* message, int messageLength);
+int mexStream_check(int sock, double timeoutSecs);
+int mexStream_peekLength(int sock);
+int mexStream_receive(int sock, char* message, int messageLength);
+char* mexStream_getFrame(int sock, int* frameLength);
+void mexStream_consumeFrame(int sock);
+char* mexStream_getSendBuffer(int sock, int messageLength);
+int mexStream_sendMx(int sock, int prefix, const mxArray* mx, double compressThreshold, int maxBytes, int* gramLength);
+int mexStream_receiveMx(int sock, double timeoutSecs, mxArray** mx, int* prefix);
+int mexStream_getPeerKey(int sock);
+int mexStream_getStats(int sock, unsigned int* numSent, unsigned int* numReceived,
+        unsigned int* numConnects, unsigned int* numAccepts);
+double mexStream_getSeconds();
+void mexStream_clearMx();
+int mexStream_close(int sock);
+void mexStream_closeAll();
+
+int mexStream_isValidSocketIndex(int sock);
+
+#endif
@@ -0,0 +1,267 @@
+/* mexStreamInterface.c
+ *
+ * Matlab mex interface for opening stream sockets, and sending and
+ * receiving framed messages.  The subcommands and status codes follow
+ * mexUDP, where they do the same thing.
+ *
+ */
+
+#include "mexStream.h"
+
+// "tcp" or "unix", or -1 if neither
+static int getMode(const mxArray *array) {
+    char mode[8];
+    if (array == NULL || mxIsEmpty(array))
+        return(mexStreamTCP);
+    if (!mxIsChar(array) || mxGetString(array, mode, sizeof(mode)))
+        return(-1);
+    if (!strcmp(mode, "tcp"))
+        return(mexStreamTCP);
+    if (!strcmp(mode, "unix"))
+        return(mexStreamUnix);
+    return(-1);
+}
+
+// free sockets and mxGram caches when Matlab clears this function
+static void mexStream_exit(void) {
+    mexStream_closeAll();
+    mexStream_clearMx();
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+
+    int status = 0;
+    int nBytes = 0;
+    static char command[MEXSTREAM_MAX_COMMAND_LENGTH];
+    void* mxData;
+
+    // First argument should be a command string
+    if(nrhs >= 1 && mxIsChar(prhs[0]) && mxGetM(prhs[0])==1) {
+        mxGetString(prhs[0], command, sizeof(command));
+
+        // second argument may be a socketID;
+        int sockID = -1;
+        if(nrhs>=2 && mxIsNumeric(prhs[1]))
+            sockID = (int)mxGetScalar(prhs[1]);
+
+        if(!strcmp(command, "open")) {
+
+            mexAtExit(mexStream_exit);
+
+            //  IP address args are short strings
+            //  PORT args are numbers.
+            if(nrhs>=4 && mxIsNumeric(prhs[3])
+            && mxIsChar(prhs[1]) && mxIsChar(prhs[2])) {
+
+                char *localIP = mxArrayToString(prhs[1]);
+                char *remoteIP = mxArrayToString(prhs[2]);
+                int localPort = (int)mxGetScalar(prhs[3]);
+
+                // remote port is optional
+                int remotePort;
+                if(nrhs>=5 && mxIsNumeric(prhs[4]) && !mxIsEmpty(prhs[4]))
+                    remotePort = (int)mxGetScalar(prhs[4]);
+                else
+                    remotePort = localPort;
+
+                // mode is optional, default to TCP
+                int mode = getMode(nrhs>=6 ? prhs[5] : NULL);
+
+                if(mode >= 0) {
+                    // try to reuse an existing, matching socket
+                    status = mexStream_find(localIP, remoteIP, localPort, remotePort, mode);
+
+                    if(status < 0)
+                        status = mexStream_open(localIP, remoteIP, localPort, remotePort, mode);
+
+                } else {
+                    mexPrintf("stream mode should be 'tcp' or 'unix'\n");
+                    status = -15;
+                }
+
+                mxFree(localIP);
+                mxFree(remoteIP);
+
+            } else
+                status = -10;
+
+        } else if(!strcmp(command, "sendBytes")) {
+
+            if (mexStream_isValidSocketIndex(sockID)) {
+
+                // treat input as packed bytes, like uint8
+                if(nrhs==3) {
+                    nBytes = mxGetM(prhs[2]) * mxGetN(prhs[2]) * mxGetElementSize(prhs[2]);
+                    if (nBytes <= MEXSTREAM_MAX_FRAME_LENGTH) {
+                        // send straight from the input
+                        mxData = mxGetData(prhs[2]);
+                        status = mexStream_send(sockID, mxData, nBytes);
+
+                    } else {
+                        mexPrintf("input is too long to send (%d, max of %d)\n", nBytes, MEXSTREAM_MAX_FRAME_LENGTH);
+                        status = -20;
+                    }
+
+                } else
+                    status = -30;
+
+            } else
+                status = -40;
+
+        } else if(!strcmp(command, "sendMx")) {
+
+            // prefix byte and variable, with optional compressThreshold and maxBytes
+            int gramLength = -1;
+            if (mexStream_isValidSocketIndex(sockID)) {
+
+                if(nrhs>=4 && mxIsNumeric(prhs[2]) && !mxIsEmpty(prhs[2])) {
+                    double compressThreshold = mxGetInf();
+                    int maxBytes = MEXSTREAM_MAX_FRAME_LENGTH - 1;
+                    if(nrhs>=5 && mxIsNumeric(prhs[4]) && !mxIsEmpty(prhs[4]))
+                        compressThreshold = mxGetScalar(prhs[4]);
+                    if(nrhs>=6 && mxIsNumeric(prhs[5]) && !mxIsEmpty(prhs[5]))
+                        maxBytes = (int)mxGetScalar(prhs[5]);
+                    status = mexStream_sendMx(sockID, (int)mxGetScalar(prhs[2]), prhs[3],
+                            compressThreshold, maxBytes, &gramLength);
+
+                } else
+                    status = -230;
+
+            } else
+                status = -240;
+
+            // optional serialized length, even if too large to send
+            if(nlhs >= 2)
+                plhs[1] = mxCreateDoubleScalar(gramLength);
+
+        } else if(!strcmp(command, "check") || !strcmp(command, "wait")) {
+
+            // optional timeout seconds, default to 0
+            //  frames arrive whole, so waiting is the same as checking
+            double timeoutSecs = 0;
+            if(nrhs==3)
+                timeoutSecs = mxGetScalar(prhs[2]);
+
+            if (mexStream_isValidSocketIndex(sockID))
+                status = mexStream_check(sockID, timeoutSecs);
+            else
+                status = !strcmp(command, "wait") ? -310 : -50;
+
+        } else if(!strcmp(command, "receiveBytes")) {
+
+            if (mexStream_isValidSocketIndex(sockID)) {
+
+                // size the output for the next frame, then receive straight into it
+                plhs[0] = mxCreateNumericMatrix(0, 0, mxUINT8_CLASS, mxREAL);
+                nBytes = mexStream_peekLength(sockID);
+                if(nBytes >= 0) {
+                    mxData = mxMalloc(nBytes > 0 ? nBytes : 1);
+                    nBytes = mexStream_receive(sockID, mxData, nBytes);
+                    if(nBytes > 0) {
+                        // treat data as individual bytes, uint8
+                        mxSetData(plhs[0], mxData);
+                        mxSetM(plhs[0], 1);
+                        mxSetN(plhs[0], nBytes);
+
+                    } else
+                        mxFree(mxData);
+                }
+                return;
+
+            } else
+                status = -60;
+
+        } else if(!strcmp(command, "receiveMx")) {
+
+            if (mexStream_isValidSocketIndex(sockID)) {
+
+                // optional timeout seconds
+                int prefix;
+                double timeoutSecs = 0;
+                mxArray *mx;
+                if(nrhs>=3)
+                    timeoutSecs = mxGetScalar(prhs[2]);
+
+                status = mexStream_receiveMx(sockID, timeoutSecs, &mx, &prefix);
+                plhs[0] = mx != NULL ? mx : mxCreateDoubleMatrix(0, 0, mxREAL);
+                if(nlhs >= 2)
+                    plhs[1] = mxCreateDoubleScalar(status);
+                if(nlhs >= 3) {
+                    if(prefix >= 0)
+                        plhs[2] = mxCreateDoubleScalar(prefix);
+                    else
+                        plhs[2] = mxCreateDoubleMatrix(0, 0, mxREAL);
+                }
+                return;
+
+            } else
+                status = -270;
+
+        } else if(!strcmp(command, "peerKey")) {
+
+            // changes with each connection, for keeping schema layouts apart
+            if (mexStream_isValidSocketIndex(sockID))
+                status = mexStream_getPeerKey(sockID);
+            else
+                status = -320;
+
+        } else if(!strcmp(command, "socketStats")) {
+
+            if (mexStream_isValidSocketIndex(sockID)) {
+
+                // counts of frames and connections
+                const char *fieldNames[] = {"sent", "received", "connects", "accepts", "isConnected"};
+                unsigned int numSent, numReceived, numConnects, numAccepts;
+                int isConnected = mexStream_getStats(sockID,
+                        &numSent, &numReceived, &numConnects, &numAccepts);
+                plhs[0] = mxCreateStructMatrix(1, 1, 5, fieldNames);
+                mxSetFieldByNumber(plhs[0], 0, 0, mxCreateDoubleScalar(numSent));
+                mxSetFieldByNumber(plhs[0], 0, 1, mxCreateDoubleScalar(numReceived));
+                mxSetFieldByNumber(plhs[0], 0, 2, mxCreateDoubleScalar(numConnects));
+                mxSetFieldByNumber(plhs[0], 0, 3, mxCreateDoubleScalar(numAccepts));
+                mxSetFieldByNumber(plhs[0], 0, 4, mxCreateLogicalScalar(isConnected));
+                return;
+
+            } else
+                status = -150;
+
+        } else if(!strcmp(command, "close")) {
+
+            if (mexStream_isValidSocketIndex(sockID))
+                status = mexStream_close(sockID);
+            else
+                status = 0;
+
+        } else if(!strcmp(command, "closeAll")) {
+
+            mexStream_closeAll();
+            status = 0;
+
+        } else {
+
+            mexPrintf("unknown subcommand, %s\n", command);
+            status = -1000;
+        }
+
+        // all subcommands return int status
+        // except the receives and the stats, which return above
+        // sendMx may also return its serialized length
+        plhs[0] = mxCreateDoubleScalar((double)status);
+
+    } else {
+        mexPrintf("mexStream usage:\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n",
+                "id = mexStream('open', localIP, remoteIP, localPort [, remotePort [, mode]])",
+                "  mode may be 'tcp' (the default) or 'unix'",
+                "status = mexStream('sendBytes', id, data)",
+                "hasData = mexStream('check', id [, timeoutSeconds])",
+                "isReady = mexStream('wait', id [, timeoutSeconds])",
+                "data = mexStream('receiveBytes', id)",
+                "[status, nBytes] = mexStream('sendMx', id, prefix, variable [, compressThreshold [, maxBytes]])",
+                "[variable, status, prefix] = mexStream('receiveMx', id [, timeoutSeconds])",
+                "key = mexStream('peerKey', id)",
+                "stats = mexStream('socketStats', id)",
+                "status = mexStream('close', id)",
+                "status = mexStream('closeAll')");
+        return;
+    }
+}
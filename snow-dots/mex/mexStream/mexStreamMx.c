@@ -0,0 +1,91 @@
+/* mexStreamMx.c
+ *
+ * Send and receive Matlab variables as mxGram bytes, with the 1-byte ack
+ * code prefix that dotsTheMessenger uses, one variable per frame.
+ * Variables are serialized straight into the socket's send buffer, just
+ * after the prefix, and decoded straight out of its receive buffer.
+ *
+ * Streams don't lose or repeat frames, so receivers don't reply with ack
+ * codes, or check for recent prefixes.  They return the prefix anyway,
+ * so the messenger can keep count.
+ *
+ * These link with their own copy of the mxGram routines, like mexUDP.
+ * Schema layouts are kept for each socket.  Senders key theirs with
+ * mexStream_getPeerKey(), which changes when the peer reconnects.
+ * Receivers drop frames they can't decode, like schema grams encoded
+ * for an earlier connection.  mexStream_send() never resends a frame
+ * over a new connection, so senders can tell by the peer key and encode
+ * again.
+ *
+ */
+
+#include "mexStream.h"
+#include "mxGram.h"
+
+int mexStream_sendMx(int sock, int prefix, const mxArray* mx, double compressThreshold, int maxBytes, int* gramLength) {
+
+    char *message;
+    int nBytes;
+
+    // leave room for the prefix
+    if (maxBytes > MEXSTREAM_MAX_FRAME_LENGTH - 1)
+        maxBytes = MEXSTREAM_MAX_FRAME_LENGTH - 1;
+
+    // check the exact size before serializing
+    //  grams that will be compressed might still fit
+    *gramLength = nBytes = mxGramSize(mx);
+    if (nBytes <= 0)
+        return(-230);
+    if (nBytes > maxBytes)
+        nBytes = maxBytes;
+
+    message = mexStream_getSendBuffer(sock, 1 + nBytes);
+    nBytes = mxToBytesMaybeCompressed(mx, message+1, nBytes, compressThreshold, *gramLength);
+
+    // handle strings are only good during this call
+    clearMxGramFunctionStrings();
+    if (nBytes == MX_GRAM_TOO_LONG)
+        return(-220);
+    if (nBytes <= 0)
+        return(-230);
+
+    *gramLength = nBytes;
+    message[0] = (char)prefix;
+    return(mexStream_send(sock, message, nBytes+1));
+}
+
+int mexStream_receiveMx(int sock, double timeoutSecs, mxArray** mx, int* prefix) {
+
+    char *frame;
+    int nBytes, status;
+
+    *mx = NULL;
+    *prefix = -1;
+
+    // skip empty frames and lone bytes, which can't hold a variable
+    while (mexStream_check(sock, timeoutSecs)) {
+        frame = mexStream_getFrame(sock, &nBytes);
+        if (nBytes <= 1) {
+            mexStream_consumeFrame(sock);
+            continue;
+        }
+
+        // decode in place, then let the frame go
+        //  with layouts from this socket's connection
+        status = bytesToMxWithSchemas(mx, frame+1, nBytes-1, sock) > 0 ? nBytes-1 : -260;
+        if (status > 0)
+            *prefix = (unsigned char)frame[0];
+        mexStream_consumeFrame(sock);
+        if (status < 0) {
+            mxDestroyArray(*mx);
+            *mx = NULL;
+        }
+        return(status);
+    }
+    return(-250);
+}
+
+void mexStream_clearMx() {
+    clearMxGramFunctionCache();
+    clearMxGramSchemaTables();
+}
@@ -0,0 +1,252 @@
+classdef TestMexStream < TestCase
+
+    properties
+        address;
+        port;
+        modes;
+
+        shortMessage;
+    end
+
+    methods
+        function self = TestMexStream(name)
+            self = self@TestCase(name);
+        end
+
+        function setUp(self)
+            clear mex
+
+            self.address = '127.0.0.1';
+            self.port = 49400;
+            self.modes = {'tcp', 'unix'};
+
+            self.shortMessage = ones(1, 10, 'uint8');
+        end
+
+        function tearDown(self)
+            mexStream('closeAll');
+        end
+
+        function testNoArgs(self)
+            % should print usage examples
+            mexName = 'mexStream';
+            result = evalc(mexName);
+            assertFalse(isempty(strfind(result, mexName)), ...
+                sprintf('no-args should print usage string for %s', mexName));
+        end
+
+        function testOpen(self)
+            for ii = 1:numel(self.modes)
+                s = mexStream('open', self.address, self.address, ...
+                    self.port, self.port, self.modes{ii});
+                assertTrue(s >= 0, ...
+                    'should get nonnegative socket id')
+
+                sameS = mexStream('open', self.address, self.address, ...
+                    self.port, self.port, self.modes{ii});
+                assertEqual(sameS, s, ...
+                    'should find the same open socket')
+
+                status = mexStream('close', s);
+                assertTrue(status >= 0, ...
+                    'should get nonnegative close status')
+            end
+
+            s = mexStream('open', self.address, self.address, ...
+                self.port, self.port, 'carrier pigeon');
+            assertTrue(s < 0, ...
+                'should not open an unknown mode')
+        end
+
+        function testVariedSizes(self)
+            for ii = 1:numel(self.modes)
+                s = mexStream('open', self.address, self.address, ...
+                    self.port, self.port, self.modes{ii});
+                assertTrue(s >= 0, ...
+                    'should get nonnegative socket id')
+
+                hasMessage = mexStream('check', s);
+                assertFalse(hasMessage > 0, ...
+                    'should have nothing yet')
+
+                % frames may be much larger than datagrams
+                %   and than the kernel's socket buffers
+                sizes = [1 7 1000 8192 100000 2^20 2^22 3];
+                for jj = 1:numel(sizes)
+                    message = uint8(mod(1:sizes(jj), 256));
+                    status = mexStream('sendBytes', s, message);
+                    assertEqual(status, sizes(jj), ...
+                        'should send the whole frame')
+
+                    hasMessage = mexStream('wait', s, 0.1);
+                    assertTrue(hasMessage > 0, ...
+                        'should have frame sent to self')
+                    readMessage = mexStream('receiveBytes', s);
+                    assertEqual(readMessage, message, ...
+                        'should receive each size exactly as sent');
+                end
+
+                readMessage = mexStream('receiveBytes', s);
+                assertTrue(isempty(readMessage), ...
+                    'should receive empty with nothing to read');
+            end
+        end
+
+        function testSendReceiveMx(self)
+            for ii = 1:numel(self.modes)
+                a = mexStream('open', self.address, self.address, ...
+                    self.port, self.port+1, self.modes{ii});
+                b = mexStream('open', self.address, self.address, ...
+                    self.port+1, self.port, self.modes{ii});
+                assertTrue(a >= 0 && b >= 0, ...
+                    'should get nonnegative socket ids')
+
+                msg.name = 'hello';
+                msg.values = {1:10, true};
+                [status, nBytes] = mexStream('sendMx', a, 7, msg);
+                assertEqual(status, nBytes + 1, ...
+                    'should send prefix and serialized message')
+
+                [readMsg, status, prefix] = mexStream('receiveMx', b, 0.1);
+                assertTrue(status > 0, ...
+                    'should get positive receive status')
+                assertEqual(prefix, 7, ...
+                    'should receive the ack code prefix')
+                assertEqual(readMsg, msg, ...
+                    'should receive message sent to other socket')
+
+                hasMessage = mexStream('check', a);
+                assertFalse(hasMessage > 0, ...
+                    'should not reply with ack code')
+
+                % the same prefix again is a new message
+                mexStream('sendMx', a, 7, msg);
+                [readMsg, status, prefix] = mexStream('receiveMx', b, 0.1);
+                assertTrue(status > 0 && isequal(readMsg, msg), ...
+                    'should receive message with repeated prefix')
+
+                bigMsg = zeros(1, 10000);
+                [status, nBytes] = mexStream('sendMx', a, 8, bigMsg, inf, 8191);
+                assertTrue(status < 0 && nBytes > 8192, ...
+                    'should not send message larger than maxBytes')
+                status = mexStream('sendMx', a, 8, bigMsg, 1024, 8191);
+                assertTrue(status > 0, ...
+                    'should send message compressed to fit')
+                readMsg = mexStream('receiveMx', b, 0.1);
+                assertEqual(readMsg, bigMsg, ...
+                    'should receive compressed message')
+
+                mexStream('closeAll');
+            end
+        end
+
+        function testReconnect(self)
+            for ii = 1:numel(self.modes)
+                a = mexStream('open', self.address, self.address, ...
+                    self.port, self.port+1, self.modes{ii});
+                b = mexStream('open', self.address, self.address, ...
+                    self.port+1, self.port, self.modes{ii});
+                mexStream('sendBytes', a, self.shortMessage);
+                readMessage = mexStream('receiveBytes', b);
+                if isempty(readMessage)
+                    mexStream('wait', b, 0.1);
+                    readMessage = mexStream('receiveBytes', b);
+                end
+                assertEqual(readMessage, self.shortMessage, ...
+                    'should receive frame from other socket')
+
+                % the peer goes away and comes back
+                key = mexStream('peerKey', a);
+                mexStream('close', b);
+                b = mexStream('open', self.address, self.address, ...
+                    self.port+1, self.port, self.modes{ii});
+                newKey = mexStream('peerKey', a);
+                assertFalse(newKey == key, ...
+                    'should get a new key for the restarted peer')
+                status = mexStream('sendBytes', a, self.shortMessage);
+                assertTrue(status >= 0, ...
+                    'should send over a fresh connection')
+                assertEqual(mexStream('peerKey', a), newKey, ...
+                    'should keep the key for the new connection')
+                hasMessage = mexStream('wait', b, 0.1);
+                assertTrue(hasMessage > 0, ...
+                    'should have frame from reconnected socket')
+
+                stats = mexStream('socketStats', a);
+                assertEqual(stats.connects, 2, ...
+                    'should connect once per peer')
+
+                mexStream('closeAll');
+            end
+        end
+
+        function testStalledPeer(self)
+            for ii = 1:numel(self.modes)
+                a = mexStream('open', self.address, self.address, ...
+                    self.port, self.port+1, self.modes{ii});
+                b = mexStream('open', self.address, self.address, ...
+                    self.port+1, self.port, self.modes{ii});
+
+                % b never reads, so the kernel buffers fill up
+                bigMessage = zeros(1, 2^24, 'uint8');
+                status = 0;
+                for jj = 1:4
+                    tic;
+                    status = mexStream('sendBytes', a, bigMessage);
+                    sendSecs = toc;
+                    if status < 0
+                        break;
+                    end
+                end
+                assertTrue(status < 0, ...
+                    'should fail to send to a peer that stopped reading')
+                % the kernel may still take a few bytes after a while
+                %   each time restarting the timeout
+                assertTrue(sendSecs < 3, ...
+                    'should give up after one timeout with no bytes sent')
+
+                mexStream('closeAll');
+            end
+        end
+
+        function testListenerInUse(self)
+            for ii = 1:numel(self.modes)
+                a = mexStream('open', self.address, self.address, ...
+                    self.port, self.port+1, self.modes{ii});
+                b = mexStream('open', self.address, self.address, ...
+                    self.port+1, self.port, self.modes{ii});
+                mexStream('sendBytes', b, self.shortMessage);
+                mexStream('wait', a, 0.1);
+                mexStream('receiveBytes', a);
+
+                other = mexStream('open', self.address, self.address, ...
+                    self.port, self.port+2, self.modes{ii});
+                assertTrue(other < 0, ...
+                    'should not take over a live listener')
+
+                mexStream('sendBytes', b, self.shortMessage);
+                hasMessage = mexStream('wait', a, 0.1);
+                assertTrue(hasMessage > 0, ...
+                    'should keep receiving at the live listener')
+                readMessage = mexStream('receiveBytes', a);
+                assertEqual(readMessage, self.shortMessage, ...
+                    'should receive frame after failed open')
+
+                mexStream('closeAll');
+            end
+        end
+
+        function testClosedSocket(self)
+            s = mexStream('open', self.address, self.address, ...
+                self.port, self.port);
+            mexStream('close', s);
+
+            status = mexStream('sendBytes', s, self.shortMessage);
+            assertTrue(status < 0, ...
+                'should not send with a closed socket id')
+            status = mexStream('wait', s, 0);
+            assertTrue(status < 0, ...
+                'should not wait with a closed socket id')
+        end
+    end
+end
@@ -1,5 +1,8 @@
 % Script to build the mex function "mexUDP".
 %   mexUDP can open, close, use UDP/IP sockets with the matUDP
 %   functions.  It knows how to send and receive data of type char, only.
+%   Sockets may have a receiver thread, so link with pthreads.
+%   mexUDP can also send and receive Matlab variables directly, so it
+%   compiles its own copy of the mxGram routines.
 
-mex mexUDPInterface.c mexUDP.c -output mexUDP
\ No newline at end of file
+mex -I../mxGram mexUDPInterface.c mexUDP.c mexUDPFragment.c mexUDPMx.c ../mxGram/mxGram.c ../mxGram/mxGramCompress.c ../mxGram/mxGramSchema.c ../mxGram/mxGramFunctionCache.c -lpthread -output mexUDP
\ No newline at end of file
@@ -10,12 +10,99 @@
 
 #include "mexUDP.h"
 
+static int mexUDP_hasQueuedPacket(mexUDP_receiver *receiver);
+static int mexUDP_waitForPacket(mexUDP_receiver *receiver, double timeoutSecs);
+static void mexUDP_clearWakeSignal(mexUDP_receiver *receiver);
+static int mexUDP_dequeuePacket(int sockID, char* message, int messageLength, double* timestamp,
+        int* isTruncated);
+
+// poll() and epoll_wait() take whole milliseconds
+static int mexUDP_getPollMsecs(double timeoutSecs) {
+    
+    if (timeoutSecs <= 0)
+        return(0);
+    if (timeoutSecs > INT_MAX/1000)
+        return(-1);
+    return((int)ceil(1000*timeoutSecs));
+}
+
+static int mexUDP_compareIDs(const void *a, const void *b) {
+    
+    return(*(const int *)a - *(const int *)b);
+}
+
+// take a socket out of the waitAny() epoll set, if it's there
+static void mexUDP_unwatch(int sockID) {
+    
+#ifdef __linux__
+    if (mexUDP_isInPollSet[sockID])
+        epoll_ctl(mexUDP_pollSet, EPOLL_CTL_DEL, mexUDP_sockets[sockID], NULL);
+#endif
+    mexUDP_isInPollSet[sockID] = 0;
+}
+
+static void mexUDP_makeKey(char* localIP, char* remoteIP, int localPort, int remotePort, mexUDP_key* key) {
+    
+    memset(key, 0, sizeof(mexUDP_key));
+    key->localAddress = inet_addr(localIP);
+    key->remoteAddress = inet_addr(remoteIP);
+    key->localPort = htons(localPort);
+    key->remotePort = htons(remotePort);
+}
+
+static int mexUDP_hashKey(const mexUDP_key* key) {
+    
+    // FNV-1a
+    const unsigned char *bytes = (const unsigned char *)key;
+    unsigned int hash = 2166136261U;
+    int ii;
+    for (ii=0; ii<(int)sizeof(mexUDP_key); ii++) {
+        hash ^= bytes[ii];
+        hash *= 16777619U;
+    }
+    return((int)(hash % MEXUDP_NUM_HASH_BUCKETS));
+}
+
+static void mexUDP_clearIndex() {
+    
+    memset(mexUDP_hashBuckets, 0xff, sizeof(mexUDP_hashBuckets));
+    mexUDP_numFreeSockets = 0;
+}
+
+static void mexUDP_addToIndex(int sockID) {
+    
+    int bucket = mexUDP_hashKey(&mexUDP_keys[sockID]);
+    mexUDP_hashNext[sockID] = mexUDP_hashBuckets[bucket];
+    mexUDP_hashBuckets[bucket] = sockID;
+}
+
+static void mexUDP_removeFromIndex(int sockID) {
+    
+    int *link = &mexUDP_hashBuckets[mexUDP_hashKey(&mexUDP_keys[sockID])];
+    while (*link >= 0) {
+        if (*link == sockID) {
+            *link = mexUDP_hashNext[sockID];
+            return;
+        }
+        link = &mexUDP_hashNext[*link];
+    }
+}
+
 int mexUDP_open(char* localIP, char* remoteIP, int localPort, int remotePort) {
     
     struct sockaddr_in LOCAL_addr;
     struct protoent *udpProto;
     int sockFD, sockID;
     
+    // the index starts out empty
+    if (mexUDP_numSockets == 0)
+        mexUDP_clearIndex();
+    
+    if (mexUDP_numFreeSockets == 0 && mexUDP_numSockets >= MEXUDP_MAX_NUM_SOCKETS) {
+        mexPrintf("too many sockets are open (max of %d)\n", MEXUDP_MAX_NUM_SOCKETS);
+        return(-1);
+    }
+    
     memset(&LOCAL_addr, 0, sizeof(LOCAL_addr));
     LOCAL_addr.sin_family = AF_INET;
     LOCAL_addr.sin_port = htons(localPort);
@@ -28,6 +115,20 @@ int mexUDP_open(char* localIP, char* remoteIP, int localPort, int remotePort) {
         return(sockFD);
     }
     
+    // ask the kernel to timestamp datagrams as they arrive
+    int isTimestamped = 1;
+#if defined(SO_TIMESTAMPNS)
+    setsockopt(sockFD, SOL_SOCKET, SO_TIMESTAMPNS, &isTimestamped, sizeof(isTimestamped));
+#elif defined(SO_TIMESTAMP)
+    setsockopt(sockFD, SOL_SOCKET, SO_TIMESTAMP, &isTimestamped, sizeof(isTimestamped));
+#endif
+    
+    // and to count datagrams it drops for lack of buffer space
+#if defined(SO_RXQ_OVFL)
+    int isCountingDrops = 1;
+    setsockopt(sockFD, SOL_SOCKET, SO_RXQ_OVFL, &isCountingDrops, sizeof(isCountingDrops));
+#endif
+    
     int status;
     status = bind(sockFD, (struct sockaddr *)&LOCAL_addr, mexUDP_addressSize);
     if (status < 0) {
@@ -37,9 +138,14 @@ int mexUDP_open(char* localIP, char* remoteIP, int localPort, int remotePort) {
         return(status);
     }
     
-    // now the socket should be fine, so keep it
-    sockID = mexUDP_numSockets++;
+    // now the socket should be fine, so keep it, reusing a closed slot
+    if (mexUDP_numFreeSockets > 0)
+        sockID = mexUDP_freeSockets[--mexUDP_numFreeSockets];
+    else
+        sockID = mexUDP_numSockets++;
     mexUDP_sockets[sockID] = sockFD;
+    mexUDP_makeKey(localIP, remoteIP, localPort, remotePort, &mexUDP_keys[sockID]);
+    mexUDP_addToIndex(sockID);
     
     // store the message target
     mexUDP_remoteAddresses[sockID] = mxCalloc(1, sizeof(LOCAL_addr));
@@ -48,6 +154,12 @@ int mexUDP_open(char* localIP, char* remoteIP, int localPort, int remotePort) {
     mexUDP_remoteAddresses[sockID]->sin_port = htons(remotePort);
     mexUDP_remoteAddresses[sockID]->sin_addr.s_addr = inet_addr(remoteIP);
     
+    // each socket has its own buffer, which may be resized
+    mexUDP_maxLengths[sockID] = MEXUDP_DEFAULT_DATAGRAM_LENGTH;
+    mexUDP_buffers[sockID] = mxMalloc(mexUDP_maxLengths[sockID]);
+    mexMakeMemoryPersistent(mexUDP_buffers[sockID]);
+    mexUDP_kernelDrops[sockID] = 0;
+    
     //mexPrintf("local = %s : %d\n", inet_ntoa(LOCAL_addr.sin_addr), ntohs(LOCAL_addr.sin_port));
     //mexPrintf("remote = %s : %d\n",inet_ntoa(mexUDP_remoteAddresses[sockID]->sin_addr),
     //        ntohs(mexUDP_remoteAddresses[sockID]->sin_port));
@@ -57,42 +169,124 @@ int mexUDP_open(char* localIP, char* remoteIP, int localPort, int remotePort) {
 
 int mexUDP_find(char* localIP, char* remoteIP, int localPort, int remotePort) {
     
-    struct sockaddr_in LOCAL_addr;
-    int result, sockID;
+    mexUDP_key key;
+    int sockID;
     
-    for(sockID=0; sockID<mexUDP_numSockets; sockID++) {
-        result = getsockname(mexUDP_sockets[sockID],
-                (struct sockaddr*)&LOCAL_addr,
-                (unsigned int *)&mexUDP_addressSize);
-        
-        if(result<0) {
-            //mexPrintf("local getsockname failed: %s (errno %d)\n", result, errno);
-            continue;
-        } else {
-            //mexPrintf("local = %s : %d\n", inet_ntoa(LOCAL_addr.sin_addr), ntohs(LOCAL_addr.sin_port));
-            if(strcmp(inet_ntoa(LOCAL_addr.sin_addr), localIP)
-            || ntohs(LOCAL_addr.sin_port) != localPort)
-                continue;
-        }
-        
-        if(NULL==mexUDP_remoteAddresses[sockID]) {
-            //mexPrintf("remote address missing\n");
-            continue;
-        } else {
-            //mexPrintf("remote = %s : %d\n", inet_ntoa(mexUDP_remoteAddresses[sockID]->sin_addr),
-            //        ntohs(mexUDP_remoteAddresses[sockID]->sin_port));
-            if(strcmp(inet_ntoa(mexUDP_remoteAddresses[sockID]->sin_addr), remoteIP)
-            || ntohs(mexUDP_remoteAddresses[sockID]->sin_port) != remotePort)
-                continue;
-        }
-        
-        // this is a match
-        return(sockID);
+    if (mexUDP_numSockets == 0)
+        return(-1);
+    
+    // look in one hash bucket, for the addresses and ports used to open
+    mexUDP_makeKey(localIP, remoteIP, localPort, remotePort, &key);
+    for (sockID = mexUDP_hashBuckets[mexUDP_hashKey(&key)]; sockID >= 0; sockID = mexUDP_hashNext[sockID]) {
+        if (!memcmp(&mexUDP_keys[sockID], &key, sizeof(key)))
+            return(sockID);
     }
+    
     // there was no match
     return(-1);
 }
 
+// set a kernel buffer size, which the kernel may double or cap
+static int mexUDP_setBufferBytes(int sockID, int option, int bytes, const char* name) {
+    
+    int status = -1, actualBytes = 0;
+    socklen_t optionSize = sizeof(actualBytes);
+    
+#ifdef __linux__
+    // privileged processes may go past rmem_max and wmem_max
+    status = setsockopt(mexUDP_sockets[sockID], SOL_SOCKET,
+            option == SO_RCVBUF ? SO_RCVBUFFORCE : SO_SNDBUFFORCE, &bytes, sizeof(bytes));
+#endif
+    if (status < 0
+            && setsockopt(mexUDP_sockets[sockID], SOL_SOCKET, option, &bytes, sizeof(bytes)) < 0) {
+        mexPrintf("failed to set %s buffer to %d bytes (errno=%d)\n", name, bytes, errno);
+        return(-1);
+    }
+    
+    // a capped buffer still works, but may drop bursts
+    if (getsockopt(mexUDP_sockets[sockID], SOL_SOCKET, option, &actualBytes, &optionSize) == 0
+            && actualBytes < bytes)
+        mexPrintf("%s buffer is capped at %d bytes, not %d (see the system buffer limits)\n",
+                name, actualBytes, bytes);
+    return(0);
+}
+
+int mexUDP_configure(int sockID, int receiveBufferBytes, int sendBufferBytes, int maxDatagramLength) {
+    
+    int status = 0;
+    int ringLength = 0;
+    
+    // kernel buffer sizes, which the kernel may adjust
+    if (receiveBufferBytes > 0
+            && mexUDP_setBufferBytes(sockID, SO_RCVBUF, receiveBufferBytes, "receive") < 0)
+        status = -1;
+    if (sendBufferBytes > 0
+            && mexUDP_setBufferBytes(sockID, SO_SNDBUF, sendBufferBytes, "send") < 0)
+        status = -1;
+    
+    if (maxDatagramLength <= 0 || maxDatagramLength == mexUDP_maxLengths[sockID])
+        return(status);
+    if (maxDatagramLength > MEXUDP_MAX_DATAGRAM_LENGTH) {
+        mexPrintf("max datagram length %d is too long (max of %d)\n",
+                maxDatagramLength, MEXUDP_MAX_DATAGRAM_LENGTH);
+        return(-1);
+    }
+    
+    // a receiver thread needs a new ring for the new length
+    if (mexUDP_receivers[sockID] != NULL) {
+        ringLength = mexUDP_receivers[sockID]->ringLength;
+        mexUDP_stopReceiver(sockID);
+    }
+    
+    mexUDP_maxLengths[sockID] = maxDatagramLength;
+    mexUDP_buffers[sockID] = mxRealloc(mexUDP_buffers[sockID], maxDatagramLength);
+    mexMakeMemoryPersistent(mexUDP_buffers[sockID]);
+    
+    if (ringLength > 0)
+        status = mexUDP_startReceiver(sockID, ringLength);
+    return(status);
+}
+
+int mexUDP_getMaxLength(int sockID) {
+    
+    return(mexUDP_maxLengths[sockID]);
+}
+
+char* mexUDP_getBuffer(int sockID) {
+    
+    return(mexUDP_buffers[sockID]);
+}
+
+int mexUDP_getPeerKey(int sockID) {
+    
+    // hash the socket with whoever it sends to now, which changes on receive
+    const unsigned char *address = (const unsigned char*)&mexUDP_remoteAddresses[sockID]->sin_addr;
+    const unsigned char *port = (const unsigned char*)&mexUDP_remoteAddresses[sockID]->sin_port;
+    unsigned int ii, key = 2166136261U;
+    
+    key = (key ^ (unsigned int)sockID) * 16777619U;
+    for (ii=0; ii<sizeof(struct in_addr); ii++)
+        key = (key ^ address[ii]) * 16777619U;
+    for (ii=0; ii<sizeof(in_port_t); ii++)
+        key = (key ^ port[ii]) * 16777619U;
+    return((int)(key & 0x7fffffff));
+}
+
+int mexUDP_getSocketStats(int sockID, int* receiveBufferBytes, int* sendBufferBytes,
+        int* maxDatagramLength, unsigned int* kernelDrops) {
+    
+    socklen_t optionSize = sizeof(int);
+    
+    *receiveBufferBytes = 0;
+    *sendBufferBytes = 0;
+    getsockopt(mexUDP_sockets[sockID], SOL_SOCKET, SO_RCVBUF, receiveBufferBytes, &optionSize);
+    optionSize = sizeof(int);
+    getsockopt(mexUDP_sockets[sockID], SOL_SOCKET, SO_SNDBUF, sendBufferBytes, &optionSize);
+    *maxDatagramLength = mexUDP_maxLengths[sockID];
+    *kernelDrops = __atomic_load_n(&mexUDP_kernelDrops[sockID], __ATOMIC_RELAXED);
+    return(0);
+}
+
 int mexUDP_send(int sockID, char* message, int messageLength) {
     
     int status;
@@ -103,53 +297,706 @@ int mexUDP_send(int sockID, char* message, int messageLength) {
 
 int mexUDP_check(int sockID, double timeoutSecs) {
     
-    static struct timeval timeout;
-    static fd_set readfds;
+    struct pollfd pollFD;
+    
+    // a receiver thread may already have the data
+    if (mexUDP_receivers[sockID] != NULL)
+        return(mexUDP_waitForPacket(mexUDP_receivers[sockID], timeoutSecs));
+    
+    // check for data at the socket, with optional timeout
+    pollFD.fd = mexUDP_sockets[sockID];
+    pollFD.events = POLLIN;
+    pollFD.revents = 0;
+    poll(&pollFD, 1, mexUDP_getPollMsecs(timeoutSecs));
+    return((pollFD.revents & POLLIN) != 0);
+}
+
+int mexUDP_wait(int sockID, double timeoutSecs) {
+    
+    double deadline = mexUDP_getSeconds() + timeoutSecs, remaining;
+    int status, isForever = timeoutSecs > INT_MAX/1000;
+#ifdef __linux__
+    struct pollfd pollFD;
+    struct timespec timeout;
+#else
+    fd_set readFDs;
+    struct timeval timeout;
+#endif
+    
+    // a receiver thread may already have the data
+    if (mexUDP_receivers[sockID] != NULL)
+        return(mexUDP_check(sockID, timeoutSecs));
+    
+    // sleep in the kernel until data arrives or the deadline passes
+    //  poll() would round the deadline up to whole milliseconds
+    do {
+        remaining = deadline - mexUDP_getSeconds();
+        if (remaining < 0)
+            remaining = 0;
+#ifdef __linux__
+        pollFD.fd = mexUDP_sockets[sockID];
+        pollFD.events = POLLIN;
+        pollFD.revents = 0;
+        timeout.tv_sec = (time_t)remaining;
+        timeout.tv_nsec = (long)(1e9*(remaining - timeout.tv_sec));
+        status = ppoll(&pollFD, 1, isForever ? NULL : &timeout, NULL);
+        if (status > 0)
+            return((pollFD.revents & POLLIN) != 0);
+#else
+        FD_ZERO(&readFDs);
+        FD_SET(mexUDP_sockets[sockID], &readFDs);
+        timeout.tv_sec = (long)remaining;
+        timeout.tv_usec = (long)(1e6*(remaining - timeout.tv_sec));
+        status = select(mexUDP_sockets[sockID]+1, &readFDs, NULL, NULL, isForever ? NULL : &timeout);
+        if (status > 0)
+            return(1);
+#endif
+    } while (status < 0 && errno == EINTR);
+    
+    return(status < 0 ? -1 : 0);
+}
+
+int mexUDP_waitAny(int* sockIDs, int numSockets, double timeoutSecs, int* readyIDs) {
+    
+    static char isRequested[MEXUDP_MAX_NUM_SOCKETS];
+    double deadline = mexUDP_getSeconds() + timeoutSecs;
+    int ii, sockID, numReady, waitMsecs;
+    int hasReceiver = 0;
+    mexUDP_receiver *receiver;
+#ifdef __linux__
+    static struct epoll_event events[MEXUDP_MAX_NUM_SOCKETS];
+    struct epoll_event event;
+    int isWatched, numEvents;
+    
+    if (mexUDP_pollSet < 0) {
+        mexUDP_pollSet = epoll_create1(0);
+        if (mexUDP_pollSet < 0) {
+            mexPrintf("epoll_create1() failed (errno=%d)\n", errno);
+            return(-1);
+        }
+    }
+#else
+    static struct pollfd pollFDs[MEXUDP_MAX_NUM_SOCKETS];
+    static int pollIDs[MEXUDP_MAX_NUM_SOCKETS];
+    int numPollFDs = 0;
+#endif
+    
+    memset(isRequested, 0, sizeof(isRequested));
+    for (ii=0; ii<numSockets; ii++)
+        isRequested[sockIDs[ii]] = 1;
+    
+    for (sockID=0; sockID<mexUDP_numSockets; sockID++) {
+        receiver = mexUDP_receivers[sockID];
+        if (receiver != NULL) {
+            // the thread reads the socket, so watch for its signal instead
+            hasReceiver |= isRequested[sockID];
+            mexUDP_unwatch(sockID);
+#ifdef __linux__
+            if (isRequested[sockID] == receiver->isWakeWatched)
+                continue;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.u32 = sockID;
+            if (epoll_ctl(mexUDP_pollSet, isRequested[sockID] ? EPOLL_CTL_ADD : EPOLL_CTL_DEL,
+                    receiver->wakeFDs[0], &event) == 0)
+                receiver->isWakeWatched = isRequested[sockID];
+#else
+            if (isRequested[sockID]) {
+                pollFDs[numPollFDs].fd = receiver->wakeFDs[0];
+                pollFDs[numPollFDs].events = POLLIN;
+                pollIDs[numPollFDs++] = sockID;
+            }
+#endif
+            continue;
+        }
+#ifdef __linux__
+        // the epoll set persists, so only touch sockets that changed
+        isWatched = isRequested[sockID] && mexUDP_sockets[sockID] >= 0;
+        if (isWatched == mexUDP_isInPollSet[sockID])
+            continue;
+        if (isWatched) {
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.u32 = sockID;
+            if (epoll_ctl(mexUDP_pollSet, EPOLL_CTL_ADD, mexUDP_sockets[sockID], &event) == 0)
+                mexUDP_isInPollSet[sockID] = 1;
+        } else
+            mexUDP_unwatch(sockID);
+#else
+        if (isRequested[sockID] && mexUDP_sockets[sockID] >= 0) {
+            pollFDs[numPollFDs].fd = mexUDP_sockets[sockID];
+            pollFDs[numPollFDs].events = POLLIN;
+            pollIDs[numPollFDs++] = sockID;
+        }
+#endif
+    }
+    
+    while (1) {
+        // receiver threads may already have data
+        numReady = 0;
+        if (hasReceiver) {
+            for (sockID=0; sockID<mexUDP_numSockets; sockID++) {
+                if (isRequested[sockID] && mexUDP_receivers[sockID] != NULL
+                        && mexUDP_hasQueuedPacket(mexUDP_receivers[sockID]))
+                    readyIDs[numReady++] = sockID;
+            }
+        }
+        
+        // receiver threads signal when they queue, so sleep until then
+        //  a signal only means to look at the ring again
+        waitMsecs = numReady > 0 ? 0 : mexUDP_getPollMsecs(deadline - mexUDP_getSeconds());
+        
+#ifdef __linux__
+        numEvents = epoll_wait(mexUDP_pollSet, events, MEXUDP_MAX_NUM_SOCKETS, waitMsecs);
+        for (ii=0; ii<numEvents && numReady<MEXUDP_MAX_NUM_SOCKETS; ii++) {
+            // only report requested sockets
+            sockID = events[ii].data.u32;
+            if (sockID >= mexUDP_numSockets || !isRequested[sockID])
+                continue;
+            if (mexUDP_receivers[sockID] != NULL)
+                mexUDP_clearWakeSignal(mexUDP_receivers[sockID]);
+            else
+                readyIDs[numReady++] = sockID;
+        }
+#else
+        if (poll(pollFDs, numPollFDs, waitMsecs) > 0) {
+            for (ii=0; ii<numPollFDs; ii++) {
+                if (!(pollFDs[ii].revents & POLLIN))
+                    continue;
+                sockID = pollIDs[ii];
+                if (mexUDP_receivers[sockID] != NULL)
+                    mexUDP_clearWakeSignal(mexUDP_receivers[sockID]);
+                else
+                    readyIDs[numReady++] = sockID;
+            }
+        }
+#endif
+        
+        if (numReady > 0 || mexUDP_getSeconds() >= deadline) {
+            qsort(readyIDs, numReady, sizeof(int), mexUDP_compareIDs);
+            return(numReady);
+        }
+    }
+}
+
+int mexUDP_peekLength(int sockID) {
+    
+    mexUDP_receiver *receiver = mexUDP_receivers[sockID];
+    int length = -1;
+    
+    // a receiver thread knows its next packet length
+    if (receiver != NULL) {
+        if (!mexUDP_hasQueuedPacket(receiver))
+            return(-1);
+        return(receiver->packets[receiver->tail & (receiver->ringLength-1)].length);
+    }
+    
+#if defined(__linux__)
+    // MSG_TRUNC reports the whole datagram length
+    length = recv(mexUDP_sockets[sockID], NULL, 0, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+#elif defined(SO_NREAD)
+    // SO_NREAD reports the first datagram length
+    socklen_t optionSize = sizeof(length);
+    if (!mexUDP_check(sockID, 0))
+        return(-1);
+    if (getsockopt(mexUDP_sockets[sockID], SOL_SOCKET, SO_NREAD, &length, &optionSize) < 0)
+        length = mexUDP_maxLengths[sockID];
+#else
+    if (!mexUDP_check(sockID, 0))
+        return(-1);
+    length = mexUDP_maxLengths[sockID];
+#endif
+    
+    // ignore any excess, as for recvfrom()
+    if (length > mexUDP_maxLengths[sockID])
+        length = mexUDP_maxLengths[sockID];
+    return(length);
+}
+
+static int mexUDP_receiveDatagram(int sockID, char* message, int messageLength, double* timestamp,
+        int* isTruncated) {
+    
+    struct msghdr header;
+    struct iovec vector;
+    char control[MEXUDP_CONTROL_LENGTH];
+    int length;
+    
+    *isTruncated = 0;
+    if (mexUDP_receivers[sockID] != NULL)
+        return(mexUDP_dequeuePacket(sockID, message, messageLength, timestamp, isTruncated));
+    
+    memset(&header, 0, sizeof(header));
+    vector.iov_base = message;
+    vector.iov_len = messageLength;
+    header.msg_iov = &vector;
+    header.msg_iovlen = 1;
+    header.msg_name = mexUDP_remoteAddresses[sockID];
+    header.msg_namelen = mexUDP_addressSize;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    
+    length = recvmsg(mexUDP_sockets[sockID], &header, MSG_DONTWAIT);
+    if (length >= 0) {
+        *timestamp = mexUDP_readControl(sockID, &header);
+        *isTruncated = (header.msg_flags & MSG_TRUNC) != 0;
+    }
+    return(length);
+}
+
+int mexUDP_receive(int sockID, char* message, int messageLength, double* timestamp) {
+    
+    int isTruncated;
+    
+    // ignore any excess, as for recvfrom()
+    return(mexUDP_receiveDatagram(sockID, message, messageLength, timestamp, &isTruncated));
+}
+
+int mexUDP_receiveWhole(int sockID, char* message, int messageLength, double* timestamp) {
+    
+    int isTruncated;
+    int length = mexUDP_receiveDatagram(sockID, message, messageLength, timestamp, &isTruncated);
+    
+    // a datagram that didn't fit is consumed, but not returned
+    if (length >= 0 && isTruncated)
+        return(MEXUDP_TRUNCATED_LENGTH);
+    return(length);
+}
+
+int mexUDP_sendBatch(int sockID, char* messages, int* messageLengths, int stride, int numMessages) {
+    
+    int status = 0;
+    int numSent = 0;
+#ifdef __linux__
+    static struct mmsghdr headers[MEXUDP_MAX_BATCH_LENGTH];
+    static struct iovec vectors[MEXUDP_MAX_BATCH_LENGTH];
+    int ii, batchLength;
+    
+    while (numSent < numMessages) {
+        batchLength = numMessages - numSent;
+        if (batchLength > MEXUDP_MAX_BATCH_LENGTH)
+            batchLength = MEXUDP_MAX_BATCH_LENGTH;
+        
+        // each message is one column of the messages matrix
+        memset(headers, 0, batchLength*sizeof(struct mmsghdr));
+        for (ii=0; ii<batchLength; ii++) {
+            vectors[ii].iov_base = messages + (size_t)(numSent+ii)*stride;
+            vectors[ii].iov_len = messageLengths[numSent+ii];
+            headers[ii].msg_hdr.msg_iov = &vectors[ii];
+            headers[ii].msg_hdr.msg_iovlen = 1;
+            headers[ii].msg_hdr.msg_name = mexUDP_remoteAddresses[sockID];
+            headers[ii].msg_hdr.msg_namelen = mexUDP_addressSize;
+        }
+        
+        status = sendmmsg(mexUDP_sockets[sockID], headers, batchLength, MSG_DONTWAIT);
+        if (status <= 0)
+            break;
+        numSent += status;
+    }
+#else
+    for (numSent=0; numSent<numMessages; numSent++) {
+        status = mexUDP_send(sockID, messages + (size_t)numSent*stride, messageLengths[numSent]);
+        if (status < 0)
+            break;
+    }
+#endif
+    
+    // report an error only if nothing went out
+    if (numSent == 0 && status < 0)
+        return(status);
+    return(numSent);
+}
+
+int mexUDP_receiveAll(int sockID, char* messages, int* messageLengths, double* timestamps, int stride, int maxMessages) {
+    
+    int numReceived = 0;
+#ifdef __linux__
+    static struct mmsghdr headers[MEXUDP_MAX_BATCH_LENGTH];
+    static struct iovec vectors[MEXUDP_MAX_BATCH_LENGTH];
+    static struct sockaddr_in senders[MEXUDP_MAX_BATCH_LENGTH];
+    static char controls[MEXUDP_MAX_BATCH_LENGTH][MEXUDP_CONTROL_LENGTH];
+    int ii, batchLength, status, isTruncated;
+    
+    // a receiver thread already has the data and timestamps
+    if (mexUDP_receivers[sockID] != NULL) {
+        for (numReceived=0; numReceived<maxMessages; numReceived++) {
+            messageLengths[numReceived] = mexUDP_dequeuePacket(sockID,
+                    messages + (size_t)numReceived*stride, stride, &timestamps[numReceived],
+                    &isTruncated);
+            if (messageLengths[numReceived] < 0)
+                break;
+        }
+        return(numReceived);
+    }
+    
+    while (numReceived < maxMessages) {
+        batchLength = maxMessages - numReceived;
+        if (batchLength > MEXUDP_MAX_BATCH_LENGTH)
+            batchLength = MEXUDP_MAX_BATCH_LENGTH;
+        
+        // each message goes in one stride of the messages buffer
+        memset(headers, 0, batchLength*sizeof(struct mmsghdr));
+        for (ii=0; ii<batchLength; ii++) {
+            vectors[ii].iov_base = messages + (size_t)(numReceived+ii)*stride;
+            vectors[ii].iov_len = stride;
+            headers[ii].msg_hdr.msg_iov = &vectors[ii];
+            headers[ii].msg_hdr.msg_iovlen = 1;
+            headers[ii].msg_hdr.msg_name = &senders[ii];
+            headers[ii].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            headers[ii].msg_hdr.msg_control = controls[ii];
+            headers[ii].msg_hdr.msg_controllen = MEXUDP_CONTROL_LENGTH;
+        }
+        
+        status = recvmmsg(mexUDP_sockets[sockID], headers, batchLength, MSG_DONTWAIT, NULL);
+        if (status <= 0)
+            break;
+        
+        for (ii=0; ii<status; ii++) {
+            messageLengths[numReceived+ii] = headers[ii].msg_len;
+            timestamps[numReceived+ii] = mexUDP_readControl(sockID, &headers[ii].msg_hdr);
+        }
+        numReceived += status;
+        
+        // like mexUDP_receive, reply to whoever sent last
+        if (mexUDP_remoteAddresses[sockID] != NULL)
+            *mexUDP_remoteAddresses[sockID] = senders[status-1];
+        
+        // a short batch means the socket is empty
+        if (status < batchLength)
+            break;
+    }
+#else
+    int length;
+    for (numReceived=0; numReceived<maxMessages; numReceived++) {
+        length = mexUDP_receive(sockID, messages + (size_t)numReceived*stride,
+                stride, &timestamps[numReceived]);
+        if (length < 0)
+            break;
+        messageLengths[numReceived] = length;
+    }
+#endif
+    return(numReceived);
+}
+
+double mexUDP_getSeconds() {
+    
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return(now.tv_sec + 1e-6*now.tv_usec);
+}
+
+double mexUDP_readControl(int sockID, struct msghdr* header) {
+    
+    struct cmsghdr *control;
+    double arrivalTime = -1;
     
-    // reinitialize optional timeout, default to non-blocking
-    if (timeoutSecs > 0) {
-        double intPart = 0;
-        double fracPart = modf(timeoutSecs, &intPart);
-        timeout.tv_sec = (time_t)intPart;
-        timeout.tv_usec = (suseconds_t)(1e6*fracPart);
+    for (control = CMSG_FIRSTHDR(header); control != NULL; control = CMSG_NXTHDR(header, control)) {
+        if (control->cmsg_level != SOL_SOCKET)
+            continue;
         
-    } else {
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 0;
+        // kernel timestamp, on the same clock as mexUDP_getSeconds()
+#if defined(SCM_TIMESTAMPNS)
+        if (control->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec arrival;
+            memcpy(&arrival, CMSG_DATA(control), sizeof(arrival));
+            arrivalTime = arrival.tv_sec + 1e-9*arrival.tv_nsec;
+        }
+#endif
+#if defined(SCM_TIMESTAMP)
+        if (control->cmsg_type == SCM_TIMESTAMP) {
+            struct timeval arrival;
+            memcpy(&arrival, CMSG_DATA(control), sizeof(arrival));
+            arrivalTime = arrival.tv_sec + 1e-6*arrival.tv_usec;
+        }
+#endif
+        
+        // running count of datagrams the kernel dropped
+#if defined(SO_RXQ_OVFL)
+        if (control->cmsg_type == SO_RXQ_OVFL) {
+            unsigned int kernelDrops;
+            memcpy(&kernelDrops, CMSG_DATA(control), sizeof(kernelDrops));
+            __atomic_store_n(&mexUDP_kernelDrops[sockID], kernelDrops, __ATOMIC_RELAXED);
+        }
+#endif
     }
+    
+    // no timestamp, so the best guess is now
+    if (arrivalTime < 0)
+        arrivalTime = mexUDP_getSeconds();
+    return(arrivalTime);
+}
+
+static void *mexUDP_receiverThread(void *arg) {
+    
+    mexUDP_receiver *receiver = (mexUDP_receiver *)arg;
+    mexUDP_packet *packet;
+    struct pollfd pollFD;
+    struct msghdr header;
+    struct iovec vector;
+    char control[MEXUDP_CONTROL_LENGTH];
+    unsigned int head, tail;
+    int length, numRead, numQueued;
+    char discard;
+#ifdef __linux__
+    uint64_t signal = 1;
+#else
+    char signal = 1;
+#endif
+    
+    pollFD.fd = receiver->socket;
+    pollFD.events = POLLIN;
+    
+    // wake up now and then to see if it's time to stop
+    while (__atomic_load_n(&receiver->isRunning, __ATOMIC_ACQUIRE)) {
+        if (poll(&pollFD, 1, MEXUDP_RECEIVER_POLL_MSECS) <= 0)
+            continue;
+        
+        // drain the socket, a batch at a time
+        numQueued = 0;
+        for (numRead=0; numRead<MEXUDP_MAX_BATCH_LENGTH; numRead++) {
+            head = receiver->head;
+            tail = __atomic_load_n(&receiver->tail, __ATOMIC_ACQUIRE);
             
-    // reinitialize file descriptor
-    FD_ZERO(&readfds);
-    FD_SET(mexUDP_sockets[sockID], &readfds);
+            if (head - tail < receiver->ringLength) {
+                // receive straight into the next free packet
+                packet = &receiver->packets[head & (receiver->ringLength-1)];
+                memset(&header, 0, sizeof(header));
+                vector.iov_base = packet->data;
+                vector.iov_len = receiver->packetLength;
+                header.msg_iov = &vector;
+                header.msg_iovlen = 1;
+                header.msg_name = &packet->sender;
+                header.msg_namelen = sizeof(packet->sender);
+                header.msg_control = control;
+                header.msg_controllen = sizeof(control);
+                length = recvmsg(receiver->socket, &header, MSG_DONTWAIT);
+                if (length < 0)
+                    break;
+                packet->length = length;
+                packet->isTruncated = (header.msg_flags & MSG_TRUNC) != 0;
+                packet->timestamp = mexUDP_readControl(receiver->sockID, &header);
+                __atomic_store_n(&receiver->head, head+1, __ATOMIC_RELEASE);
+                receiver->wasFull = 0;
+                numQueued++;
+                
+            } else {
+                // Matlab is behind, so discard the newest datagram
+                length = recvfrom(receiver->socket, &discard, sizeof(discard),
+                        MSG_DONTWAIT, NULL, NULL);
+                if (length < 0)
+                    break;
+                __atomic_add_fetch(&receiver->numDropped, 1, __ATOMIC_RELAXED);
+                if (!receiver->wasFull)
+                    __atomic_add_fetch(&receiver->numOverruns, 1, __ATOMIC_RELAXED);
+                receiver->wasFull = 1;
+            }
+            __atomic_add_fetch(&receiver->numReceived, 1, __ATOMIC_RELAXED);
+        }
+        
+        // wake Matlab if it's waiting
+        //  a full pipe has already been signalled, so ignore errors
+        if (numQueued > 0)
+            length = write(receiver->wakeFDs[1], &signal, sizeof(signal));
+    }
+    return(NULL);
+}
+
+// consume signals before looking at the ring, so none are missed
+static void mexUDP_clearWakeSignal(mexUDP_receiver *receiver) {
+    
+    char buffer[64];
+    while (read(receiver->wakeFDs[0], buffer, sizeof(buffer)) > 0);
+}
+
+// sleep until the receiver thread queues a packet or the deadline passes
+static int mexUDP_waitForPacket(mexUDP_receiver *receiver, double timeoutSecs) {
+    
+    double deadline = mexUDP_getSeconds() + timeoutSecs, remaining;
+    struct pollfd pollFD;
+#ifdef __linux__
+    struct timespec timeout;
+    int isForever = timeoutSecs > INT_MAX/1000;
+#endif
+    
+    pollFD.fd = receiver->wakeFDs[0];
+    pollFD.events = POLLIN;
+    while (1) {
+        if (mexUDP_hasQueuedPacket(receiver))
+            return(1);
+        mexUDP_clearWakeSignal(receiver);
+        if (mexUDP_hasQueuedPacket(receiver))
+            return(1);
+        
+        remaining = deadline - mexUDP_getSeconds();
+        if (remaining <= 0)
+            return(0);
+        pollFD.revents = 0;
+#ifdef __linux__
+        timeout.tv_sec = (time_t)remaining;
+        timeout.tv_nsec = (long)(1e9*(remaining - timeout.tv_sec));
+        ppoll(&pollFD, 1, isForever ? NULL : &timeout, NULL);
+#else
+        poll(&pollFD, 1, mexUDP_getPollMsecs(remaining));
+#endif
+    }
+}
+
+static int mexUDP_hasQueuedPacket(mexUDP_receiver *receiver) {
     
-    // check for data at the socket
-    select(mexUDP_sockets[sockID]+1, &readfds, NULL, NULL, &timeout);
-    return(FD_ISSET(mexUDP_sockets[sockID], &readfds));
+    return(__atomic_load_n(&receiver->head, __ATOMIC_ACQUIRE) != receiver->tail);
 }
 
-int mexUDP_receive(int sockID, char* message, int messageLength) {
+static int mexUDP_dequeuePacket(int sockID, char* message, int messageLength, double* timestamp,
+        int* isTruncated) {
     
+    mexUDP_receiver *receiver = mexUDP_receivers[sockID];
+    mexUDP_packet *packet;
     int length;
-    length = recvfrom(mexUDP_sockets[sockID],
-            message,
-            messageLength,
-            MSG_DONTWAIT,
-            (struct sockaddr *)mexUDP_remoteAddresses[sockID],
-            (unsigned int *)&mexUDP_addressSize);
+    
+    if (!mexUDP_hasQueuedPacket(receiver))
+        return(-1);
+    
+    // copy out the oldest packet, then give its slot back
+    packet = &receiver->packets[receiver->tail & (receiver->ringLength-1)];
+    length = packet->length < messageLength ? packet->length : messageLength;
+    memcpy(message, packet->data, length);
+    *timestamp = packet->timestamp;
+    *isTruncated = packet->isTruncated || packet->length > messageLength;
+    
+    // like recvfrom(), reply to whoever sent last
+    if (mexUDP_remoteAddresses[sockID] != NULL)
+        *mexUDP_remoteAddresses[sockID] = packet->sender;
+    
+    __atomic_store_n(&receiver->tail, receiver->tail+1, __ATOMIC_RELEASE);
     return(length);
 }
 
+// close the signal descriptors, which also takes them out of the epoll set
+static void mexUDP_closeWakeFDs(mexUDP_receiver *receiver) {
+    
+#ifdef __linux__
+    if (receiver->isWakeWatched)
+        epoll_ctl(mexUDP_pollSet, EPOLL_CTL_DEL, receiver->wakeFDs[0], NULL);
+#endif
+    receiver->isWakeWatched = 0;
+    close(receiver->wakeFDs[0]);
+    if (receiver->wakeFDs[1] != receiver->wakeFDs[0])
+        close(receiver->wakeFDs[1]);
+}
+
+int mexUDP_startReceiver(int sockID, int ringLength) {
+    
+    mexUDP_receiver *receiver;
+    unsigned int roundLength, ii;
+    int status;
+    
+    if (mexUDP_receivers[sockID] != NULL)
+        return(0);
+    
+    // the thread will read the socket, so waitAny() mustn't watch it
+    mexUDP_unwatch(sockID);
+    
+    // ring length must be a power of two
+    if (ringLength <= 0)
+        ringLength = MEXUDP_DEFAULT_RING_LENGTH;
+    if (ringLength > MEXUDP_MAX_RING_LENGTH)
+        ringLength = MEXUDP_MAX_RING_LENGTH;
+    for (roundLength=1; roundLength<(unsigned int)ringLength; roundLength <<= 1);
+    
+    receiver = mxCalloc(1, sizeof(mexUDP_receiver));
+    mexMakeMemoryPersistent(receiver);
+    receiver->packets = mxCalloc(roundLength, sizeof(mexUDP_packet));
+    mexMakeMemoryPersistent(receiver->packets);
+    receiver->packetLength = mexUDP_maxLengths[sockID];
+    receiver->packetData = mxMalloc((size_t)roundLength * receiver->packetLength);
+    mexMakeMemoryPersistent(receiver->packetData);
+    for (ii=0; ii<roundLength; ii++)
+        receiver->packets[ii].data = receiver->packetData + (size_t)ii*receiver->packetLength;
+    receiver->ringLength = roundLength;
+    receiver->sockID = sockID;
+    receiver->socket = mexUDP_sockets[sockID];
+    receiver->isRunning = 1;
+    
+#ifdef __linux__
+    receiver->wakeFDs[0] = receiver->wakeFDs[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    status = receiver->wakeFDs[0] < 0 ? -1 : 0;
+#else
+    status = pipe(receiver->wakeFDs);
+    if (status == 0) {
+        fcntl(receiver->wakeFDs[0], F_SETFL, O_NONBLOCK);
+        fcntl(receiver->wakeFDs[1], F_SETFL, O_NONBLOCK);
+    }
+#endif
+    if (status == 0) {
+        status = pthread_create(&receiver->thread, NULL, mexUDP_receiverThread, receiver);
+        if (status != 0)
+            mexUDP_closeWakeFDs(receiver);
+    }
+    if (status != 0) {
+        mexPrintf("receiver thread failed to start with return %d (errno=%d)\n", status, errno);
+        mxFree(receiver->packetData);
+        mxFree(receiver->packets);
+        mxFree(receiver);
+        return(-1);
+    }
+    mexUDP_receivers[sockID] = receiver;
+    return(0);
+}
+
+int mexUDP_stopReceiver(int sockID) {
+    
+    mexUDP_receiver *receiver = mexUDP_receivers[sockID];
+    
+    if (receiver == NULL)
+        return(0);
+    
+    __atomic_store_n(&receiver->isRunning, 0, __ATOMIC_RELEASE);
+    pthread_join(receiver->thread, NULL);
+    mexUDP_closeWakeFDs(receiver);
+    mxFree(receiver->packetData);
+    mxFree(receiver->packets);
+    mxFree(receiver);
+    mexUDP_receivers[sockID] = NULL;
+    return(0);
+}
+
+int mexUDP_getReceiverStats(int sockID, unsigned int* numReceived, unsigned int* numDropped,
+        unsigned int* numOverruns, unsigned int* numQueued) {
+    
+    mexUDP_receiver *receiver = mexUDP_receivers[sockID];
+    
+    if (receiver == NULL)
+        return(-1);
+    
+    *numReceived = __atomic_load_n(&receiver->numReceived, __ATOMIC_RELAXED);
+    *numDropped = __atomic_load_n(&receiver->numDropped, __ATOMIC_RELAXED);
+    *numOverruns = __atomic_load_n(&receiver->numOverruns, __ATOMIC_RELAXED);
+    *numQueued = __atomic_load_n(&receiver->head, __ATOMIC_ACQUIRE) - receiver->tail;
+    return(0);
+}
+
 int mexUDP_close(int sockID) {
     
     if(mexUDP_sockets[sockID] >=0) {
         //mexPrintf("closing socket %d\n", sockID);
+        mexUDP_stopReceiver(sockID);
+        mexUDP_clearFragmenter(sockID);
+        mexUDP_unwatch(sockID);
         close(mexUDP_sockets[sockID]);
         mexUDP_sockets[sockID]=-1;
         
+        // let the next open reuse this slot
+        mexUDP_removeFromIndex(sockID);
+        mexUDP_freeSockets[mexUDP_numFreeSockets++] = sockID;
+        
         if(mexUDP_remoteAddresses[sockID] != NULL) {
             mxFree(mexUDP_remoteAddresses[sockID]);
             mexUDP_remoteAddresses[sockID] = NULL;
         }
+        
+        if(mexUDP_buffers[sockID] != NULL) {
+            mxFree(mexUDP_buffers[sockID]);
+            mexUDP_buffers[sockID] = NULL;
+        }
     }
     return(0);
 }
@@ -160,9 +1007,15 @@ void mexUDP_closeAll() {
         mexUDP_close(sockID);
     }
     mexUDP_numSockets = 0;
+    mexUDP_clearIndex();
+    
+    if (mexUDP_pollSet >= 0) {
+        close(mexUDP_pollSet);
+        mexUDP_pollSet = -1;
+    }
 }
 
 int mexUDP_isValidSocketIndex(int sock) {
-    int isValid = (sock >=0) && (sock < mexUDP_numSockets);
+    int isValid = (sock >=0) && (sock < mexUDP_numSockets) && (mexUDP_sockets[sock] >= 0);
     return(isValid);
 }
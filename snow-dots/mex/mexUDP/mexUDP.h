@@ -11,6 +11,11 @@
 #ifndef _MEX_UDP_H_
 #define _MEX_UDP_H_
 
+// Linux has sendmmsg() and recvmmsg() for batches of datagrams
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -22,24 +27,202 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sys/time.h>
+#include <poll.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <sys/select.h>
+#endif
+#include <pthread.h>
 #include <math.h>
+#include <limits.h>
 
 #include "mex.h"
 
-// may be platform dependent, roughly the max datagram length
-#define MEXUDP_MAX_DATAGRAM_LENGTH 8192
+// each socket may choose its own max datagram length, up to the
+// largest UDP payload for IPv4
+#define MEXUDP_DEFAULT_DATAGRAM_LENGTH 8192
+#define MEXUDP_MAX_DATAGRAM_LENGTH 65507
+#define MEXUDP_MAX_COMMAND_LENGTH 64
 #define MEXUDP_MAX_NUM_SOCKETS 512
 
+// sockets are indexed by their addresses and ports
+#define MEXUDP_NUM_HASH_BUCKETS 1024
+
+typedef struct {
+    in_addr_t localAddress;
+    in_addr_t remoteAddress;
+    in_port_t localPort;
+    in_port_t remotePort;
+} mexUDP_key;
+
+// how many datagrams to move with one system call
+#define MEXUDP_MAX_BATCH_LENGTH 64
+
+// how many prefixed messages may be in flight at once
+//  less than half the prefixes, so old and new ones can't be confused
+#define MEXUDP_MAX_WINDOW_LENGTH 127
+
+// how many recent prefixes a receiver may ignore
+//  a window of delivered prefixes plus a window of held ones
+#define MEXUDP_MAX_RECENT_LENGTH 256
+
+// room for control messages, like kernel timestamps
+#define MEXUDP_CONTROL_LENGTH 128
+
+// receiver threads queue datagrams in a ring of packets
+#define MEXUDP_DEFAULT_RING_LENGTH 256
+#define MEXUDP_MAX_RING_LENGTH 65536
+#define MEXUDP_RECEIVER_POLL_MSECS 10
+
+// receiveWhole() discards datagrams that didn't fit
+#define MEXUDP_TRUNCATED_LENGTH -2
+
+typedef struct {
+    int length;
+    int isTruncated;
+    double timestamp;
+    struct sockaddr_in sender;
+    char *data;
+} mexUDP_packet;
+
+// single producer, the thread, and single consumer, Matlab
+typedef struct {
+    pthread_t thread;
+    int sockID;
+    int socket;
+    int packetLength;
+    int isRunning;
+    int wasFull;
+    unsigned int ringLength;
+    unsigned int head;
+    unsigned int tail;
+    unsigned int numReceived;
+    unsigned int numDropped;
+    unsigned int numOverruns;
+    mexUDP_packet *packets;
+    char *packetData;
+    
+    // the thread signals after queueing, so Matlab can sleep until then
+    //  an eventfd on Linux, both ends of a pipe elsewhere
+    int wakeFDs[2];
+    int isWakeWatched;
+} mexUDP_receiver;
+
+// fragments carry messages longer than one datagram
+#define MEXUDP_FRAGMENT_MAGIC 0x6d46
+#define MEXUDP_FRAGMENT_HEADER_LENGTH 24
+#define MEXUDP_FRAGMENT_DATA 1
+#define MEXUDP_FRAGMENT_NAK 2
+#define MEXUDP_MAX_MESSAGE_LENGTH (1<<24)
+#define MEXUDP_MAX_NUM_FRAGMENTS 65535
+#define MEXUDP_NUM_SENT_MESSAGES 4
+#define MEXUDP_DEFAULT_NAK_DELAY_SECS 0.002
+
+typedef struct {
+    unsigned int messageID;
+    int length;
+    int fragmentLength;
+    char *data;
+} mexUDP_sentMessage;
+
+typedef struct {
+    // recent messages, kept for retransmission
+    unsigned int nextMessageID;
+    mexUDP_sentMessage sent[MEXUDP_NUM_SENT_MESSAGES];
+    char *datagrams;
+    size_t datagramBytes;
+    int *datagramLengths;
+    int maxDatagrams;
+    unsigned int lastResentID;
+    double lastResendTime;
+    
+    // one message at a time is reassembled
+    int isAssembling;
+    int hasCompleted;
+    unsigned int messageID;
+    unsigned int lastCompleteID;
+    int messageLength;
+    int maxMessageLength;
+    char *message;
+    int fragmentLength;
+    int numFragments;
+    int numFragmentsReceived;
+    char *isFragmentReceived;
+    double lastArrivalTime;
+    double lastNakTime;
+    
+    // options for recovery and testing
+    double nakDelaySecs;
+    double lossRate;
+    unsigned int randomState;
+    
+    unsigned int numFragmentsSent;
+    unsigned int numFragmentsResent;
+    unsigned int numFragmentsLost;
+    unsigned int numNaksSent;
+    unsigned int numNaksReceived;
+    unsigned int numMessagesReceived;
+    unsigned int numMessagesAbandoned;
+    unsigned int numStrays;
+} mexUDP_fragmenter;
+
 static int                  mexUDP_numSockets=0;
 static int                  mexUDP_sockets[MEXUDP_MAX_NUM_SOCKETS];
 static struct sockaddr_in   *mexUDP_remoteAddresses[MEXUDP_MAX_NUM_SOCKETS];
 static int                  mexUDP_addressSize=sizeof(struct sockaddr);
+static mexUDP_receiver      *mexUDP_receivers[MEXUDP_MAX_NUM_SOCKETS];
+static int                  mexUDP_pollSet=-1;
+static char                 mexUDP_isInPollSet[MEXUDP_MAX_NUM_SOCKETS];
+static mexUDP_key           mexUDP_keys[MEXUDP_MAX_NUM_SOCKETS];
+static int                  mexUDP_hashBuckets[MEXUDP_NUM_HASH_BUCKETS];
+static int                  mexUDP_hashNext[MEXUDP_MAX_NUM_SOCKETS];
+static int                  mexUDP_freeSockets[MEXUDP_MAX_NUM_SOCKETS];
+static int                  mexUDP_numFreeSockets=0;
+static char                 *mexUDP_buffers[MEXUDP_MAX_NUM_SOCKETS];
+static int                  mexUDP_maxLengths[MEXUDP_MAX_NUM_SOCKETS];
+static unsigned int         mexUDP_kernelDrops[MEXUDP_MAX_NUM_SOCKETS];
 
 int mexUDP_open(char* localIP, char* remoteIP, int localPort, int remotePort);
 int mexUDP_find(char* localIP, char* remoteIP, int localPort, int remotePort);
+int mexUDP_configure(int sock, int receiveBufferBytes, int sendBufferBytes, int maxDatagramLength);
+int mexUDP_getMaxLength(int sock);
+char* mexUDP_getBuffer(int sock);
+int mexUDP_getSocketStats(int sock, int* receiveBufferBytes, int* sendBufferBytes,
+        int* maxDatagramLength, unsigned int* kernelDrops);
 int mexUDP_send(int sock, char* message, int messageLength);
 int mexUDP_check(int sock, double timeoutSecs);
-int mexUDP_receive(int sock, char* message, int messageLength);
+int mexUDP_wait(int sock, double timeoutSecs);
+int mexUDP_waitAny(int* socks, int numSocks, double timeoutSecs, int* readySocks);
+int mexUDP_peekLength(int sock);
+int mexUDP_receive(int sock, char* message, int messageLength, double* timestamp);
+int mexUDP_receiveWhole(int sock, char* message, int messageLength, double* timestamp);
+int mexUDP_sendBatch(int sock, char* messages, int* messageLengths, int stride, int numMessages);
+int mexUDP_receiveAll(int sock, char* messages, int* messageLengths, double* timestamps, int stride, int maxMessages);
+double mexUDP_getSeconds();
+double mexUDP_readControl(int sock, struct msghdr* header);
+int mexUDP_startReceiver(int sock, int ringLength);
+int mexUDP_stopReceiver(int sock);
+int mexUDP_getReceiverStats(int sock, unsigned int* numReceived, unsigned int* numDropped,
+        unsigned int* numOverruns, unsigned int* numQueued);
+int mexUDP_sendFragmented(int sock, char* message, int messageLength);
+int mexUDP_receiveFragmented(int sock, double timeoutSecs, char** message);
+int mexUDP_setFragmentOptions(int sock, double lossRate, double nakDelaySecs, unsigned int seed);
+mexUDP_fragmenter* mexUDP_getFragmenter(int sock);
+void mexUDP_clearFragmenter(int sock);
+int mexUDP_sendMx(int sock, int prefix, const mxArray* mx, double compressThreshold, int maxBytes, int* gramLength);
+int mexUDP_sendMxAcked(int sock, int prefix, const mxArray* mx, double compressThreshold, int maxBytes,
+        double ackTimeout, int sendRetries, int* gramLength, int* isAcked, double* ackTime);
+int mexUDP_sendAcked(int sock, char* message, int messageLength, double ackTimeout, int sendRetries,
+        int* isAcked, double* ackTime);
+int mexUDP_sendMxWindow(int sock, const int* prefixes, const mxArray** mxs, int numMessages,
+        double compressThreshold, int maxBytes, double ackTimeout, int sendRetries,
+        int* gramLengths, int* isAcked, double* ackTimes);
+int mexUDP_getPeerKey(int sock);
+int mexUDP_receiveMx(int sock, const int* recentPrefixes, int numRecent, double timeoutSecs, mxArray** mx, int* prefix);
+void mexUDP_clearMx();
 int mexUDP_close(int sock);
 void mexUDP_closeAll();
 
@@ -0,0 +1,386 @@
+/* mexUDPFragment.c
+ *
+ * A fragmenting transport for messages longer than one datagram.  Each
+ * fragment starts with a header that has a message ID, the length of the
+ * whole message, the fragment's offset, index, and count, and the length
+ * of every fragment but the last.  Receivers reassemble one message at a
+ * time, and discard fragments that don't fit that layout, or that were
+ * truncated because they were longer than the receiver's datagrams.
+ *
+ * When fragments go missing, the receiver sends back a NAK that lists
+ * them.  The sender keeps its last few messages and resends just the
+ * listed fragments.  Senders only see NAKs when they read from their
+ * sockets, for example with receiveFragmented.  If all the fragments of
+ * a message are lost, the message is lost, like any other datagram.
+ *
+ * For testing, a sender may drop some of its own fragments on purpose.
+ *
+ */
+
+#include "mexUDP.h"
+
+static mexUDP_fragmenter *mexUDP_fragmenters[MEXUDP_MAX_NUM_SOCKETS];
+
+// fragment headers are in network byte order
+static void mexUDP_putShort(unsigned char* bytes, unsigned int value) {
+    bytes[0] = (unsigned char)(value >> 8);
+    bytes[1] = (unsigned char)value;
+}
+
+static void mexUDP_putLong(unsigned char* bytes, unsigned int value) {
+    bytes[0] = (unsigned char)(value >> 24);
+    bytes[1] = (unsigned char)(value >> 16);
+    bytes[2] = (unsigned char)(value >> 8);
+    bytes[3] = (unsigned char)value;
+}
+
+static unsigned int mexUDP_getShort(const unsigned char* bytes) {
+    return((unsigned int)bytes[0] << 8 | bytes[1]);
+}
+
+static unsigned int mexUDP_getLong(const unsigned char* bytes) {
+    return((unsigned int)bytes[0] << 24 | (unsigned int)bytes[1] << 16
+            | (unsigned int)bytes[2] << 8 | bytes[3]);
+}
+
+static void mexUDP_writeFragmentHeader(unsigned char* bytes, int type, unsigned int messageID,
+        int messageLength, int offset, int index, int numFragments, int fragmentLength) {
+    mexUDP_putShort(bytes, MEXUDP_FRAGMENT_MAGIC);
+    bytes[2] = (unsigned char)type;
+    bytes[3] = 0;
+    mexUDP_putLong(bytes + 4, messageID);
+    mexUDP_putLong(bytes + 8, messageLength);
+    mexUDP_putLong(bytes + 12, offset);
+    mexUDP_putShort(bytes + 16, index);
+    mexUDP_putShort(bytes + 18, numFragments);
+    mexUDP_putLong(bytes + 20, fragmentLength);
+}
+
+// xorshift, so that injected losses repeat for a given seed
+static int mexUDP_isInjectedLoss(mexUDP_fragmenter* fragmenter) {
+    
+    unsigned int x = fragmenter->randomState;
+    if (fragmenter->lossRate <= 0)
+        return(0);
+    
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    fragmenter->randomState = x;
+    return(x / 4294967296.0 < fragmenter->lossRate);
+}
+
+static int mexUDP_getNumFragments(int messageLength, int fragmentLength) {
+    
+    if (messageLength == 0)
+        return(1);
+    return((messageLength + fragmentLength - 1) / fragmentLength);
+}
+
+// send all fragments, or just the listed ones
+static int mexUDP_sendFragments(int sockID, mexUDP_fragmenter* fragmenter,
+        mexUDP_sentMessage* sent, int* indexes, int numIndexes) {
+    
+    int ii, index, offset, dataLength;
+    int numDatagrams = 0;
+    int stride = sent->fragmentLength + MEXUDP_FRAGMENT_HEADER_LENGTH;
+    int numFragments = mexUDP_getNumFragments(sent->length, sent->fragmentLength);
+    unsigned char *datagram;
+    
+    if ((size_t)numIndexes * stride > fragmenter->datagramBytes) {
+        fragmenter->datagramBytes = (size_t)numIndexes * stride;
+        fragmenter->datagrams = mxRealloc(fragmenter->datagrams, fragmenter->datagramBytes);
+        mexMakeMemoryPersistent(fragmenter->datagrams);
+    }
+    if (numIndexes > fragmenter->maxDatagrams) {
+        fragmenter->datagramLengths = mxRealloc(fragmenter->datagramLengths, numIndexes * sizeof(int));
+        mexMakeMemoryPersistent(fragmenter->datagramLengths);
+        fragmenter->maxDatagrams = numIndexes;
+    }
+    
+    for (ii=0; ii<numIndexes; ii++) {
+        index = indexes != NULL ? indexes[ii] : ii;
+        if (index >= numFragments)
+            continue;
+        
+        if (mexUDP_isInjectedLoss(fragmenter)) {
+            fragmenter->numFragmentsLost++;
+            continue;
+        }
+        
+        offset = index * sent->fragmentLength;
+        dataLength = sent->length - offset;
+        if (dataLength > sent->fragmentLength)
+            dataLength = sent->fragmentLength;
+        
+        datagram = (unsigned char *)fragmenter->datagrams + (size_t)numDatagrams*stride;
+        mexUDP_writeFragmentHeader(datagram, MEXUDP_FRAGMENT_DATA, sent->messageID,
+                sent->length, offset, index, numFragments, sent->fragmentLength);
+        memcpy(datagram + MEXUDP_FRAGMENT_HEADER_LENGTH, sent->data + offset, dataLength);
+        fragmenter->datagramLengths[numDatagrams++] = MEXUDP_FRAGMENT_HEADER_LENGTH + dataLength;
+    }
+    
+    if (numDatagrams == 0)
+        return(0);
+    return(mexUDP_sendBatch(sockID, fragmenter->datagrams, fragmenter->datagramLengths,
+            stride, numDatagrams));
+}
+
+static void mexUDP_resendFragments(int sockID, mexUDP_fragmenter* fragmenter,
+        unsigned int messageID, const unsigned char* indexBytes, int numIndexes) {
+    
+    mexUDP_sentMessage *sent = &fragmenter->sent[messageID % MEXUDP_NUM_SENT_MESSAGES];
+    int ii, numSent;
+    int *indexes;
+    
+    double now = mexUDP_getSeconds();
+    
+    // the message may be too old to resend
+    if (sent->data == NULL || sent->messageID != messageID || numIndexes <= 0)
+        return;
+    
+    // NAKs pile up while the sender is busy, so answer just one of them
+    if (messageID == fragmenter->lastResentID
+            && now - fragmenter->lastResendTime < fragmenter->nakDelaySecs)
+        return;
+    fragmenter->lastResentID = messageID;
+    fragmenter->lastResendTime = now;
+    
+    indexes = mxMalloc(numIndexes * sizeof(int));
+    for (ii=0; ii<numIndexes; ii++)
+        indexes[ii] = mexUDP_getShort(indexBytes + 2*ii);
+    numSent = mexUDP_sendFragments(sockID, fragmenter, sent, indexes, numIndexes);
+    if (numSent > 0)
+        fragmenter->numFragmentsResent += numSent;
+    mxFree(indexes);
+}
+
+// returns true when the fragment completes its message
+static int mexUDP_addFragment(mexUDP_fragmenter* fragmenter, unsigned int messageID,
+        int messageLength, int offset, int index, int numFragments, int fragmentLength,
+        const char* data, int dataLength, double arrivalTime) {
+    
+    int expectedLength;
+    
+    // ignore leftovers from old messages
+    if (fragmenter->hasCompleted && (int)(messageID - fragmenter->lastCompleteID) <= 0)
+        return(0);
+    if (fragmenter->isAssembling && (int)(messageID - fragmenter->messageID) < 0)
+        return(0);
+    
+    // a newer message replaces any partial one
+    if (!fragmenter->isAssembling || messageID != fragmenter->messageID) {
+        if (messageLength < 0 || messageLength > MEXUDP_MAX_MESSAGE_LENGTH
+                || fragmentLength <= 0 || fragmentLength > MEXUDP_MAX_DATAGRAM_LENGTH
+                || numFragments > MEXUDP_MAX_NUM_FRAGMENTS
+                || numFragments != mexUDP_getNumFragments(messageLength, fragmentLength)) {
+            fragmenter->numStrays++;
+            return(0);
+        }
+        if (fragmenter->isAssembling)
+            fragmenter->numMessagesAbandoned++;
+        
+        if (messageLength > fragmenter->maxMessageLength || fragmenter->message == NULL) {
+            fragmenter->message = mxRealloc(fragmenter->message, messageLength > 0 ? messageLength : 1);
+            mexMakeMemoryPersistent(fragmenter->message);
+            fragmenter->maxMessageLength = messageLength;
+        }
+        fragmenter->isFragmentReceived = mxRealloc(fragmenter->isFragmentReceived, numFragments);
+        mexMakeMemoryPersistent(fragmenter->isFragmentReceived);
+        memset(fragmenter->isFragmentReceived, 0, numFragments);
+        
+        fragmenter->isAssembling = 1;
+        fragmenter->messageID = messageID;
+        fragmenter->messageLength = messageLength;
+        fragmenter->fragmentLength = fragmentLength;
+        fragmenter->numFragments = numFragments;
+        fragmenter->numFragmentsReceived = 0;
+        fragmenter->lastNakTime = 0;
+    }
+    
+    // each fragment has a fixed place and length in the message
+    if (messageLength != fragmenter->messageLength || numFragments != fragmenter->numFragments
+            || fragmentLength != fragmenter->fragmentLength || index >= numFragments
+            || offset != index * fragmentLength) {
+        fragmenter->numStrays++;
+        return(0);
+    }
+    expectedLength = messageLength - offset;
+    if (expectedLength > fragmentLength)
+        expectedLength = fragmentLength;
+    if (dataLength != expectedLength) {
+        fragmenter->numStrays++;
+        return(0);
+    }
+    
+    fragmenter->lastArrivalTime = arrivalTime;
+    if (fragmenter->isFragmentReceived[index])
+        return(0);
+    
+    memcpy(fragmenter->message + offset, data, dataLength);
+    fragmenter->isFragmentReceived[index] = 1;
+    fragmenter->numFragmentsReceived++;
+    if (fragmenter->numFragmentsReceived < numFragments)
+        return(0);
+    
+    fragmenter->isAssembling = 0;
+    fragmenter->hasCompleted = 1;
+    fragmenter->lastCompleteID = messageID;
+    fragmenter->numMessagesReceived++;
+    return(1);
+}
+
+// ask for missing fragments, once arrivals have paused for a moment
+static void mexUDP_sendNak(int sockID, mexUDP_fragmenter* fragmenter) {
+    
+    unsigned char *datagram = (unsigned char *)mexUDP_getBuffer(sockID);
+    int maxIndexes = (mexUDP_getMaxLength(sockID) - MEXUDP_FRAGMENT_HEADER_LENGTH) / 2;
+    int ii, numMissing = 0;
+    double now = mexUDP_getSeconds();
+    
+    if (!fragmenter->isAssembling
+            || now - fragmenter->lastArrivalTime < fragmenter->nakDelaySecs
+            || now - fragmenter->lastNakTime < fragmenter->nakDelaySecs)
+        return;
+    
+    for (ii=0; ii<fragmenter->numFragments && numMissing<maxIndexes; ii++) {
+        if (!fragmenter->isFragmentReceived[ii])
+            mexUDP_putShort(datagram + MEXUDP_FRAGMENT_HEADER_LENGTH + 2*numMissing++, ii);
+    }
+    mexUDP_writeFragmentHeader(datagram, MEXUDP_FRAGMENT_NAK, fragmenter->messageID,
+            0, 0, 0, numMissing, 0);
+    mexUDP_send(sockID, (char *)datagram, MEXUDP_FRAGMENT_HEADER_LENGTH + 2*numMissing);
+    fragmenter->lastNakTime = now;
+    fragmenter->numNaksSent++;
+}
+
+int mexUDP_sendFragmented(int sockID, char* message, int messageLength) {
+    
+    mexUDP_fragmenter *fragmenter = mexUDP_getFragmenter(sockID);
+    mexUDP_sentMessage *sent;
+    int fragmentLength = mexUDP_getMaxLength(sockID) - MEXUDP_FRAGMENT_HEADER_LENGTH;
+    int numFragments, numSent;
+    
+    if (messageLength < 0 || messageLength > MEXUDP_MAX_MESSAGE_LENGTH)
+        return(-1);
+    numFragments = mexUDP_getNumFragments(messageLength, fragmentLength);
+    if (numFragments > MEXUDP_MAX_NUM_FRAGMENTS)
+        return(-1);
+    
+    // keep a copy in place of the oldest message
+    sent = &fragmenter->sent[fragmenter->nextMessageID % MEXUDP_NUM_SENT_MESSAGES];
+    sent->data = mxRealloc(sent->data, messageLength > 0 ? messageLength : 1);
+    mexMakeMemoryPersistent(sent->data);
+    memcpy(sent->data, message, messageLength);
+    sent->length = messageLength;
+    sent->fragmentLength = fragmentLength;
+    sent->messageID = fragmenter->nextMessageID++;
+    
+    numSent = mexUDP_sendFragments(sockID, fragmenter, sent, NULL, numFragments);
+    if (numSent > 0)
+        fragmenter->numFragmentsSent += numSent;
+    return(numSent);
+}
+
+int mexUDP_receiveFragmented(int sockID, double timeoutSecs, char** message) {
+    
+    mexUDP_fragmenter *fragmenter = mexUDP_getFragmenter(sockID);
+    char *buffer = mexUDP_getBuffer(sockID);
+    unsigned char *bytes = (unsigned char *)buffer;
+    int maxLength = mexUDP_getMaxLength(sockID);
+    int length, numIndexes;
+    double arrivalTime, waitSecs;
+    double deadline = mexUDP_getSeconds() + timeoutSecs;
+    
+    while (1) {
+        // sort out everything that has arrived
+        //  truncated datagrams are strays, too
+        while ((length = mexUDP_receiveWhole(sockID, buffer, maxLength, &arrivalTime)) >= 0
+                || length == MEXUDP_TRUNCATED_LENGTH) {
+            if (length < MEXUDP_FRAGMENT_HEADER_LENGTH
+                    || mexUDP_getShort(bytes) != MEXUDP_FRAGMENT_MAGIC) {
+                fragmenter->numStrays++;
+                continue;
+            }
+            
+            if (bytes[2] == MEXUDP_FRAGMENT_DATA) {
+                if (mexUDP_addFragment(fragmenter, mexUDP_getLong(bytes + 4),
+                        (int)mexUDP_getLong(bytes + 8), (int)mexUDP_getLong(bytes + 12),
+                        mexUDP_getShort(bytes + 16), mexUDP_getShort(bytes + 18),
+                        (int)mexUDP_getLong(bytes + 20), buffer + MEXUDP_FRAGMENT_HEADER_LENGTH,
+                        length - MEXUDP_FRAGMENT_HEADER_LENGTH, arrivalTime)) {
+                    *message = fragmenter->message;
+                    return(fragmenter->messageLength);
+                }
+                
+            } else if (bytes[2] == MEXUDP_FRAGMENT_NAK) {
+                fragmenter->numNaksReceived++;
+                numIndexes = mexUDP_getShort(bytes + 18);
+                if (numIndexes > (length - MEXUDP_FRAGMENT_HEADER_LENGTH) / 2)
+                    numIndexes = (length - MEXUDP_FRAGMENT_HEADER_LENGTH) / 2;
+                mexUDP_resendFragments(sockID, fragmenter, mexUDP_getLong(bytes + 4),
+                        bytes + MEXUDP_FRAGMENT_HEADER_LENGTH, numIndexes);
+                
+            } else
+                fragmenter->numStrays++;
+        }
+        
+        mexUDP_sendNak(sockID, fragmenter);
+        
+        // wait for more, waking up in time for the next NAK
+        waitSecs = deadline - mexUDP_getSeconds();
+        if (waitSecs <= 0)
+            return(-1);
+        if (fragmenter->isAssembling && waitSecs > fragmenter->nakDelaySecs)
+            waitSecs = fragmenter->nakDelaySecs;
+        mexUDP_check(sockID, waitSecs);
+    }
+}
+
+int mexUDP_setFragmentOptions(int sockID, double lossRate, double nakDelaySecs, unsigned int seed) {
+    
+    mexUDP_fragmenter *fragmenter = mexUDP_getFragmenter(sockID);
+    
+    fragmenter->lossRate = lossRate < 0 ? 0 : (lossRate > 1 ? 1 : lossRate);
+    fragmenter->nakDelaySecs = nakDelaySecs > 0 ? nakDelaySecs : MEXUDP_DEFAULT_NAK_DELAY_SECS;
+    if (seed != 0)
+        fragmenter->randomState = seed;
+    return(0);
+}
+
+mexUDP_fragmenter* mexUDP_getFragmenter(int sockID) {
+    
+    mexUDP_fragmenter *fragmenter = mexUDP_fragmenters[sockID];
+    
+    if (fragmenter == NULL) {
+        fragmenter = mxCalloc(1, sizeof(mexUDP_fragmenter));
+        mexMakeMemoryPersistent(fragmenter);
+        fragmenter->nakDelaySecs = MEXUDP_DEFAULT_NAK_DELAY_SECS;
+        fragmenter->randomState = 1;
+        mexUDP_fragmenters[sockID] = fragmenter;
+    }
+    return(fragmenter);
+}
+
+void mexUDP_clearFragmenter(int sockID) {
+    
+    mexUDP_fragmenter *fragmenter = mexUDP_fragmenters[sockID];
+    int ii;
+    
+    if (fragmenter == NULL)
+        return;
+    
+    for (ii=0; ii<MEXUDP_NUM_SENT_MESSAGES; ii++)
+        if (fragmenter->sent[ii].data != NULL)
+            mxFree(fragmenter->sent[ii].data);
+    if (fragmenter->datagrams != NULL)
+        mxFree(fragmenter->datagrams);
+    if (fragmenter->datagramLengths != NULL)
+        mxFree(fragmenter->datagramLengths);
+    if (fragmenter->message != NULL)
+        mxFree(fragmenter->message);
+    if (fragmenter->isFragmentReceived != NULL)
+        mxFree(fragmenter->isFragmentReceived);
+    mxFree(fragmenter);
+    mexUDP_fragmenters[sockID] = NULL;
+}
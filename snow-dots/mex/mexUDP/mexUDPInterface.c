@@ -11,25 +11,60 @@
 
 #include "mexUDP.h"
 
+// numeric field of an options struct, or 0 if missing
+static int getOption(const mxArray *options, const char *name) {
+    mxArray *field;
+    if (options == NULL || !mxIsStruct(options))
+        return(0);
+    field = mxGetField(options, 0, name);
+    if (field == NULL || !mxIsNumeric(field) || mxIsEmpty(field))
+        return(0);
+    return((int)mxGetScalar(field));
+}
+
+// message prefixes from a double or uint8 array, up to max
+static int getPrefixes(const mxArray *array, int *prefixes, int max) {
+    int ii, n;
+    if (array == NULL || !(mxIsDouble(array) || mxIsUint8(array)))
+        return(0);
+    n = mxGetNumberOfElements(array);
+    if (n > max)
+        n = max;
+    for (ii=0; ii<n; ii++) {
+        if (mxIsDouble(array))
+            prefixes[ii] = (int)mxGetPr(array)[ii];
+        else
+            prefixes[ii] = ((unsigned char*)mxGetData(array))[ii];
+    }
+    return(n);
+}
+
+// free sockets and mxGram caches when Matlab clears this function
+static void mexUDP_exit(void) {
+    mexUDP_closeAll();
+    mexUDP_clearMx();
+}
+
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     
     int status = 0;
     int nBytes = 0;
-    static char bigByteBuffer[MEXUDP_MAX_DATAGRAM_LENGTH];
+    static char command[MEXUDP_MAX_COMMAND_LENGTH];
+    char* buffer;
     void* mxData;
     
     // First argument should be a command string
     if(nrhs >= 1 && mxIsChar(prhs[0]) && mxGetM(prhs[0])==1) {
-        mxGetString(prhs[0], bigByteBuffer, sizeof(bigByteBuffer));
+        mxGetString(prhs[0], command, sizeof(command));
         
         // second argument may be a socketID;
         int sockID = -1;
         if(nrhs>=2 && mxIsNumeric(prhs[1]))
             sockID = (int)mxGetScalar(prhs[1]);
         
-        if(!strcmp(bigByteBuffer, "open")) {
+        if(!strcmp(command, "open")) {
             
-            mexAtExit(mexUDP_closeAll);
+            mexAtExit(mexUDP_exit);
             
             //  IP address args are short strings
             //  PORT args are numbers.
@@ -42,16 +77,34 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
                 
                 // remote port is optional
                 int remotePort;
-                if(nrhs==5 && mxIsNumeric(prhs[4]))
+                if(nrhs>=5 && mxIsNumeric(prhs[4]) && !mxIsEmpty(prhs[4]))
                     remotePort = (int)mxGetScalar(prhs[4]);
                 else
                     remotePort = localPort;
                 
-                // try to reuse an existing, matching socket
-                status = mexUDP_find(localIP, remoteIP, localPort, remotePort);
+                // options struct is optional
+                const mxArray *options = nrhs>=6 ? prhs[5] : NULL;
+                int maxDatagramLength = getOption(options, "maxDatagramBytes");
                 
-                if(status < 0)
-                    status = mexUDP_open(localIP, remoteIP, localPort, remotePort);
+                if(maxDatagramLength <= MEXUDP_MAX_DATAGRAM_LENGTH) {
+                    
+                    // try to reuse an existing, matching socket
+                    status = mexUDP_find(localIP, remoteIP, localPort, remotePort);
+                    
+                    if(status < 0)
+                        status = mexUDP_open(localIP, remoteIP, localPort, remotePort);
+                    
+                    if(status >= 0 && options != NULL)
+                        mexUDP_configure(status,
+                                getOption(options, "receiveBufferBytes"),
+                                getOption(options, "sendBufferBytes"),
+                                maxDatagramLength);
+                    
+                } else {
+                    mexPrintf("max datagram length is too long (%d, max of %d)\n",
+                            maxDatagramLength, MEXUDP_MAX_DATAGRAM_LENGTH);
+                    status = -15;
+                }
                 
                 //mexPrintf("mexUDP opened socket %d: %s:%d - %s:%d\n",
                 //        status, localIP, localPort, remoteIP, remotePort);
@@ -62,20 +115,20 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
             } else
                 status = -10;
             
-        } else if(!strcmp(bigByteBuffer, "sendBytes")) {
+        } else if(!strcmp(command, "sendBytes")) {
             
             if (mexUDP_isValidSocketIndex(sockID)) {
                 
                 // treat input as packed bytes, like uint8
                 if(nrhs==3) {
                     nBytes = mxGetM(prhs[2]) * mxGetN(prhs[2]) * mxGetElementSize(prhs[2]);
-                    if (nBytes <= sizeof(bigByteBuffer)) {
+                    if (nBytes <= mexUDP_getMaxLength(sockID)) {
+                        // send straight from the input
                         mxData = mxGetData(prhs[2]);
-                        memcpy(bigByteBuffer, mxData, nBytes);
-                        status = mexUDP_send(sockID, bigByteBuffer, nBytes);
+                        status = mexUDP_send(sockID, mxData, nBytes);
                         
                     } else {
-                        mexPrintf("input is too long to send (%d, max of %d)\n", nBytes, sizeof(bigByteBuffer));
+                        mexPrintf("input is too long to send (%d, max of %d)\n", nBytes, mexUDP_getMaxLength(sockID));
                         status = -20;
                     }
                     
@@ -85,7 +138,137 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
             } else
                 status = -40;
 
-        } else if(!strcmp(bigByteBuffer, "check")) {
+        } else if(!strcmp(command, "sendMx")) {
+            
+            // prefix byte and variable, with optional compressThreshold and maxBytes
+            int gramLength = -1;
+            if (mexUDP_isValidSocketIndex(sockID)) {
+                
+                if(nrhs>=4 && mxIsNumeric(prhs[2]) && !mxIsEmpty(prhs[2])) {
+                    double compressThreshold = mxGetInf();
+                    int maxBytes = mexUDP_getMaxLength(sockID);
+                    if(nrhs>=5 && mxIsNumeric(prhs[4]) && !mxIsEmpty(prhs[4]))
+                        compressThreshold = mxGetScalar(prhs[4]);
+                    if(nrhs>=6 && mxIsNumeric(prhs[5]) && !mxIsEmpty(prhs[5]))
+                        maxBytes = (int)mxGetScalar(prhs[5]);
+                    status = mexUDP_sendMx(sockID, (int)mxGetScalar(prhs[2]), prhs[3],
+                            compressThreshold, maxBytes, &gramLength);
+                    
+                } else
+                    status = -230;
+                
+            } else
+                status = -240;
+            
+            // optional serialized length, even if too large to send
+            if(nlhs >= 2)
+                plhs[1] = mxCreateDoubleScalar(gramLength);
+            
+        } else if(!strcmp(command, "sendAcked") || !strcmp(command, "sendMxAcked")) {
+            
+            // message, ackTimeout, and sendRetries
+            //  bytes start with their own prefix, variables get the given prefix
+            int isMx = !strcmp(command, "sendMxAcked");
+            int gramLength = -1, isAcked = 0;
+            double ackTime = 0;
+            if (mexUDP_isValidSocketIndex(sockID)) {
+                
+                int nArgs = isMx ? 6 : 5;
+                if(nrhs>=nArgs && mxIsNumeric(prhs[nArgs-2]) && mxIsNumeric(prhs[nArgs-1])) {
+                    double ackTimeout = mxGetScalar(prhs[nArgs-2]);
+                    int sendRetries = (int)mxGetScalar(prhs[nArgs-1]);
+                    
+                    if(isMx && mxIsNumeric(prhs[2]) && !mxIsEmpty(prhs[2])) {
+                        double compressThreshold = mxGetInf();
+                        int maxBytes = mexUDP_getMaxLength(sockID);
+                        if(nrhs>=7 && mxIsNumeric(prhs[6]) && !mxIsEmpty(prhs[6]))
+                            compressThreshold = mxGetScalar(prhs[6]);
+                        if(nrhs>=8 && mxIsNumeric(prhs[7]) && !mxIsEmpty(prhs[7]))
+                            maxBytes = (int)mxGetScalar(prhs[7]);
+                        status = mexUDP_sendMxAcked(sockID, (int)mxGetScalar(prhs[2]), prhs[3],
+                                compressThreshold, maxBytes, ackTimeout, sendRetries,
+                                &gramLength, &isAcked, &ackTime);
+                        
+                    } else if(!isMx) {
+                        // treat input as packed bytes, like uint8
+                        nBytes = mxGetM(prhs[2]) * mxGetN(prhs[2]) * mxGetElementSize(prhs[2]);
+                        if (nBytes > 0 && nBytes <= mexUDP_getMaxLength(sockID))
+                            status = mexUDP_sendAcked(sockID, mxGetData(prhs[2]), nBytes,
+                                    ackTimeout, sendRetries, &isAcked, &ackTime);
+                        else
+                            status = -220;
+                        
+                    } else
+                        status = -230;
+                    
+                } else
+                    status = -230;
+                
+            } else
+                status = -240;
+            
+            // whether and when the ack code arrived
+            if(nlhs >= 2)
+                plhs[1] = mxCreateLogicalScalar(isAcked);
+            if(nlhs >= 3)
+                plhs[2] = mxCreateDoubleScalar(ackTime);
+            if(nlhs >= 4)
+                plhs[3] = mxCreateDoubleScalar(gramLength);
+            
+        } else if(!strcmp(command, "sendMxWindow")) {
+            
+            // prefixes and a cell array of variables, one for each prefix
+            //  with ackTimeout and sendRetries, like sendMxAcked
+            int ii, numMessages = -1;
+            int prefixes[MEXUDP_MAX_WINDOW_LENGTH], gramLengths[MEXUDP_MAX_WINDOW_LENGTH];
+            int isAcked[MEXUDP_MAX_WINDOW_LENGTH];
+            double ackTimes[MEXUDP_MAX_WINDOW_LENGTH];
+            const mxArray *mxs[MEXUDP_MAX_WINDOW_LENGTH];
+            if (mexUDP_isValidSocketIndex(sockID)) {
+                
+                if(nrhs>=6 && mxIsCell(prhs[3]) && mxIsNumeric(prhs[4]) && mxIsNumeric(prhs[5])
+                && mxGetNumberOfElements(prhs[3]) <= MEXUDP_MAX_WINDOW_LENGTH
+                && getPrefixes(prhs[2], prefixes, MEXUDP_MAX_WINDOW_LENGTH) == mxGetNumberOfElements(prhs[3])) {
+                    double compressThreshold = mxGetInf();
+                    int maxBytes = mexUDP_getMaxLength(sockID);
+                    if(nrhs>=7 && mxIsNumeric(prhs[6]) && !mxIsEmpty(prhs[6]))
+                        compressThreshold = mxGetScalar(prhs[6]);
+                    if(nrhs>=8 && mxIsNumeric(prhs[7]) && !mxIsEmpty(prhs[7]))
+                        maxBytes = (int)mxGetScalar(prhs[7]);
+                    
+                    numMessages = mxGetNumberOfElements(prhs[3]);
+                    for(ii=0; ii<numMessages; ii++)
+                        mxs[ii] = mxGetCell(prhs[3], ii);
+                    status = mexUDP_sendMxWindow(sockID, prefixes, mxs, numMessages,
+                            compressThreshold, maxBytes, mxGetScalar(prhs[4]), (int)mxGetScalar(prhs[5]),
+                            gramLengths, isAcked, ackTimes);
+                    
+                } else
+                    status = -290;
+                
+            } else
+                status = -300;
+            
+            // which acks arrived and when, and serialized lengths
+            if(numMessages < 0)
+                numMessages = 0;
+            if(nlhs >= 2) {
+                plhs[1] = mxCreateLogicalMatrix(1, numMessages);
+                for(ii=0; ii<numMessages; ii++)
+                    mxGetLogicals(plhs[1])[ii] = isAcked[ii];
+            }
+            if(nlhs >= 3) {
+                plhs[2] = mxCreateDoubleMatrix(1, numMessages, mxREAL);
+                for(ii=0; ii<numMessages; ii++)
+                    mxGetPr(plhs[2])[ii] = ackTimes[ii];
+            }
+            if(nlhs >= 4) {
+                plhs[3] = mxCreateDoubleMatrix(1, numMessages, mxREAL);
+                for(ii=0; ii<numMessages; ii++)
+                    mxGetPr(plhs[3])[ii] = gramLengths[ii];
+            }
+            
+        } else if(!strcmp(command, "check")) {
             
             // optional timeout seconds, default to 0
             double timeoutSecs = 0;
@@ -97,53 +280,400 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
             else
                 status = -50;
             
-        } else if(!strcmp(bigByteBuffer, "receiveBytes")) {
+        } else if(!strcmp(command, "wait")) {
+            
+            // block until data or the timeout, to the microsecond
+            double timeoutSecs = 0;
+            if(nrhs==3)
+                timeoutSecs = mxGetScalar(prhs[2]);
+            
+            if (mexUDP_isValidSocketIndex(sockID))
+                status = mexUDP_wait(sockID, timeoutSecs);
+            else
+                status = -310;
+            
+        } else if(!strcmp(command, "peerKey")) {
+            
+            // who the socket sends to now, for keeping schema layouts apart
+            if (mexUDP_isValidSocketIndex(sockID))
+                status = mexUDP_getPeerKey(sockID);
+            else
+                status = -320;
+            
+        } else if(!strcmp(command, "waitAny")) {
+            
+            // first arg is an array of socket ids, not a scalar
+            int ii, numSockets, numReady;
+            int sockIDs[MEXUDP_MAX_NUM_SOCKETS], readyIDs[MEXUDP_MAX_NUM_SOCKETS];
+            numSockets = nrhs>=2 && mxIsDouble(prhs[1]) ? mxGetNumberOfElements(prhs[1]) : -1;
+            status = numSockets >= 0 && numSockets <= MEXUDP_MAX_NUM_SOCKETS ? 0 : -140;
+            for(ii=0; ii<numSockets && status==0; ii++) {
+                sockIDs[ii] = (int)mxGetPr(prhs[1])[ii];
+                if (!mexUDP_isValidSocketIndex(sockIDs[ii]))
+                    status = -140;
+            }
+            
+            // optional timeout seconds, default to 0
+            double timeoutSecs = 0;
+            if(nrhs==3)
+                timeoutSecs = mxGetScalar(prhs[2]);
+            
+            if(status == 0) {
+                numReady = mexUDP_waitAny(sockIDs, numSockets, timeoutSecs, readyIDs);
+                if(numReady >= 0) {
+                    plhs[0] = mxCreateDoubleMatrix(1, numReady, mxREAL);
+                    for(ii=0; ii<numReady; ii++)
+                        mxGetPr(plhs[0])[ii] = readyIDs[ii];
+                    return;
+                    
+                } else
+                    status = numReady;
+            }
+            
+        } else if(!strcmp(command, "receiveBytes")) {
+            
+            if (mexUDP_isValidSocketIndex(sockID)) {
+                
+                // size the output for the next datagram, then receive straight into it
+                double arrivalTime;
+                plhs[0] = mxCreateNumericMatrix(0, 0, mxUINT8_CLASS, mxREAL);
+                nBytes = mexUDP_peekLength(sockID);
+                if(nBytes >= 0) {
+                    mxData = mxMalloc(nBytes > 0 ? nBytes : 1);
+                    nBytes = mexUDP_receive(sockID, mxData, nBytes, &arrivalTime);
+                    if(nBytes > 0) {
+                        // treat data as individual bytes, uint8
+                        mxSetData(plhs[0], mxData);
+                        mxSetM(plhs[0], 1);
+                        mxSetN(plhs[0], nBytes);
+                        
+                    } else
+                        mxFree(mxData);
+                }
+                
+                // optional kernel arrival time
+                if(nlhs >= 2) {
+                    if(nBytes > 0)
+                        plhs[1] = mxCreateDoubleScalar(arrivalTime);
+                    else
+                        plhs[1] = mxCreateDoubleMatrix(0, 0, mxREAL);
+                }
+                
+                return;
+                
+            } else
+                status = -60;
+            
+        } else if(!strcmp(command, "receiveMx")) {
             
             if (mexUDP_isValidSocketIndex(sockID)) {
                 
-                nBytes = mexUDP_receive(sockID, bigByteBuffer, sizeof(bigByteBuffer));
-                if(nBytes > 0) {
-                    // treat data as individual bytes, uint8
+                // optional recent prefixes to ignore, and timeout seconds
+                int recentPrefixes[MEXUDP_MAX_RECENT_LENGTH], numRecent = 0, prefix;
+                double timeoutSecs = 0;
+                mxArray *mx;
+                if(nrhs>=3)
+                    numRecent = getPrefixes(prhs[2], recentPrefixes, MEXUDP_MAX_RECENT_LENGTH);
+                if(nrhs>=4)
+                    timeoutSecs = mxGetScalar(prhs[3]);
+                
+                status = mexUDP_receiveMx(sockID, recentPrefixes, numRecent, timeoutSecs, &mx, &prefix);
+                plhs[0] = mx != NULL ? mx : mxCreateDoubleMatrix(0, 0, mxREAL);
+                if(nlhs >= 2)
+                    plhs[1] = mxCreateDoubleScalar(status);
+                if(nlhs >= 3) {
+                    if(prefix >= 0)
+                        plhs[2] = mxCreateDoubleScalar(prefix);
+                    else
+                        plhs[2] = mxCreateDoubleMatrix(0, 0, mxREAL);
+                }
+                return;
+                
+            } else
+                status = -270;
+            
+        } else if(!strcmp(command, "sendBytesBatch")) {
+            
+            if (mexUDP_isValidSocketIndex(sockID)) {
+                
+                // each column of input is one message, of packed bytes
+                if(nrhs>=3) {
+                    int ii;
+                    int stride = mxGetM(prhs[2]) * mxGetElementSize(prhs[2]);
+                    int numMessages = mxGetN(prhs[2]);
+                    int *lengths = mxMalloc((numMessages+1) * sizeof(int));
+                    
+                    // optional lengths, default to whole columns
+                    status = 0;
+                    for(ii=0; ii<numMessages; ii++) {
+                        if(nrhs==4 && mxIsDouble(prhs[3])
+                                && mxGetNumberOfElements(prhs[3])==numMessages)
+                            lengths[ii] = (int)mxGetPr(prhs[3])[ii];
+                        else
+                            lengths[ii] = stride;
+                        
+                        if(lengths[ii] < 0 || lengths[ii] > stride
+                                || lengths[ii] > mexUDP_getMaxLength(sockID)) {
+                            mexPrintf("input %d is too long to send (%d, max of %d)\n",
+                                    ii+1, lengths[ii], mexUDP_getMaxLength(sockID));
+                            status = -70;
+                            break;
+                        }
+                    }
+                    
+                    if(status == 0)
+                        status = mexUDP_sendBatch(sockID, mxGetData(prhs[2]), lengths, stride, numMessages);
+                    mxFree(lengths);
+                    
+                } else
+                    status = -80;
+                
+            } else
+                status = -90;
+            
+        } else if(!strcmp(command, "receiveAll")) {
+            
+            if (mexUDP_isValidSocketIndex(sockID)) {
+                
+                // optional max count, default to one batch
+                int maxMessages = MEXUDP_MAX_BATCH_LENGTH;
+                if(nrhs==3)
+                    maxMessages = (int)mxGetScalar(prhs[2]);
+                if(maxMessages < 0)
+                    maxMessages = 0;
+                
+                int ii, numMessages, maxLength = 0;
+                int stride = mexUDP_getMaxLength(sockID);
+                int *lengths = mxMalloc((maxMessages+1) * sizeof(int));
+                double *timestamps = mxMalloc((maxMessages+1) * sizeof(double));
+                char *messages = mxMalloc((size_t)(maxMessages+1) * stride);
+                numMessages = mexUDP_receiveAll(sockID, messages, lengths, timestamps,
+                        stride, maxMessages);
+                for(ii=0; ii<numMessages; ii++)
+                    if(lengths[ii] > maxLength)
+                        maxLength = lengths[ii];
+                
+                // one column per message, padded with zeros to the longest
+                //  squeeze columns together in place, then hand them over
+                plhs[0] = mxCreateNumericMatrix(0, 0, mxUINT8_CLASS, mxREAL);
+                if(numMessages > 0 && maxLength > 0) {
+                    for(ii=0; ii<numMessages; ii++) {
+                        memmove(messages + (size_t)ii*maxLength,
+                                messages + (size_t)ii*stride, lengths[ii]);
+                        memset(messages + (size_t)ii*maxLength + lengths[ii], 0, maxLength - lengths[ii]);
+                    }
+                    mxSetData(plhs[0], mxRealloc(messages, (size_t)maxLength*numMessages));
+                    mxSetM(plhs[0], maxLength);
+                    mxSetN(plhs[0], numMessages);
+                    
+                } else {
+                    mxSetN(plhs[0], numMessages);
+                    mxFree(messages);
+                }
+                
+                // optional byte counts and receive times for each message
+                if(nlhs >= 2) {
+                    plhs[1] = mxCreateDoubleMatrix(1, numMessages, mxREAL);
+                    for(ii=0; ii<numMessages; ii++)
+                        mxGetPr(plhs[1])[ii] = lengths[ii];
+                }
+                if(nlhs >= 3) {
+                    plhs[2] = mxCreateDoubleMatrix(1, numMessages, mxREAL);
+                    memcpy(mxGetPr(plhs[2]), timestamps, numMessages*sizeof(double));
+                }
+                
+                mxFree(lengths);
+                mxFree(timestamps);
+                return;
+                
+            } else
+                status = -100;
+            
+        } else if(!strcmp(command, "startReceiver")) {
+            
+            // optional ring length, default to a few hundred packets
+            int ringLength = 0;
+            if(nrhs==3)
+                ringLength = (int)mxGetScalar(prhs[2]);
+            
+            if (mexUDP_isValidSocketIndex(sockID))
+                status = mexUDP_startReceiver(sockID, ringLength);
+            else
+                status = -110;
+            
+        } else if(!strcmp(command, "stopReceiver")) {
+            
+            if (mexUDP_isValidSocketIndex(sockID))
+                status = mexUDP_stopReceiver(sockID);
+            else
+                status = -120;
+            
+        } else if(!strcmp(command, "receiverStats")) {
+            
+            unsigned int numReceived, numDropped, numOverruns, numQueued;
+            if (mexUDP_isValidSocketIndex(sockID)
+                    && mexUDP_getReceiverStats(sockID, &numReceived, &numDropped,
+                    &numOverruns, &numQueued) >= 0) {
+                
+                const char *fieldNames[] = {"received", "dropped", "overruns", "queued"};
+                plhs[0] = mxCreateStructMatrix(1, 1, 4, fieldNames);
+                mxSetFieldByNumber(plhs[0], 0, 0, mxCreateDoubleScalar(numReceived));
+                mxSetFieldByNumber(plhs[0], 0, 1, mxCreateDoubleScalar(numDropped));
+                mxSetFieldByNumber(plhs[0], 0, 2, mxCreateDoubleScalar(numOverruns));
+                mxSetFieldByNumber(plhs[0], 0, 3, mxCreateDoubleScalar(numQueued));
+                return;
+                
+            } else
+                status = -130;
+            
+        } else if(!strcmp(command, "sendFragmented")) {
+            
+            if (mexUDP_isValidSocketIndex(sockID)) {
+                
+                // treat input as packed bytes, of any length
+                if(nrhs==3) {
+                    nBytes = mxGetM(prhs[2]) * mxGetN(prhs[2]) * mxGetElementSize(prhs[2]);
+                    if (nBytes <= MEXUDP_MAX_MESSAGE_LENGTH)
+                        status = mexUDP_sendFragmented(sockID, mxGetData(prhs[2]), nBytes);
+                    else {
+                        mexPrintf("input is too long to send (%d, max of %d)\n", nBytes, MEXUDP_MAX_MESSAGE_LENGTH);
+                        status = -160;
+                    }
+                    
+                } else
+                    status = -170;
+                
+            } else
+                status = -180;
+            
+        } else if(!strcmp(command, "receiveFragmented")) {
+            
+            if (mexUDP_isValidSocketIndex(sockID)) {
+                
+                // optional timeout seconds, default to 0
+                double timeoutSecs = 0;
+                if(nrhs==3)
+                    timeoutSecs = mxGetScalar(prhs[2]);
+                
+                nBytes = mexUDP_receiveFragmented(sockID, timeoutSecs, &buffer);
+                if(nBytes >= 0) {
                     plhs[0] = mxCreateNumericMatrix(1, nBytes, mxUINT8_CLASS, mxREAL);
-                    mxData = mxGetData(plhs[0]);
-                    memcpy(mxData, bigByteBuffer, nBytes);
+                    memcpy(mxGetData(plhs[0]), buffer, nBytes);
                     
                 } else
                     plhs[0] = mxCreateNumericMatrix(0, 0, mxUINT8_CLASS, mxREAL);
+                return;
+                
+            } else
+                status = -190;
+            
+        } else if(!strcmp(command, "fragmentOptions")) {
+            
+            // options struct may have lossRate, nakDelaySecs, and seed
+            if (mexUDP_isValidSocketIndex(sockID) && nrhs==3 && mxIsStruct(prhs[2])) {
+                mxArray *field;
+                double lossRate = 0, nakDelaySecs = 0;
+                unsigned int seed = 0;
+                if ((field = mxGetField(prhs[2], 0, "lossRate")) != NULL && !mxIsEmpty(field))
+                    lossRate = mxGetScalar(field);
+                if ((field = mxGetField(prhs[2], 0, "nakDelaySecs")) != NULL && !mxIsEmpty(field))
+                    nakDelaySecs = mxGetScalar(field);
+                if ((field = mxGetField(prhs[2], 0, "seed")) != NULL && !mxIsEmpty(field))
+                    seed = (unsigned int)mxGetScalar(field);
+                status = mexUDP_setFragmentOptions(sockID, lossRate, nakDelaySecs, seed);
+                
+            } else
+                status = -200;
+            
+        } else if(!strcmp(command, "fragmentStats")) {
+            
+            if (mexUDP_isValidSocketIndex(sockID)) {
+                mexUDP_fragmenter *fragmenter = mexUDP_getFragmenter(sockID);
+                const char *fieldNames[] = {"fragmentsSent", "fragmentsResent", "fragmentsLost",
+                        "naksSent", "naksReceived", "messagesReceived", "messagesAbandoned", "strays"};
+                plhs[0] = mxCreateStructMatrix(1, 1, 8, fieldNames);
+                mxSetFieldByNumber(plhs[0], 0, 0, mxCreateDoubleScalar(fragmenter->numFragmentsSent));
+                mxSetFieldByNumber(plhs[0], 0, 1, mxCreateDoubleScalar(fragmenter->numFragmentsResent));
+                mxSetFieldByNumber(plhs[0], 0, 2, mxCreateDoubleScalar(fragmenter->numFragmentsLost));
+                mxSetFieldByNumber(plhs[0], 0, 3, mxCreateDoubleScalar(fragmenter->numNaksSent));
+                mxSetFieldByNumber(plhs[0], 0, 4, mxCreateDoubleScalar(fragmenter->numNaksReceived));
+                mxSetFieldByNumber(plhs[0], 0, 5, mxCreateDoubleScalar(fragmenter->numMessagesReceived));
+                mxSetFieldByNumber(plhs[0], 0, 6, mxCreateDoubleScalar(fragmenter->numMessagesAbandoned));
+                mxSetFieldByNumber(plhs[0], 0, 7, mxCreateDoubleScalar(fragmenter->numStrays));
+                return;
                 
+            } else
+                status = -210;
+            
+        } else if(!strcmp(command, "socketStats")) {
+            
+            int receiveBufferBytes, sendBufferBytes, maxDatagramLength;
+            unsigned int kernelDrops;
+            if (mexUDP_isValidSocketIndex(sockID)
+                    && mexUDP_getSocketStats(sockID, &receiveBufferBytes, &sendBufferBytes,
+                    &maxDatagramLength, &kernelDrops) >= 0) {
+                
+                const char *fieldNames[] = {"receiveBufferBytes", "sendBufferBytes",
+                        "maxDatagramBytes", "kernelDrops"};
+                plhs[0] = mxCreateStructMatrix(1, 1, 4, fieldNames);
+                mxSetFieldByNumber(plhs[0], 0, 0, mxCreateDoubleScalar(receiveBufferBytes));
+                mxSetFieldByNumber(plhs[0], 0, 1, mxCreateDoubleScalar(sendBufferBytes));
+                mxSetFieldByNumber(plhs[0], 0, 2, mxCreateDoubleScalar(maxDatagramLength));
+                mxSetFieldByNumber(plhs[0], 0, 3, mxCreateDoubleScalar(kernelDrops));
                 return;
                 
             } else
-                status = -60;
+                status = -150;
             
-        } else if(!strcmp(bigByteBuffer, "close")) {
+        } else if(!strcmp(command, "close")) {
             
             if (mexUDP_isValidSocketIndex(sockID))
                 status = mexUDP_close(sockID);
             else
                 status = 0;
             
-        } else if(!strcmp(bigByteBuffer, "closeAll")) {
+        } else if(!strcmp(command, "closeAll")) {
             
             mexUDP_closeAll();
             status = 0;
             
         } else {
             
-            mexPrintf("unknown subcommand, %s\n", bigByteBuffer);
+            mexPrintf("unknown subcommand, %s\n", command);
             status = -1000;
         }
         
         // all subcommands return int status
-        // except receive, which returns above
+        // except waitAny, the receives, and the stats, which return above
+        // the sends may also return acks and serialized lengths
         plhs[0] = mxCreateDoubleScalar((double)status);
         
     } else {
-        mexPrintf("mexUDP usage:\n %s\n %s\n %s\n %s\n %s\n %s\n",
-                "id = mexUDP('open', localIP, remoteIP, localPort [, remotePort])",
+        mexPrintf("mexUDP usage:\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n",
+                "id = mexUDP('open', localIP, remoteIP, localPort [, remotePort [, options]])",
+                "  options may have receiveBufferBytes, sendBufferBytes, maxDatagramBytes",
                 "status = mexUDP('sendBytes', id, data)",
+                "numSent = mexUDP('sendBytesBatch', id, dataColumns [, lengths])",
                 "hasData = mexUDP('check', id [, timeoutSeconds])",
-                "data = mexUDP('receiveBytes', id)",
+                "isReady = mexUDP('wait', id [, timeoutSeconds])",
+                "readyIds = mexUDP('waitAny', ids [, timeoutSeconds])",
+                "key = mexUDP('peerKey', id)",
+                "[data, arrivalTime] = mexUDP('receiveBytes', id)",
+                "[dataColumns, lengths, times] = mexUDP('receiveAll', id [, maxCount])",
+                "[status, nBytes] = mexUDP('sendMx', id, prefix, variable [, compressThreshold [, maxBytes]])",
+                "[status, isAcked, ackTime] = mexUDP('sendAcked', id, prefixedData, ackTimeout, sendRetries)",
+                "[status, isAcked, ackTime, nBytes] = mexUDP('sendMxAcked', id, prefix, variable, ackTimeout, sendRetries [, compressThreshold [, maxBytes]])",
+                "[status, isAcked, ackTimes, nBytes] = mexUDP('sendMxWindow', id, prefixes, variables, ackTimeout, sendRetries [, compressThreshold [, maxBytes]])",
+                "[variable, status, prefix] = mexUDP('receiveMx', id [, recentPrefixes [, timeoutSeconds]])",
+                "status = mexUDP('startReceiver', id [, ringLength])",
+                "status = mexUDP('stopReceiver', id)",
+                "stats = mexUDP('receiverStats', id)",
+                "stats = mexUDP('socketStats', id)",
+                "numSent = mexUDP('sendFragmented', id, data)",
+                "data = mexUDP('receiveFragmented', id [, timeoutSeconds])",
+                "status = mexUDP('fragmentOptions', id, options)",
+                "  options may have lossRate, nakDelaySecs, seed",
+                "stats = mexUDP('fragmentStats', id)",
                 "status = mexUDP('close', id)",
                 "status = mexUDP('closeAll')");
         return;
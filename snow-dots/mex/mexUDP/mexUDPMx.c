@@ -0,0 +1,225 @@
+/* mexUDPMx.c
+ *
+ * Send and receive Matlab variables as mxGram bytes, with the 1-byte ack
+ * code prefix that dotsTheMessenger uses.  Variables are serialized
+ * straight into the socket buffer, just after the prefix, and decoded
+ * straight out of it, so Matlab never sees the bytes.
+ *
+ * Senders may also wait natively for the ack code, and resend when it
+ * doesn't arrive in time.  They may also send a window of several
+ * messages at once, with distinct prefixes, and match acks in any order.
+ *
+ * Receivers acknowledge every prefixed datagram, including resends of a
+ * message they already have, whose first ack might have been lost.  But
+ * they only decode messages whose prefix isn't among the recent ones.
+ * They don't acknowledge new messages they can't decode, like schema
+ * grams whose layout they never got, so the sender finds out.
+ *
+ * These link with their own copy of the mxGram routines.  So schema
+ * layouts and cached function handles here are separate from those of
+ * the mxGram mex function.  Schema layouts are kept for each peer, by
+ * mexUDP_getPeerKey().
+ *
+ */
+
+#include "mexUDP.h"
+#include "mxGram.h"
+
+// serialize after the prefix, in a buffer of the socket's max length
+static int mexUDP_encodeMx(int sock, int prefix, const mxArray* mx, double compressThreshold, int maxBytes,
+        char* message, int* gramLength) {
+
+    char *gramBytes = message + 1;
+    int nBytes;
+
+    // leave room for the prefix
+    if (maxBytes > mexUDP_getMaxLength(sock) - 1)
+        maxBytes = mexUDP_getMaxLength(sock) - 1;
+
+    // check the exact size before serializing
+    //  grams that will be compressed might still fit
+    *gramLength = mxGramSize(mx);
+    nBytes = mxToBytesMaybeCompressed(mx, gramBytes, maxBytes, compressThreshold, *gramLength);
+
+    // handle strings are only good during this call
+    clearMxGramFunctionStrings();
+    if (nBytes == MX_GRAM_TOO_LONG)
+        return(-220);
+    if (nBytes <= 0)
+        return(-230);
+
+    *gramLength = nBytes;
+    gramBytes[-1] = (char)prefix;
+    return(nBytes+1);
+}
+
+int mexUDP_sendMx(int sock, int prefix, const mxArray* mx, double compressThreshold, int maxBytes, int* gramLength) {
+
+    int nBytes = mexUDP_encodeMx(sock, prefix, mx, compressThreshold, maxBytes,
+            mexUDP_getBuffer(sock), gramLength);
+    if (nBytes < 0)
+        return(nBytes);
+    return(mexUDP_send(sock, mexUDP_getBuffer(sock), nBytes));
+}
+
+int mexUDP_sendMxAcked(int sock, int prefix, const mxArray* mx, double compressThreshold, int maxBytes,
+        double ackTimeout, int sendRetries, int* gramLength, int* isAcked, double* ackTime) {
+
+    int nBytes = mexUDP_encodeMx(sock, prefix, mx, compressThreshold, maxBytes,
+            mexUDP_getBuffer(sock), gramLength);
+    *isAcked = 0;
+    *ackTime = 0;
+    if (nBytes < 0)
+        return(nBytes);
+    return(mexUDP_sendAcked(sock, mexUDP_getBuffer(sock), nBytes, ackTimeout, sendRetries, isAcked, ackTime));
+}
+
+int mexUDP_sendAcked(int sock, char* message, int messageLength, double ackTimeout, int sendRetries,
+        int* isAcked, double* ackTime) {
+
+    char reply[2];
+    int status = -1, nTries, nBytes;
+    double startTime = mexUDP_getSeconds(), deadline, arrivalTime;
+
+    *isAcked = 0;
+    *ackTime = 0;
+    if (messageLength < 1)
+        return(-1);
+
+    // send and wait for ack code up to (sendRetries + 1) times
+    for (nTries=0; nTries<=sendRetries; nTries++) {
+        status = mexUDP_send(sock, message, messageLength);
+        if (status < 0 || ackTimeout < 0)
+            return(status);
+
+        // the ack code is a 1-byte reply matching the prefix
+        //  a 2-byte buffer tells it apart from truncated messages
+        //  ignore other replies, like acks for earlier resends
+        deadline = mexUDP_getSeconds() + ackTimeout;
+        while (mexUDP_check(sock, deadline - mexUDP_getSeconds())) {
+            nBytes = mexUDP_receive(sock, reply, sizeof(reply), &arrivalTime);
+            if (nBytes == 1 && reply[0] == message[0]) {
+                *isAcked = 1;
+                *ackTime = mexUDP_getSeconds() - startTime;
+                return(status);
+            }
+            if (mexUDP_getSeconds() >= deadline)
+                break;
+        }
+    }
+
+    // never got an acknowledgement
+    *ackTime = mexUDP_getSeconds() - startTime;
+    return(status);
+}
+
+int mexUDP_sendMxWindow(int sock, const int* prefixes, const mxArray** mxs, int numMessages,
+        double compressThreshold, int maxBytes, double ackTimeout, int sendRetries,
+        int* gramLengths, int* isAcked, double* ackTimes) {
+
+    char reply[2];
+    int ii, status = 0, nTries, nBytes, numSent = 0, numAcked = 0;
+    int stride = mexUDP_getMaxLength(sock);
+    int *lengths;
+    char *messages;
+    double startTime = mexUDP_getSeconds(), deadline, arrivalTime;
+
+    for (ii=0; ii<numMessages; ii++) {
+        gramLengths[ii] = -1;
+        isAcked[ii] = 0;
+        ackTimes[ii] = 0;
+    }
+    if (numMessages < 1 || numMessages > MEXUDP_MAX_WINDOW_LENGTH)
+        return(-290);
+
+    // serialize everything before sending anything
+    lengths = mxMalloc(numMessages * sizeof(int));
+    messages = mxMalloc((size_t)numMessages * stride);
+    for (ii=0; ii<numMessages && status>=0; ii++) {
+        status = mexUDP_encodeMx(sock, prefixes[ii], mxs[ii], compressThreshold, maxBytes,
+                messages + (size_t)ii*stride, &gramLengths[ii]);
+        lengths[ii] = status;
+    }
+
+    // send the whole window at once, then resend whatever isn't acked
+    //  acks may arrive in any order, so match them by prefix
+    if (status >= 0)
+        status = numSent = mexUDP_sendBatch(sock, messages, lengths, stride, numMessages);
+    for (nTries=0; status>=0 && ackTimeout>=0; nTries++) {
+        if (nTries > 0) {
+            for (ii=0; ii<numMessages && status>=0; ii++)
+                if (!isAcked[ii])
+                    status = mexUDP_send(sock, messages + (size_t)ii*stride, lengths[ii]);
+            if (status < 0)
+                break;
+        }
+
+        deadline = mexUDP_getSeconds() + ackTimeout;
+        while (numAcked < numMessages && mexUDP_check(sock, deadline - mexUDP_getSeconds())) {
+            nBytes = mexUDP_receive(sock, reply, sizeof(reply), &arrivalTime);
+            for (ii=0; nBytes==1 && ii<numMessages; ii++) {
+                if (!isAcked[ii] && (unsigned char)reply[0] == prefixes[ii]) {
+                    isAcked[ii] = 1;
+                    ackTimes[ii] = mexUDP_getSeconds() - startTime;
+                    numAcked++;
+                    break;
+                }
+            }
+            if (mexUDP_getSeconds() >= deadline)
+                break;
+        }
+
+        if (numAcked == numMessages || nTries >= sendRetries)
+            break;
+    }
+
+    mxFree(lengths);
+    mxFree(messages);
+    if (status < 0)
+        return(status);
+    return(ackTimeout < 0 ? numSent : numAcked);
+}
+
+int mexUDP_receiveMx(int sock, const int* recentPrefixes, int numRecent, double timeoutSecs, mxArray** mx, int* prefix) {
+
+    char *buffer = mexUDP_getBuffer(sock);
+    int ii, nBytes, isRecent;
+    double arrivalTime;
+
+    *mx = NULL;
+    *prefix = -1;
+
+    // ignore empty datagrams and repeats of recent prefixes
+    //  with several messages in flight, repeats may be out of order
+    while (mexUDP_check(sock, timeoutSecs)) {
+        nBytes = mexUDP_receive(sock, buffer, mexUDP_getMaxLength(sock), &arrivalTime);
+        if (nBytes <= 1)
+            continue;
+
+        // reply with the ack code to the sender for repeats
+        for (ii=0, isRecent=0; ii<numRecent && !isRecent; ii++)
+            isRecent = (unsigned char)buffer[0] == recentPrefixes[ii];
+        if (isRecent) {
+            mexUDP_send(sock, buffer, 1);
+            continue;
+        }
+
+        // decode in place, with layouts from this sender
+        //  then acknowledge, or leave the sender to resend or give up
+        if (bytesToMxWithSchemas(mx, buffer+1, nBytes-1, mexUDP_getPeerKey(sock)) > 0) {
+            mexUDP_send(sock, buffer, 1);
+            *prefix = (unsigned char)buffer[0];
+            return(nBytes-1);
+        }
+
+        mxDestroyArray(*mx);
+        *mx = NULL;
+        return(-260);
+    }
+    return(-250);
+}
+
+void mexUDP_clearMx() {
+    clearMxGramFunctionCache();
+    clearMxGramSchemaTables();
+}
@@ -53,6 +53,99 @@ classdef TestMexUDP < TestCase
                 'should get nonnegative socket id')
         end
         
+        function testOpenCloseMany(self)
+            % closed sockets should give their ids back for reuse
+            nPorts = 10;
+            nRepeats = 5000;
+            firstId = mexUDP('open', self.address, self.address, self.port);
+            mexUDP('close', firstId);
+            for ii = 1:nRepeats
+                port = self.port + mod(ii, nPorts);
+                s = mexUDP('open', self.address, self.address, port);
+                assertEqual(s, firstId, ...
+                    'should reuse the closed socket id')
+                
+                sameS = mexUDP('open', self.address, self.address, port);
+                assertEqual(sameS, s, ...
+                    'should find the same open socket')
+                
+                status = mexUDP('close', s);
+                assertTrue(status >= 0, ...
+                    'should get nonnegative close status')
+            end
+            
+            status = mexUDP('sendBytes', firstId, self.shortMessage);
+            assertTrue(status < 0, ...
+                'should not send with a closed socket id')
+        end
+        
+        function testSocketOptions(self)
+            plain = mexUDP('open', self.address, self.address, ...
+                self.port+1, self.port+1);
+            defaultStats = mexUDP('socketStats', plain);
+            mexUDP('close', plain);
+
+            options.receiveBufferBytes = 2^20;
+            options.sendBufferBytes = 2^20;
+            options.maxDatagramBytes = 30000;
+            s = mexUDP('open', self.address, self.address, ...
+                self.port, self.port, options);
+            assertTrue(s >= 0, ...
+                'should get nonnegative socket id')
+
+            % the system may cap buffers below the given size
+            stats = mexUDP('socketStats', s);
+            assertEqual(stats.maxDatagramBytes, options.maxDatagramBytes, ...
+                'should use the given max datagram size')
+            assertTrue(stats.receiveBufferBytes > 0 ...
+                && stats.receiveBufferBytes >= defaultStats.receiveBufferBytes, ...
+                'should report a receive buffer no smaller than the default')
+            assertTrue(stats.sendBufferBytes > 0 ...
+                && stats.sendBufferBytes >= defaultStats.sendBufferBytes, ...
+                'should report a send buffer no smaller than the default')
+            assertEqual(stats.kernelDrops, 0, ...
+                'should start with no kernel drops')
+            
+            longMessage = ones(1, 20000, 'uint8');
+            status = mexUDP('sendBytes', s, longMessage);
+            assertTrue(status >= 0, ...
+                'should get nonnegative send status')
+            self.waitSeveralMiliseconds();
+            readMessage = mexUDP('receiveBytes', s);
+            assertEqual(readMessage, longMessage, ...
+                'should receive same long message send to self');
+            
+            tooLongMessage = ones(1, 30001, 'uint8');
+            status = mexUDP('sendBytes', s, tooLongMessage);
+            assertTrue(status < 0, ...
+                'should not send beyond the max datagram size')
+        end
+        
+        function testVariedSizes(self)
+            s = mexUDP('open', self.address, self.address, ...
+                self.port, self.port);
+            assertTrue(s >= 0, ...
+                'should get nonnegative socket id')
+            
+            sizes = [1 7 1000 8192 3];
+            for ii = 1:numel(sizes)
+                message = uint8(mod(1:sizes(ii), 256));
+                mexUDP('sendBytes', s, message);
+                self.waitSeveralMiliseconds();
+                readMessage = mexUDP('receiveBytes', s);
+                assertEqual(readMessage, message, ...
+                    'should receive each size exactly as sent');
+            end
+            
+            readMessage = mexUDP('receiveBytes', s);
+            assertTrue(isempty(readMessage), ...
+                'should receive empty with nothing to read');
+            
+            status = mexUDP('close', s);
+            assertTrue(status >= 0, ...
+                'should get nonnegative close status')
+        end
+        
         function testBasicInterface(self)
             s = mexUDP('open', self.address, self.address, ...
                 self.port, self.port);
@@ -76,6 +169,371 @@ classdef TestMexUDP < TestCase
                 'should get nonnegative close status')
         end
         
+        function testBatchInterface(self)
+            s = mexUDP('open', self.address, self.address, ...
+                self.port, self.port);
+            assertTrue(s >= 0, ...
+                'should get nonnegative socket id')
+            
+            % one message per column, with various lengths
+            nMessages = 5;
+            batch = repmat(uint8(1:10)', 1, nMessages);
+            lengths = 1:nMessages;
+            numSent = mexUDP('sendBytesBatch', s, batch, lengths);
+            assertEqual(numSent, nMessages, ...
+                'should send one message per column')
+            
+            [data, readLengths, times] = mexUDP('receiveAll', s);
+            assertEqual(size(data), [max(lengths), nMessages], ...
+                'should receive one column per message')
+            assertEqual(readLengths, lengths, ...
+                'should receive each message length')
+            assertEqual(numel(times), nMessages, ...
+                'should get one timestamp per message')
+            for ii = 1:nMessages
+                assertEqual(data(1:lengths(ii),ii), batch(1:lengths(ii),ii), ...
+                    'should receive same messages sent to self');
+            end
+            
+            data = mexUDP('receiveAll', s);
+            assertTrue(isempty(data), ...
+                'should receive nothing once all messages are read')
+        end
+        
+        function testReceiverThread(self)
+            s = mexUDP('open', self.address, self.address, ...
+                self.port, self.port);
+            assertTrue(s >= 0, ...
+                'should get nonnegative socket id')
+            
+            ringLength = 4;
+            status = mexUDP('startReceiver', s, ringLength);
+            assertTrue(status >= 0, ...
+                'should get nonnegative start status')
+            
+            % overfill the ring
+            nMessages = 3*ringLength;
+            batch = repmat(self.shortMessage', 1, nMessages);
+            mexUDP('sendBytesBatch', s, batch);
+            hasMessage = mexUDP('check', s, 0.1);
+            assertTrue(hasMessage > 0, ...
+                'should have message queued by receiver')
+            self.waitSeveralMiliseconds();
+            
+            stats = mexUDP('receiverStats', s);
+            assertEqual(stats.received, nMessages, ...
+                'receiver should see all messages')
+            assertEqual(stats.queued, ringLength, ...
+                'receiver should queue until ring is full')
+            assertEqual(stats.dropped, nMessages - ringLength, ...
+                'receiver should drop messages once ring is full')
+            assertEqual(stats.overruns, 1, ...
+                'receiver should count one overrun')
+            
+            readMessage = mexUDP('receiveBytes', s);
+            assertEqual(readMessage, self.shortMessage, ...
+                'should dequeue same message sent to self');
+            
+            status = mexUDP('stopReceiver', s);
+            assertTrue(status >= 0, ...
+                'should get nonnegative stop status')
+        end
+        
+        function testArrivalTime(self)
+            s = mexUDP('open', self.address, self.address, ...
+                self.port, self.port);
+            assertTrue(s >= 0, ...
+                'should get nonnegative socket id')
+            
+            mexUDP('sendBytes', s, self.shortMessage);
+            self.waitSeveralMiliseconds();
+            mexUDP('sendBytes', s, self.shortMessage);
+            self.waitSeveralMiliseconds();
+            
+            [readMessage, firstTime] = mexUDP('receiveBytes', s);
+            assertEqual(readMessage, self.shortMessage, ...
+                'should receive same message send to self');
+            [readMessage, secondTime] = mexUDP('receiveBytes', s);
+            assertTrue(isscalar(firstTime) && isscalar(secondTime), ...
+                'should get one arrival time per message')
+            assertTrue(secondTime - firstTime > 0.004, ...
+                'arrival times should not depend on when messages are read')
+            
+            [readMessage, noTime] = mexUDP('receiveBytes', s);
+            assertTrue(isempty(readMessage) && isempty(noTime), ...
+                'should get no arrival time without a message')
+        end
+        
+        function testWaitAny(self)
+            nSockets = 3;
+            s = zeros(1, nSockets);
+            for ii = 1:nSockets
+                port = self.port + ii - 1;
+                s(ii) = mexUDP('open', self.address, self.address, ...
+                    port, port);
+                assertTrue(s(ii) >= 0, ...
+                    'should get nonnegative socket id')
+            end
+            
+            timeoutSecs = 0.1;
+            readyIds = mexUDP('waitAny', s, timeoutSecs);
+            assertTrue(isempty(readyIds), ...
+                'should block and return with no ready sockets');
+            
+            mexUDP('sendBytes', s(1), self.shortMessage);
+            mexUDP('sendBytes', s(3), self.shortMessage);
+            readyIds = mexUDP('waitAny', s, timeoutSecs);
+            if numel(readyIds) < 2
+                self.waitSeveralMiliseconds();
+                readyIds = mexUDP('waitAny', s, timeoutSecs);
+            end
+            assertEqual(readyIds, s([1 3]), ...
+                'should return all sockets with messages');
+            
+            readyIds = mexUDP('waitAny', s(2), 0);
+            assertTrue(isempty(readyIds), ...
+                'should ignore sockets that were not asked about');
+
+            % a receiver thread takes over a socket waitAny was watching
+            mexUDP('receiveAll', s(1));
+            mexUDP('receiveAll', s(3));
+            mexUDP('startReceiver', s(1));
+            for ii = 1:10
+                mexUDP('sendBytes', s(1), self.shortMessage);
+            end
+            self.waitSeveralMiliseconds();
+            readyIds = mexUDP('waitAny', s(2), 0);
+            assertTrue(isempty(readyIds), ...
+                'should ignore a receiver socket that was not asked about');
+            readyIds = mexUDP('waitAny', s, timeoutSecs);
+            assertEqual(readyIds, s(1), ...
+                'should report a receiver socket once');
+        end
+        
+        function testSendReceiveMx(self)
+            a = mexUDP('open', self.address, self.address, ...
+                self.port, self.port+1);
+            b = mexUDP('open', self.address, self.address, ...
+                self.port+1, self.port);
+            assertTrue(a >= 0 && b >= 0, ...
+                'should get nonnegative socket ids')
+            
+            msg.name = 'hello';
+            msg.values = {1:10, @disp, true};
+            [status, nBytes] = mexUDP('sendMx', a, 7, msg);
+            assertEqual(status, nBytes + 1, ...
+                'should send prefix and serialized message')
+            
+            [readMsg, status, prefix] = mexUDP('receiveMx', b, 255, 0.1);
+            assertTrue(status > 0, ...
+                'should get positive receive status')
+            assertEqual(prefix, 7, ...
+                'should receive the ack code prefix')
+            assertEqual(func2str(readMsg.values{2}), 'disp', ...
+                'should receive function handle sent to other socket')
+            readMsg.values{2} = msg.values{2};
+            assertEqual(readMsg, msg, ...
+                'should receive message sent to other socket')
+            
+            ack = mexUDP('receiveBytes', a);
+            assertEqual(ack, uint8(7), ...
+                'should receive ack code from other socket')
+            
+            mexUDP('sendMx', a, 7, msg);
+            [readMsg, status, prefix] = mexUDP('receiveMx', b, 7, 0.1);
+            assertTrue(status < 0 && isempty(readMsg) && isempty(prefix), ...
+                'should ignore message with recent prefix')
+            
+            bigMsg = zeros(1, 10000);
+            [status, nBytes] = mexUDP('sendMx', a, 8, bigMsg);
+            assertTrue(status < 0 && nBytes > 8192, ...
+                'should not send message larger than a datagram')
+            status = mexUDP('sendMx', a, 8, bigMsg, 1024, 8191);
+            assertTrue(status > 0, ...
+                'should send message compressed to fit')
+            readMsg = mexUDP('receiveMx', b, 7, 0.1);
+            assertEqual(readMsg, bigMsg, ...
+                'should receive compressed message')
+            
+            % leave the sender to find out about garbled messages
+            mexUDP('receiveAll', a);
+            mexUDP('sendBytes', a, uint8([9 255*ones(1, 20)]));
+            [readMsg, status, prefix] = mexUDP('receiveMx', b, 8, 0.1);
+            assertTrue(status < 0 && isempty(readMsg) && isempty(prefix), ...
+                'should not decode garbled message')
+            assertFalse(mexUDP('check', a, 0.01) > 0, ...
+                'should not acknowledge garbled message')
+        end
+        
+        function testPeerKey(self)
+            a = mexUDP('open', self.address, self.address, ...
+                self.port, self.port+1);
+            b = mexUDP('open', self.address, self.address, ...
+                self.port+1, self.port);
+            keyA = mexUDP('peerKey', a);
+            keyB = mexUDP('peerKey', b);
+            assertTrue(keyA >= 0 && keyB >= 0 && keyA ~= keyB, ...
+                'should get a distinct key for each socket and peer')
+            
+            mexUDP('sendBytes', a, self.shortMessage);
+            mexUDP('wait', b, 0.1);
+            mexUDP('receiveBytes', b);
+            assertEqual(mexUDP('peerKey', b), keyB, ...
+                'should keep the key while the peer stays the same')
+            
+            status = mexUDP('peerKey', b+1);
+            assertTrue(status < 0, ...
+                'should not get a key for a closed socket id')
+        end
+        
+        function testSendAcked(self)
+            a = mexUDP('open', self.address, self.address, ...
+                self.port, self.port+1);
+            assertTrue(a >= 0, ...
+                'should get nonnegative socket id')
+            
+            % no one is listening to acknowledge
+            ackTimeout = 0.02;
+            sendRetries = 2;
+            [status, isAcked, ackTime, nBytes] = mexUDP('sendMxAcked', ...
+                a, 5, 1:10, ackTimeout, sendRetries);
+            assertEqual(status, nBytes + 1, ...
+                'should send prefix and serialized message')
+            assertFalse(isAcked, ...
+                'should not get acknowledgement')
+            assertTrue(ackTime >= (sendRetries+1)*ackTimeout, ...
+                'should wait for each try')
+            
+            % a 1-byte message sent to self acknowledges itself
+            s = mexUDP('open', self.address, self.address, ...
+                self.port+2, self.port+2);
+            [status, isAcked, ackTime] = mexUDP('sendAcked', ...
+                s, uint8(9), ackTimeout, sendRetries);
+            assertTrue(status > 0, ...
+                'should get positive send status')
+            assertTrue(isAcked, ...
+                'should get acknowledgement from self')
+            assertTrue(ackTime < ackTimeout, ...
+                'should not wait to resend')
+        end
+        
+        function testSendMxWindow(self)
+            a = mexUDP('open', self.address, self.address, ...
+                self.port, self.port+1);
+            b = mexUDP('open', self.address, self.address, ...
+                self.port+1, self.port);
+            assertTrue(a >= 0 && b >= 0, ...
+                'should get nonnegative socket ids')
+            
+            % send a window without waiting for acknowledgement
+            prefixes = 11:15;
+            msgs = {1:10, 'hello', {true, @disp}, eye(3), int8(-3)};
+            [status, isAcked, ackTimes, nBytes] = mexUDP( ...
+                'sendMxWindow', a, prefixes, msgs, -1, 0);
+            assertEqual(status, numel(msgs), ...
+                'should send every message in the window')
+            assertFalse(any(isAcked) || any(ackTimes), ...
+                'should not wait for acknowledgements')
+            assertTrue(all(nBytes > 0), ...
+                'should report serialized sizes')
+            
+            % receive in order, treating older prefixes as recent
+            for ii = 1:numel(msgs)
+                [readMsg, status, prefix] = mexUDP('receiveMx', ...
+                    b, prefixes(1:ii-1), 0.1);
+                assertTrue(status > 0, ...
+                    'should get positive receive status')
+                assertEqual(prefix, prefixes(ii), ...
+                    'should receive each ack code prefix')
+                if ii ~= 3
+                    assertEqual(readMsg, msgs{ii}, ...
+                        'should receive each message in the window')
+                end
+            end
+            
+            % the acknowledgements came back in order, one per message
+            for ii = 1:numel(msgs)
+                ack = mexUDP('receiveBytes', a);
+                assertEqual(ack, uint8(prefixes(ii)), ...
+                    'should receive each ack code')
+            end
+            
+            % resends of any recent prefix are ignored
+            mexUDP('sendMx', a, prefixes(2), 'again');
+            readMsg = mexUDP('receiveMx', b, prefixes, 0.1);
+            assertTrue(isempty(readMsg), ...
+                'should ignore message with any recent prefix')
+            
+            % one message too large to send means none are sent
+            [status, isAcked, ackTimes, nBytes] = mexUDP('sendMxWindow', ...
+                a, [1 2], {1:10, zeros(1, 10000)}, -1, 0);
+            assertTrue(status < 0 && nBytes(2) > 8192, ...
+                'should not send a window with a message too large')
+            readMsg = mexUDP('receiveMx', b, [], 0.1);
+            assertTrue(isempty(readMsg), ...
+                'should not send any part of a bad window')
+        end
+        
+        function testFragmentedWithLoss(self)
+            a = mexUDP('open', self.address, self.address, ...
+                self.port, self.port+1);
+            b = mexUDP('open', self.address, self.address, ...
+                self.port+1, self.port);
+            assertTrue(a >= 0 && b >= 0, ...
+                'should get nonnegative socket ids')
+            
+            % drop some fragments on purpose
+            options.lossRate = 0.2;
+            options.nakDelaySecs = 0.001;
+            options.seed = 1;
+            status = mexUDP('fragmentOptions', a, options);
+            assertTrue(status >= 0, ...
+                'should get nonnegative options status')
+            
+            longMessage = uint8(mod(1:100000, 251));
+            numSent = mexUDP('sendFragmented', a, longMessage);
+            assertTrue(numSent > 0, ...
+                'should send some fragments')
+            
+            % the receiver asks for missing fragments
+            % the sender resends them when it reads its socket
+            readMessage = [];
+            for ii = 1:100
+                readMessage = mexUDP('receiveFragmented', b, 0.005);
+                if ~isempty(readMessage)
+                    break;
+                end
+                mexUDP('receiveFragmented', a);
+            end
+            assertEqual(readMessage, longMessage, ...
+                'should reassemble same long message sent with loss');
+            
+            stats = mexUDP('fragmentStats', a);
+            assertTrue(stats.fragmentsLost > 0 && stats.fragmentsResent > 0, ...
+                'sender should lose and resend some fragments')
+        end
+        
+        function testFragmentedTruncated(self)
+            a = mexUDP('open', self.address, self.address, ...
+                self.port, self.port+1);
+            options.maxDatagramBytes = 4096;
+            b = mexUDP('open', self.address, self.address, ...
+                self.port+1, self.port, options);
+            assertTrue(a >= 0 && b >= 0, ...
+                'should get nonnegative socket ids')
+            
+            % fragments longer than b's datagrams get cut short
+            longMessage = uint8(mod(1:20000, 251));
+            mexUDP('sendFragmented', a, longMessage);
+            readMessage = mexUDP('receiveFragmented', b, 0.05);
+            assertTrue(isempty(readMessage), ...
+                'should not reassemble truncated fragments')
+            
+            stats = mexUDP('fragmentStats', b);
+            assertTrue(stats.strays > 0, ...
+                'should count truncated fragments as strays')
+        end
+        
         function testBlockingCheck(self)
             s = mexUDP('open', self.address, self.address, ...
                 self.port, self.port);
@@ -95,5 +553,38 @@ classdef TestMexUDP < TestCase
             assertTrue(hasMessage > 0, ...
                 'should block and return with message')
         end
+        
+        function testWait(self)
+            s = mexUDP('open', self.address, self.address, ...
+                self.port, self.port);
+            assertTrue(s >= 0, ...
+                'should get nonnegative socket id')
+            
+            timeoutSecs = 0.01;
+            tic;
+            isReady = mexUDP('wait', s, timeoutSecs);
+            waitTime = toc;
+            assertEqual(isReady, 0, ...
+                'should sleep and return with no message');
+            assertTrue(waitTime >= timeoutSecs, ...
+                'should sleep until the deadline');
+            
+            mexUDP('sendBytes', s, self.shortMessage);
+            tic;
+            isReady = mexUDP('wait', s, 1);
+            waitTime = toc;
+            assertEqual(isReady, 1, ...
+                'should wake up with a message');
+            assertTrue(waitTime < 0.5, ...
+                'should wake up before the deadline');
+            
+            data = mexUDP('receiveBytes', s);
+            assertEqual(data, self.shortMessage, ...
+                'should leave the message in place');
+            
+            status = mexUDP('wait', s+1, 0);
+            assertTrue(status < 0, ...
+                'should get negative status for bad socket id');
+        end
     end
-end
\ No newline at end of file
+end
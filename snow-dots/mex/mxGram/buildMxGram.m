@@ -3,4 +3,4 @@
 %   return the bytes in an array of type uint8.  Can convert such a uint8
 %   array back into a regular Matlab array.
 
-mex mxGramInterface.c mxGram.c -output mxGram
\ No newline at end of file
+mex mxGramInterface.c mxGram.c mxGramDecoder.c mxGramCompress.c mxGramSchema.c mxGramDelta.c mxGramFunctionCache.c mxGramBenchmark.c -output mxGram
\ No newline at end of file
@@ -11,6 +11,10 @@
 
 #include "mxGram.h"
 
+// struct arrays go as legacy mxGramStruct grams, unless packing is on
+//  peers running older versions of mxGram can't read packed structs
+static int isMxGramStructPacked = 0;
+
 int mxToBytes(const mxArray *mx, char *byteArray, int byteArrayLength) {
     int ii;
     int nInfoBytes=0, nDataBytes=0, nFreeBytes=0;
@@ -22,26 +26,29 @@ int mxToBytes(const mxArray *mx, char *byteArray, int byteArrayLength) {
     mxArray *elementData, *elementName;
     char *elementByteArray;
     int elementGramLength;
+    int isContainer;
+    const mxArray *functionString;
     
-    mxArray *callMatlabError;
-    
+    // unset cell elements and struct fields go as empty doubles
     if (mx == NULL)
-        return(0);
+        return(writeMxGramEmptyToBytes(byteArray, byteArrayLength));
     
     info.gramBytes = byteArray;
     setInfoFieldsFromMx(&info, mx);
     
-    info.dataBytes = byteArray + MX_GRAM_OFFSET_DATA;
-    nFreeBytes = byteArrayLength - MX_GRAM_OFFSET_DATA;
+    // containers don't know their length until elements are written
+    //  so start with the compact legacy header, and maybe widen it later
+    isContainer = isMxGramContainerType(info.gramType);
+    if (isContainer)
+        info.headLength = MX_GRAM_INFO_HEAD;
     
-    if (info.gramType==mxGramDouble) {
-        nDataBytes = writeMxDoubleDataToBytes(mx, &info, nFreeBytes);
-        
-    } else if (info.gramType==mxGramChar) {
-        nDataBytes = writeMxCharDataToBytes(mx, &info, nFreeBytes);
-        
-    } else if (info.gramType==mxGramLogical) {
-        nDataBytes = writeMxLogicalDataToBytes(mx, &info, nFreeBytes);
+    info.dataBytes = byteArray + info.headLength;
+    nFreeBytes = byteArrayLength - info.headLength;
+    if (nFreeBytes < 0)
+        return(-1);
+    
+    if (!isContainer) {
+        nDataBytes = writeMxSimpleDataToBytes(mx, &info, nFreeBytes);
         
     } else if (info.gramType==mxGramCell) {
         // recur to write data for each cell element
@@ -64,9 +71,7 @@ int mxToBytes(const mxArray *mx, char *byteArray, int byteArrayLength) {
     } else if (info.gramType==mxGramStruct) {
         
         // struct arrays resized to 1xn, with m fields
-        nElements = mxGetNumberOfFields(mx);
-        info.dataM = nElements;
-        info.dataN = mxGetM(mx) * mxGetN(mx);
+        nElements = info.dataM;
         
         // recur to write data for each field name
         elementByteArray = info.dataBytes;
@@ -99,11 +104,14 @@ int mxToBytes(const mxArray *mx, char *byteArray, int byteArrayLength) {
             }
         }
         
+    } else if (info.gramType==mxGramPackedStruct) {
+        nDataBytes = writeMxPackedStructToBytes(mx, &info, nFreeBytes);
+        
     } else if (info.gramType==mxGramFunctionHandle) {
         // recur to write stringified version of function
-        callMatlabError = mexCallMATLABWithTrap(1, &elementData, 1, (mxArray**)&mx, MX_GRAM_FUNCTION_TO_STRING);
-        if (callMatlabError == NULL && elementData != NULL) {
-            nDataBytes = mxToBytes((const mxArray*)elementData, info.dataBytes, nFreeBytes);
+        functionString = getMxGramFunctionString(mx);
+        if (functionString != NULL) {
+            nDataBytes = mxToBytes(functionString, info.dataBytes, nFreeBytes);
             if (nDataBytes < 0)
                 return(nDataBytes);
         } else
@@ -118,7 +126,9 @@ int mxToBytes(const mxArray *mx, char *byteArray, int byteArrayLength) {
     if (nDataBytes < 0)
         return(nDataBytes);
     
-    info.gramLength = MX_GRAM_OFFSET_DATA + nDataBytes;
+    if (isContainer)
+        return(finishMxContainerGram(&info, nDataBytes, byteArray, byteArrayLength));
+    
     nInfoBytes = writeInfoFieldsToBytes(&info, byteArray, byteArrayLength);
     //mexPrintf("nInfoBytes = %d\n", nInfoBytes);
     //printMxGramInfo(&info);
@@ -128,7 +138,7 @@ int mxToBytes(const mxArray *mx, char *byteArray, int byteArrayLength) {
 
 int bytesToMx(mxArray **mx, const char *byteArray, int byteArrayLength) {
     int ii;
-    int nInfoBytes=0, nFreeBytes=0, nBytesRead=0;
+    int nInfoBytes=0, nDataBytes=0, nFreeBytes=0, nBytesRead=0;
     mxGramInfo info;
     
     // for complex types
@@ -140,32 +150,31 @@ int bytesToMx(mxArray **mx, const char *byteArray, int byteArrayLength) {
     int elementBytesRead;
     char **fieldNames;
     
-    mxArray *callMatlabError;
-    
     info.gramBytes = (char *)byteArray;
     nInfoBytes = readInfoFieldsFromBytes(&info, byteArray, byteArrayLength);
+    if (nInfoBytes < 0) {
+        *mx = mxCreateDoubleScalar(-1);
+        return(0);
+    }
     nBytesRead += nInfoBytes;
     
-    info.dataBytes = (char *)byteArray + MX_GRAM_OFFSET_DATA;
-    nFreeBytes = byteArrayLength - MX_GRAM_OFFSET_DATA;
+    info.dataBytes = (char *)byteArray + info.headLength;
+    nFreeBytes = byteArrayLength - info.headLength;
     
     //printMxGramInfo(&info);
     //printBytes(info.gramBytes, info.gramLength);
     
-    if (info.gramType==mxGramDouble) {
-        *mx = mxCreateDoubleMatrix(info.dataM, info.dataN, mxREAL);
-        nBytesRead += readMxDoubleDataFromBytes(*mx, &info, nFreeBytes);
-        
-    } else if (info.gramType==mxGramChar) {
-        mwSize dims[2];
-        dims[0] = info.dataM;
-        dims[1] = info.dataN;
-        *mx = mxCreateCharArray(2, dims);
-        nBytesRead += readMxCharDataFromBytes(*mx, &info, nFreeBytes);
-        
-    } else if (info.gramType==mxGramLogical) {
-        *mx = mxCreateLogicalMatrix(info.dataM, info.dataN);
-        nBytesRead += readMxLogicalDataFromBytes(*mx, &info, nFreeBytes);
+    // don't allocate arrays for data that aren't really there
+    if (!hasMxGramDataBytes(&info, nFreeBytes)) {
+        *mx = mxCreateDoubleScalar(-1);
+        return(0);
+    }
+    
+    if (isMxGramSimpleType(&info)) {
+        nDataBytes = readMxSimpleGramFromBytes(mx, &info, nFreeBytes);
+        if (nDataBytes < 0)
+            return(0);
+        nBytesRead += nDataBytes;
         
     } else if (info.gramType==mxGramCell) {
         *mx = mxCreateCellMatrix(info.dataM, info.dataN);
@@ -186,7 +195,7 @@ int bytesToMx(mxArray **mx, const char *byteArray, int byteArrayLength) {
         
     } else if (info.gramType==mxGramStruct) {
         
-        // struct arrays may have size 1xn, with m fields
+        // legacy struct arrays have size 1xn, with m fields
         nElements = info.dataM;
         fieldNames = mxMalloc(nElements*sizeof(char*));
         
@@ -220,10 +229,31 @@ int bytesToMx(mxArray **mx, const char *byteArray, int byteArrayLength) {
     } else if (info.gramType==mxGramFunctionHandle) {
         // recur to read out stringified version of function
         elementBytesRead = bytesToMx(&elementData, info.dataBytes, nFreeBytes);
-        if (elementBytesRead > 0) {
-            nBytesRead += elementBytesRead;
-            callMatlabError = mexCallMATLABWithTrap(1, mx, 1, &elementData, MX_GRAM_STRING_TO_FUNCTION);
-        }
+        if (elementBytesRead <= 0)
+            return(0);
+        *mx = getMxGramFunctionFromString(elementData);
+        mxDestroyArray(elementData);
+        if (*mx == NULL)
+            return(0);
+        nBytesRead += elementBytesRead;
+        
+    } else if (info.gramType==mxGramPackedStruct) {
+        nDataBytes = readMxPackedStructFromBytes(mx, &info, nFreeBytes);
+        if (nDataBytes < 0)
+            return(0);
+        nBytesRead += nDataBytes;
+        
+    } else if (info.gramType==mxGramCompressed) {
+        nDataBytes = readMxCompressedGramFromBytes(mx, &info, nFreeBytes);
+        if (nDataBytes < 0)
+            return(0);
+        nBytesRead += nDataBytes;
+        
+    } else if (info.gramType==mxGramSchema) {
+        nDataBytes = readMxSchemaGramFromBytes(mx, &info, nFreeBytes);
+        if (nDataBytes < 0)
+            return(0);
+        nBytesRead += nDataBytes;
         
     } else {
         *mx = mxCreateDoubleScalar(-1);
@@ -233,160 +263,1017 @@ int bytesToMx(mxArray **mx, const char *byteArray, int byteArrayLength) {
     return(nBytesRead);
 }
 
+int mxGramSize(const mxArray *mx) {
+    int ii, jj;
+    int elementGramLength;
+    size_t nDataBytes = 0;
+    mxGramInfo info;
+    const mxArray *functionString;
+    
+    // unset cell elements and struct fields go as empty doubles
+    if (mx == NULL)
+        return(MX_GRAM_INFO_HEAD);
+    
+    setInfoFieldsFromMx(&info, mx);
+    
+    if ((info.gramFlags & MX_GRAM_FLAG_SPARSE)
+            || isMxGramNumericType(info.gramType)
+            || info.gramType==mxGramChar
+            || info.gramType==mxGramLogical) {
+        // simple types know their length already
+        nDataBytes = info.dataLength;
+        
+    } else if (info.gramType==mxGramCell) {
+        // recur to size each cell element
+        for (ii=0; ii<info.dataM * info.dataN; ii++) {
+            elementGramLength = mxGramSize(mxGetCell(mx, ii));
+            if (elementGramLength < 0)
+                return(elementGramLength);
+            nDataBytes += elementGramLength;
+        }
+        
+    } else if (info.gramType==mxGramStruct) {
+        // field names always go as ASCII chars
+        for (ii=0; ii<info.dataM; ii++)
+            nDataBytes += MX_GRAM_INFO_HEAD + strlen(mxGetFieldNameByNumber(mx, ii));
+        
+        // recur to size each field datum
+        for (ii=0; ii<info.dataM; ii++) {
+            for (jj=0; jj<info.dataN; jj++) {
+                elementGramLength = mxGramSize(mxGetFieldByNumber(mx, jj, ii));
+                if (elementGramLength < 0)
+                    return(elementGramLength);
+                nDataBytes += elementGramLength;
+            }
+        }
+        
+    } else if (info.gramType==mxGramPackedStruct) {
+        elementGramLength = getMxPackedStructDataSize(mx);
+        if (elementGramLength < 0)
+            return(elementGramLength);
+        nDataBytes = elementGramLength;
+        
+    } else if (info.gramType==mxGramFunctionHandle) {
+        // recur to size stringified version of function
+        functionString = getMxGramFunctionString(mx);
+        if (functionString != NULL) {
+            elementGramLength = mxGramSize(functionString);
+            if (elementGramLength < 0)
+                return(elementGramLength);
+            nDataBytes = elementGramLength;
+        } else
+            return(-1);
+        
+    } else {
+        return(mxGramUnsupported);
+    }
+    
+    // mxToBytes returns lengths as int
+    setInfoHeadLength(&info, nDataBytes);
+    if (nDataBytes > INT_MAX - MX_GRAM_WIDE_INFO_HEAD)
+        return(-1);
+    return(info.headLength + (int)nDataBytes);
+}
+
+int writeMxSimpleDataToBytes(const mxArray *mx, mxGramInfo *info, int nBytes) {
+    if (info->gramFlags & MX_GRAM_FLAG_SPARSE)
+        return(writeMxSparseDataToBytes(mx, info, nBytes));
+    else if (isMxGramNumericType(info->gramType))
+        return(writeMxNumericDataToBytes(mx, info, nBytes));
+    else if (info->gramType==mxGramChar)
+        return(writeMxCharDataToBytes(mx, info, nBytes));
+    else if (info->gramType==mxGramLogical)
+        return(writeMxLogicalDataToBytes(mx, info, nBytes));
+    else
+        return(mxGramUnsupported);
+}
+
+int readMxSimpleGramFromBytes(mxArray **mx, mxGramInfo *info, int nBytes) {
+    int nElements;
+    mwSize dims[2];
+    
+    if (info->gramFlags & MX_GRAM_FLAG_SPARSE) {
+        // sparse arrays are always double or logical
+        nElements = (int)getMxGramSparseNonzeros(info);
+        if (info->gramType==mxGramLogical)
+            *mx = mxCreateSparseLogicalMatrix(info->dataM, info->dataN, nElements);
+        else
+            *mx = mxCreateSparse(info->dataM, info->dataN, nElements,
+                    (info->gramFlags & MX_GRAM_FLAG_COMPLEX) ? mxCOMPLEX : mxREAL);
+        return(readMxSparseDataFromBytes(*mx, info, nBytes));
+        
+    } else if (isMxGramNumericType(info->gramType)) {
+        // every element gets overwritten, so skip zero-filling
+        *mx = mxCreateUninitNumericMatrix(info->dataM, info->dataN,
+                getMxClassForMxGramType(info->gramType),
+                (info->gramFlags & MX_GRAM_FLAG_COMPLEX) ? mxCOMPLEX : mxREAL);
+        return(readMxNumericDataFromBytes(*mx, info, nBytes));
+        
+    } else if (info->gramType==mxGramChar) {
+        dims[0] = info->dataM;
+        dims[1] = info->dataN;
+        *mx = mxCreateCharArray(2, dims);
+        return(readMxCharDataFromBytes(*mx, info, nBytes));
+        
+    } else if (info->gramType==mxGramLogical) {
+        *mx = mxCreateLogicalMatrix(info->dataM, info->dataN);
+        return(readMxLogicalDataFromBytes(*mx, info, nBytes));
+    }
+    return(-1);
+}
+
+int finishMxContainerGram(mxGramInfo *info, int nDataBytes, char *byteArray, int byteArrayLength) {
+    // use the compact legacy header whenever it can hold the info
+    //  otherwise make room for the wide header
+    setInfoHeadLength(info, nDataBytes);
+    if (info->headLength != MX_GRAM_INFO_HEAD) {
+        if (byteArrayLength - info->headLength < nDataBytes)
+            return(-1);
+        memmove(byteArray + info->headLength, info->dataBytes, nDataBytes);
+        info->dataBytes = byteArray + info->headLength;
+    }
+    writeInfoFieldsToBytes(info, byteArray, byteArrayLength);
+    return(info->gramLength);
+}
+
+int writeMxGramEmptyToBytes(char *byteArray, int byteArrayLength) {
+    mxGramInfo info;
+    setInfoFieldsForMatrix(&info, mxGramDouble, sizeof(double), 0, 0);
+    return(writeInfoFieldsToBytes(&info, byteArray, byteArrayLength));
+}
+
+int writeMxCompressedGramToBytes(const char *gramBytes, int gramLength, char *byteArray, int byteArrayLength) {
+    int nDataBytes;
+    mxGramInfo info;
+    
+    // compressed data follow the header, with the original length as dataN
+    setInfoFieldsForMatrix(&info, mxGramCompressed, 1, 1, gramLength);
+    if (byteArrayLength < MX_GRAM_INFO_HEAD)
+        return(-1);
+    info.dataBytes = byteArray + MX_GRAM_INFO_HEAD;
+    nDataBytes = compressMxGramBytes(gramBytes, gramLength,
+            info.dataBytes, byteArrayLength - MX_GRAM_INFO_HEAD);
+    if (nDataBytes < 0)
+        return(-1);
+    
+    info.dataLength = nDataBytes;
+    return(finishMxContainerGram(&info, nDataBytes, byteArray, byteArrayLength));
+}
+
+// serialize, and try compressing grams of at least compressThreshold bytes
+//  gramLength comes from mxGramSize(), byteArrayLength is the most to write
+int mxToBytesMaybeCompressed(const mxArray *mx, char *byteArray, int byteArrayLength,
+        double compressThreshold, int gramLength) {
+    char *rawBytes;
+    int nBytes, nCompressedBytes;
+    
+    if (gramLength <= 0)
+        return(-1);
+    
+    if (gramLength < compressThreshold) {
+        if (gramLength > byteArrayLength)
+            return(MX_GRAM_TOO_LONG);
+        return(mxToBytes(mx, byteArray, gramLength));
+    }
+    
+    // keep the compressed gram only if it comes out smaller
+    rawBytes = mxMalloc(gramLength);
+    nBytes = mxToBytes(mx, rawBytes, gramLength);
+    if (nBytes > 0) {
+        nCompressedBytes = writeMxCompressedGramToBytes(rawBytes, nBytes,
+                byteArray, nBytes-1 < byteArrayLength ? nBytes-1 : byteArrayLength);
+        if (nCompressedBytes > 0)
+            nBytes = nCompressedBytes;
+        else if (nBytes <= byteArrayLength)
+            memcpy(byteArray, rawBytes, nBytes);
+        else
+            nBytes = MX_GRAM_TOO_LONG;
+    }
+    mxFree(rawBytes);
+    return(nBytes);
+}
+
+int readMxCompressedGramFromBytes(mxArray **mx, mxGramInfo *info, int nBytes) {
+    int nGramBytes, nBytesRead;
+    char *gramBytes;
+    
+    // expand the original gram, then read it as usual
+    gramBytes = mxMalloc(info->dataN);
+    nGramBytes = decompressMxGramBytes(info->dataBytes, info->dataLength,
+            gramBytes, info->dataN);
+    if (nGramBytes != (int)info->dataN) {
+        mxFree(gramBytes);
+        return(-1);
+    }
+    
+    nBytesRead = bytesToMx(mx, gramBytes, nGramBytes);
+    mxFree(gramBytes);
+    if (nBytesRead != nGramBytes)
+        return(-1);
+    return(info->dataLength);
+}
+
+int writeMxPackedStructToBytes(const mxArray *mx, mxGramInfo *info, int nBytes) {
+    int ii;
+    int nFields = mxGetNumberOfFields(mx);
+    int nDataBytes = 0;
+    int fieldGramLength;
+    char *gramData = info->dataBytes;
+    char *nameData;
+    const char *fieldName;
+    size_t nameLength;
+    mxGramInfo namesInfo;
+    
+    // write all field names once, as one char gram of NUL-terminated names
+    setInfoFieldsForMatrix(&namesInfo, mxGramChar, 1, 1, getMxPackedStructNamesLength(mx));
+    if (nBytes < 0 || (size_t)nBytes < namesInfo.gramLength)
+        return(-1);
+    writeInfoFieldsToBytes(&namesInfo, gramData, nBytes);
+    nameData = gramData + namesInfo.headLength;
+    for (ii=0; ii<nFields; ii++) {
+        fieldName = mxGetFieldNameByNumber(mx, ii);
+        nameLength = strlen(fieldName) + 1;
+        memcpy(nameData, fieldName, nameLength);
+        nameData += nameLength;
+    }
+    nDataBytes += namesInfo.gramLength;
+    gramData += namesInfo.gramLength;
+    nBytes -= namesInfo.gramLength;
+    
+    // write one column gram for each field
+    for (ii=0; ii<nFields; ii++) {
+        fieldGramLength = writeMxPackedFieldToBytes(mx, ii, gramData, nBytes);
+        if (fieldGramLength < 0)
+            return(fieldGramLength);
+        
+        nDataBytes += fieldGramLength;
+        gramData += fieldGramLength;
+        nBytes -= fieldGramLength;
+    }
+    return(nDataBytes);
+}
+
+int writeMxPackedFieldToBytes(const mxArray *mx, int fieldNumber, char *byteArray, int byteArrayLength) {
+    size_t jj;
+    size_t numel = mxGetNumberOfElements(mx);
+    int nDataBytes = 0, nFreeBytes = 0;
+    int elementGramLength;
+    const mxArray *elementData;
+    char *elementByteArray;
+    mxGramInfo info;
+    
+    if (isMxPackedFieldColumnar(mx, fieldNumber)) {
+        // real scalars of one class go as a single 1xn array
+        elementData = mxGetFieldByNumber(mx, 0, fieldNumber);
+        setInfoFieldsForMatrix(&info, getMxGramTypeForMx(elementData),
+                mxGetElementSize(elementData), 1, numel);
+        if (byteArrayLength < 0 || (size_t)byteArrayLength < info.gramLength)
+            return(-1);
+        writeInfoFieldsToBytes(&info, byteArray, byteArrayLength);
+        
+        elementByteArray = byteArray + info.headLength;
+        for (jj=0; jj<numel; jj++) {
+            elementData = mxGetFieldByNumber(mx, jj, fieldNumber);
+            memcpy(elementByteArray, mxGetData(elementData), info.dataSize);
+            elementByteArray += info.dataSize;
+        }
+        return(info.gramLength);
+    }
+    
+    // anything else goes as a 1xn cell of elements
+    setInfoFieldsForMatrix(&info, mxGramCell, sizeof(mxArray*), 1, numel);
+    info.headLength = MX_GRAM_INFO_HEAD;
+    info.dataBytes = byteArray + info.headLength;
+    nFreeBytes = byteArrayLength - info.headLength;
+    if (nFreeBytes < 0)
+        return(-1);
+    
+    elementByteArray = info.dataBytes;
+    for (jj=0; jj<numel; jj++) {
+        elementData = mxGetFieldByNumber(mx, jj, fieldNumber);
+        elementGramLength = mxToBytes(elementData, elementByteArray, nFreeBytes);
+        if (elementGramLength < 0)
+            return(elementGramLength);
+        
+        nDataBytes += elementGramLength;
+        elementByteArray += elementGramLength;
+        nFreeBytes -= elementGramLength;
+    }
+    return(finishMxContainerGram(&info, nDataBytes, byteArray, byteArrayLength));
+}
+
+int readMxPackedStructFromBytes(mxArray **mx, mxGramInfo *info, int nBytes) {
+    int ii;
+    int nFields, nDataBytes = 0;
+    int columnBytesRead, status;
+    const char *gramData = info->dataBytes;
+    mxGramInfo namesInfo;
+    mxArray *column;
+    
+    // read field names from one char gram of NUL-terminated names
+    if (readInfoFieldsFromBytes(&namesInfo, gramData, nBytes) < 0
+            || namesInfo.gramType != mxGramChar
+            || namesInfo.dataSize != 1
+            || !hasMxGramDataBytes(&namesInfo, nBytes - namesInfo.headLength))
+        return(-1);
+    *mx = createMxPackedStruct(gramData + namesInfo.headLength,
+            namesInfo.dataLength, info->dataM, info->dataN);
+    if (*mx == NULL)
+        return(-1);
+    
+    nDataBytes += namesInfo.headLength + namesInfo.dataLength;
+    gramData += namesInfo.headLength + namesInfo.dataLength;
+    nBytes -= namesInfo.headLength + namesInfo.dataLength;
+    
+    // read one column gram for each field and spread it over elements
+    nFields = mxGetNumberOfFields(*mx);
+    for (ii=0; ii<nFields; ii++) {
+        columnBytesRead = bytesToMx(&column, gramData, nBytes);
+        if (columnBytesRead <= 0)
+            return(-1);
+        
+        status = setMxPackedFieldFromColumn(*mx, ii, column);
+        mxDestroyArray(column);
+        if (status < 0)
+            return(-1);
+        
+        nDataBytes += columnBytesRead;
+        gramData += columnBytesRead;
+        nBytes -= columnBytesRead;
+    }
+    return(nDataBytes);
+}
+
+mxArray *createMxPackedStruct(const char *nameData, size_t nNameBytes, size_t m, size_t n) {
+    int ii;
+    int nFields = 0;
+    size_t jj;
+    const char **fieldNames;
+    mwSize dims[2];
+    mxArray *mx;
+    
+    // each field name ends with NUL
+    if (nNameBytes > 0 && nameData[nNameBytes-1] != '\0')
+        return(NULL);
+    for (jj=0; jj<nNameBytes; jj++)
+        if (nameData[jj] == '\0')
+            nFields++;
+    
+    fieldNames = mxMalloc((nFields+1)*sizeof(char*));
+    for (ii=0; ii<nFields; ii++) {
+        fieldNames[ii] = nameData;
+        nameData += strlen(nameData) + 1;
+    }
+    dims[0] = m;
+    dims[1] = n;
+    mx = mxCreateStructArray(2, dims, nFields, fieldNames);
+    mxFree((void *)fieldNames);
+    return(mx);
+}
+
+int setMxPackedFieldFromColumn(mxArray *mx, int fieldNumber, mxArray *column) {
+    size_t jj, elementSize;
+    size_t numel = mxGetNumberOfElements(mx);
+    mxArray *elementData;
+    
+    if (mxGetNumberOfElements(column) != numel)
+        return(-1);
+    
+    if (mxIsCell(column)) {
+        // take elements from the cell
+        for (jj=0; jj<numel; jj++) {
+            elementData = mxGetCell(column, jj);
+            mxSetCell(column, jj, NULL);
+            mxSetFieldByNumber(mx, jj, fieldNumber, elementData);
+        }
+        
+    } else if ((mxIsNumeric(column) || mxIsLogical(column))
+            && !mxIsComplex(column) && !mxIsSparse(column)) {
+        // split the array into scalars
+        elementSize = mxGetElementSize(column);
+        for (jj=0; jj<numel; jj++) {
+            if (mxIsLogical(column))
+                elementData = mxCreateLogicalMatrix(1, 1);
+            else
+                elementData = mxCreateUninitNumericMatrix(1, 1, mxGetClassID(column), mxREAL);
+            memcpy(mxGetData(elementData), (char *)mxGetData(column) + jj*elementSize, elementSize);
+            mxSetFieldByNumber(mx, jj, fieldNumber, elementData);
+        }
+        
+    } else
+        return(-1);
+    
+    return(0);
+}
+
+int getMxPackedStructDataSize(const mxArray *mx) {
+    int ii;
+    int nFields = mxGetNumberOfFields(mx);
+    int fieldGramLength;
+    size_t nDataBytes = 0;
+    mxGramInfo namesInfo;
+    
+    setInfoFieldsForMatrix(&namesInfo, mxGramChar, 1, 1, getMxPackedStructNamesLength(mx));
+    nDataBytes += namesInfo.gramLength;
+    
+    for (ii=0; ii<nFields; ii++) {
+        fieldGramLength = getMxPackedFieldSize(mx, ii);
+        if (fieldGramLength < 0)
+            return(fieldGramLength);
+        nDataBytes += fieldGramLength;
+    }
+    
+    if (nDataBytes > INT_MAX)
+        return(-1);
+    return((int)nDataBytes);
+}
+
+int getMxPackedFieldSize(const mxArray *mx, int fieldNumber) {
+    size_t jj;
+    size_t numel = mxGetNumberOfElements(mx);
+    int elementGramLength;
+    size_t nDataBytes = 0;
+    mxGramInfo info;
+    
+    if (isMxPackedFieldColumnar(mx, fieldNumber)) {
+        setInfoFieldsForMatrix(&info, mxGramDouble,
+                mxGetElementSize(mxGetFieldByNumber(mx, 0, fieldNumber)), 1, numel);
+        return(info.gramLength);
+    }
+    
+    setInfoFieldsForMatrix(&info, mxGramCell, sizeof(mxArray*), 1, numel);
+    for (jj=0; jj<numel; jj++) {
+        elementGramLength = mxGramSize(mxGetFieldByNumber(mx, jj, fieldNumber));
+        if (elementGramLength < 0)
+            return(elementGramLength);
+        nDataBytes += elementGramLength;
+    }
+    
+    setInfoHeadLength(&info, nDataBytes);
+    if (nDataBytes > INT_MAX - MX_GRAM_WIDE_INFO_HEAD)
+        return(-1);
+    return(info.headLength + (int)nDataBytes);
+}
+
+size_t getMxPackedStructNamesLength(const mxArray *mx) {
+    int ii;
+    int nFields = mxGetNumberOfFields(mx);
+    size_t namesLength = 0;
+    for (ii=0; ii<nFields; ii++)
+        namesLength += strlen(mxGetFieldNameByNumber(mx, ii)) + 1;
+    return(namesLength);
+}
+
+int isMxPackedFieldColumnar(const mxArray *mx, int fieldNumber) {
+    size_t jj;
+    size_t numel = mxGetNumberOfElements(mx);
+    const mxArray *firstData, *elementData;
+    
+    if (numel == 0)
+        return(0);
+    
+    firstData = mxGetFieldByNumber(mx, 0, fieldNumber);
+    if (firstData == NULL || !(mxIsNumeric(firstData) || mxIsLogical(firstData)))
+        return(0);
+    
+    for (jj=0; jj<numel; jj++) {
+        elementData = mxGetFieldByNumber(mx, jj, fieldNumber);
+        if (elementData == NULL
+                || mxGetClassID(elementData) != mxGetClassID(firstData)
+                || mxGetNumberOfElements(elementData) != 1
+                || mxIsComplex(elementData)
+                || mxIsSparse(elementData))
+            return(0);
+    }
+    return(1);
+}
+
 void setInfoFieldsFromMx(mxGramInfo *info, const mxArray *mx) {
+    size_t nElements;
+    size_t nParts;
+    
     info->gramType = (MX_GRAM_UINT16)getMxGramTypeForMx(mx);
+    info->gramFlags = getMxGramFlagsForMx(mx);
     info->dataSize = (MX_GRAM_UINT16)mxGetElementSize(mx);
-    info->dataM = (MX_GRAM_UINT16)mxGetM(mx);
-    info->dataN = (MX_GRAM_UINT16)mxGetN(mx);
-    info->dataLength = (MX_GRAM_UINT16)(info->dataSize*info->dataM*info->dataN);
+    info->dataM = (MX_GRAM_UINT32)mxGetM(mx);
+    info->dataN = (MX_GRAM_UINT32)mxGetN(mx);
+    
+    // plain ASCII text can go as 1-byte chars
+    if (info->gramType==mxGramChar
+            && isMxCharNarrow(mxGetChars(mx), (size_t)info->dataM * info->dataN))
+        info->dataSize = 1;
+    
+    // complex data have real and imaginary parts
+    nParts = (info->gramFlags & MX_GRAM_FLAG_COMPLEX) ? 2 : 1;
+    
+    if (info->gramFlags & MX_GRAM_FLAG_SPARSE) {
+        // column indexes, row indexes, and nonzero elements
+        nElements = mxGetJc(mx)[info->dataN];
+        info->dataLength = (MX_GRAM_UINT32)(
+                MX_GRAM_INDEX_SIZE*(info->dataN + 1 + nElements)
+                + info->dataSize*nParts*nElements);
+    } else {
+        nElements = (size_t)info->dataM * info->dataN;
+        info->dataLength = (MX_GRAM_UINT32)(info->dataSize*nParts*nElements);
+    }
+    
+    // legacy struct arrays resized to 1xn, with m fields
+    if (info->gramType==mxGramStruct) {
+        info->dataM = (MX_GRAM_UINT32)mxGetNumberOfFields(mx);
+        info->dataN = (MX_GRAM_UINT32)(mxGetM(mx) * mxGetN(mx));
+    }
+    
+    setInfoHeadLength(info, info->dataLength);
+}
+
+void setInfoFieldsForMatrix(mxGramInfo *info, mxGramType gramType, size_t dataSize, size_t m, size_t n) {
+    info->gramType = (MX_GRAM_UINT16)gramType;
+    info->gramFlags = 0;
+    info->dataSize = (MX_GRAM_UINT16)dataSize;
+    info->dataM = (MX_GRAM_UINT32)m;
+    info->dataN = (MX_GRAM_UINT32)n;
+    info->dataLength = (MX_GRAM_UINT32)(dataSize*m*n);
+    setInfoHeadLength(info, info->dataLength);
+}
+
+void setInfoHeadLength(mxGramInfo *info, size_t nDataBytes) {
+    // choose the legacy header unless the data are too big for it
+    info->headLength = MX_GRAM_INFO_HEAD;
+    info->gramLength = (MX_GRAM_UINT32)(info->headLength + nDataBytes);
+    if (!isLegacyInfo(info)) {
+        info->headLength = MX_GRAM_WIDE_INFO_HEAD;
+        info->gramLength = (MX_GRAM_UINT32)(info->headLength + nDataBytes);
+    }
 }
 
 int readInfoFieldsFromBytes(mxGramInfo *info, const char *byteArray, int byteArrayLength) {
-    if (byteArrayLength >= MX_GRAM_INFO_HEAD) {
+    MX_GRAM_UINT16 firstField;
+    
+    if (byteArrayLength < MX_GRAM_INFO_HEAD)
+        return(-1);
+    
+    // a legacy gramLength can't be smaller than the legacy header
+    firstField = readInt16FromBytes(byteArray);
+    if (firstField >= MX_GRAM_INFO_HEAD) {
+        info->headLength = MX_GRAM_INFO_HEAD;
         info->gramLength = readInt16FromBytes(byteArray+MX_GRAM_OFFSET_GRAMLENGTH);
         info->gramType = readInt16FromBytes(byteArray+MX_GRAM_OFFSET_GRAMTYPE);
+        info->gramFlags = info->gramType & ~MX_GRAM_TYPE_MASK;
+        info->gramType &= MX_GRAM_TYPE_MASK;
         info->dataLength = readInt16FromBytes(byteArray+MX_GRAM_OFFSET_DATALENGTH);
         info->dataSize = readInt16FromBytes(byteArray+MX_GRAM_OFFSET_DATASIZE);
         info->dataM = readInt16FromBytes(byteArray+MX_GRAM_OFFSET_M);
         info->dataN = readInt16FromBytes(byteArray+MX_GRAM_OFFSET_N);
         return(MX_GRAM_INFO_HEAD);
+        
+    } else if (firstField == MX_GRAM_WIDE_VERSION
+            && byteArrayLength >= MX_GRAM_WIDE_INFO_HEAD) {
+        info->headLength = MX_GRAM_WIDE_INFO_HEAD;
+        info->gramType = readInt16FromBytes(byteArray+MX_GRAM_WIDE_OFFSET_GRAMTYPE);
+        info->gramFlags = info->gramType & ~MX_GRAM_TYPE_MASK;
+        info->gramType &= MX_GRAM_TYPE_MASK;
+        info->dataSize = readInt16FromBytes(byteArray+MX_GRAM_WIDE_OFFSET_DATASIZE);
+        info->gramLength = readInt32FromBytes(byteArray+MX_GRAM_WIDE_OFFSET_GRAMLENGTH);
+        info->dataLength = readInt32FromBytes(byteArray+MX_GRAM_WIDE_OFFSET_DATALENGTH);
+        info->dataM = readInt32FromBytes(byteArray+MX_GRAM_WIDE_OFFSET_M);
+        info->dataN = readInt32FromBytes(byteArray+MX_GRAM_WIDE_OFFSET_N);
+        return(MX_GRAM_WIDE_INFO_HEAD);
+        
     } else
         return(-1);
 }
 
 int writeInfoFieldsToBytes(const mxGramInfo *info, char *byteArray, int byteArrayLength) {
-    if (byteArrayLength >= MX_GRAM_INFO_HEAD) {
+    if (info->headLength == MX_GRAM_INFO_HEAD
+            && byteArrayLength >= MX_GRAM_INFO_HEAD) {
         writeInt16ToBytes(info->gramLength, byteArray+MX_GRAM_OFFSET_GRAMLENGTH);
-        writeInt16ToBytes(info->gramType, byteArray+MX_GRAM_OFFSET_GRAMTYPE);
+        writeInt16ToBytes(info->gramType | info->gramFlags, byteArray+MX_GRAM_OFFSET_GRAMTYPE);
         writeInt16ToBytes(info->dataLength, byteArray+MX_GRAM_OFFSET_DATALENGTH);
         writeInt16ToBytes(info->dataSize, byteArray+MX_GRAM_OFFSET_DATASIZE);
         writeInt16ToBytes(info->dataM, byteArray+MX_GRAM_OFFSET_M);
         writeInt16ToBytes(info->dataN, byteArray+MX_GRAM_OFFSET_N);
         return(MX_GRAM_INFO_HEAD);
+        
+    } else if (info->headLength == MX_GRAM_WIDE_INFO_HEAD
+            && byteArrayLength >= MX_GRAM_WIDE_INFO_HEAD) {
+        writeInt16ToBytes(MX_GRAM_WIDE_VERSION, byteArray+MX_GRAM_WIDE_OFFSET_VERSION);
+        writeInt16ToBytes(info->gramType | info->gramFlags, byteArray+MX_GRAM_WIDE_OFFSET_GRAMTYPE);
+        writeInt16ToBytes(info->dataSize, byteArray+MX_GRAM_WIDE_OFFSET_DATASIZE);
+        writeInt16ToBytes(0, byteArray+MX_GRAM_WIDE_OFFSET_RESERVED);
+        writeInt32ToBytes(info->gramLength, byteArray+MX_GRAM_WIDE_OFFSET_GRAMLENGTH);
+        writeInt32ToBytes(info->dataLength, byteArray+MX_GRAM_WIDE_OFFSET_DATALENGTH);
+        writeInt32ToBytes(info->dataM, byteArray+MX_GRAM_WIDE_OFFSET_M);
+        writeInt32ToBytes(info->dataN, byteArray+MX_GRAM_WIDE_OFFSET_N);
+        return(MX_GRAM_WIDE_INFO_HEAD);
+        
     } else
         return(-1);
 }
 
-int writeMxDoubleDataToBytes(const mxArray *mx, mxGramInfo *info, int nBytes) {
-    int ii;
-    int numel = info->dataM * info->dataN;
-    double* mxData = mxGetPr(mx);
+int hasMxGramDataBytes(const mxGramInfo *info, int nBytes) {
+    size_t numel = (size_t)info->dataM * info->dataN;
+    size_t nParts = (info->gramFlags & MX_GRAM_FLAG_COMPLEX) ? 2 : 1;
+    
+    // containers check each element as they go
+    if (isMxGramContainerType(info->gramType))
+        return(1);
+    
+    if (nBytes < 0 || info->dataLength > (size_t)nBytes || info->dataSize == 0)
+        return(0);
+    
+    // compressed data hold one gram, and can't expand without limit
+    if (info->gramType==mxGramCompressed)
+        return(info->dataM == 1 && info->dataN > 0
+                && info->dataN / MX_GRAM_LZ_MAX_RATIO <= info->dataLength);
+    
+    // schema data start with a layout hash and any layout
+    if (info->gramType==mxGramSchema)
+        return(info->dataM < MX_GRAM_MAX_SCHEMAS
+                && (size_t)MX_GRAM_SCHEMA_HASH_LENGTH + info->dataN <= info->dataLength);
+    
+    // sparse data need at least their column indexes
+    if (info->gramFlags & MX_GRAM_FLAG_SPARSE)
+        return(MX_GRAM_INDEX_SIZE*((size_t)info->dataN + 1) <= info->dataLength);
+    
+    // dense data take at least one byte per element, and fill dataLength
+    if (numel > info->dataLength)
+        return(0);
+    return(info->dataSize*nParts*numel == info->dataLength);
+}
+
+int isLegacyInfo(const mxGramInfo *info) {
+    return(info->gramLength <= MX_GRAM_INFO_MAX
+            && info->dataLength <= MX_GRAM_INFO_MAX
+            && info->dataM <= MX_GRAM_INFO_MAX
+            && info->dataN <= MX_GRAM_INFO_MAX);
+}
+
+int writeMxNumericDataToBytes(const mxArray *mx, mxGramInfo *info, int nBytes) {
+    size_t numel = (size_t)info->dataM * info->dataN;
+    int isComplex = (info->gramFlags & MX_GRAM_FLAG_COMPLEX) != 0;
+    size_t nDataBytes = info->dataSize * numel * (isComplex ? 2 : 1);
+    
+    if (nBytes >= 0 && (size_t)nBytes >= nDataBytes) {
+        writeMxElementsToBytes(mx, numel, info->dataSize, isComplex, info->dataBytes);
+        return((int)nDataBytes);
+    } else
+        return(-1);
+}
+
+int readMxNumericDataFromBytes(mxArray *mx, mxGramInfo *info, int nBytes) {
+    size_t numel = (size_t)info->dataM * info->dataN;
+    int isComplex = (info->gramFlags & MX_GRAM_FLAG_COMPLEX) != 0;
+    size_t nDataBytes = info->dataSize * numel * (isComplex ? 2 : 1);
+    
+    if (info->dataSize == mxGetElementSize(mx)
+            && nBytes >= 0 && (size_t)nBytes >= nDataBytes) {
+        readMxElementsFromBytes(mx, numel, info->dataSize, isComplex, info->dataBytes);
+        return((int)nDataBytes);
+    } else
+        return(-1);
+}
+
+int writeMxSparseDataToBytes(const mxArray *mx, mxGramInfo *info, int nBytes) {
+    size_t ii;
+    size_t nCols = info->dataN;
+    mwIndex *jc = mxGetJc(mx);
+    mwIndex *ir = mxGetIr(mx);
+    size_t nnz = jc[nCols];
+    int isComplex = (info->gramFlags & MX_GRAM_FLAG_COMPLEX) != 0;
+    size_t nDataBytes = MX_GRAM_INDEX_SIZE*(nCols + 1 + nnz)
+            + info->dataSize * nnz * (isComplex ? 2 : 1);
     char *gramData = info->dataBytes;
     
-    if (nBytes >= info->dataSize*numel) {
-        // write 8-byte doubles to data bytes
-        for(ii=0; ii<numel; ii++) {
-            writeDouble64ToBytes(mxData[ii], gramData);
-            gramData += info->dataSize;
+    if (nBytes >= 0 && (size_t)nBytes >= nDataBytes) {
+        // write column starts and row indexes as uint32
+        for(ii=0; ii<=nCols; ii++) {
+            writeInt32ToBytes((MX_GRAM_UINT32)jc[ii], gramData);
+            gramData += MX_GRAM_INDEX_SIZE;
         }
-        return(info->dataSize*numel);
+        for(ii=0; ii<nnz; ii++) {
+            writeInt32ToBytes((MX_GRAM_UINT32)ir[ii], gramData);
+            gramData += MX_GRAM_INDEX_SIZE;
+        }
+        
+        // write nonzero elements
+        writeMxElementsToBytes(mx, nnz, info->dataSize, isComplex, gramData);
+        return((int)nDataBytes);
     } else
         return(-1);
 }
 
-int readMxDoubleDataFromBytes(mxArray *mx, mxGramInfo *info, int nBytes) {
-    int ii;
-    int numel = info->dataM * info->dataN;
-    double* mxData = mxGetPr(mx);
+int readMxSparseDataFromBytes(mxArray *mx, mxGramInfo *info, int nBytes) {
+    size_t ii, kk;
+    size_t nCols = info->dataN;
+    mwIndex *jc = mxGetJc(mx);
+    mwIndex *ir = mxGetIr(mx);
+    size_t nnz = getMxGramSparseNonzeros(info);
+    int isComplex = (info->gramFlags & MX_GRAM_FLAG_COMPLEX) != 0;
+    size_t nDataBytes = MX_GRAM_INDEX_SIZE*(nCols + 1 + nnz)
+            + info->dataSize * nnz * (isComplex ? 2 : 1);
     const char *gramData = info->dataBytes;
     
-    if (nBytes >= mxGetElementSize(mx)*numel) {
-        // read 8-byte doubles from data bytes
-        for(ii=0; ii<numel; ii++) {
-            mxData[ii] = readDouble64FromBytes(gramData);
-            gramData += info->dataSize;
+    if (info->dataSize == mxGetElementSize(mx)
+            && nDataBytes == info->dataLength
+            && nBytes >= 0 && (size_t)nBytes >= nDataBytes) {
+        // read column starts and row indexes from uint32
+        for(ii=0; ii<=nCols; ii++) {
+            jc[ii] = readInt32FromBytes(gramData);
+            gramData += MX_GRAM_INDEX_SIZE;
+        }
+        for(ii=0; ii<nnz; ii++) {
+            ir[ii] = readInt32FromBytes(gramData);
+            gramData += MX_GRAM_INDEX_SIZE;
+        }
+        if (jc[0] != 0 || jc[nCols] != nnz)
+            return(-1);
+        
+        // Matlab trusts sparse indexes, so check them all
+        //  columns start in order, rows are in range and in order
+        for(ii=0; ii<nCols; ii++) {
+            if (jc[ii] > jc[ii+1])
+                return(-1);
+        }
+        for(ii=0; ii<nCols; ii++) {
+            for(kk=jc[ii]; kk<jc[ii+1]; kk++) {
+                if (ir[kk] >= info->dataM
+                        || (kk > jc[ii] && ir[kk] <= ir[kk-1]))
+                    return(-1);
+            }
         }
-        return(info->dataSize*numel);
+        
+        // read nonzero elements
+        readMxElementsFromBytes(mx, nnz, info->dataSize, isComplex, gramData);
+        return((int)nDataBytes);
     } else
         return(-1);
 }
 
+size_t getMxGramSparseNonzeros(const mxGramInfo *info) {
+    // dataLength covers indexes plus nonzero elements
+    size_t nParts = (info->gramFlags & MX_GRAM_FLAG_COMPLEX) ? 2 : 1;
+    size_t nIndexBytes = MX_GRAM_INDEX_SIZE*((size_t)info->dataN + 1);
+    size_t nElementBytes = MX_GRAM_INDEX_SIZE + info->dataSize*nParts;
+    if (info->dataLength < nIndexBytes)
+        return(0);
+    return((info->dataLength - nIndexBytes) / nElementBytes);
+}
+
+void writeMxElementsToBytes(const mxArray *mx, size_t numel, size_t elementSize, int isComplex, char *gramData) {
+    const char *realData = (const char *)mxGetData(mx);
+#if !MX_HAS_INTERLEAVED_COMPLEX
+    const char *imagData;
+    size_t ii;
+#endif
+    
+    if (numel == 0)
+        return;
+    
+    if (!isComplex) {
+        // write all elements with one block copy
+        memcpy(gramData, realData, numel*elementSize);
+        
+    } else {
+#if MX_HAS_INTERLEAVED_COMPLEX
+        // real and imaginary parts are already interleaved
+        memcpy(gramData, realData, 2*numel*elementSize);
+#else
+        // interleave separate real and imaginary parts
+        imagData = (const char *)mxGetImagData(mx);
+        for(ii=0; ii<numel; ii++) {
+            memcpy(gramData, realData + ii*elementSize, elementSize);
+            gramData += elementSize;
+            memcpy(gramData, imagData + ii*elementSize, elementSize);
+            gramData += elementSize;
+        }
+#endif
+    }
+}
+
+void readMxElementsFromBytes(mxArray *mx, size_t numel, size_t elementSize, int isComplex, const char *gramData) {
+    char *realData = (char *)mxGetData(mx);
+#if !MX_HAS_INTERLEAVED_COMPLEX
+    char *imagData;
+    size_t ii;
+#endif
+    
+    if (numel == 0)
+        return;
+    
+    if (!isComplex) {
+        // read all elements with one block copy
+        memcpy(realData, gramData, numel*elementSize);
+        
+    } else {
+#if MX_HAS_INTERLEAVED_COMPLEX
+        // real and imaginary parts stay interleaved
+        memcpy(realData, gramData, 2*numel*elementSize);
+#else
+        // separate interleaved real and imaginary parts
+        imagData = (char *)mxGetImagData(mx);
+        for(ii=0; ii<numel; ii++) {
+            memcpy(realData + ii*elementSize, gramData, elementSize);
+            gramData += elementSize;
+            memcpy(imagData + ii*elementSize, gramData, elementSize);
+            gramData += elementSize;
+        }
+#endif
+    }
+}
+
 int writeMxCharDataToBytes(const mxArray *mx, mxGramInfo *info, int nBytes) {
-    int ii;
-    int numel = info->dataM * info->dataN;
+    size_t numel = (size_t)info->dataM * info->dataN;
+    size_t nDataBytes = info->dataSize * numel;
     mxChar* mxData = mxGetChars(mx);
     char *gramData = info->dataBytes;
     
-    if (nBytes >= info->dataSize*numel) {
-        // write 1- or 2-byte chars to data bytes
-        for(ii=0; ii<numel; ii++) {
-            *((mxChar*)gramData) = mxData[ii];
-            gramData += info->dataSize;
+    if (nBytes >= 0 && (size_t)nBytes >= nDataBytes) {
+        if (info->dataSize == 1) {
+            // write narrow 1-byte chars to data bytes
+            narrowMxCharsToBytes(mxData, gramData, numel);
+            
+        } else if (numel > 0) {
+            // write 2-byte chars with one block copy
+            memcpy(gramData, mxData, nDataBytes);
         }
-        return(info->dataSize*numel);
+        return((int)nDataBytes);
     } else
         return(-1);
 }
 
 int readMxCharDataFromBytes(mxArray *mx, mxGramInfo *info, int nBytes) {
-    int ii;
-    int numel = info->dataM * info->dataN;
+    size_t numel = (size_t)info->dataM * info->dataN;
+    size_t nDataBytes = info->dataSize * numel;
     mxChar* mxData = mxGetChars(mx);
     const char *gramData = info->dataBytes;
     
-    if (nBytes >= mxGetElementSize(mx)*numel) {
+    if (nBytes >= 0 && (size_t)nBytes >= nDataBytes) {
         if (info->dataSize == 1) {
             // read 1-byte characters from data bytes
-            for(ii=0; ii<numel; ii++) {
-                mxData[ii] = *gramData;
-                gramData += info->dataSize;
-            }
+            widenBytesToMxChars(gramData, mxData, numel);
             
-        } else {
-            // read 2-byte characters from data bytes
-            for(ii=0; ii<numel; ii++) {
-                mxData[ii] = *((mxChar*)gramData);
-                gramData += info->dataSize;
-            }
-        }
-        return(info->dataSize*numel);
+        } else if (info->dataSize == sizeof(mxChar)) {
+            // read 2-byte characters with one block copy
+            if (numel > 0)
+                memcpy(mxData, gramData, nDataBytes);
+            
+        } else
+            return(-1);
+        
+        return((int)nDataBytes);
     } else
         return(-1);
 }
 
 int writeMxLogicalDataToBytes(const mxArray *mx, mxGramInfo *info, int nBytes) {
-    int ii;
-    int numel = info->dataM * info->dataN;
+    size_t numel = (size_t)info->dataM * info->dataN;
+    size_t nDataBytes = info->dataSize * numel;
     mxLogical *mxData = mxGetLogicals(mx);
     char *gramData = info->dataBytes;
     
-    if (nBytes >= info->dataSize*numel) {
-        for(ii=0; ii<numel; ii++) {
-            *((mxLogical*)gramData) = mxData[ii];
-            gramData += info->dataSize;
-        }
-        return(info->dataSize*numel);
+    if (nBytes >= 0 && (size_t)nBytes >= nDataBytes) {
+        // write 1-byte logicals with one block copy
+        if (numel > 0)
+            memcpy(gramData, mxData, nDataBytes);
+        return((int)nDataBytes);
     } else
         return(-1);
 }
 
 int readMxLogicalDataFromBytes(mxArray *mx, mxGramInfo *info, int nBytes) {
-    int ii;
-    int numel = info->dataM * info->dataN;
+    size_t numel = (size_t)info->dataM * info->dataN;
+    size_t nDataBytes = info->dataSize * numel;
     mxLogical *mxData = mxGetLogicals(mx);
     const char *gramData = info->dataBytes;
     
-    if (nBytes >= mxGetElementSize(mx)*numel) {
-        for(ii=0; ii<numel; ii++) {
-            mxData[ii] = (mxLogical)*gramData;
-            gramData += info->dataSize;
-        }
-        return(info->dataSize*numel);
+    if (info->dataSize == sizeof(mxLogical)
+            && nBytes >= 0 && (size_t)nBytes >= nDataBytes) {
+        // read 1-byte logicals with one block copy
+        if (numel > 0)
+            memcpy(mxData, gramData, nDataBytes);
+        return((int)nDataBytes);
     } else
         return(-1);
 }
 
+int isMxCharNarrow(const mxChar *chars, size_t numel) {
+    size_t ii = 0;
+    mxChar bits = 0;
+#if MX_GRAM_SSE2
+    __m128i highBits = _mm_set1_epi16((short)MX_GRAM_CHAR_WIDE_BITS);
+    __m128i orBits = _mm_setzero_si128();
+    
+    // accumulate the bits of 8 chars at a time
+    for (; ii+8 <= numel; ii+=8)
+        orBits = _mm_or_si128(orBits, _mm_loadu_si128((const __m128i*)(chars+ii)));
+    
+    orBits = _mm_cmpeq_epi16(_mm_and_si128(orBits, highBits), _mm_setzero_si128());
+    if (_mm_movemask_epi8(orBits) != 0xffff)
+        return(0);
+#endif
+    for (; ii<numel; ii++)
+        bits |= chars[ii];
+    return((bits & MX_GRAM_CHAR_WIDE_BITS) == 0);
+}
+
+void narrowMxCharsToBytes(const mxChar *chars, char *bytes, size_t numel) {
+    size_t ii = 0;
+#if MX_GRAM_SSE2
+    __m128i low, high;
+    
+    // pack 16 chars at a time, which must already be narrow
+    for (; ii+16 <= numel; ii+=16) {
+        low = _mm_loadu_si128((const __m128i*)(chars+ii));
+        high = _mm_loadu_si128((const __m128i*)(chars+ii+8));
+        _mm_storeu_si128((__m128i*)(bytes+ii), _mm_packus_epi16(low, high));
+    }
+#endif
+    for (; ii<numel; ii++)
+        bytes[ii] = (char)chars[ii];
+}
+
+void widenBytesToMxChars(const char *bytes, mxChar *chars, size_t numel) {
+    size_t ii = 0;
+#if MX_GRAM_SSE2
+    __m128i packed;
+    __m128i zero = _mm_setzero_si128();
+    
+    // unpack 16 bytes at a time
+    for (; ii+16 <= numel; ii+=16) {
+        packed = _mm_loadu_si128((const __m128i*)(bytes+ii));
+        _mm_storeu_si128((__m128i*)(chars+ii), _mm_unpacklo_epi8(packed, zero));
+        _mm_storeu_si128((__m128i*)(chars+ii+8), _mm_unpackhi_epi8(packed, zero));
+    }
+#endif
+    for (; ii<numel; ii++)
+        chars[ii] = (MX_GRAM_UINT8)bytes[ii];
+}
+
+int setMxGramStructPacking(int isPacked) {
+    int wasPacked = isMxGramStructPacked;
+    isMxGramStructPacked = isPacked;
+    return(wasPacked);
+}
+
 mxGramType getMxGramTypeForMx(const mxArray *mx) {
     mxClassID mxType = mxGetClassID(mx);
     if (mxType==mxDOUBLE_CLASS) return(mxGramDouble);
     else if (mxType==mxLOGICAL_CLASS) return(mxGramLogical);
     else if (mxType==mxCHAR_CLASS) return(mxGramChar);
     else if (mxType==mxCELL_CLASS) return(mxGramCell);
-    else if (mxType==mxSTRUCT_CLASS) return(mxGramStruct);
+    else if (mxType==mxSTRUCT_CLASS) return(isMxGramStructPacked ? mxGramPackedStruct : mxGramStruct);
     else if (mxType==mxFUNCTION_CLASS) return(mxGramFunctionHandle);
+    else if (mxType==mxSINGLE_CLASS) return(mxGramSingle);
+    else if (mxType==mxINT8_CLASS) return(mxGramInt8);
+    else if (mxType==mxUINT8_CLASS) return(mxGramUint8);
+    else if (mxType==mxINT16_CLASS) return(mxGramInt16);
+    else if (mxType==mxUINT16_CLASS) return(mxGramUint16);
+    else if (mxType==mxINT32_CLASS) return(mxGramInt32);
+    else if (mxType==mxUINT32_CLASS) return(mxGramUint32);
+    else if (mxType==mxINT64_CLASS) return(mxGramInt64);
+    else if (mxType==mxUINT64_CLASS) return(mxGramUint64);
     else return(mxGramUnsupported);
 }
 
+MX_GRAM_UINT16 getMxGramFlagsForMx(const mxArray *mx) {
+    MX_GRAM_UINT16 flags = 0;
+    if (mxIsComplex(mx)) flags |= MX_GRAM_FLAG_COMPLEX;
+    if (mxIsSparse(mx)) flags |= MX_GRAM_FLAG_SPARSE;
+    return(flags);
+}
+
+mxClassID getMxClassForMxGramType(mxGramType gramType) {
+    if (gramType==mxGramDouble) return(mxDOUBLE_CLASS);
+    else if (gramType==mxGramSingle) return(mxSINGLE_CLASS);
+    else if (gramType==mxGramInt8) return(mxINT8_CLASS);
+    else if (gramType==mxGramUint8) return(mxUINT8_CLASS);
+    else if (gramType==mxGramInt16) return(mxINT16_CLASS);
+    else if (gramType==mxGramUint16) return(mxUINT16_CLASS);
+    else if (gramType==mxGramInt32) return(mxINT32_CLASS);
+    else if (gramType==mxGramUint32) return(mxUINT32_CLASS);
+    else if (gramType==mxGramInt64) return(mxINT64_CLASS);
+    else if (gramType==mxGramUint64) return(mxUINT64_CLASS);
+    else return(mxUNKNOWN_CLASS);
+}
+
+int isMxGramContainerType(mxGramType gramType) {
+    return(gramType==mxGramCell
+            || gramType==mxGramStruct
+            || gramType==mxGramPackedStruct
+            || gramType==mxGramFunctionHandle);
+}
+
+int isMxGramSimpleType(const mxGramInfo *info) {
+    return((info->gramFlags & MX_GRAM_FLAG_SPARSE)
+            || isMxGramNumericType(info->gramType)
+            || info->gramType==mxGramChar
+            || info->gramType==mxGramLogical);
+}
+
+int isMxGramNumericType(mxGramType gramType) {
+    return(getMxClassForMxGramType(gramType) != mxUNKNOWN_CLASS);
+}
+
 void writeInt16ToBytes(const MX_GRAM_UINT16 sourceInt, char* bytes) {
     // little endian
     bytes[0] = (MX_GRAM_UINT8)(sourceInt%256);
@@ -404,6 +1291,23 @@ void writeDouble64ToBytes(const double sourceDouble, char* bytes) {
     memcpy((void*)bytes, (const void*)&sourceDouble, 8);
 }
 
+void writeInt32ToBytes(const MX_GRAM_UINT32 sourceInt, char* bytes) {
+    // little endian
+    bytes[0] = (MX_GRAM_UINT8)(sourceInt & 0xff);
+    bytes[1] = (MX_GRAM_UINT8)((sourceInt >> 8) & 0xff);
+    bytes[2] = (MX_GRAM_UINT8)((sourceInt >> 16) & 0xff);
+    bytes[3] = (MX_GRAM_UINT8)((sourceInt >> 24) & 0xff);
+}
+
+MX_GRAM_UINT32 readInt32FromBytes(const char* bytes) {
+    // little endian
+    MX_GRAM_UINT32 readInt = (MX_GRAM_UINT32)(MX_GRAM_UINT8)bytes[0]
+            + ((MX_GRAM_UINT32)(MX_GRAM_UINT8)bytes[1] << 8)
+            + ((MX_GRAM_UINT32)(MX_GRAM_UINT8)bytes[2] << 16)
+            + ((MX_GRAM_UINT32)(MX_GRAM_UINT8)bytes[3] << 24);
+    return(readInt);
+}
+
 double readDouble64FromBytes(const char* bytes) {
     double readDouble;
     memcpy((void*)&readDouble, (const void*)bytes, 8);
@@ -412,12 +1316,13 @@ double readDouble64FromBytes(const char* bytes) {
 
 void printMxGramInfo(const mxGramInfo *info) {
     mexPrintf("mxGramInfo:\n");
-    mexPrintf(" gramLength = %d\n", info->gramLength);
-    mexPrintf(" gramType = %d\n", info->gramType);
-    mexPrintf(" dataLength = %d\n", info->dataLength);
-    mexPrintf(" dataSize = %d\n", info->dataSize);
-    mexPrintf(" dataM = %d\n", info->dataM);
-    mexPrintf(" dataN = %d\n", info->dataN);
+    mexPrintf(" headLength = %u\n", info->headLength);
+    mexPrintf(" gramLength = %u\n", info->gramLength);
+    mexPrintf(" gramType = %u\n", info->gramType);
+    mexPrintf(" dataLength = %u\n", info->dataLength);
+    mexPrintf(" dataSize = %u\n", info->dataSize);
+    mexPrintf(" dataM = %u\n", info->dataM);
+    mexPrintf(" dataN = %u\n", info->dataN);
 }
 
 void printBytes(const char *bytes, int nBytes) {
@@ -15,15 +15,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include "mex.h"
 
 // use fixed-width types worked out by Matlab
 #include "tmwtypes.h"
+#define MX_GRAM_UINT32 uint32_T
 #define MX_GRAM_UINT16 uint16_T
 #define MX_GRAM_UINT8 uint8_T
 
-// declare the fixed structure of the mxGram byte header
+// declare the fixed structure of the legacy mxGram byte header
 #define MX_GRAM_OFFSET_GRAMLENGTH 0
 #define MX_GRAM_OFFSET_GRAMTYPE 2
 #define MX_GRAM_OFFSET_DATALENGTH 4
@@ -33,23 +35,172 @@
 #define MX_GRAM_OFFSET_DATA 12
 #define MX_GRAM_FIELD_SIZE 2
 #define MX_GRAM_INFO_HEAD 12
+#define MX_GRAM_INFO_MAX 65535
+
+// declare the fixed structure of the "wide" mxGram byte header
+//  the wide header starts with a version number, which is always less
+//  than MX_GRAM_INFO_HEAD and can't be mistaken for a legacy gramLength
+#define MX_GRAM_WIDE_VERSION 1
+#define MX_GRAM_WIDE_OFFSET_VERSION 0
+#define MX_GRAM_WIDE_OFFSET_GRAMTYPE 2
+#define MX_GRAM_WIDE_OFFSET_DATASIZE 4
+#define MX_GRAM_WIDE_OFFSET_RESERVED 6
+#define MX_GRAM_WIDE_OFFSET_GRAMLENGTH 8
+#define MX_GRAM_WIDE_OFFSET_DATALENGTH 12
+#define MX_GRAM_WIDE_OFFSET_M 16
+#define MX_GRAM_WIDE_OFFSET_N 20
+#define MX_GRAM_WIDE_OFFSET_DATA 24
+#define MX_GRAM_WIDE_INFO_HEAD 24
+
+// flags combined with the gramType in the byte header
+#define MX_GRAM_TYPE_MASK 0x00ff
+#define MX_GRAM_FLAG_COMPLEX 0x0100
+#define MX_GRAM_FLAG_SPARSE 0x0200
+
+// sparse grams write row and column indexes as uint32
+#define MX_GRAM_INDEX_SIZE 4
+
+// Matlab R2018a and later may store complex data interleaved
+#ifndef MX_HAS_INTERLEAVED_COMPLEX
+#define MX_HAS_INTERLEAVED_COMPLEX 0
+#endif
+
+// chars with any of these bits set can't be sent as 1-byte ASCII
+#define MX_GRAM_CHAR_WIDE_BITS 0xff80
+
+// use SSE2 for char kernels where the compiler provides it
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MX_GRAM_SSE2 1
+#else
+#define MX_GRAM_SSE2 0
+#endif
+
+// compressed grams use an LZ4-style block codec
+//  matches are at least 4 bytes and at most 64KB back
+//  the last bytes of each block always go as literals
+#define MX_GRAM_LZ_HASH_BITS 12
+#define MX_GRAM_LZ_MIN_MATCH 4
+#define MX_GRAM_LZ_MAX_OFFSET 65535
+#define MX_GRAM_LZ_TOKEN_MAX 15
+#define MX_GRAM_LZ_MATCH_LIMIT 12
+#define MX_GRAM_LZ_LAST_LITERALS 5
+#define MX_GRAM_LZ_SKIP_SHIFT 6
+#define MX_GRAM_LZ_MAX_RATIO 255
+
+// mxToBytesMaybeCompressed() status when neither gram fits
+#define MX_GRAM_TOO_LONG -2
 
 // builtin function names for string <-> function
 #define MX_GRAM_STRING_TO_FUNCTION "str2func"
 #define MX_GRAM_FUNCTION_TO_STRING "func2str"
 
 // struct to mirror the mxGram byte header
+//  lengths and dimensions are wide enough for either header
 typedef struct var {
     char            *gramBytes;
-    MX_GRAM_UINT16  gramLength;
+    MX_GRAM_UINT16  headLength;
+    MX_GRAM_UINT32  gramLength;
     MX_GRAM_UINT16	gramType;
-    MX_GRAM_UINT16  dataLength;
+    MX_GRAM_UINT16	gramFlags;
+    MX_GRAM_UINT32  dataLength;
     MX_GRAM_UINT16  dataSize;
-    MX_GRAM_UINT16	dataM;
-    MX_GRAM_UINT16	dataN;
+    MX_GRAM_UINT32	dataM;
+    MX_GRAM_UINT32	dataN;
     char            *dataBytes;
 } mxGramInfo;
 
+// schema grams send each layout once, then refer to it by ID
+#define MX_GRAM_MAX_SCHEMAS 256
+
+// each peer gets its own table of layouts, found by an integer key
+//  the least recently used table makes room for a new key
+#define MX_GRAM_MAX_SCHEMA_TABLES 64
+#define MX_GRAM_DEFAULT_SCHEMA_KEY -1
+
+// schema data start with a hash of their layout, to catch stale tables
+#define MX_GRAM_SCHEMA_HASH_LENGTH 4
+
+// encoders try the layouts they sent most recently before splitting
+#define MX_GRAM_RECENT_SCHEMAS 4
+
+// one layout of headers and struct field names
+//  the headers fix the length of the values that go with it
+typedef struct {
+    char            *layoutBytes;
+    int             nLayoutBytes;
+    int             nValueBytes;
+    MX_GRAM_UINT32  layoutHash;
+} mxGramLayout;
+
+// layouts sent to one peer, and layouts received from it
+typedef struct {
+    int             key;
+    unsigned int    lastUse;
+    mxGramLayout    encoderLayouts[MX_GRAM_MAX_SCHEMAS];
+    int             nEncoderLayouts;
+    int             recentEncoderLayouts[MX_GRAM_RECENT_SCHEMAS];
+    int             nRecentEncoderLayouts;
+    mxGramLayout    decoderLayouts[MX_GRAM_MAX_SCHEMAS];
+} mxGramSchemaTable;
+
+// function handle strings cached during one call, keyed by mxArray
+typedef struct {
+    const mxArray   *function;
+    mxArray         *string;
+} mxGramFunctionString;
+
+// function handles cached across calls, keyed by string
+#define MX_GRAM_FUNCTION_CACHE_SIZE 256
+typedef struct {
+    char            *string;
+    MX_GRAM_UINT32  hash;
+    mxArray         *function;
+} mxGramStringFunction;
+
+// how often the caches avoid calling Matlab, and Matlab's time
+typedef struct {
+    double  func2strCalls;
+    double  func2strHits;
+    double  func2strSeconds;
+    double  str2funcCalls;
+    double  str2funcHits;
+    double  str2funcSeconds;
+} mxGramFunctionCacheStats;
+
+// resumable decoders for grams that arrive in pieces
+#define MX_GRAM_MAX_DECODERS 32
+#define MX_GRAM_DECODER_MAX_DEPTH 64
+
+// one gram in progress, and how much of it has arrived
+typedef struct {
+    mxGramInfo      info;
+    mxArray         *mx;
+    int             isPersistent;
+    size_t          nDataBytesRead;
+    size_t          nElementsRead;
+    char            *dataBuffer;
+    char            **fieldNames;
+} mxGramDecoderFrame;
+
+// nested grams in progress, plus any partial header
+typedef struct {
+    char                headBytes[MX_GRAM_WIDE_INFO_HEAD];
+    int                 nHeadBytes;
+    int                 depth;
+    mxGramDecoderFrame  frames[MX_GRAM_DECODER_MAX_DEPTH];
+} mxGramDecoder;
+
+// serialized field values last sent for one key, to send only changes
+typedef struct {
+    char    *key;
+    int     nFields;
+    int     maxFields;
+    char    **names;
+    char    **values;
+    int     *nValueBytes;
+} mxGramDelta;
+
 typedef enum {
     mxGramDouble,
     mxGramChar,
@@ -57,18 +208,84 @@ typedef enum {
     mxGramCell,
     mxGramStruct,
     mxGramFunctionHandle,
+    mxGramSingle,
+    mxGramInt8,
+    mxGramUint8,
+    mxGramInt16,
+    mxGramUint16,
+    mxGramInt32,
+    mxGramUint32,
+    mxGramInt64,
+    mxGramUint64,
+    mxGramPackedStruct,
+    mxGramCompressed,
+    mxGramSchema,
     mxGramUnsupported=-1
 } mxGramType;
 
 int mxToBytes(const mxArray *mx, char *byteArray, int byteArrayLength);
 int bytesToMx(mxArray **mx, const char *byteArray, int byteArrayLength);
+int mxGramSize(const mxArray *mx);
 
 void setInfoFieldsFromMx(mxGramInfo *info, const mxArray *mx);
+void setInfoHeadLength(mxGramInfo *info, size_t nDataBytes);
+void setInfoFieldsForMatrix(mxGramInfo *info, mxGramType gramType, size_t dataSize, size_t m, size_t n);
+int finishMxContainerGram(mxGramInfo *info, int nDataBytes, char *byteArray, int byteArrayLength);
+int writeMxGramEmptyToBytes(char *byteArray, int byteArrayLength);
 int readInfoFieldsFromBytes(mxGramInfo *info, const char *byteArray, int byteArrayLength);
 int writeInfoFieldsToBytes(const mxGramInfo *info, char *byteArray, int byteArrayLength);
+int isLegacyInfo(const mxGramInfo *info);
+int hasMxGramDataBytes(const mxGramInfo *info, int nBytes);
+
+int writeMxSimpleDataToBytes(const mxArray *mx, mxGramInfo *info, int nBytes);
+int readMxSimpleGramFromBytes(mxArray **mx, mxGramInfo *info, int nBytes);
+
+int writeMxNumericDataToBytes(const mxArray *mx, mxGramInfo *info, int nBytes);
+int readMxNumericDataFromBytes(mxArray *mx, mxGramInfo *info, int nBytes);
+
+int writeMxPackedStructToBytes(const mxArray *mx, mxGramInfo *info, int nBytes);
+int writeMxPackedFieldToBytes(const mxArray *mx, int fieldNumber, char *byteArray, int byteArrayLength);
+int readMxPackedStructFromBytes(mxArray **mx, mxGramInfo *info, int nBytes);
+mxArray *createMxPackedStruct(const char *nameData, size_t nNameBytes, size_t m, size_t n);
+int setMxPackedFieldFromColumn(mxArray *mx, int fieldNumber, mxArray *column);
+int getMxPackedStructDataSize(const mxArray *mx);
+int getMxPackedFieldSize(const mxArray *mx, int fieldNumber);
+size_t getMxPackedStructNamesLength(const mxArray *mx);
+int isMxPackedFieldColumnar(const mxArray *mx, int fieldNumber);
+
+int writeMxCompressedGramToBytes(const char *gramBytes, int gramLength, char *byteArray, int byteArrayLength);
+int mxToBytesMaybeCompressed(const mxArray *mx, char *byteArray, int byteArrayLength, double compressThreshold, int gramLength);
+int readMxCompressedGramFromBytes(mxArray **mx, mxGramInfo *info, int nBytes);
+int compressMxGramBytes(const char *source, int sourceLength, char *dest, int destLength);
+int decompressMxGramBytes(const char *source, int sourceLength, char *dest, int destLength);
 
-int writeMxDoubleDataToBytes(const mxArray *mx, mxGramInfo *info, int nBytes);
-int readMxDoubleDataFromBytes(mxArray *mx, mxGramInfo *info, int nBytes);
+int writeMxSchemaGramToBytes(int schemaKey, const char *gramBytes, int gramLength, char *byteArray, int byteArrayLength, int *isNewLayout);
+int readMxSchemaGramFromBytes(mxArray **mx, mxGramInfo *info, int nBytes);
+int bytesToMxWithSchemas(mxArray **mx, const char *byteArray, int byteArrayLength, int schemaKey);
+int getMxSchemaGramRecentSize(int schemaKey);
+int writeMxSchemaGramFromRecentLayout(int schemaKey, const mxArray *mx, char *byteArray, int byteArrayLength);
+int writeMxLayoutValuesToBytes(const mxArray *mx, const char **layout, const char *layoutEnd, char *values, int nValueBytes);
+int readMxLayoutValuesFromBytes(mxArray **mx, const char **layout, const char *layoutEnd, const char **values, const char *valuesEnd);
+int splitMxGramLayout(const char *gramBytes, int nBytes, char **layout, char **values, int isLayoutData);
+int getMxGramLayoutChildren(const mxGramInfo *info, const char *firstChild, int nFirstChildBytes);
+MX_GRAM_UINT32 hashMxGramLayout(const char *layout, int nLayoutBytes);
+mxGramSchemaTable *getMxGramSchemaTable(int schemaKey, int isCreate);
+int findMxGramEncoderLayout(mxGramSchemaTable *table, const char *layout, int nLayoutBytes, MX_GRAM_UINT32 layoutHash);
+int addMxGramEncoderLayout(mxGramSchemaTable *table, const char *layout, int nLayoutBytes, int nValueBytes, MX_GRAM_UINT32 layoutHash);
+void useMxGramEncoderLayout(mxGramSchemaTable *table, int schemaID);
+void setMxGramDecoderLayout(mxGramSchemaTable *table, int schemaID, const char *layout, int nLayoutBytes);
+void clearMxGramEncoderSchemas(int schemaKey);
+void clearMxGramSchemaTables(void);
+
+int writeMxDeltaStruct(const char *key, const mxArray *mx, mxArray **deltaMx);
+void clearMxGramDeltas(const char *keyPrefix);
+
+int writeMxSparseDataToBytes(const mxArray *mx, mxGramInfo *info, int nBytes);
+int readMxSparseDataFromBytes(mxArray *mx, mxGramInfo *info, int nBytes);
+size_t getMxGramSparseNonzeros(const mxGramInfo *info);
+
+void writeMxElementsToBytes(const mxArray *mx, size_t numel, size_t elementSize, int isComplex, char *gramData);
+void readMxElementsFromBytes(mxArray *mx, size_t numel, size_t elementSize, int isComplex, const char *gramData);
 
 int writeMxCharDataToBytes(const mxArray *mx, mxGramInfo *info, int nBytes);
 int readMxCharDataFromBytes(mxArray *mx, mxGramInfo *info, int nBytes);
@@ -76,14 +293,49 @@ int readMxCharDataFromBytes(mxArray *mx, mxGramInfo *info, int nBytes);
 int writeMxLogicalDataToBytes(const mxArray *mx, mxGramInfo *info, int nBytes);
 int readMxLogicalDataFromBytes(mxArray *mx, mxGramInfo *info, int nBytes);
 
+int isMxCharNarrow(const mxChar *chars, size_t numel);
+void narrowMxCharsToBytes(const mxChar *chars, char *bytes, size_t numel);
+void widenBytesToMxChars(const char *bytes, mxChar *chars, size_t numel);
+
+int setMxGramStructPacking(int isPacked);
 mxGramType getMxGramTypeForMx(const mxArray *mx);
+MX_GRAM_UINT16 getMxGramFlagsForMx(const mxArray *mx);
+mxClassID getMxClassForMxGramType(mxGramType gramType);
+int isMxGramNumericType(mxGramType gramType);
+int isMxGramContainerType(mxGramType gramType);
+int isMxGramSimpleType(const mxGramInfo *info);
 
 void writeInt16ToBytes(const MX_GRAM_UINT16 sourceInt, char* bytes);
 MX_GRAM_UINT16 readInt16FromBytes(const char* bytes);
 
+void writeInt32ToBytes(const MX_GRAM_UINT32 sourceInt, char* bytes);
+MX_GRAM_UINT32 readInt32FromBytes(const char* bytes);
+
 void writeDouble64ToBytes(const double sourceDouble, char* bytes);
 double readDouble64FromBytes(const char* bytes);
 
+const mxArray *getMxGramFunctionString(const mxArray *function);
+void clearMxGramFunctionStrings(void);
+mxArray *getMxGramFunctionFromString(const mxArray *string);
+void clearMxGramFunctionCache(void);
+mxArray *getMxGramFunctionCacheStats(void);
+double getMxGramSeconds(void);
+
+int openMxGramDecoder(void);
+int closeMxGramDecoder(int decoderID);
+void closeAllMxGramDecoders(void);
+int pushBytesToMxGramDecoder(int decoderID, const char *bytes, int nBytes, mxArray **variables);
+int readMxGramDecoderHead(mxGramDecoder *decoder, const char *bytes, int nBytes);
+int startMxGramDecoderFrame(mxGramDecoder *decoder, const mxGramInfo *info);
+int readMxGramDecoderData(mxGramDecoderFrame *frame, const char *bytes, int nBytes);
+int isMxGramDecoderFrameDone(const mxGramDecoderFrame *frame);
+int finishMxGramDecoderFrame(mxGramDecoderFrame *frame);
+int addMxGramDecoderElement(mxGramDecoderFrame *frame, mxArray *element);
+void freeMxGramDecoderFrame(mxGramDecoderFrame *frame);
+void resetMxGramDecoder(mxGramDecoder *decoder);
+
+mxArray *mxGramBenchmark(const double *sizes, int nSizes);
+
 void printMxGramInfo(const mxGramInfo *info);
 void printBytes(const char *bytes, int nBytes);
 
@@ -0,0 +1,187 @@
+/* mxGramBenchmark.c
+ *
+ * Micro-benchmark for the mxGram data kernels.  Compares the per-element
+ * loops mxGram used to convert numeric, char, and logical data with the
+ * block-copy and vectorized kernels it uses now.
+ *
+ */
+
+#include "mxGram.h"
+
+// repeat each kernel for at least this long
+#define MX_GRAM_BENCHMARK_SECS 0.05
+
+typedef int (*mxGramKernel)(mxArray *mx, mxGramInfo *info, int nBytes);
+
+// per-element loops, as mxGram used to do them
+static int legacyWriteDouble(mxArray *mx, mxGramInfo *info, int nBytes) {
+    size_t ii, numel = (size_t)info->dataM * info->dataN;
+    double *mxData = mxGetPr(mx);
+    char *gramData = info->dataBytes;
+    for(ii=0; ii<numel; ii++) {
+        writeDouble64ToBytes(mxData[ii], gramData);
+        gramData += sizeof(double);
+    }
+    return((int)(sizeof(double)*numel));
+}
+
+static int legacyReadDouble(mxArray *mx, mxGramInfo *info, int nBytes) {
+    size_t ii, numel = (size_t)info->dataM * info->dataN;
+    double *mxData = mxGetPr(mx);
+    const char *gramData = info->dataBytes;
+    for(ii=0; ii<numel; ii++) {
+        mxData[ii] = readDouble64FromBytes(gramData);
+        gramData += sizeof(double);
+    }
+    return((int)(sizeof(double)*numel));
+}
+
+static int legacyWriteChar(mxArray *mx, mxGramInfo *info, int nBytes) {
+    size_t ii, numel = (size_t)info->dataM * info->dataN;
+    mxChar *mxData = mxGetChars(mx);
+    char *gramData = info->dataBytes;
+    for(ii=0; ii<numel; ii++) {
+        *((mxChar*)gramData) = mxData[ii];
+        gramData += sizeof(mxChar);
+    }
+    return((int)(sizeof(mxChar)*numel));
+}
+
+static int legacyReadChar(mxArray *mx, mxGramInfo *info, int nBytes) {
+    size_t ii, numel = (size_t)info->dataM * info->dataN;
+    mxChar *mxData = mxGetChars(mx);
+    const char *gramData = info->dataBytes;
+    for(ii=0; ii<numel; ii++) {
+        mxData[ii] = *gramData;
+        gramData++;
+    }
+    return((int)numel);
+}
+
+static int legacyWriteLogical(mxArray *mx, mxGramInfo *info, int nBytes) {
+    size_t ii, numel = (size_t)info->dataM * info->dataN;
+    mxLogical *mxData = mxGetLogicals(mx);
+    char *gramData = info->dataBytes;
+    for(ii=0; ii<numel; ii++) {
+        *((mxLogical*)gramData) = mxData[ii];
+        gramData++;
+    }
+    return((int)numel);
+}
+
+static int legacyReadLogical(mxArray *mx, mxGramInfo *info, int nBytes) {
+    size_t ii, numel = (size_t)info->dataM * info->dataN;
+    mxLogical *mxData = mxGetLogicals(mx);
+    const char *gramData = info->dataBytes;
+    for(ii=0; ii<numel; ii++) {
+        mxData[ii] = (mxLogical)*gramData;
+        gramData++;
+    }
+    return((int)numel);
+}
+
+// current kernels, adapted to the same signature
+static int bulkWriteDouble(mxArray *mx, mxGramInfo *info, int nBytes) {
+    return(writeMxNumericDataToBytes(mx, info, nBytes));
+}
+
+static int bulkWriteChar(mxArray *mx, mxGramInfo *info, int nBytes) {
+    return(writeMxCharDataToBytes(mx, info, nBytes));
+}
+
+static int bulkWriteLogical(mxArray *mx, mxGramInfo *info, int nBytes) {
+    return(writeMxLogicalDataToBytes(mx, info, nBytes));
+}
+
+static double timeKernel(mxGramKernel kernel, mxArray *mx, mxGramInfo *info, int nBytes) {
+    int nReps = 0;
+    double elapsed;
+    double start = getMxGramSeconds();
+    do {
+        kernel(mx, info, nBytes);
+        nReps++;
+        elapsed = getMxGramSeconds() - start;
+    } while (elapsed < MX_GRAM_BENCHMARK_SECS);
+    return(elapsed / nReps);
+}
+
+static mxArray *createBenchmarkArray(mxGramType gramType, size_t numel) {
+    size_t ii;
+    mwSize dims[2];
+    mxArray *mx;
+
+    if (gramType==mxGramChar) {
+        dims[0] = 1;
+        dims[1] = numel;
+        mx = mxCreateCharArray(2, dims);
+        for (ii=0; ii<numel; ii++)
+            mxGetChars(mx)[ii] = 'a' + ii%26;
+
+    } else if (gramType==mxGramLogical) {
+        mx = mxCreateLogicalMatrix(1, numel);
+        for (ii=0; ii<numel; ii++)
+            mxGetLogicals(mx)[ii] = ii%3 == 0;
+
+    } else {
+        mx = mxCreateDoubleMatrix(1, numel, mxREAL);
+        for (ii=0; ii<numel; ii++)
+            mxGetPr(mx)[ii] = ii*1.5;
+    }
+    return(mx);
+}
+
+mxArray *mxGramBenchmark(const double *sizes, int nSizes) {
+    const char *fieldNames[] = {"kernel", "nElements", "legacyMBPerSec", "bulkMBPerSec"};
+    const char *kernelNames[] = {"double write", "double read",
+            "char write", "char read", "logical write", "logical read"};
+    mxGramType kernelTypes[] = {mxGramDouble, mxGramDouble,
+            mxGramChar, mxGramChar, mxGramLogical, mxGramLogical};
+    mxGramKernel legacyKernels[] = {legacyWriteDouble, legacyReadDouble,
+            legacyWriteChar, legacyReadChar, legacyWriteLogical, legacyReadLogical};
+    mxGramKernel bulkKernels[] = {bulkWriteDouble, readMxNumericDataFromBytes,
+            bulkWriteChar, readMxCharDataFromBytes, bulkWriteLogical, readMxLogicalDataFromBytes};
+    int nKernels = sizeof(kernelNames)/sizeof(kernelNames[0]);
+
+    int ii, jj;
+    size_t numel, nBufferBytes;
+    double nMegabytes, legacySecs, bulkSecs;
+    mxArray *mx, *results;
+    mxGramInfo info;
+    char *buffer;
+
+    results = mxCreateStructMatrix(1, nKernels*nSizes, 4, fieldNames);
+    for (ii=0; ii<nSizes; ii++) {
+        numel = (size_t)sizes[ii];
+        for (jj=0; jj<nKernels; jj++) {
+            mx = createBenchmarkArray(kernelTypes[jj], numel);
+            setInfoFieldsFromMx(&info, mx);
+
+            // room for 2-byte legacy chars as well as narrow chars
+            nBufferBytes = numel*sizeof(double);
+            buffer = mxMalloc(nBufferBytes);
+            info.dataBytes = buffer;
+
+            // kernels come in write-read pairs
+            //  read kernels start from written data
+            if (jj % 2)
+                bulkKernels[jj-1](mx, &info, (int)nBufferBytes);
+
+            legacySecs = timeKernel(legacyKernels[jj], mx, &info, (int)nBufferBytes);
+            bulkSecs = timeKernel(bulkKernels[jj], mx, &info, (int)nBufferBytes);
+
+            nMegabytes = 1e-6 * numel * mxGetElementSize(mx);
+            mxSetFieldByNumber(results, ii*nKernels + jj, 0,
+                    mxCreateString(kernelNames[jj]));
+            mxSetFieldByNumber(results, ii*nKernels + jj, 1,
+                    mxCreateDoubleScalar((double)numel));
+            mxSetFieldByNumber(results, ii*nKernels + jj, 2,
+                    mxCreateDoubleScalar(nMegabytes / legacySecs));
+            mxSetFieldByNumber(results, ii*nKernels + jj, 3,
+                    mxCreateDoubleScalar(nMegabytes / bulkSecs));
+
+            mxFree(buffer);
+            mxDestroyArray(mx);
+        }
+    }
+    return(results);
+}
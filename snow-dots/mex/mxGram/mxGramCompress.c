@@ -0,0 +1,187 @@
+/* mxGramCompress.c
+ *
+ * Fast LZ-family codec for compressed mxGrams.  Uses the LZ4 block
+ * layout: each sequence is a token byte, some literal bytes, and a
+ * 2-byte offset back to a match in data already written.  The last
+ * sequence has literals only.
+ *
+ */
+
+#include "mxGram.h"
+
+static MX_GRAM_UINT32 readLzWord(const unsigned char *bytes) {
+    MX_GRAM_UINT32 word;
+    memcpy(&word, bytes, sizeof(word));
+    return(word);
+}
+
+static int hashLzWord(MX_GRAM_UINT32 word) {
+    return((int)((word * 2654435761U) >> (32 - MX_GRAM_LZ_HASH_BITS)));
+}
+
+// 4-bit length in the token, plus 255s and a remainder as needed
+static int writeLzLength(unsigned char **dest, const unsigned char *destEnd, size_t length) {
+    unsigned char *d = *dest;
+    if (length < MX_GRAM_LZ_TOKEN_MAX)
+        return(0);
+    
+    length -= MX_GRAM_LZ_TOKEN_MAX;
+    if ((size_t)(destEnd - d) < length/255 + 1)
+        return(-1);
+    for (; length >= 255; length -= 255)
+        *d++ = 255;
+    *d++ = (unsigned char)length;
+    *dest = d;
+    return(0);
+}
+
+static int readLzLength(const unsigned char **source, const unsigned char *sourceEnd, size_t *length) {
+    const unsigned char *s = *source;
+    unsigned char b;
+    if (*length < MX_GRAM_LZ_TOKEN_MAX)
+        return(0);
+    
+    do {
+        if (s >= sourceEnd || *length > INT_MAX)
+            return(-1);
+        b = *s++;
+        *length += b;
+    } while (b == 255);
+    *source = s;
+    return(0);
+}
+
+// one token, its literals, and its match, if any
+static int writeLzSequence(unsigned char **dest, const unsigned char *destEnd,
+        const unsigned char *literals, size_t nLiterals, size_t offset, size_t matchLength) {
+    unsigned char *token = *dest;
+    size_t matchCode = matchLength > 0 ? matchLength - MX_GRAM_LZ_MIN_MATCH : 0;
+    
+    if (token >= destEnd)
+        return(-1);
+    *token = (unsigned char)(
+            (nLiterals < MX_GRAM_LZ_TOKEN_MAX ? nLiterals : MX_GRAM_LZ_TOKEN_MAX) << 4
+            | (matchCode < MX_GRAM_LZ_TOKEN_MAX ? matchCode : MX_GRAM_LZ_TOKEN_MAX));
+    (*dest)++;
+    
+    if (writeLzLength(dest, destEnd, nLiterals) < 0
+            || (size_t)(destEnd - *dest) < nLiterals)
+        return(-1);
+    memcpy(*dest, literals, nLiterals);
+    *dest += nLiterals;
+    
+    if (matchLength == 0)
+        return(0);
+    
+    if (destEnd - *dest < 2)
+        return(-1);
+    (*dest)[0] = (unsigned char)(offset & 0xff);
+    (*dest)[1] = (unsigned char)(offset >> 8);
+    *dest += 2;
+    return(writeLzLength(dest, destEnd, matchCode));
+}
+
+int compressMxGramBytes(const char *source, int sourceLength, char *dest, int destLength) {
+    int table[1 << MX_GRAM_LZ_HASH_BITS];
+    const unsigned char *src = (const unsigned char *)source;
+    unsigned char *d = (unsigned char *)dest;
+    const unsigned char *destEnd = d + destLength;
+    int ii = 0, anchor = 0, candidate, hash;
+    int matchLimit = sourceLength - MX_GRAM_LZ_MATCH_LIMIT;
+    int literalLimit = sourceLength - MX_GRAM_LZ_LAST_LITERALS;
+    int matchLength;
+    
+    if (sourceLength < 0 || destLength < 0)
+        return(-1);
+    memset(table, 0xff, sizeof(table));
+    
+    while (ii < matchLimit) {
+        hash = hashLzWord(readLzWord(src + ii));
+        candidate = table[hash];
+        table[hash] = ii;
+    
+        // skip ahead faster through data that don't match
+        if (candidate < 0 || ii - candidate > MX_GRAM_LZ_MAX_OFFSET
+                || readLzWord(src + candidate) != readLzWord(src + ii)) {
+            ii += 1 + ((ii - anchor) >> MX_GRAM_LZ_SKIP_SHIFT);
+            continue;
+        }
+    
+        // extend the match forward, then back over pending literals
+        matchLength = MX_GRAM_LZ_MIN_MATCH;
+        while (ii + matchLength < literalLimit
+                && src[candidate + matchLength] == src[ii + matchLength])
+            matchLength++;
+        while (ii > anchor && candidate > 0 && src[ii-1] == src[candidate-1]) {
+            ii--;
+            candidate--;
+            matchLength++;
+        }
+    
+        if (writeLzSequence(&d, destEnd, src + anchor, ii - anchor,
+                ii - candidate, matchLength) < 0)
+            return(-1);
+        ii += matchLength;
+        anchor = ii;
+    }
+    
+    // whatever is left goes as literals
+    if (writeLzSequence(&d, destEnd, src + anchor, sourceLength - anchor, 0, 0) < 0)
+        return(-1);
+    return((int)(d - (unsigned char *)dest));
+}
+
+int decompressMxGramBytes(const char *source, int sourceLength, char *dest, int destLength) {
+    const unsigned char *s = (const unsigned char *)source;
+    const unsigned char *sourceEnd = s + sourceLength;
+    unsigned char *d = (unsigned char *)dest;
+    unsigned char *destEnd = d + destLength;
+    const unsigned char *match;
+    unsigned char token;
+    size_t length, offset;
+    
+    if (sourceLength <= 0 || destLength < 0)
+        return(-1);
+    
+    while (s < sourceEnd) {
+        token = *s++;
+    
+        length = token >> 4;
+        if (readLzLength(&s, sourceEnd, &length) < 0
+                || length > (size_t)(sourceEnd - s)
+                || length > (size_t)(destEnd - d))
+            return(-1);
+        memcpy(d, s, length);
+        d += length;
+        s += length;
+    
+        // the last sequence has no match
+        if (s == sourceEnd)
+            break;
+    
+        if (sourceEnd - s < 2)
+            return(-1);
+        offset = s[0] | (s[1] << 8);
+        s += 2;
+        if (offset == 0 || offset > (size_t)(d - (unsigned char *)dest))
+            return(-1);
+    
+        length = token & MX_GRAM_LZ_TOKEN_MAX;
+        if (readLzLength(&s, sourceEnd, &length) < 0)
+            return(-1);
+        length += MX_GRAM_LZ_MIN_MATCH;
+        if (length > (size_t)(destEnd - d))
+            return(-1);
+    
+        // matches may overlap the bytes they produce
+        match = d - offset;
+        if (offset >= length) {
+            memcpy(d, match, length);
+            d += length;
+        } else {
+            while (length--)
+                *d++ = *match++;
+        }
+    }
+    return((int)(d - (unsigned char *)dest));
+}
@@ -0,0 +1,405 @@
+/* mxGramDecoder.c
+ *
+ * Resumable decoders for mxGram bytes that arrive in pieces, as from
+ * several UDP datagrams or a stream socket.  Each decoder keeps a stack
+ * of the grams in progress and fills in their mxArrays as bytes arrive,
+ * so large variables are decoded while they are still arriving.  Whole
+ * grams may also arrive back to back in the same piece.
+ *
+ */
+
+#include "mxGram.h"
+
+static mxGramDecoder *decoders[MX_GRAM_MAX_DECODERS];
+
+int openMxGramDecoder(void) {
+    int ii;
+    for (ii=0; ii<MX_GRAM_MAX_DECODERS; ii++) {
+        if (decoders[ii] == NULL) {
+            decoders[ii] = mxCalloc(1, sizeof(mxGramDecoder));
+            mexMakeMemoryPersistent(decoders[ii]);
+            return(ii);
+        }
+    }
+    return(-1);
+}
+
+int closeMxGramDecoder(int decoderID) {
+    if (decoderID < 0 || decoderID >= MX_GRAM_MAX_DECODERS
+            || decoders[decoderID] == NULL)
+        return(-1);
+    
+    resetMxGramDecoder(decoders[decoderID]);
+    mxFree(decoders[decoderID]);
+    decoders[decoderID] = NULL;
+    return(0);
+}
+
+void closeAllMxGramDecoders(void) {
+    int ii;
+    for (ii=0; ii<MX_GRAM_MAX_DECODERS; ii++)
+        closeMxGramDecoder(ii);
+}
+
+int pushBytesToMxGramDecoder(int decoderID, const char *bytes, int nBytes, mxArray **variables) {
+    int ii, nRead, status = 0;
+    int nDone = 0, maxDone = 0;
+    mxArray **done = NULL;
+    mxArray *element, *copy;
+    int isPersistent;
+    mxGramDecoder *decoder;
+    mxGramDecoderFrame *frame;
+    
+    if (decoderID < 0 || decoderID >= MX_GRAM_MAX_DECODERS
+            || decoders[decoderID] == NULL || nBytes < 0) {
+        *variables = mxCreateCellMatrix(1, 0);
+        return(-1);
+    }
+    decoder = decoders[decoderID];
+    
+    while (nBytes > 0) {
+        // a header comes next, unless a simple gram needs more data
+        frame = decoder->depth > 0 ? &decoder->frames[decoder->depth-1] : NULL;
+        if (frame == NULL || isMxGramContainerType(frame->info.gramType))
+            nRead = readMxGramDecoderHead(decoder, bytes, nBytes);
+        else
+            nRead = readMxGramDecoderData(frame, bytes, nBytes);
+    
+        if (nRead < 0) {
+            status = -1;
+            break;
+        }
+        bytes += nRead;
+        nBytes -= nRead;
+    
+        // finish any grams that are complete, innermost first
+        while (decoder->depth > 0) {
+            frame = &decoder->frames[decoder->depth-1];
+            if (!isMxGramDecoderFrameDone(frame))
+                break;
+    
+            if (finishMxGramDecoderFrame(frame) < 0) {
+                status = -1;
+                break;
+            }
+            element = frame->mx;
+            isPersistent = frame->isPersistent;
+            frame->mx = NULL;
+            freeMxGramDecoderFrame(frame);
+            decoder->depth--;
+    
+            if (decoder->depth > 0) {
+                if (addMxGramDecoderElement(&decoder->frames[decoder->depth-1], element) < 0) {
+                    status = -1;
+                    break;
+                }
+    
+            } else {
+                // persistent arrays can't go back to Matlab, so copy them
+                if (isPersistent) {
+                    copy = mxDuplicateArray(element);
+                    mxDestroyArray(element);
+                    element = copy;
+                }
+    
+                if (nDone == maxDone) {
+                    maxDone = 2*maxDone + 1;
+                    done = mxRealloc(done, maxDone*sizeof(mxArray*));
+                }
+                done[nDone++] = element;
+            }
+        }
+    
+        if (status < 0)
+            break;
+    }
+    
+    // start over after bad bytes
+    if (status < 0)
+        resetMxGramDecoder(decoder);
+    
+    // keep grams in progress for the next piece
+    for (ii=0; ii<decoder->depth; ii++) {
+        frame = &decoder->frames[ii];
+        if (frame->mx != NULL && !frame->isPersistent) {
+            mexMakeArrayPersistent(frame->mx);
+            frame->isPersistent = 1;
+        }
+    }
+    
+    *variables = mxCreateCellMatrix(1, nDone);
+    for (ii=0; ii<nDone; ii++)
+        mxSetCell(*variables, ii, done[ii]);
+    if (done != NULL)
+        mxFree(done);
+    
+    return(status);
+}
+
+int readMxGramDecoderHead(mxGramDecoder *decoder, const char *bytes, int nBytes) {
+    int nNeeded, nTake;
+    MX_GRAM_UINT16 firstField;
+    mxGramInfo info;
+    
+    // the first field tells which header is coming
+    nNeeded = MX_GRAM_FIELD_SIZE;
+    if (decoder->nHeadBytes >= MX_GRAM_FIELD_SIZE) {
+        firstField = readInt16FromBytes(decoder->headBytes);
+        if (firstField >= MX_GRAM_INFO_HEAD)
+            nNeeded = MX_GRAM_INFO_HEAD;
+        else if (firstField == MX_GRAM_WIDE_VERSION)
+            nNeeded = MX_GRAM_WIDE_INFO_HEAD;
+        else
+            return(-1);
+    }
+    
+    nTake = nNeeded - decoder->nHeadBytes;
+    if (nTake > nBytes)
+        nTake = nBytes;
+    memcpy(decoder->headBytes + decoder->nHeadBytes, bytes, nTake);
+    decoder->nHeadBytes += nTake;
+    
+    // start a new gram once its whole header is here
+    if (nNeeded > MX_GRAM_FIELD_SIZE && decoder->nHeadBytes == nNeeded) {
+        decoder->nHeadBytes = 0;
+        if (readInfoFieldsFromBytes(&info, decoder->headBytes, nNeeded) < 0
+                || startMxGramDecoderFrame(decoder, &info) < 0)
+            return(-1);
+    }
+    return(nTake);
+}
+
+int startMxGramDecoderFrame(mxGramDecoder *decoder, const mxGramInfo *info) {
+    int isBuffered = 0;
+    mwSize dims[2];
+    mxGramDecoderFrame *frame;
+    
+    if (decoder->depth >= MX_GRAM_DECODER_MAX_DEPTH)
+        return(-1);
+    
+    // don't allocate arrays for data that can't be real
+    if (!isMxGramContainerType(info->gramType)
+            && (info->dataLength > INT_MAX
+            || !hasMxGramDataBytes(info, (int)info->dataLength)))
+        return(-1);
+    
+    frame = &decoder->frames[decoder->depth];
+    memset(frame, 0, sizeof(mxGramDecoderFrame));
+    frame->info = *info;
+    frame->info.gramBytes = NULL;
+    frame->info.dataBytes = NULL;
+    
+    if (info->gramFlags & MX_GRAM_FLAG_SPARSE) {
+        // sparse data are read all at once
+        if (info->gramType==mxGramLogical)
+            frame->mx = mxCreateSparseLogicalMatrix(info->dataM, info->dataN,
+                    getMxGramSparseNonzeros(info));
+        else
+            frame->mx = mxCreateSparse(info->dataM, info->dataN,
+                    getMxGramSparseNonzeros(info),
+                    (info->gramFlags & MX_GRAM_FLAG_COMPLEX) ? mxCOMPLEX : mxREAL);
+        isBuffered = 1;
+    
+    } else if (isMxGramNumericType(info->gramType)) {
+        // real data go straight into the array, complex data are read all at once
+        frame->mx = mxCreateUninitNumericMatrix(info->dataM, info->dataN,
+                getMxClassForMxGramType(info->gramType),
+                (info->gramFlags & MX_GRAM_FLAG_COMPLEX) ? mxCOMPLEX : mxREAL);
+        isBuffered = (info->gramFlags & MX_GRAM_FLAG_COMPLEX) != 0;
+        if (info->dataSize != mxGetElementSize(frame->mx)) {
+            freeMxGramDecoderFrame(frame);
+            return(-1);
+        }
+    
+    } else if (info->gramType==mxGramChar) {
+        if (info->dataSize != 1 && info->dataSize != sizeof(mxChar))
+            return(-1);
+        dims[0] = info->dataM;
+        dims[1] = info->dataN;
+        frame->mx = mxCreateCharArray(2, dims);
+    
+    } else if (info->gramType==mxGramLogical) {
+        if (info->dataSize != sizeof(mxLogical))
+            return(-1);
+        frame->mx = mxCreateLogicalMatrix(info->dataM, info->dataN);
+    
+    } else if (info->gramType==mxGramCell) {
+        frame->mx = mxCreateCellMatrix(info->dataM, info->dataN);
+    
+    } else if (info->gramType==mxGramStruct) {
+        // legacy struct arrays have size 1xn, with m fields
+        frame->fieldNames = mxCalloc(info->dataM + 1, sizeof(char*));
+        mexMakeMemoryPersistent(frame->fieldNames);
+        if (info->dataM == 0)
+            frame->mx = mxCreateStructMatrix(1, info->dataN, 0, NULL);
+    
+    } else if (info->gramType==mxGramCompressed
+            || info->gramType==mxGramSchema) {
+        // compressed and schema data are expanded all at once
+        isBuffered = 1;
+    
+    } else if (info->gramType!=mxGramPackedStruct
+            && info->gramType!=mxGramFunctionHandle) {
+        return(-1);
+    }
+    
+    if (isBuffered) {
+        frame->dataBuffer = mxMalloc(info->dataLength > 0 ? info->dataLength : 1);
+        mexMakeMemoryPersistent(frame->dataBuffer);
+    }
+    
+    decoder->depth++;
+    return(0);
+}
+
+int readMxGramDecoderData(mxGramDecoderFrame *frame, const char *bytes, int nBytes) {
+    size_t nTake = frame->info.dataLength - frame->nDataBytesRead;
+    if (nTake > (size_t)nBytes)
+        nTake = nBytes;
+    
+    if (nTake > 0) {
+        if (frame->dataBuffer != NULL)
+            memcpy(frame->dataBuffer + frame->nDataBytesRead, bytes, nTake);
+    
+        else if (frame->info.gramType==mxGramChar && frame->info.dataSize == 1)
+            widenBytesToMxChars(bytes, mxGetChars(frame->mx) + frame->nDataBytesRead, nTake);
+    
+        else
+            memcpy((char *)mxGetData(frame->mx) + frame->nDataBytesRead, bytes, nTake);
+    }
+    
+    frame->nDataBytesRead += nTake;
+    return((int)nTake);
+}
+
+int isMxGramDecoderFrameDone(const mxGramDecoderFrame *frame) {
+    const mxGramInfo *info = &frame->info;
+    
+    if (info->gramType==mxGramCell)
+        return(frame->nElementsRead == (size_t)info->dataM * info->dataN);
+    
+    else if (info->gramType==mxGramFunctionHandle)
+        return(frame->nElementsRead == 1);
+    
+    else if (info->gramType==mxGramPackedStruct)
+        return(frame->mx != NULL
+                && frame->nElementsRead == 1 + (size_t)mxGetNumberOfFields(frame->mx));
+    
+    else if (info->gramType==mxGramStruct)
+        return(frame->nElementsRead == info->dataM + (size_t)info->dataM * info->dataN);
+    
+    else
+        return(frame->nDataBytesRead == info->dataLength);
+}
+
+int finishMxGramDecoderFrame(mxGramDecoderFrame *frame) {
+    int nDataBytes;
+    
+    // read buffered data all at once
+    if (frame->dataBuffer != NULL) {
+        frame->info.dataBytes = frame->dataBuffer;
+        if (frame->info.gramType==mxGramCompressed)
+            nDataBytes = readMxCompressedGramFromBytes(&frame->mx, &frame->info, frame->info.dataLength);
+        else if (frame->info.gramType==mxGramSchema)
+            nDataBytes = readMxSchemaGramFromBytes(&frame->mx, &frame->info, frame->info.dataLength);
+        else if (frame->info.gramFlags & MX_GRAM_FLAG_SPARSE)
+            nDataBytes = readMxSparseDataFromBytes(frame->mx, &frame->info, frame->info.dataLength);
+        else
+            nDataBytes = readMxNumericDataFromBytes(frame->mx, &frame->info, frame->info.dataLength);
+        if (nDataBytes < 0)
+            return(-1);
+    }
+    return(frame->mx != NULL ? 0 : -1);
+}
+
+int addMxGramDecoderElement(mxGramDecoderFrame *frame, mxArray *element) {
+    size_t index = frame->nElementsRead;
+    size_t nNameBytes;
+    int status = 0;
+    char *nameData;
+    mxGramInfo *info = &frame->info;
+    
+    if (info->gramType==mxGramCell) {
+        mxSetCell(frame->mx, index, element);
+    
+    } else if (info->gramType==mxGramFunctionHandle) {
+        // function handles arrive as strings
+        frame->mx = getMxGramFunctionFromString(element);
+        mxDestroyArray(element);
+        if (frame->mx == NULL)
+            status = -1;
+    
+    } else if (info->gramType==mxGramPackedStruct) {
+        if (index == 0) {
+            // field names arrive as one string of NUL-terminated names
+            nNameBytes = mxGetNumberOfElements(element);
+            if (mxIsChar(element) && isMxCharNarrow(mxGetChars(element), nNameBytes)) {
+                nameData = mxMalloc(nNameBytes + 1);
+                narrowMxCharsToBytes(mxGetChars(element), nameData, nNameBytes);
+                frame->mx = createMxPackedStruct(nameData, nNameBytes, info->dataM, info->dataN);
+                mxFree(nameData);
+            }
+            if (frame->mx == NULL)
+                status = -1;
+    
+        } else
+            status = setMxPackedFieldFromColumn(frame->mx, index-1, element);
+        mxDestroyArray(element);
+    
+    } else if (info->gramType==mxGramStruct) {
+        if (index < info->dataM) {
+            // legacy field names arrive one at a time
+            frame->fieldNames[index] = mxArrayToString(element);
+            mxDestroyArray(element);
+            if (frame->fieldNames[index] == NULL)
+                return(-1);
+            mexMakeMemoryPersistent(frame->fieldNames[index]);
+    
+            if (index + 1 == info->dataM) {
+                frame->mx = mxCreateStructMatrix(1, info->dataN, info->dataM,
+                        (const char **)frame->fieldNames);
+                if (frame->mx == NULL)
+                    status = -1;
+            }
+    
+        } else {
+            // then field data, one field at a time
+            index -= info->dataM;
+            mxSetFieldByNumber(frame->mx, index % info->dataN, index / info->dataN, element);
+        }
+    
+    } else {
+        mxDestroyArray(element);
+        status = -1;
+    }
+    
+    frame->nElementsRead++;
+    return(status);
+}
+
+void freeMxGramDecoderFrame(mxGramDecoderFrame *frame) {
+    size_t ii;
+    
+    if (frame->mx != NULL)
+        mxDestroyArray(frame->mx);
+    
+    if (frame->dataBuffer != NULL)
+        mxFree(frame->dataBuffer);
+    
+    if (frame->fieldNames != NULL) {
+        for (ii=0; ii<frame->info.dataM; ii++)
+            if (frame->fieldNames[ii] != NULL)
+                mxFree(frame->fieldNames[ii]);
+        mxFree(frame->fieldNames);
+    }
+    
+    memset(frame, 0, sizeof(mxGramDecoderFrame));
+}
+
+void resetMxGramDecoder(mxGramDecoder *decoder) {
+    while (decoder->depth > 0) {
+        decoder->depth--;
+        freeMxGramDecoderFrame(&decoder->frames[decoder->depth]);
+    }
+    decoder->nHeadBytes = 0;
+}
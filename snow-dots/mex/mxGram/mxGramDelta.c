@@ -0,0 +1,186 @@
+/* mxGramDelta.c
+ *
+ * Delta encoding for scalar structs that get sent over and over, like
+ * the public properties of ensemble objects.  The encoder keeps a
+ * baseline of serialized field values for each string key.  Encoding a
+ * struct returns a struct with just the fields whose serialized values
+ * differ from the baseline, and updates the baseline to match.
+ *
+ * Comparing serialized bytes means values are the same when they would
+ * decode the same.  So NaNs match themselves, and function handles
+ * match when they have the same string.
+ *
+ */
+
+#include "mxGram.h"
+
+// one baseline per key, kept across calls
+static mxGramDelta *deltas;
+static int nDeltas;
+static int maxDeltas;
+
+static char *copyMxGramDeltaString(const char *string) {
+    char *copy = mxMalloc(strlen(string) + 1);
+    strcpy(copy, string);
+    mexMakeMemoryPersistent(copy);
+    return(copy);
+}
+
+static void freeMxGramDelta(mxGramDelta *delta) {
+    int ii;
+    for (ii=0; ii<delta->nFields; ii++) {
+        mxFree(delta->names[ii]);
+        mxFree(delta->values[ii]);
+    }
+    if (delta->maxFields > 0) {
+        mxFree(delta->names);
+        mxFree(delta->values);
+        mxFree(delta->nValueBytes);
+    }
+    mxFree(delta->key);
+    memset(delta, 0, sizeof(mxGramDelta));
+}
+
+static mxGramDelta *findMxGramDelta(const char *key) {
+    int ii;
+    for (ii=0; ii<nDeltas; ii++)
+        if (!strcmp(deltas[ii].key, key))
+            return(&deltas[ii]);
+
+    // start an empty baseline for a new key
+    if (nDeltas == maxDeltas) {
+        maxDeltas = 2*maxDeltas + 8;
+        deltas = mxRealloc(deltas, maxDeltas*sizeof(mxGramDelta));
+        mexMakeMemoryPersistent(deltas);
+    }
+    memset(&deltas[nDeltas], 0, sizeof(mxGramDelta));
+    deltas[nDeltas].key = copyMxGramDeltaString(key);
+    return(&deltas[nDeltas++]);
+}
+
+// fields usually come in the same order, so try the same index first
+static int findMxGramDeltaField(const mxGramDelta *delta, const char *name, int hint) {
+    int ii;
+    if (hint < delta->nFields && !strcmp(delta->names[hint], name))
+        return(hint);
+    for (ii=0; ii<delta->nFields; ii++)
+        if (!strcmp(delta->names[ii], name))
+            return(ii);
+    return(-1);
+}
+
+// take ownership of the serialized value
+static void setMxGramDeltaField(mxGramDelta *delta, int fieldIndex, const char *name, char *value, int nValueBytes) {
+    if (fieldIndex < 0) {
+        if (delta->nFields == delta->maxFields) {
+            delta->maxFields = 2*delta->maxFields + 8;
+            delta->names = mxRealloc(delta->names, delta->maxFields*sizeof(char*));
+            delta->values = mxRealloc(delta->values, delta->maxFields*sizeof(char*));
+            delta->nValueBytes = mxRealloc(delta->nValueBytes, delta->maxFields*sizeof(int));
+            mexMakeMemoryPersistent(delta->names);
+            mexMakeMemoryPersistent(delta->values);
+            mexMakeMemoryPersistent(delta->nValueBytes);
+        }
+        fieldIndex = delta->nFields++;
+        delta->names[fieldIndex] = copyMxGramDeltaString(name);
+    } else
+        mxFree(delta->values[fieldIndex]);
+
+    mexMakeMemoryPersistent(value);
+    delta->values[fieldIndex] = value;
+    delta->nValueBytes[fieldIndex] = nValueBytes;
+}
+
+int writeMxDeltaStruct(const char *key, const mxArray *mx, mxArray **deltaMx) {
+    int ii, jj, nFields, nChanged = 0, nBytes, fieldIndex;
+    const char **changedNames;
+    int *changedFields, *baselineFields, *changedLengths;
+    char **changedValues, *value;
+    const mxArray *field;
+    mxGramDelta *delta;
+
+    *deltaMx = NULL;
+    if (key == NULL || mx == NULL || !mxIsStruct(mx) || mxGetNumberOfElements(mx) != 1)
+        return(-1);
+
+    delta = findMxGramDelta(key);
+    nFields = mxGetNumberOfFields(mx);
+    changedNames = mxMalloc((nFields+1)*sizeof(char*));
+    changedValues = mxMalloc((nFields+1)*sizeof(char*));
+    changedFields = mxMalloc((nFields+1)*sizeof(int));
+    baselineFields = mxMalloc((nFields+1)*sizeof(int));
+    changedLengths = mxMalloc((nFields+1)*sizeof(int));
+
+    // serialize every field before touching the baseline
+    for (ii=0; ii<nFields; ii++) {
+        field = mxGetFieldByNumber(mx, 0, ii);
+        nBytes = mxGramSize(field);
+        if (nBytes <= 0)
+            break;
+
+        value = mxMalloc(nBytes);
+        if (mxToBytes(field, value, nBytes) != nBytes) {
+            mxFree(value);
+            break;
+        }
+
+        fieldIndex = findMxGramDeltaField(delta, mxGetFieldNameByNumber(mx, ii), ii);
+        if (fieldIndex >= 0 && delta->nValueBytes[fieldIndex] == nBytes
+                && !memcmp(delta->values[fieldIndex], value, nBytes)) {
+            mxFree(value);
+            continue;
+        }
+
+        changedNames[nChanged] = mxGetFieldNameByNumber(mx, ii);
+        changedValues[nChanged] = value;
+        changedFields[nChanged] = ii;
+        baselineFields[nChanged] = fieldIndex;
+        changedLengths[nChanged] = nBytes;
+        nChanged++;
+    }
+
+    if (ii < nFields) {
+        // some field can't be sent, so leave the baseline alone
+        for (jj=0; jj<nChanged; jj++)
+            mxFree(changedValues[jj]);
+        nChanged = -1;
+
+    } else {
+        // return the changed fields, and remember them
+        *deltaMx = mxCreateStructMatrix(1, 1, nChanged, changedNames);
+        for (jj=0; jj<nChanged; jj++) {
+            field = mxGetFieldByNumber(mx, 0, changedFields[jj]);
+            if (field != NULL)
+                mxSetFieldByNumber(*deltaMx, 0, jj, mxDuplicateArray(field));
+            setMxGramDeltaField(delta, baselineFields[jj], changedNames[jj],
+                    changedValues[jj], changedLengths[jj]);
+        }
+    }
+
+    mxFree(changedNames);
+    mxFree(changedValues);
+    mxFree(changedFields);
+    mxFree(baselineFields);
+    mxFree(changedLengths);
+    return(nChanged);
+}
+
+void clearMxGramDeltas(const char *keyPrefix) {
+    int ii = 0;
+    size_t nPrefix = keyPrefix == NULL ? 0 : strlen(keyPrefix);
+
+    // fill each freed slot with the last baseline
+    while (ii < nDeltas) {
+        if (keyPrefix == NULL || !strncmp(deltas[ii].key, keyPrefix, nPrefix)) {
+            freeMxGramDelta(&deltas[ii]);
+            deltas[ii] = deltas[--nDeltas];
+        } else
+            ii++;
+    }
+
+    if (nDeltas == 0 && deltas != NULL) {
+        mxFree(deltas);
+        deltas = NULL;
+        maxDeltas = 0;
+    }
+}
@@ -0,0 +1,178 @@
+/* mxGramFunctionCache.c
+ *
+ * Caches for converting function handles to strings and back, so that
+ * repeated handles don't call into the Matlab interpreter each time.
+ *
+ * Encoding caches each handle's string, keyed by the handle's mxArray.
+ * mxArray pointers are only safe keys while Matlab holds the arrays, so
+ * this cache is cleared at the end of each mxGram call.  It still saves
+ * the second func2str for each handle, since mxGram sizes variables
+ * before encoding them.
+ *
+ * Decoding caches a function handle for each string, keyed by the
+ * string, and keeps them across calls.  str2func gives equivalent
+ * handles for the same string, so a duplicate of a cached handle can
+ * stand in for a new one.
+ *
+ */
+
+#include "mxGram.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+// handle strings for the current call
+static mxGramFunctionString *functionStrings;
+static int nFunctionStrings;
+static int maxFunctionStrings;
+
+// handles for recent strings, direct-mapped by hash
+static mxGramStringFunction stringFunctions[MX_GRAM_FUNCTION_CACHE_SIZE];
+
+static mxGramFunctionCacheStats cacheStats;
+
+double getMxGramSeconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return((double)counter.QuadPart / (double)frequency.QuadPart);
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return(now.tv_sec + 1e-6*now.tv_usec);
+#endif
+}
+
+const mxArray *getMxGramFunctionString(const mxArray *function) {
+    int ii;
+    double startTime;
+    mxArray *string;
+    mxArray *callMatlabError;
+    
+    for (ii=0; ii<nFunctionStrings; ii++) {
+        if (functionStrings[ii].function == function) {
+            cacheStats.func2strHits++;
+            return(functionStrings[ii].string);
+        }
+    }
+    
+    startTime = getMxGramSeconds();
+    callMatlabError = mexCallMATLABWithTrap(1, &string, 1, (mxArray**)&function, MX_GRAM_FUNCTION_TO_STRING);
+    cacheStats.func2strSeconds += getMxGramSeconds() - startTime;
+    cacheStats.func2strCalls++;
+    if (callMatlabError != NULL || string == NULL)
+        return(NULL);
+    
+    if (nFunctionStrings == maxFunctionStrings) {
+        maxFunctionStrings = 2*maxFunctionStrings + 8;
+        functionStrings = mxRealloc(functionStrings, maxFunctionStrings*sizeof(mxGramFunctionString));
+        mexMakeMemoryPersistent(functionStrings);
+    }
+    functionStrings[nFunctionStrings].function = function;
+    functionStrings[nFunctionStrings].string = string;
+    nFunctionStrings++;
+    return(string);
+}
+
+void clearMxGramFunctionStrings(void) {
+    int ii;
+    for (ii=0; ii<nFunctionStrings; ii++)
+        mxDestroyArray(functionStrings[ii].string);
+    nFunctionStrings = 0;
+}
+
+mxArray *getMxGramFunctionFromString(const mxArray *string) {
+    int ii;
+    double startTime;
+    char *key;
+    MX_GRAM_UINT32 hash = 2166136261U;
+    mxArray *function;
+    mxArray *callMatlabError;
+    mxGramStringFunction *entry;
+    
+    key = mxArrayToString(string);
+    if (key == NULL)
+        return(NULL);
+    
+    // FNV-1a
+    for (ii=0; key[ii] != '\0'; ii++) {
+        hash ^= (MX_GRAM_UINT8)key[ii];
+        hash *= 16777619U;
+    }
+    entry = &stringFunctions[hash % MX_GRAM_FUNCTION_CACHE_SIZE];
+    
+    if (entry->function != NULL && entry->hash == hash && !strcmp(entry->string, key)) {
+        mxFree(key);
+        cacheStats.str2funcHits++;
+        return(mxDuplicateArray(entry->function));
+    }
+    
+    startTime = getMxGramSeconds();
+    callMatlabError = mexCallMATLABWithTrap(1, &function, 1, (mxArray**)&string, MX_GRAM_STRING_TO_FUNCTION);
+    cacheStats.str2funcSeconds += getMxGramSeconds() - startTime;
+    cacheStats.str2funcCalls++;
+    if (callMatlabError != NULL || function == NULL) {
+        mxFree(key);
+        return(NULL);
+    }
+    
+    // replace whatever handle was cached in this slot
+    if (entry->function != NULL) {
+        mxDestroyArray(entry->function);
+        mxFree(entry->string);
+    }
+    entry->string = key;
+    mexMakeMemoryPersistent(entry->string);
+    entry->hash = hash;
+    entry->function = mxDuplicateArray(function);
+    mexMakeArrayPersistent(entry->function);
+    return(function);
+}
+
+void clearMxGramFunctionCache(void) {
+    int ii;
+    
+    clearMxGramFunctionStrings();
+    if (functionStrings != NULL)
+        mxFree(functionStrings);
+    functionStrings = NULL;
+    maxFunctionStrings = 0;
+    
+    for (ii=0; ii<MX_GRAM_FUNCTION_CACHE_SIZE; ii++) {
+        if (stringFunctions[ii].function != NULL) {
+            mxDestroyArray(stringFunctions[ii].function);
+            mxFree(stringFunctions[ii].string);
+        }
+    }
+    memset(stringFunctions, 0, sizeof(stringFunctions));
+    memset(&cacheStats, 0, sizeof(cacheStats));
+}
+
+mxArray *getMxGramFunctionCacheStats(void) {
+    const char *fieldNames[] = {"func2strCalls", "func2strHits", "func2strSeconds",
+            "str2funcCalls", "str2funcHits", "str2funcSeconds", "savedSeconds"};
+    double savedSeconds = 0;
+    mxArray *stats;
+    
+    // assume each hit would have taken the average time of a call
+    if (cacheStats.func2strCalls > 0)
+        savedSeconds += cacheStats.func2strHits
+                * cacheStats.func2strSeconds / cacheStats.func2strCalls;
+    if (cacheStats.str2funcCalls > 0)
+        savedSeconds += cacheStats.str2funcHits
+                * cacheStats.str2funcSeconds / cacheStats.str2funcCalls;
+    
+    stats = mxCreateStructMatrix(1, 1, 7, fieldNames);
+    mxSetFieldByNumber(stats, 0, 0, mxCreateDoubleScalar(cacheStats.func2strCalls));
+    mxSetFieldByNumber(stats, 0, 1, mxCreateDoubleScalar(cacheStats.func2strHits));
+    mxSetFieldByNumber(stats, 0, 2, mxCreateDoubleScalar(cacheStats.func2strSeconds));
+    mxSetFieldByNumber(stats, 0, 3, mxCreateDoubleScalar(cacheStats.str2funcCalls));
+    mxSetFieldByNumber(stats, 0, 4, mxCreateDoubleScalar(cacheStats.str2funcHits));
+    mxSetFieldByNumber(stats, 0, 5, mxCreateDoubleScalar(cacheStats.str2funcSeconds));
+    mxSetFieldByNumber(stats, 0, 6, mxCreateDoubleScalar(savedSeconds));
+    return(stats);
+}
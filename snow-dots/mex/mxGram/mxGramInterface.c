@@ -11,12 +11,20 @@
 
 #include "mxGram.h"
 
-// may be platform dependent, roughly the max length of a UDP datagram
-#define MAX_NUM_BYTES 8192
+// long enough for any command name
+#define MAX_COMMAND_LENGTH 64
+
+// free decoders, caches, and schemas when Matlab clears this function
+static void clearMxGram(void) {
+    closeAllMxGramDecoders();
+    clearMxGramFunctionCache();
+    clearMxGramSchemaTables();
+    clearMxGramDeltas(NULL);
+}
 
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     
-    static char bigByteBuffer[MAX_NUM_BYTES];
+    char commandName[MAX_COMMAND_LENGTH];
     char* byteData;
     int nBytes = 0;
 	int nBytesRead = 0;
@@ -24,24 +32,67 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     
     // just for "test" case
     int ii;
+    char testBytes[sizeof(double)];
     MX_GRAM_UINT16 testInt;
 	MX_GRAM_UINT16 readInt;
+    MX_GRAM_UINT32 testWideInt;
+    MX_GRAM_UINT32 readWideInt;
     double testDoubles[] = {-6000, -1.1, 0, 1.1, 6000, 3.14159265358979};
     int n = sizeof(testDoubles)/sizeof(testDoubles[0]);
     double readDouble;
     
+    // just for compressed or packed "mxToBytes" cases
+    double compressThreshold;
+    int wasPacked;
+    char *rawData;
+    
+    // just for schema cases
+    int nSchemaBytes;
+    int schemaKey;
+    int isNewLayout = 0;
+    
+    // just for decoder cases
+    int decoderID;
+    int status;
+    
+    // just for delta cases
+    char *key;
+    
+    // just for "benchmark" case
+    double benchmarkSizes[] = {1e3, 1e4, 1e5, 1e6};
+    int nBenchmarkSizes = sizeof(benchmarkSizes)/sizeof(benchmarkSizes[0]);
+    
     if(sizeof(double) != 8) mexPrintf("\n\nThis platform does not use 8-byte doubles--a problem\n\n");
     
+    mexAtExit(clearMxGram);
+    
     if(nrhs > 0 && mxIsChar(prhs[0])){
-        mxGetString(prhs[0], bigByteBuffer, sizeof(bigByteBuffer));
+        mxGetString(prhs[0], commandName, sizeof(commandName));
         
-        if(!strcmp(bigByteBuffer, "mxToBytes") && nrhs==2) {
+        if(!strcmp(commandName, "mxToBytes") && nrhs>=2 && nrhs<=4) {
+            
+            // optional size at which to try compression
+            compressThreshold = nrhs>=3 ? mxGetScalar(prhs[2]) : mxGetInf();
             
-            nBytes = mxToBytes(prhs[1], bigByteBuffer, sizeof(bigByteBuffer));
+            // optionally pack struct arrays, for peers that can read them
+            wasPacked = setMxGramStructPacking(nrhs==4 && mxGetScalar(prhs[3]) != 0);
+            
+            // write directly into an array of the uncompressed size
+            //  and trim it to fit a compressed gram
+            nBytes = mxGramSize(prhs[1]);
             if (nBytes > 0) {
                 plhs[0] = mxCreateNumericMatrix(1, nBytes, mxUINT8_CLASS, mxREAL);
                 byteData = mxGetData(plhs[0]);
-                memcpy(byteData, bigByteBuffer, nBytes);
+                nBytes = mxToBytesMaybeCompressed(prhs[1], byteData, nBytes, compressThreshold, nBytes);
+                if (nBytes > 0)
+                    mxSetN(plhs[0], nBytes);
+                else
+                    mxDestroyArray(plhs[0]);
+            }
+            
+            setMxGramStructPacking(wasPacked);
+            
+            if (nBytes > 0) {
                 plhs[1] = mxCreateDoubleScalar(nBytes);
                 
             } else {
@@ -49,14 +100,25 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
                 plhs[1] = mxCreateDoubleScalar(-1);
             }
             
-        } else if (!strcmp(bigByteBuffer, "bytesToMx") && nrhs==2) {
+        } else if (!strcmp(commandName, "size") && (nrhs==2 || nrhs==3)) {
+            
+            // exact number of bytes mxToBytes would return
+            wasPacked = setMxGramStructPacking(nrhs==3 && mxGetScalar(prhs[2]) != 0);
+            nBytes = mxGramSize(prhs[1]);
+            setMxGramStructPacking(wasPacked);
+            plhs[0] = mxCreateDoubleScalar(nBytes > 0 ? nBytes : -1);
+            
+        } else if (!strcmp(commandName, "bytesToMx") && (nrhs==2 || nrhs==3)) {
+            
+            // optional peer key for schema layouts
+            schemaKey = nrhs==3 ? (int)mxGetScalar(prhs[2]) : MX_GRAM_DEFAULT_SCHEMA_KEY;
             
+            // read directly from the uint8 array, without copying it first
             nBytes = mxGetM(prhs[1]) * mxGetN(prhs[1]);
-            if (nBytes > 0 && nBytes <= sizeof(bigByteBuffer)) {
+            if (nBytes > 0 && mxIsUint8(prhs[1])) {
                 byteData = mxGetData(prhs[1]);
-                memcpy(bigByteBuffer, byteData, nBytes);
                 
-                nBytesRead = bytesToMx(&newMex, (const char *)bigByteBuffer, nBytes);
+                nBytesRead = bytesToMxWithSchemas(&newMex, (const char *)byteData, nBytes, schemaKey);
                 if (nBytesRead > 0) {
                     plhs[0] = newMex;
                     plhs[1] = mxCreateDoubleScalar(nBytesRead);
@@ -71,24 +133,172 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
                 plhs[1] = mxCreateDoubleScalar(-3);
             }
             
-        } else if (!strcmp(bigByteBuffer, "test")) {
+        } else if (!strcmp(commandName, "schemaEncode") && (nrhs==2 || nrhs==3)) {
+            
+            // optional peer key for schema layouts
+            schemaKey = nrhs==3 ? (int)mxGetScalar(prhs[2]) : MX_GRAM_DEFAULT_SCHEMA_KEY;
+            
+            // peers that read schemas also read packed structs
+            wasPacked = setMxGramStructPacking(1);
+            
+            // send just values for a recent layout
+            nBytes = getMxSchemaGramRecentSize(schemaKey);
+            if (nBytes > 0) {
+                rawData = mxMalloc(nBytes);
+                nBytes = writeMxSchemaGramFromRecentLayout(schemaKey, prhs[1], rawData, nBytes);
+                if (nBytes > 0) {
+                    plhs[0] = mxCreateNumericMatrix(0, 0, mxUINT8_CLASS, mxREAL);
+                    mxSetData(plhs[0], rawData);
+                    mxSetM(plhs[0], 1);
+                    mxSetN(plhs[0], nBytes);
+                } else
+                    mxFree(rawData);
+            }
+            
+            // or serialize the whole variable and split out its layout
+            if (nBytes <= 0) {
+                nBytes = mxGramSize(prhs[1]);
+                if (nBytes > 0) {
+                    rawData = mxMalloc(nBytes);
+                    nBytes = mxToBytes(prhs[1], rawData, nBytes);
+                    if (nBytes > 0) {
+                        nSchemaBytes = nBytes + MX_GRAM_WIDE_INFO_HEAD + MX_GRAM_SCHEMA_HASH_LENGTH;
+                        plhs[0] = mxCreateNumericMatrix(1, nSchemaBytes, mxUINT8_CLASS, mxREAL);
+                        byteData = mxGetData(plhs[0]);
+                        nSchemaBytes = writeMxSchemaGramToBytes(schemaKey, rawData, nBytes,
+                                byteData, nSchemaBytes, &isNewLayout);
+                        if (nSchemaBytes > 0)
+                            nBytes = nSchemaBytes;
+                        else
+                            memcpy(byteData, rawData, nBytes);
+                        mxSetN(plhs[0], nBytes);
+                    }
+                    mxFree(rawData);
+                }
+            }
+            setMxGramStructPacking(wasPacked);
+            
+            if (nBytes > 0) {
+                plhs[1] = mxCreateDoubleScalar(nBytes);
+                
+            } else {
+                plhs[0] = mxCreateNumericMatrix(0, 0, mxUINT8_CLASS, mxREAL);
+                plhs[1] = mxCreateDoubleScalar(-1);
+            }
+            if (nlhs >= 3)
+                plhs[2] = mxCreateLogicalScalar(nBytes > 0 && isNewLayout);
+            
+        } else if (!strcmp(commandName, "schemaClear")) {
+            
+            // start over with new schema IDs and layouts for one peer
+            //  or forget all layouts, sent and received
+            if (nrhs==2)
+                clearMxGramEncoderSchemas((int)mxGetScalar(prhs[1]));
+            else
+                clearMxGramSchemaTables();
+            
+        } else if (!strcmp(commandName, "deltaEncode") && nrhs==3) {
+            
+            // just the struct fields that changed since the last time
+            key = mxArrayToString(prhs[1]);
+            status = writeMxDeltaStruct(key, prhs[2], &newMex);
+            if (key != NULL)
+                mxFree(key);
+            
+            if (status >= 0) {
+                plhs[0] = newMex;
+                plhs[1] = mxCreateDoubleScalar(status);
+                
+            } else {
+                plhs[0] = mxCreateDoubleMatrix(0, 0, mxREAL);
+                plhs[1] = mxCreateDoubleScalar(-1);
+            }
+            
+        } else if (!strcmp(commandName, "deltaClear")) {
+            
+            // forget baselines, so the next deltas carry every field
+            if (nrhs==2 && mxIsChar(prhs[1])) {
+                key = mxArrayToString(prhs[1]);
+                clearMxGramDeltas(key);
+                mxFree(key);
+            } else
+                clearMxGramDeltas(NULL);
+            
+        } else if (!strcmp(commandName, "functionCacheStats")) {
+            
+            // how often function handles skipped calls to Matlab
+            plhs[0] = getMxGramFunctionCacheStats();
+            
+        } else if (!strcmp(commandName, "functionCacheClear")) {
+            
+            // forget cached function handles, as after changing the path
+            clearMxGramFunctionCache();
+            
+        } else if (!strcmp(commandName, "decoderOpen")) {
+            
+            decoderID = openMxGramDecoder();
+            plhs[0] = mxCreateDoubleScalar(decoderID);
+            
+        } else if (!strcmp(commandName, "decoderPush") && nrhs==3) {
+            
+            // decode whatever grams these bytes complete
+            decoderID = (int)mxGetScalar(prhs[1]);
+            nBytes = mxGetM(prhs[2]) * mxGetN(prhs[2]);
+            if (mxIsUint8(prhs[2])) {
+                byteData = mxGetData(prhs[2]);
+                status = pushBytesToMxGramDecoder(decoderID, (const char *)byteData, nBytes, &plhs[0]);
+                plhs[1] = mxCreateDoubleScalar(status < 0 ? status : nBytes);
+                
+            } else {
+                plhs[0] = mxCreateCellMatrix(1, 0);
+                plhs[1] = mxCreateDoubleScalar(-3);
+            }
+            
+        } else if (!strcmp(commandName, "decoderClose") && nrhs==2) {
+            
+            decoderID = (int)mxGetScalar(prhs[1]);
+            status = closeMxGramDecoder(decoderID);
+            plhs[0] = mxCreateDoubleScalar(status);
+            
+        } else if (!strcmp(commandName, "benchmark")) {
+            
+            // optional array sizes to benchmark
+            if (nrhs==2 && mxIsDouble(prhs[1]) && !mxIsEmpty(prhs[1]))
+                plhs[0] = mxGramBenchmark(mxGetPr(prhs[1]), (int)(mxGetM(prhs[1]) * mxGetN(prhs[1])));
+            else
+                plhs[0] = mxGramBenchmark(benchmarkSizes, nBenchmarkSizes);
+            
+        } else if (!strcmp(commandName, "test")) {
             
             mexPrintf("Sanity test for uint16:\n\n");
             for (ii=0; ii<65536; ii+=100) {
                 testInt = ii;
-                writeInt16ToBytes(testInt, bigByteBuffer);
-                readInt = readInt16FromBytes(bigByteBuffer);
+                writeInt16ToBytes(testInt, testBytes);
+                readInt = readInt16FromBytes(testBytes);
                 mexPrintf("%u -> %u %u -> %u\n",
                         (MX_GRAM_UINT16)testInt,
-                        (MX_GRAM_UINT8)bigByteBuffer[0], (MX_GRAM_UINT8)bigByteBuffer[1],
+                        (MX_GRAM_UINT8)testBytes[0], (MX_GRAM_UINT8)testBytes[1],
                         (MX_GRAM_UINT16)readInt);
             }
             mexPrintf("\n");
             
+            mexPrintf("Sanity test for uint32:\n\n");
+            for (ii=0; ii<32; ii++) {
+                testWideInt = (MX_GRAM_UINT32)1 << ii;
+                writeInt32ToBytes(testWideInt, testBytes);
+                readWideInt = readInt32FromBytes(testBytes);
+                mexPrintf("%u -> %u %u %u %u -> %u\n",
+                        testWideInt,
+                        (MX_GRAM_UINT8)testBytes[0], (MX_GRAM_UINT8)testBytes[1],
+                        (MX_GRAM_UINT8)testBytes[2], (MX_GRAM_UINT8)testBytes[3],
+                        readWideInt);
+            }
+            mexPrintf("\n");
+            
             mexPrintf("Sanity test for double:\n\n");
             for (ii=0; ii<n; ii++) {
-                writeDouble64ToBytes(testDoubles[ii], bigByteBuffer);
-                readDouble = readDouble64FromBytes(bigByteBuffer);
+                writeDouble64ToBytes(testDoubles[ii], testBytes);
+                readDouble = readDouble64FromBytes(testBytes);
                 mexPrintf("%.15f -> %.15f\n",
                         testDoubles[ii],
                         readDouble);
@@ -97,10 +307,24 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
         
     } else {
         
-        mexPrintf("mxGram usage:\n %s\n %s\n",
-                "[uint8Array, status] = mxGram('mxToBytes', variable)",
-                "[variable, status] = mxGram('bytesToMx', uint8Array)");
+        mexPrintf("mxGram usage:\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n %s\n",
+                "[uint8Array, status] = mxGram('mxToBytes', variable [, compressThreshold, isPacked])",
+                "nBytes = mxGram('size', variable [, isPacked])",
+                "[variable, status] = mxGram('bytesToMx', uint8Array [, schemaKey])",
+                "[uint8Array, status, isNewLayout] = mxGram('schemaEncode', variable [, schemaKey])",
+                "mxGram('schemaClear' [, schemaKey])",
+                "[delta, nChanged] = mxGram('deltaEncode', key, scalarStruct)",
+                "mxGram('deltaClear' [, keyPrefix])",
+                "stats = mxGram('functionCacheStats')",
+                "mxGram('functionCacheClear')",
+                "decoder = mxGram('decoderOpen')",
+                "[variables, status] = mxGram('decoderPush', decoder, uint8Array)",
+                "status = mxGram('decoderClose', decoder)",
+                "results = mxGram('benchmark' [, nElements])");
         
     }
+    
+    // handle strings are only good during this call
+    clearMxGramFunctionStrings();
 }
 
@@ -0,0 +1,589 @@
+/* mxGramSchema.c
+ *
+ * Schema grams for variables that have the same layout over and over,
+ * like ensemble transactions.  A layout is all of a gram's headers, plus
+ * struct field names, with the data left out.  The first time a layout
+ * is sent, the schema gram carries the layout along with a schema ID.
+ * After that, it carries just the ID and the data values.  Encoders and
+ * decoders each keep a table of layouts, indexed by schema ID.
+ *
+ * Each peer gets its own tables, found by an integer key, like a socket
+ * or address.  Otherwise, a layout sent to one peer would look like it
+ * had been sent to all of them.  Every schema gram also carries a hash of
+ * its layout, so a decoder with a stale or missing layout fails, instead
+ * of reading values with the wrong layout.
+ *
+ * A new layout is found by serializing the whole variable and splitting
+ * the gram.  After that, encoders walk the variable alongside the layouts
+ * they sent most recently, and write just the values.  Decoders walk the
+ * layout and read values straight into new arrays.  Neither one makes an
+ * ordinary gram along the way.
+ *
+ */
+
+#include "mxGram.h"
+
+static mxGramSchemaTable *schemaTables[MX_GRAM_MAX_SCHEMA_TABLES];
+static unsigned int schemaTableUses;
+
+// bytesToMx() reads schema grams with this peer's layouts
+static int decoderSchemaKey = MX_GRAM_DEFAULT_SCHEMA_KEY;
+
+int writeMxSchemaGramToBytes(int schemaKey, const char *gramBytes, int gramLength, char *byteArray, int byteArrayLength, int *isNewLayout) {
+    int schemaID;
+    int nLayoutBytes, nValueBytes, nSentLayoutBytes;
+    char *layout, *values, *layoutEnd, *valuesEnd, *data;
+    MX_GRAM_UINT32 layoutHash;
+    mxGramInfo info;
+    mxGramSchemaTable *table;
+    
+    // split the gram into layout and values
+    layout = mxMalloc(2*(size_t)gramLength);
+    values = layout + gramLength;
+    layoutEnd = layout;
+    valuesEnd = values;
+    if (splitMxGramLayout(gramBytes, gramLength, &layoutEnd, &valuesEnd, 0) != gramLength) {
+        mxFree(layout);
+        return(-1);
+    }
+    nLayoutBytes = (int)(layoutEnd - layout);
+    nValueBytes = (int)(valuesEnd - values);
+    
+    // look up the layout, or register it and send it along
+    table = getMxGramSchemaTable(schemaKey, 1);
+    layoutHash = hashMxGramLayout(layout, nLayoutBytes);
+    schemaID = findMxGramEncoderLayout(table, layout, nLayoutBytes, layoutHash);
+    *isNewLayout = schemaID < 0;
+    if (*isNewLayout)
+        schemaID = addMxGramEncoderLayout(table, layout, nLayoutBytes, nValueBytes, layoutHash);
+    if (schemaID < 0) {
+        mxFree(layout);
+        return(-1);
+    }
+    useMxGramEncoderLayout(table, schemaID);
+    nSentLayoutBytes = *isNewLayout ? nLayoutBytes : 0;
+    
+    // dataM is the schema ID, dataN is the length of any layout
+    setInfoFieldsForMatrix(&info, mxGramSchema, 1, schemaID, nSentLayoutBytes);
+    info.dataLength = MX_GRAM_SCHEMA_HASH_LENGTH + nSentLayoutBytes + nValueBytes;
+    setInfoHeadLength(&info, info.dataLength);
+    if (info.gramLength > (MX_GRAM_UINT32)byteArrayLength) {
+        mxFree(layout);
+        return(-1);
+    }
+    
+    writeInfoFieldsToBytes(&info, byteArray, byteArrayLength);
+    data = byteArray + info.headLength;
+    writeInt32ToBytes(layoutHash, data);
+    data += MX_GRAM_SCHEMA_HASH_LENGTH;
+    memcpy(data, layout, nSentLayoutBytes);
+    memcpy(data + nSentLayoutBytes, values, nValueBytes);
+    mxFree(layout);
+    return(info.gramLength);
+}
+
+int getMxSchemaGramRecentSize(int schemaKey) {
+    int ii, gramLength = -1;
+    mxGramInfo info;
+    mxGramSchemaTable *table = getMxGramSchemaTable(schemaKey, 0);
+    if (table == NULL)
+        return(-1);
+    
+    // room for the largest gram from any recent layout
+    for (ii=0; ii<table->nRecentEncoderLayouts; ii++) {
+        setInfoFieldsForMatrix(&info, mxGramSchema, 1, table->recentEncoderLayouts[ii], 0);
+        setInfoHeadLength(&info, MX_GRAM_SCHEMA_HASH_LENGTH
+                + (size_t)table->encoderLayouts[table->recentEncoderLayouts[ii]].nValueBytes);
+        if ((int)info.gramLength > gramLength)
+            gramLength = info.gramLength;
+    }
+    return(gramLength);
+}
+
+int writeMxSchemaGramFromRecentLayout(int schemaKey, const mxArray *mx, char *byteArray, int byteArrayLength) {
+    int ii, schemaID, nValueBytes;
+    const char *layout, *layoutEnd;
+    char *data;
+    mxGramInfo info;
+    mxGramLayout *schema;
+    mxGramSchemaTable *table = getMxGramSchemaTable(schemaKey, 0);
+    if (table == NULL)
+        return(-1);
+    
+    // write values straight from the variable, if it fits a recent layout
+    for (ii=0; ii<table->nRecentEncoderLayouts; ii++) {
+        schemaID = table->recentEncoderLayouts[ii];
+        schema = &table->encoderLayouts[schemaID];
+        setInfoFieldsForMatrix(&info, mxGramSchema, 1, schemaID, 0);
+        info.dataLength = MX_GRAM_SCHEMA_HASH_LENGTH + schema->nValueBytes;
+        setInfoHeadLength(&info, info.dataLength);
+        if (info.gramLength > (MX_GRAM_UINT32)byteArrayLength)
+            continue;
+        
+        layout = schema->layoutBytes;
+        layoutEnd = layout + schema->nLayoutBytes;
+        data = byteArray + info.headLength + MX_GRAM_SCHEMA_HASH_LENGTH;
+        nValueBytes = writeMxLayoutValuesToBytes(mx, &layout, layoutEnd, data, schema->nValueBytes);
+        if (nValueBytes != schema->nValueBytes || layout != layoutEnd)
+            continue;
+        
+        writeInfoFieldsToBytes(&info, byteArray, byteArrayLength);
+        writeInt32ToBytes(schema->layoutHash, byteArray + info.headLength);
+        useMxGramEncoderLayout(table, schemaID);
+        return(info.gramLength);
+    }
+    return(-1);
+}
+
+int writeMxLayoutValuesToBytes(const mxArray *mx, const char **layout, const char *layoutEnd, char *values, int nValueBytes) {
+    int ii, nFields, nChildren, nChildBytes;
+    int nBytesWritten = 0;
+    size_t jj, numel, nameLength;
+    const char *names;
+    const mxArray *elementData;
+    mxGramInfo info, mxInfo, namesInfo;
+    
+    if (readInfoFieldsFromBytes(&info, *layout, (int)(layoutEnd - *layout)) < 0)
+        return(-1);
+    *layout += info.headLength;
+    
+    // unset cell elements and struct fields go as empty doubles
+    if (mx == NULL)
+        return(info.gramType==mxGramDouble && info.gramFlags==0
+                && info.dataM==0 && info.dataN==0 && info.dataLength==0 ? 0 : -1);
+    
+    // every header must be the one mxToBytes would write
+    //  containers get the same lengths when their elements match
+    setInfoFieldsFromMx(&mxInfo, mx);
+    if (mxInfo.gramType != info.gramType
+            || mxInfo.gramFlags != info.gramFlags
+            || mxInfo.dataSize != info.dataSize
+            || mxInfo.dataM != info.dataM
+            || mxInfo.dataN != info.dataN)
+        return(-1);
+    
+    if (isMxGramSimpleType(&info)) {
+        if (mxInfo.dataLength != info.dataLength
+                || mxInfo.headLength != info.headLength)
+            return(-1);
+        mxInfo.dataBytes = values;
+        return(writeMxSimpleDataToBytes(mx, &mxInfo, nValueBytes));
+        
+    } else if (info.gramType==mxGramCell) {
+        nChildren = info.dataM * info.dataN;
+        for (ii=0; ii<nChildren; ii++) {
+            nChildBytes = writeMxLayoutValuesToBytes(mxGetCell(mx, ii), layout, layoutEnd,
+                    values + nBytesWritten, nValueBytes - nBytesWritten);
+            if (nChildBytes < 0)
+                return(-1);
+            nBytesWritten += nChildBytes;
+        }
+        return(nBytesWritten);
+        
+    } else if (info.gramType==mxGramFunctionHandle) {
+        elementData = getMxGramFunctionString(mx);
+        if (elementData == NULL)
+            return(-1);
+        return(writeMxLayoutValuesToBytes(elementData, layout, layoutEnd, values, nValueBytes));
+        
+    } else if (info.gramType==mxGramPackedStruct) {
+        // field names are in the layout, and must be the same
+        if (readInfoFieldsFromBytes(&namesInfo, *layout, (int)(layoutEnd - *layout)) < 0
+                || namesInfo.gramType != mxGramChar
+                || namesInfo.dataSize != 1
+                || namesInfo.dataLength > (size_t)(layoutEnd - *layout - namesInfo.headLength))
+            return(-1);
+        names = *layout + namesInfo.headLength;
+        nFields = mxGetNumberOfFields(mx);
+        for (ii=0, jj=0; ii<nFields; ii++) {
+            nameLength = strlen(mxGetFieldNameByNumber(mx, ii)) + 1;
+            if (jj + nameLength > namesInfo.dataLength
+                    || memcmp(names + jj, mxGetFieldNameByNumber(mx, ii), nameLength))
+                return(-1);
+            jj += nameLength;
+        }
+        if (jj != namesInfo.dataLength)
+            return(-1);
+        *layout += namesInfo.gramLength;
+        
+        // each field is a column of scalars, or a cell of elements
+        numel = mxGetNumberOfElements(mx);
+        for (ii=0; ii<nFields; ii++) {
+            if (readInfoFieldsFromBytes(&info, *layout, (int)(layoutEnd - *layout)) < 0
+                    || info.dataM != 1 || info.dataN != numel)
+                return(-1);
+            
+            if (info.gramType==mxGramCell) {
+                if (isMxPackedFieldColumnar(mx, ii))
+                    return(-1);
+                *layout += info.headLength;
+                for (jj=0; jj<numel; jj++) {
+                    nChildBytes = writeMxLayoutValuesToBytes(mxGetFieldByNumber(mx, jj, ii),
+                            layout, layoutEnd, values + nBytesWritten, nValueBytes - nBytesWritten);
+                    if (nChildBytes < 0)
+                        return(-1);
+                    nBytesWritten += nChildBytes;
+                }
+                
+            } else {
+                elementData = mxGetFieldByNumber(mx, 0, ii);
+                if (!isMxPackedFieldColumnar(mx, ii)
+                        || info.gramFlags != 0
+                        || info.gramType != getMxGramTypeForMx(elementData)
+                        || info.dataSize != mxGetElementSize(elementData)
+                        || info.dataLength != info.dataSize*numel
+                        || info.dataLength > (size_t)(nValueBytes - nBytesWritten))
+                    return(-1);
+                *layout += info.headLength;
+                for (jj=0; jj<numel; jj++) {
+                    memcpy(values + nBytesWritten,
+                            mxGetData(mxGetFieldByNumber(mx, jj, ii)), info.dataSize);
+                    nBytesWritten += info.dataSize;
+                }
+            }
+        }
+        return(nBytesWritten);
+    }
+    return(-1);
+}
+
+int readMxLayoutValuesFromBytes(mxArray **mx, const char **layout, const char *layoutEnd, const char **values, const char *valuesEnd) {
+    int ii, nFields, nChildren, status;
+    int nBytesRead = 0;
+    mxGramInfo info, namesInfo;
+    mxArray *elementData;
+    
+    *mx = NULL;
+    if (readInfoFieldsFromBytes(&info, *layout, (int)(layoutEnd - *layout)) < 0)
+        return(-1);
+    *layout += info.headLength;
+    
+    if (isMxGramSimpleType(&info)) {
+        // data come from the values
+        info.dataBytes = (char *)*values;
+        if (!hasMxGramDataBytes(&info, (int)(valuesEnd - *values)))
+            return(-1);
+        nBytesRead = readMxSimpleGramFromBytes(mx, &info, (int)(valuesEnd - *values));
+        if (nBytesRead < 0) {
+            mxDestroyArray(*mx);
+            *mx = NULL;
+            return(-1);
+        }
+        *values += nBytesRead;
+        return(nBytesRead);
+        
+    } else if (info.gramType==mxGramCell) {
+        *mx = mxCreateCellMatrix(info.dataM, info.dataN);
+        nChildren = info.dataM * info.dataN;
+        for (ii=0; ii<nChildren; ii++) {
+            status = readMxLayoutValuesFromBytes(&elementData, layout, layoutEnd, values, valuesEnd);
+            if (status < 0) {
+                mxDestroyArray(*mx);
+                *mx = NULL;
+                return(-1);
+            }
+            mxSetCell(*mx, ii, elementData);
+            nBytesRead += status;
+        }
+        return(nBytesRead);
+        
+    } else if (info.gramType==mxGramFunctionHandle) {
+        nBytesRead = readMxLayoutValuesFromBytes(&elementData, layout, layoutEnd, values, valuesEnd);
+        if (nBytesRead < 0)
+            return(-1);
+        *mx = getMxGramFunctionFromString(elementData);
+        mxDestroyArray(elementData);
+        return(*mx != NULL ? nBytesRead : -1);
+        
+    } else if (info.gramType==mxGramPackedStruct) {
+        // field names come from the layout
+        if (readInfoFieldsFromBytes(&namesInfo, *layout, (int)(layoutEnd - *layout)) < 0
+                || namesInfo.gramType != mxGramChar
+                || namesInfo.dataSize != 1
+                || !hasMxGramDataBytes(&namesInfo, (int)(layoutEnd - *layout - namesInfo.headLength)))
+            return(-1);
+        *mx = createMxPackedStruct(*layout + namesInfo.headLength,
+                namesInfo.dataLength, info.dataM, info.dataN);
+        if (*mx == NULL)
+            return(-1);
+        *layout += namesInfo.headLength + namesInfo.dataLength;
+        
+        // spread each column over the elements
+        nFields = mxGetNumberOfFields(*mx);
+        for (ii=0; ii<nFields; ii++) {
+            status = readMxLayoutValuesFromBytes(&elementData, layout, layoutEnd, values, valuesEnd);
+            if (status >= 0) {
+                nBytesRead += status;
+                status = setMxPackedFieldFromColumn(*mx, ii, elementData);
+                mxDestroyArray(elementData);
+            }
+            if (status < 0) {
+                mxDestroyArray(*mx);
+                *mx = NULL;
+                return(-1);
+            }
+        }
+        return(nBytesRead);
+    }
+    return(-1);
+}
+
+int readMxSchemaGramFromBytes(mxArray **mx, mxGramInfo *info, int nBytes) {
+    int nValueBytes;
+    const char *data, *layout, *values;
+    MX_GRAM_UINT32 layoutHash;
+    mxGramSchemaTable *table;
+    mxGramLayout *schema;
+    
+    if (info->dataM >= MX_GRAM_MAX_SCHEMAS
+            || (size_t)MX_GRAM_SCHEMA_HASH_LENGTH + info->dataN > info->dataLength)
+        return(-1);
+    data = info->dataBytes + MX_GRAM_SCHEMA_HASH_LENGTH;
+    layoutHash = readInt32FromBytes(info->dataBytes);
+    
+    // a new layout replaces any old one with the same ID
+    table = getMxGramSchemaTable(decoderSchemaKey, 1);
+    if (info->dataN > 0)
+        setMxGramDecoderLayout(table, info->dataM, data, info->dataN);
+    
+    // the layout must be the one the encoder had in mind
+    schema = &table->decoderLayouts[info->dataM];
+    if (schema->layoutBytes == NULL || schema->layoutHash != layoutHash)
+        return(-1);
+    
+    // read values straight into arrays, following the layout
+    nValueBytes = info->dataLength - MX_GRAM_SCHEMA_HASH_LENGTH - info->dataN;
+    layout = schema->layoutBytes;
+    values = data + info->dataN;
+    if (readMxLayoutValuesFromBytes(mx, &layout, schema->layoutBytes + schema->nLayoutBytes,
+            &values, values + nValueBytes) != nValueBytes
+            || layout != schema->layoutBytes + schema->nLayoutBytes) {
+        if (*mx != NULL)
+            mxDestroyArray(*mx);
+        *mx = NULL;
+        return(-1);
+    }
+    return(info->dataLength);
+}
+
+int bytesToMxWithSchemas(mxArray **mx, const char *byteArray, int byteArrayLength, int schemaKey) {
+    int nBytesRead;
+    decoderSchemaKey = schemaKey;
+    nBytesRead = bytesToMx(mx, byteArray, byteArrayLength);
+    decoderSchemaKey = MX_GRAM_DEFAULT_SCHEMA_KEY;
+    return(nBytesRead);
+}
+
+int splitMxGramLayout(const char *gramBytes, int nBytes, char **layout, char **values, int isLayoutData) {
+    int ii, nChildren, nChildBytes;
+    int nBytesRead = 0;
+    char **dest;
+    mxGramInfo info;
+    
+    if (readInfoFieldsFromBytes(&info, gramBytes, nBytes) < 0
+            || info.gramLength > (MX_GRAM_UINT32)nBytes
+            || info.gramLength < info.headLength)
+        return(-1);
+    
+    // headers always go in the layout
+    memcpy(*layout, gramBytes, info.headLength);
+    *layout += info.headLength;
+    nBytesRead += info.headLength;
+    
+    // simple data go with the values, unless they're struct field names
+    if (!isMxGramContainerType(info.gramType)) {
+        if (info.headLength + info.dataLength != info.gramLength)
+            return(-1);
+        dest = isLayoutData ? layout : values;
+        memcpy(*dest, gramBytes + nBytesRead, info.dataLength);
+        *dest += info.dataLength;
+        return(info.gramLength);
+    }
+    
+    // recur for each element
+    nChildren = getMxGramLayoutChildren(&info, NULL, 0);
+    for (ii=0; ii<nChildren; ii++) {
+        nChildBytes = splitMxGramLayout(gramBytes + nBytesRead, info.gramLength - nBytesRead,
+                layout, values, info.gramType==mxGramPackedStruct && ii==0);
+        if (nChildBytes < 0)
+            return(-1);
+    
+        // packed structs have a field for each name
+        if (ii == 0)
+            nChildren = getMxGramLayoutChildren(&info, gramBytes + nBytesRead, nChildBytes);
+        nBytesRead += nChildBytes;
+    }
+    
+    if (nChildren < 0 || nBytesRead != info.gramLength)
+        return(-1);
+    return(nBytesRead);
+}
+
+int getMxGramLayoutChildren(const mxGramInfo *info, const char *firstChild, int nFirstChildBytes) {
+    int jj, nNames = 0;
+    mxGramInfo namesInfo;
+    
+    if (info->gramType==mxGramCell)
+        return(info->dataM * info->dataN);
+    
+    else if (info->gramType==mxGramFunctionHandle)
+        return(1);
+    
+    else if (info->gramType==mxGramStruct)
+        return(info->dataM + info->dataM * info->dataN);
+    
+    else if (info->gramType==mxGramPackedStruct) {
+        // a names gram comes first, then a field for each name
+        if (firstChild == NULL)
+            return(1);
+        if (readInfoFieldsFromBytes(&namesInfo, firstChild, nFirstChildBytes) < 0
+                || namesInfo.gramType != mxGramChar || namesInfo.dataSize != 1)
+            return(-1);
+        for (jj=0; jj<(int)namesInfo.dataLength; jj++)
+            if (firstChild[namesInfo.headLength + jj] == '\0')
+                nNames++;
+        return(1 + nNames);
+    }
+    return(-1);
+}
+
+MX_GRAM_UINT32 hashMxGramLayout(const char *layout, int nLayoutBytes) {
+    // FNV-1a
+    int ii;
+    MX_GRAM_UINT32 hash = 2166136261U;
+    for (ii=0; ii<nLayoutBytes; ii++) {
+        hash ^= (MX_GRAM_UINT8)layout[ii];
+        hash *= 16777619U;
+    }
+    return(hash);
+}
+
+mxGramSchemaTable *getMxGramSchemaTable(int schemaKey, int isCreate) {
+    int ii, slot = -1;
+    mxGramSchemaTable *table;
+    
+    for (ii=0; ii<MX_GRAM_MAX_SCHEMA_TABLES; ii++) {
+        table = schemaTables[ii];
+        if (table != NULL && table->key == schemaKey) {
+            table->lastUse = ++schemaTableUses;
+            return(table);
+        }
+        
+        // remember an empty slot, or else the least recently used table
+        if (slot < 0 || (schemaTables[slot] != NULL
+                && (table == NULL || table->lastUse < schemaTables[slot]->lastUse)))
+            slot = ii;
+    }
+    if (!isCreate)
+        return(NULL);
+    
+    // an evicted peer just gets its layouts again
+    table = schemaTables[slot];
+    if (table == NULL) {
+        table = mxMalloc(sizeof(mxGramSchemaTable));
+        mexMakeMemoryPersistent(table);
+        schemaTables[slot] = table;
+    } else {
+        clearMxGramEncoderSchemas(table->key);
+        for (ii=0; ii<MX_GRAM_MAX_SCHEMAS; ii++)
+            if (table->decoderLayouts[ii].layoutBytes != NULL)
+                mxFree(table->decoderLayouts[ii].layoutBytes);
+    }
+    memset(table, 0, sizeof(mxGramSchemaTable));
+    table->key = schemaKey;
+    table->lastUse = ++schemaTableUses;
+    return(table);
+}
+
+int findMxGramEncoderLayout(mxGramSchemaTable *table, const char *layout, int nLayoutBytes, MX_GRAM_UINT32 layoutHash) {
+    int ii;
+    mxGramLayout *schema;
+    for (ii=0; ii<table->nEncoderLayouts; ii++) {
+        schema = &table->encoderLayouts[ii];
+        if (schema->layoutHash == layoutHash
+                && schema->nLayoutBytes == nLayoutBytes
+                && !memcmp(schema->layoutBytes, layout, nLayoutBytes))
+            return(ii);
+    }
+    return(-1);
+}
+
+int addMxGramEncoderLayout(mxGramSchemaTable *table, const char *layout, int nLayoutBytes, int nValueBytes, MX_GRAM_UINT32 layoutHash) {
+    mxGramLayout *schema;
+    
+    if (table->nEncoderLayouts >= MX_GRAM_MAX_SCHEMAS)
+        return(-1);
+    
+    schema = &table->encoderLayouts[table->nEncoderLayouts];
+    schema->layoutBytes = mxMalloc(nLayoutBytes > 0 ? nLayoutBytes : 1);
+    mexMakeMemoryPersistent(schema->layoutBytes);
+    memcpy(schema->layoutBytes, layout, nLayoutBytes);
+    schema->nLayoutBytes = nLayoutBytes;
+    schema->nValueBytes = nValueBytes;
+    schema->layoutHash = layoutHash;
+    return(table->nEncoderLayouts++);
+}
+
+void useMxGramEncoderLayout(mxGramSchemaTable *table, int schemaID) {
+    int ii;
+    
+    // find the layout among the recent ones, or let the oldest go
+    for (ii=0; ii<table->nRecentEncoderLayouts; ii++)
+        if (table->recentEncoderLayouts[ii] == schemaID)
+            break;
+    if (ii == table->nRecentEncoderLayouts) {
+        if (table->nRecentEncoderLayouts < MX_GRAM_RECENT_SCHEMAS)
+            table->nRecentEncoderLayouts++;
+        else
+            ii--;
+    }
+    
+    // move it to the front
+    for (; ii>0; ii--)
+        table->recentEncoderLayouts[ii] = table->recentEncoderLayouts[ii-1];
+    table->recentEncoderLayouts[0] = schemaID;
+}
+
+void setMxGramDecoderLayout(mxGramSchemaTable *table, int schemaID, const char *layout, int nLayoutBytes) {
+    mxGramLayout *schema = &table->decoderLayouts[schemaID];
+    
+    if (schema->layoutBytes != NULL)
+        mxFree(schema->layoutBytes);
+    
+    schema->layoutBytes = mxMalloc(nLayoutBytes > 0 ? nLayoutBytes : 1);
+    mexMakeMemoryPersistent(schema->layoutBytes);
+    memcpy(schema->layoutBytes, layout, nLayoutBytes);
+    schema->nLayoutBytes = nLayoutBytes;
+    schema->layoutHash = hashMxGramLayout(layout, nLayoutBytes);
+}
+
+void clearMxGramEncoderSchemas(int schemaKey) {
+    int ii;
+    mxGramSchemaTable *table = getMxGramSchemaTable(schemaKey, 0);
+    if (table == NULL)
+        return;
+    
+    for (ii=0; ii<table->nEncoderLayouts; ii++)
+        mxFree(table->encoderLayouts[ii].layoutBytes);
+    memset(table->encoderLayouts, 0, sizeof(table->encoderLayouts));
+    table->nEncoderLayouts = 0;
+    table->nRecentEncoderLayouts = 0;
+}
+
+void clearMxGramSchemaTables(void) {
+    int ii, jj;
+    mxGramSchemaTable *table;
+    for (ii=0; ii<MX_GRAM_MAX_SCHEMA_TABLES; ii++) {
+        table = schemaTables[ii];
+        if (table == NULL)
+            continue;
+        
+        for (jj=0; jj<table->nEncoderLayouts; jj++)
+            mxFree(table->encoderLayouts[jj].layoutBytes);
+        for (jj=0; jj<MX_GRAM_MAX_SCHEMAS; jj++)
+            if (table->decoderLayouts[jj].layoutBytes != NULL)
+                mxFree(table->decoderLayouts[jj].layoutBytes);
+        mxFree(table);
+        schemaTables[ii] = NULL;
+    }
+}
@@ -31,8 +31,8 @@ classdef TestMxGram < TestCase
         function tearDown(self)
         end
         
-        function [remade, bytes] = roundTrip(self, original)
-            bytes = mxGram('mxToBytes', original);
+        function [remade, bytes] = roundTrip(self, original, varargin)
+            bytes = mxGram('mxToBytes', original, varargin{:});
             assertEqual(class(bytes), 'uint8', ...
                 'should return array of single bytes')
             assertFalse(isempty(bytes), ...
@@ -48,6 +48,22 @@ classdef TestMxGram < TestCase
             [bytes, status] = mxGram('mxToBytes', unreasonable);
             assertFalse(status > 0, ...
                 'should return negative status for unreasonable input')
+            assertFalse(mxGram('size', unreasonable) > 0, ...
+                'should return negative size for unreasonable input')
+        end
+        
+        function bytes = roundTripLargeInput(self, large)
+            [bytes, status] = mxGram('mxToBytes', large);
+            assertEqual(status, numel(bytes), ...
+                'should return positive status for large input')
+            assertEqual(mxGram('size', large), numel(bytes), ...
+                'should predict exact number of bytes for large input')
+            
+            [remade, status] = mxGram('bytesToMx', bytes);
+            assertEqual(status, numel(bytes), ...
+                'should read all bytes of large input')
+            assertEqual(large, remade, ...
+                'should have reproduced large variable')
         end
         
         function structArray = structArrayFromCellArray(self, cellArray)
@@ -70,9 +86,38 @@ classdef TestMxGram < TestCase
             end
         end
         
-        function testUnreasonablyLargeDoublemxToChars(self)
-            unreasonable = eye(1000);
-            self.failWithUnreasonableInput(unreasonable);
+        function testNumericClassesToFromBytes(self)
+            classes = {'single', 'int8', 'uint8', 'int16', 'uint16', ...
+                'int32', 'uint32', 'int64', 'uint64'};
+            for ii = 1:length(classes)
+                self.roundTrip(cast(magic(5), classes{ii}));
+                self.roundTrip(zeros(0, 3, classes{ii}));
+                self.roundTrip(complex(cast(1:3, classes{ii}), ...
+                    cast(4:6, classes{ii})));
+            end
+            
+            % native classes should not be widened to double
+            bytes = mxGram('mxToBytes', ones(1, 100, 'uint16'));
+            assertEqual(numel(bytes), 12 + 2*100, ...
+                'should write uint16 elements as 2 bytes each')
+        end
+        
+        function testComplexToFromBytes(self)
+            self.roundTrip(1i);
+            self.roundTrip(complex(eye(5), -eye(5)));
+            self.roundTrip(exp(1i*(0:0.1:pi)));
+        end
+        
+        function testSparseToFromBytes(self)
+            self.roundTrip(sparse(eye(10)));
+            self.roundTrip(sparse(4, 5));
+            self.roundTrip(sparse([0 1i; 2 0]));
+            self.roundTrip(sparse(logical(eye(6))));
+        end
+        
+        function testLargeDoubleToFromBytes(self)
+            large = eye(1000);
+            self.roundTripLargeInput(large);
         end
         
         function testCharsToFromBytes(self)
@@ -81,9 +126,22 @@ classdef TestMxGram < TestCase
             end
         end
         
-        function testUnreasonablyLargeCharmxToChars(self)
-            unreasonable = char('a'*eye(1000));
-            self.failWithUnreasonableInput(unreasonable);
+        function testCharSizesToFromBytes(self)
+            % ASCII goes as 1 byte per char, other chars as 2 bytes
+            ascii = repmat('abc', 1, 100);
+            [remade, bytes] = self.roundTrip(ascii);
+            assertEqual(numel(bytes), 12 + numel(ascii), ...
+                'should send ASCII chars as 1 byte each')
+            
+            greek = char(945:994);
+            [remade, bytes] = self.roundTrip(greek);
+            assertEqual(numel(bytes), 12 + 2*numel(greek), ...
+                'should send non-ASCII chars as 2 bytes each')
+        end
+        
+        function testLargeCharToFromBytes(self)
+            large = char('a'*eye(1000));
+            self.roundTripLargeInput(large);
         end
         
         function testLogicalsToFromBytes(self)
@@ -92,9 +150,9 @@ classdef TestMxGram < TestCase
             end
         end
         
-        function testUnreasonablyLargeLogicalmxToChars(self)
-            unreasonable = true(1000,1000);
-            self.failWithUnreasonableInput(unreasonable);
+        function testLargeLogicalToFromBytes(self)
+            large = true(1000,1000);
+            self.roundTripLargeInput(large);
         end
         
         function testCellToFromBytes(self)
@@ -104,9 +162,9 @@ classdef TestMxGram < TestCase
             self.roundTrip(self.logicals);
         end
         
-        function testUnreasonablyLargeCellmxToChars(self)
-            unreasonable = {eye(1000)};
-            self.failWithUnreasonableInput(unreasonable);
+        function testLargeCellToFromBytes(self)
+            large = {eye(1000)};
+            self.roundTripLargeInput(large);
         end
         
         function testFunctionsToFromBytes(self)
@@ -143,6 +201,28 @@ classdef TestMxGram < TestCase
             end
         end
         
+        function testFunctionCacheStats(self)
+            mxGram('functionCacheClear');
+            functions = {@disp, @(x) x+1};
+            bytes = mxGram('mxToBytes', functions);
+            stats = mxGram('functionCacheStats');
+            assertEqual(stats.func2strCalls, 2, ...
+                'should call func2str once for each handle')
+            assertEqual(stats.func2strHits, 2, ...
+                'should reuse strings from sizing to encoding')
+            
+            % repeat strings skip str2func
+            mxGram('bytesToMx', bytes);
+            remade = mxGram('bytesToMx', bytes);
+            stats = mxGram('functionCacheStats');
+            assertEqual(stats.str2funcCalls, 2, ...
+                'should call str2func once for each string')
+            assertEqual(stats.str2funcHits, 2, ...
+                'should reuse handles for repeat strings')
+            assertEqual(func2str(remade{2}), func2str(functions{2}), ...
+                'should decode cached function handle')
+        end
+        
         function testScalarStructToFromBytes(self)
             emptyStruct = struct;
             self.roundTrip(emptyStruct);
@@ -174,9 +254,277 @@ classdef TestMxGram < TestCase
             self.roundTrip(repmat(funStruct, 1, 3));
         end
         
-        function testUnreasonablyLargeStructmxToChars(self)
-            unreasonable.largeDouble = eye(1000);
-            self.failWithUnreasonableInput(unreasonable);
+        function testLargeStructToFromBytes(self)
+            large.largeDouble = eye(1000);
+            self.roundTripLargeInput(large);
+        end
+        
+        function testCorruptBytesToMx(self)
+            % header claims 1000x1000 doubles, but data has only one
+            corrupt = uint8([20 0 0 0 8 0 8 0 232 3 232 3 0 0 0 0 0 0 240 63]);
+            [remade, status] = mxGram('bytesToMx', corrupt);
+            assertTrue(status < 0, ...
+                'should return negative status for corrupt bytes')
+            
+            % truncated data
+            truncated = uint8([20 0 0 0 8 0 8 0 1 0 1 0 0 0 0 0 0 0 240]);
+            [remade, status] = mxGram('bytesToMx', truncated);
+            assertTrue(status < 0, ...
+                'should return negative status for truncated bytes')
+            
+            % sparse indexes out of order or out of range
+            %   jc = [0 2 3] and ir = [0 1 2] follow the 12-byte header
+            bytes = mxGram('mxToBytes', sparse([1 0; 2 0; 0 3]));
+            corruptions = {13, 1; 17, 4; 25, 1; 29, 0; 33, 3};
+            for ii = 1:size(corruptions, 1)
+                corrupt = bytes;
+                corrupt(corruptions{ii,1}) = corruptions{ii,2};
+                [remade, status] = mxGram('bytesToMx', corrupt);
+                assertTrue(status < 0, ...
+                    'should return negative status for bad sparse indexes')
+            end
+        end
+        
+        function testPackedStructToFromBytes(self)
+            % scalar fields of one class go column-wise
+            packed = struct('x', num2cell(1:100), 'isOn', true);
+            [remade, bytes] = self.roundTrip(packed, inf, true);
+            assertTrue(numel(bytes) < 100*(12+8), ...
+                'should pack scalar fields into one array')
+            assertEqual(mxGram('size', packed, true), numel(bytes), ...
+                'should predict packed size')
+            
+            % mixed fields and 2D struct arrays
+            mixed = struct('x', {1, 'two'; int8(3), {4}}, 'y', []);
+            self.roundTrip(mixed, inf, true);
+            
+            % packing is opt-in, for peers that can read it
+            [remade, bytes] = self.roundTrip(packed);
+            assertTrue(numel(bytes) > 100*(12+8), ...
+                'should not pack without being asked')
+        end
+        
+        function testLegacyStructFromBytes(self)
+            % struct('a', 1) in the original per-element layout
+            legacy = uint8([46 0 4 0 8 0 8 0 1 0 1 0 ...
+                14 0 1 0 2 0 2 0 1 0 1 0 97 0 ...
+                20 0 0 0 8 0 8 0 1 0 1 0 0 0 0 0 0 0 240 63]);
+            [remade, status] = mxGram('bytesToMx', legacy);
+            assertEqual(status, numel(legacy), ...
+                'should read all bytes of legacy struct')
+            assertEqual(remade, struct('a', 1), ...
+                'should decode bytes with a legacy struct')
+            bytes = mxGram('mxToBytes', struct('a', 1));
+            assertEqual(bytes(3:4), legacy(3:4), ...
+                'should encode legacy struct by default')
+        end
+        
+        function testCompressedToFromBytes(self)
+            % slowly varying data, like an eye position trace
+            trace = cumsum(round(randn(3, 5000)/4), 2);
+            rawBytes = mxGram('mxToBytes', trace);
+            [bytes, status] = mxGram('mxToBytes', trace, 1000);
+            assertEqual(status, numel(bytes), ...
+                'should report size of compressed bytes')
+            assertTrue(numel(bytes) < numel(rawBytes), ...
+                'should compress bytes above threshold')
+            assertEqual(mxGram('bytesToMx', bytes), trace, ...
+                'should decode compressed bytes')
+            
+            % compressed grams also arrive in pieces
+            id = mxGram('decoderOpen');
+            remade = {};
+            for ii = 1:100:numel(bytes)
+                last = min(ii+99, numel(bytes));
+                remade = cat(2, remade, mxGram('decoderPush', id, bytes(ii:last)));
+            end
+            mxGram('decoderClose', id);
+            assertEqual(remade, {trace}, ...
+                'should decode compressed bytes in pieces')
+            
+            % small or incompressible variables go uncompressed
+            assertEqual(mxGram('mxToBytes', trace, inf), rawBytes, ...
+                'should not compress bytes below threshold')
+            noise = uint8(255*rand(1, 1000));
+            assertEqual(mxGram('mxToBytes', noise, 0), ...
+                mxGram('mxToBytes', noise), ...
+                'should not compress bytes that would get larger')
+        end
+        
+        function testSchemaToFromBytes(self)
+            mxGram('schemaClear');
+            first = {'method', 'dots', @disp, {1, [2 3]}, false, true};
+            second = {'method', 'dots', @disp, {4, [5 6]}, true, false};
+            rawBytes = mxGram('mxToBytes', first);
+            
+            % the first message carries the layout
+            [firstBytes, status] = mxGram('schemaEncode', first);
+            assertEqual(status, numel(firstBytes), ...
+                'should report size of schema bytes')
+            
+            % later messages with the same layout carry just values
+            secondBytes = mxGram('schemaEncode', second);
+            assertTrue(numel(secondBytes) < numel(rawBytes), ...
+                'should send fewer bytes for a known layout')
+            
+            remade = mxGram('bytesToMx', firstBytes);
+            assertEqual(func2str(remade{3}), func2str(first{3}), ...
+                'should decode function handle with layout')
+            remade = mxGram('bytesToMx', secondBytes);
+            assertEqual(remade([1 2 4:6]), second([1 2 4:6]), ...
+                'should decode values with known layout')
+            
+            % structs keep their field names in the layout
+            s = struct('x', {1, 2, 3}, 'label', 'a');
+            mxGram('bytesToMx', mxGram('schemaEncode', s));
+            assertEqual(mxGram('bytesToMx', mxGram('schemaEncode', s)), s, ...
+                'should decode struct with known layout')
+            
+            % after clearing, layouts go again
+            mxGram('schemaClear');
+            againBytes = mxGram('schemaEncode', second);
+            assertEqual(numel(againBytes), numel(firstBytes), ...
+                'should send the layout again after clearing')
+        end
+        
+        function testSchemaKeys(self)
+            mxGram('schemaClear');
+            msg = {'method', 'dots', {1, [2 3]}};
+            
+            % each peer gets its own layouts
+            [firstBytes, status, isNewLayout] = ...
+                mxGram('schemaEncode', msg, 1);
+            assertTrue(status > 0 && isNewLayout, ...
+                'should send the layout to the first peer')
+            [otherBytes, status, isNewLayout] = ...
+                mxGram('schemaEncode', msg, 2);
+            assertTrue(status > 0 && isNewLayout, ...
+                'should send the layout to the second peer too')
+            assertEqual(otherBytes, firstBytes, ...
+                'should send the same bytes to each new peer')
+            [againBytes, status, isNewLayout] = ...
+                mxGram('schemaEncode', msg, 1);
+            assertTrue(status > 0 && ~isNewLayout, ...
+                'should leave out the layout the first peer has')
+            
+            % receivers keep layouts by peer, too
+            remade = mxGram('bytesToMx', firstBytes, 10);
+            assertEqual(remade, msg, ...
+                'should decode message with layout')
+            assertEqual(mxGram('bytesToMx', againBytes, 10), msg, ...
+                'should decode values with layout from the same peer')
+            [remade, status] = mxGram('bytesToMx', againBytes, 20);
+            assertTrue(status < 0, ...
+                'should not decode values without that peer''s layout')
+            
+            % a layout that changed under the same schema ID won't match
+            mxGram('schemaClear', 1);
+            other = {'other', 7};
+            mxGram('bytesToMx', mxGram('schemaEncode', other, 1), 10);
+            [remade, status] = mxGram('bytesToMx', againBytes, 10);
+            assertTrue(status < 0, ...
+                'should not decode values with a stale layout')
+            mxGram('schemaClear');
+        end
+        
+        function testDeltaEncode(self)
+            mxGram('deltaClear');
+            state = struct('x', nan, 'color', [1 0 0], ...
+                'isVisible', true, 'callback', @disp);
+            
+            % the first delta carries every field
+            [delta, nChanged] = mxGram('deltaEncode', 'dots:1', state);
+            assertEqual(nChanged, 4, ...
+                'should report every field as changed')
+            assertEqual(fieldnames(delta), fieldnames(state), ...
+                'should carry every field the first time')
+            
+            % unchanged values, including NaN, are left out
+            [delta, nChanged] = mxGram('deltaEncode', 'dots:1', state);
+            assertEqual(nChanged, 0, ...
+                'should report no fields changed')
+            assertTrue(isempty(fieldnames(delta)), ...
+                'should carry no fields when nothing changed')
+            
+            % only changed fields go again
+            state.color = [0 1 0];
+            [delta, nChanged] = mxGram('deltaEncode', 'dots:1', state);
+            assertEqual(nChanged, 1, ...
+                'should report one changed field')
+            assertEqual(delta, struct('color', [0 1 0]), ...
+                'should carry just the changed field')
+            
+            % each key has its own baseline
+            [delta, nChanged] = mxGram('deltaEncode', 'dots:2', state);
+            assertEqual(nChanged, 4, ...
+                'should carry every field for a new key')
+            
+            % clearing a key prefix starts over
+            mxGram('deltaClear', 'dots:');
+            [delta, nChanged] = mxGram('deltaEncode', 'dots:1', state);
+            assertEqual(nChanged, 4, ...
+                'should carry every field after clearing')
+            
+            % objects can't be serialized, so the baseline stays put
+            [delta, nChanged] = mxGram('deltaEncode', 'dots:1', ...
+                struct('x', 1, 'object', self));
+            assertTrue(nChanged < 0 && isempty(delta), ...
+                'should refuse unsupported field values')
+            [delta, nChanged] = mxGram('deltaEncode', 'dots:1', state);
+            assertEqual(nChanged, 0, ...
+                'should keep baseline after refusing a struct')
+            mxGram('deltaClear');
+        end
+        
+        function testDecoderToFromBytes(self)
+            originals = {eye(30), 'hello', {1, 'two', true(2)}, ...
+                struct('x', {1, 2, 3}), sparse([0 1; 2i 0]), @disp};
+            bytes = zeros(1, 0, 'uint8');
+            for ii = 1:numel(originals)
+                bytes = cat(2, bytes, mxGram('mxToBytes', originals{ii}));
+            end
+            
+            % push all bytes at once, then one byte at a time
+            id = mxGram('decoderOpen');
+            [remade, status] = mxGram('decoderPush', id, bytes);
+            assertEqual(status, numel(bytes), ...
+                'should accept all pushed bytes')
+            assertEqual(numel(remade), numel(originals), ...
+                'should decode all variables from one push')
+            
+            remade = {};
+            for ii = 1:numel(bytes)
+                remade = cat(2, remade, mxGram('decoderPush', id, bytes(ii)));
+            end
+            mxGram('decoderClose', id);
+            assertEqual(numel(remade), numel(originals), ...
+                'should decode all variables from single bytes')
+            for ii = 1:numel(originals)-1
+                assertEqual(remade{ii}, originals{ii}, ...
+                    'should decode same variable from single bytes')
+            end
+            assertEqual(func2str(remade{end}), func2str(originals{end}), ...
+                'should decode function handle from single bytes')
+        end
+        
+        function testDecoderCorruptBytes(self)
+            id = mxGram('decoderOpen');
+            [remade, status] = mxGram('decoderPush', id, uint8([3 0 99 99]));
+            assertTrue(status < 0, ...
+                'should return negative status for corrupt bytes')
+            
+            % decoder starts over after an error
+            bytes = mxGram('mxToBytes', 'fresh');
+            remade = mxGram('decoderPush', id, bytes);
+            mxGram('decoderClose', id);
+            assertEqual(remade, {'fresh'}, ...
+                'should decode again after corrupt bytes')
+        end
+        
+        function testUnsupportedmxToBytes(self)
+            % objects can't be converted to bytes
+            self.failWithUnreasonableInput(self);
+            self.failWithUnreasonableInput({1, self});
         end
         
         function testNestedTypesToFromBytes(self)
@@ -195,6 +543,26 @@ classdef TestMxGram < TestCase
             emptyCell = cell(3,3);
             self.roundTrip(emptyCell);
         end
+        
+        function testWideHeaderToFromBytes(self)
+            % dimensions over 65535 don't fit in the legacy header
+            self.roundTrip(zeros(0, 70000));
+            self.roundTrip(char(zeros(70000, 0)));
+            self.roundTrip(false(0, 70000));
+            self.roundTrip(cell(70000, 0));
+        end
+        
+        function testLegacyHeaderToFromBytes(self)
+            % small variables should still use the 12-byte header
+            bytes = mxGram('mxToBytes', 1);
+            assertEqual(numel(bytes), 20, ...
+                'should use the legacy header for small variables')
+            
+            legacy = uint8([20 0 0 0 8 0 8 0 1 0 1 0 0 0 0 0 0 0 240 63]);
+            remade = mxGram('bytesToMx', legacy);
+            assertEqual(remade, 1, ...
+                'should decode bytes with a legacy header')
+        end
     end
     
     methods (Static)
@@ -0,0 +1,88 @@
+% Measure ensemble transaction latency and throughput without a server.
+% @param sizes payload sizes to measure, in bytes
+% @param windows window depths to measure, in transactions
+% @param nTransactions how many transactions to measure for each
+% @param csvFile optional file name for the CSV results
+% @details
+% benchmarkEnsembleLoad() builds and runs the ensembleLoad program, whose
+% source is next to this file.  The program goes in tempdir(), and is
+% rebuilt whenever the source is newer.  ensembleLoad starts an echo
+% server and a load generator over the loopback address.  They speak the
+% same prefix-ack and mxGram wire format as dotsTheMessenger, but don't
+% need a second instance of Matlab.
+% @details
+% For each combination of @a sizes and @a windows, the load generator
+% keeps up to that many transactions in flight and measures the time from
+% sending each transaction to getting its reply.  The defaults are
+% [16 256 1024 8192 32768] bytes, windows of [1 4 16 64], and 10000
+% transactions each.  If @a csvFile is provided, ensembleLoad writes its
+% results there, for regression tracking.  ensembleLoad may also run
+% from the command line, with or without Matlab.
+% @details
+% Returns a struct array with one element per combination and fields
+% from the CSV header, including tps, p50Usec, p99Usec, and p999Usec.
+% Returns [] if ensembleLoad couldn't be built or run.
+%
+% @ingroup dotsUtilities
+function data = benchmarkEnsembleLoad( ...
+    sizes, windows, nTransactions, csvFile)
+
+if nargin < 1 || isempty(sizes)
+    sizes = [16 256 1024 8192 32768];
+end
+
+if nargin < 2 || isempty(windows)
+    windows = [1 4 16 64];
+end
+
+if nargin < 3 || isempty(nTransactions)
+    nTransactions = 10000;
+end
+
+if nargin < 4 || isempty(csvFile)
+    csvFile = [tempname() '.csv'];
+end
+
+% build the program in the temp folder, again whenever the source changes
+here = fileparts(mfilename('fullpath'));
+source = fullfile(here, 'ensembleLoad.c');
+program = fullfile(tempdir(), 'ensembleLoad');
+programInfo = dir(program);
+sourceInfo = dir(source);
+if isempty(programInfo) || programInfo.datenum < sourceInfo.datenum
+    status = system(sprintf('cc -O2 -o "%s" "%s" -lm', program, source));
+    if status ~= 0
+        disp('Can not build ensembleLoad')
+        data = [];
+        return;
+    end
+end
+
+status = system(sprintf( ...
+    '"%s" -sizes %s -windows %s -n %d -o "%s"', program, ...
+    sprintf('%d,', sizes(1:end-1), sizes(end)), ...
+    sprintf('%d,', windows(1:end-1), windows(end)), ...
+    nTransactions, csvFile));
+if status ~= 0
+    disp('Can not run ensembleLoad')
+    data = [];
+    return;
+end
+
+% read the CSV header and numeric rows into a struct array
+fid = fopen(csvFile, 'r');
+header = fgetl(fid);
+values = textscan(fid, '%f', 'Delimiter', ',');
+fclose(fid);
+names = regexp(header, ',', 'split');
+values = reshape(values{1}, numel(names), [])';
+data = cell2struct(num2cell(values), names, 2);
+
+% print one row per combination
+fprintf('%10s %8s %12s %10s %10s %10s\n', ...
+    'bytes', 'window', 'tps', 'p50 us', 'p99 us', 'p999 us');
+for ii = 1:numel(data)
+    fprintf('%10d %8d %12.0f %10.1f %10.1f %10.1f\n', ...
+        data(ii).payloadBytes, data(ii).window, data(ii).tps, ...
+        data(ii).p50Usec, data(ii).p99Usec, data(ii).p999Usec);
+end
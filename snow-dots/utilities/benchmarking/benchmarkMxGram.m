@@ -0,0 +1,64 @@
+% Measure throughput of the mxGram data conversion kernels.
+% @param nElements array sizes to measure
+% @param showPlot whether or not to plot the throughput results
+% @details
+% benchmarkMxGram() calls mxGram('benchmark') to time the kernels that
+% convert double, char, and logical array data to and from bytes.  Each
+% kernel is timed twice: once using the per-element loops that mxGram
+% used originally, and once using the current block-copy and vectorized
+% kernels.
+% @details
+% @a nElements specifies the array sizes to measure.  The default is
+% 10.^(3:6).  By default, prints a table of results to the Command Window
+% and plots them in a new figure.  If @a showPlot is provided and false,
+% only prints the table.
+% @details
+% Returns a struct array with fields kernel, nElements, legacyMBPerSec,
+% and bulkMBPerSec, one element for each kernel and array size.
+%
+% @ingroup dotsUtilities
+function data = benchmarkMxGram(nElements, showPlot)
+
+if nargin < 1 || isempty(nElements)
+    nElements = 10.^(3:6);
+end
+
+if nargin < 2 || isempty(showPlot)
+    showPlot = true;
+end
+
+data = mxGram('benchmark', nElements);
+
+% print one row per kernel and size
+fprintf('%-16s %10s %14s %14s %8s\n', ...
+    'kernel', 'nElements', 'legacy MB/s', 'bulk MB/s', 'speedup');
+for ii = 1:numel(data)
+    fprintf('%-16s %10d %14.0f %14.0f %8.1f\n', ...
+        data(ii).kernel, data(ii).nElements, ...
+        data(ii).legacyMBPerSec, data(ii).bulkMBPerSec, ...
+        data(ii).bulkMBPerSec / data(ii).legacyMBPerSec);
+end
+
+if ~showPlot
+    return;
+end
+
+% plot throughput vs array size for each kernel
+f = figure;
+clf(f);
+ax = axes('Parent', f, 'XScale', 'log', 'YScale', 'log');
+hold(ax, 'on');
+kernels = unique({data.kernel}, 'stable');
+colors = lines(numel(kernels));
+for ii = 1:numel(kernels)
+    isKernel = strcmp({data.kernel}, kernels{ii});
+    line([data(isKernel).nElements], [data(isKernel).legacyMBPerSec], ...
+        'Parent', ax, 'Color', colors(ii,:), 'LineStyle', ':', ...
+        'Marker', '.');
+    line([data(isKernel).nElements], [data(isKernel).bulkMBPerSec], ...
+        'Parent', ax, 'Color', colors(ii,:), 'LineStyle', '-', ...
+        'Marker', '.', 'DisplayName', kernels{ii});
+end
+xlabel(ax, 'number of elements');
+ylabel(ax, 'MB/s (dotted: legacy, solid: bulk)');
+title(ax, 'mxGram kernel throughput');
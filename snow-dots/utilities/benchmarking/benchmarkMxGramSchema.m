@@ -0,0 +1,66 @@
+% Measure mxGram schema encoding of ensemble transactions.
+% @param iterations how many transactions to encode and decode
+% @details
+% benchmarkMxGramSchema() builds a representative method-call transaction
+% from dotsEnsembleUtilities, like the ones dotsClientEnsemble sends to a
+% dotsEnsembleServer.  It encodes and decodes the transaction many times
+% with mxGram('mxToBytes'), then again with mxGram('schemaEncode'), and
+% prints the message size and time per message for each.
+% @details
+% @a iterations specifies how many transactions to encode and decode.
+% The default is 10000.
+% @details
+% Returns a struct array with fields encoding, nBytes, encodeMicroseconds,
+% and decodeMicroseconds, one element for each encoding.
+%
+% @ingroup dotsUtilities
+function data = benchmarkMxGramSchema(iterations)
+
+if nargin < 1 || isempty(iterations)
+    iterations = 10000;
+end
+
+% a method call with arguments, as from makeMethodTransaction()
+txn = dotsEnsembleUtilities.getTransactionTemplate();
+txn.type = 'method';
+txn.target = 'dotsDrawableTargets';
+txn.method = @mayDrawNow;
+txn.args = {[0.5 -0.5], true, 'red'};
+txn.isResult = false;
+txn.isSynchronized = true;
+command = dotsEnsembleUtilities.getTransactionParts(txn);
+
+encodings = {'mxToBytes', 'schemaEncode'};
+data = struct( ...
+    'encoding', encodings, ...
+    'nBytes', 0, ...
+    'encodeMicroseconds', 0, ...
+    'decodeMicroseconds', 0);
+
+mxGram('schemaClear');
+for ii = 1:numel(encodings)
+    % the first schema message carries the layout, so skip it
+    bytes = mxGram(encodings{ii}, command);
+    mxGram('bytesToMx', bytes);
+
+    tic();
+    for jj = 1:iterations
+        bytes = mxGram(encodings{ii}, command);
+    end
+    data(ii).encodeMicroseconds = 1e6 * toc() / iterations;
+
+    tic();
+    for jj = 1:iterations
+        mxGram('bytesToMx', bytes);
+    end
+    data(ii).decodeMicroseconds = 1e6 * toc() / iterations;
+    data(ii).nBytes = numel(bytes);
+end
+
+fprintf('%-14s %8s %12s %12s\n', ...
+    'encoding', 'bytes', 'encode us', 'decode us');
+for ii = 1:numel(data)
+    fprintf('%-14s %8d %12.1f %12.1f\n', ...
+        data(ii).encoding, data(ii).nBytes, ...
+        data(ii).encodeMicroseconds, data(ii).decodeMicroseconds);
+end
@@ -0,0 +1,641 @@
+/* ensembleLoad.c
+ *
+ * Headless load generator and echo server for the wire format that
+ * dotsTheMessenger uses between dotsClientEnsemble and
+ * dotsEnsembleServer.  Each message is a 1-byte ack code prefix followed
+ * by an mxGram.  The receiver replies to every prefixed datagram with
+ * the 1-byte prefix, and ignores repeats of recent prefixes.
+ *
+ * The client sends uint8 row vector grams, several at once up to a
+ * window depth, and resends any that go unanswered.  The server acks
+ * each one, checks its mxGram header, and replies with the same gram
+ * under its own prefix, the way dotsEnsembleServer replies to
+ * synchronized transactions.  The client measures the time from the
+ * first send of each request to the arrival of its reply.
+ *
+ * This doesn't need Matlab.  It writes the mxGram header itself, so it
+ * only sends numeric grams.  Build it with any C compiler:
+ *
+ *  cc -O2 -o ensembleLoad ensembleLoad.c -lm
+ *
+ * By default it forks an echo server on the loopback address and runs
+ * the client against it, for every combination of payload size and
+ * window depth.  It prints one CSV row per combination:
+ *
+ *  ensembleLoad -sizes 16,1024,8192 -windows 1,8,32 -n 10000 > load.csv
+ *
+ * It can also run either side alone, for example the server on one host
+ * and the client on another:
+ *
+ *  ensembleLoad -server -host 192.168.1.2 -port 49350
+ *  ensembleLoad -client -host 192.168.1.2 -port 49350
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// match dotsTheMessenger and mexUDP
+#define LOAD_PREFIX_MODULUS 255
+#define LOAD_MAX_WINDOW 127
+#define LOAD_MAX_DATAGRAM 65507
+
+// match the mxGram byte headers and the uint8 gram type
+#define LOAD_GRAM_HEAD 12
+#define LOAD_GRAM_WIDE_HEAD 24
+#define LOAD_GRAM_WIDE_VERSION 1
+#define LOAD_GRAM_HEAD_MAX 65535
+#define LOAD_GRAM_UINT8 8
+
+// each payload starts with the client's transaction number
+#define LOAD_SEQ_BYTES 4
+#define LOAD_MAX_PAYLOAD (LOAD_MAX_DATAGRAM - 1 - LOAD_GRAM_WIDE_HEAD)
+
+#define LOAD_MAX_CONFIGS 32
+#define LOAD_SOCKET_BUFFER_BYTES (8*1024*1024)
+
+typedef struct {
+    int             seq;
+    int             prefix;
+    int             length;
+    int             nSends;
+    double          firstSendTime;
+    double          lastSendTime;
+    char            *message;
+} loadRequest;
+
+typedef struct {
+    const char      *host;
+    int             port;
+    int             sizes[LOAD_MAX_CONFIGS];
+    int             nSizes;
+    int             windows[LOAD_MAX_CONFIGS];
+    int             nWindows;
+    int             nTransactions;
+    int             nWarmup;
+    double          ackTimeout;
+    int             sendRetries;
+    int             isServer;
+    int             isClient;
+    const char      *outName;
+} loadOptions;
+
+typedef struct {
+    int             nDone;
+    int             nFailed;
+    int             nResends;
+    double          seconds;
+    double          *latencies;
+} loadResults;
+
+static volatile sig_atomic_t loadIsStopped = 0;
+
+static void loadStop(int sig) {
+    (void)sig;
+    loadIsStopped = 1;
+}
+
+static double loadGetSeconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return((double)now.tv_sec + 1e-9*now.tv_nsec);
+}
+
+static void loadWriteInt16(unsigned int value, char *bytes) {
+    // little endian, like mxGram
+    bytes[0] = (char)(value & 0xff);
+    bytes[1] = (char)((value >> 8) & 0xff);
+}
+
+static void loadWriteInt32(unsigned int value, char *bytes) {
+    loadWriteInt16(value & 0xffff, bytes);
+    loadWriteInt16(value >> 16, bytes+2);
+}
+
+static unsigned int loadReadInt16(const char *bytes) {
+    return((unsigned char)bytes[0] + 256*(unsigned int)(unsigned char)bytes[1]);
+}
+
+static unsigned int loadReadInt32(const char *bytes) {
+    return(loadReadInt16(bytes) + 65536*loadReadInt16(bytes+2));
+}
+
+// write a 1 x nData uint8 gram, with the legacy header when it fits
+static int loadWriteGram(char *gram, int nData, int seq) {
+    int ii, head = LOAD_GRAM_HEAD;
+    char *data;
+
+    if (head + nData > LOAD_GRAM_HEAD_MAX) {
+        head = LOAD_GRAM_WIDE_HEAD;
+        loadWriteInt16(LOAD_GRAM_WIDE_VERSION, gram);
+        loadWriteInt16(LOAD_GRAM_UINT8, gram+2);
+        loadWriteInt16(1, gram+4);
+        loadWriteInt16(0, gram+6);
+        loadWriteInt32(head + nData, gram+8);
+        loadWriteInt32(nData, gram+12);
+        loadWriteInt32(1, gram+16);
+        loadWriteInt32(nData, gram+20);
+    } else {
+        loadWriteInt16(head + nData, gram);
+        loadWriteInt16(LOAD_GRAM_UINT8, gram+2);
+        loadWriteInt16(nData, gram+4);
+        loadWriteInt16(1, gram+6);
+        loadWriteInt16(1, gram+8);
+        loadWriteInt16(nData, gram+10);
+    }
+
+    data = gram + head;
+    loadWriteInt32(seq, data);
+    for (ii=LOAD_SEQ_BYTES; ii<nData; ii++)
+        data[ii] = (char)ii;
+    return(head + nData);
+}
+
+// check a uint8 row vector gram and return its data offset, or -1
+static int loadReadGram(const char *gram, int nBytes) {
+    unsigned int head, gramLength, gramType, dataLength, m, n;
+
+    if (nBytes < LOAD_GRAM_HEAD)
+        return(-1);
+
+    if (loadReadInt16(gram) >= LOAD_GRAM_HEAD) {
+        head = LOAD_GRAM_HEAD;
+        gramLength = loadReadInt16(gram);
+        gramType = loadReadInt16(gram+2);
+        dataLength = loadReadInt16(gram+4);
+        m = loadReadInt16(gram+8);
+        n = loadReadInt16(gram+10);
+    } else if (loadReadInt16(gram) == LOAD_GRAM_WIDE_VERSION && nBytes >= LOAD_GRAM_WIDE_HEAD) {
+        head = LOAD_GRAM_WIDE_HEAD;
+        gramType = loadReadInt16(gram+2);
+        gramLength = loadReadInt32(gram+8);
+        dataLength = loadReadInt32(gram+12);
+        m = loadReadInt32(gram+16);
+        n = loadReadInt32(gram+20);
+    } else
+        return(-1);
+
+    if (gramLength != (unsigned int)nBytes || gramType != LOAD_GRAM_UINT8
+            || dataLength != m*n || head + dataLength != gramLength
+            || dataLength < LOAD_SEQ_BYTES)
+        return(-1);
+    return((int)head);
+}
+
+static int loadOpenSocket(const char *host, int port, int isServer) {
+    struct sockaddr_in address;
+    int sock, bufferBytes = LOAD_SOCKET_BUFFER_BYTES;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+        return(-1);
+
+    // deep windows of big grams need room in the kernel
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufferBytes, sizeof(bufferBytes));
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &bufferBytes, sizeof(bufferBytes));
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = inet_addr(host);
+
+    // the server answers whoever sends, the client talks to one server
+    if (isServer) {
+        if (bind(sock, (struct sockaddr*)&address, sizeof(address)) < 0) {
+            close(sock);
+            return(-1);
+        }
+    } else if (connect(sock, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        close(sock);
+        return(-1);
+    }
+    return(sock);
+}
+
+static int loadServe(int sock) {
+    static char buffer[LOAD_MAX_DATAGRAM];
+    static char *replies[LOAD_PREFIX_MODULUS];
+    static int replyLengths[LOAD_PREFIX_MODULUS];
+    int recent[LOAD_MAX_WINDOW+1];
+    int ii, nBytes, prefix, isRecent, nextRecent = 0, sentPrefix = 0;
+    long nReceived = 0, nRepeats = 0, nInvalid = 0;
+    struct sockaddr_in from, client;
+    socklen_t fromLength;
+    struct pollfd pollFD;
+
+    memset(&client, 0, sizeof(client));
+
+    pollFD.fd = sock;
+    pollFD.events = POLLIN;
+    while (!loadIsStopped) {
+        if (poll(&pollFD, 1, 100) <= 0)
+            continue;
+
+        fromLength = sizeof(from);
+        nBytes = recvfrom(sock, buffer, sizeof(buffer), 0, (struct sockaddr*)&from, &fromLength);
+
+        // lone bytes are acks for replies, which never get resent
+        if (nBytes <= 1)
+            continue;
+
+        // remember as many prefixes as a client may have in flight
+        //  a new client starts its prefixes over
+        if (from.sin_port != client.sin_port || from.sin_addr.s_addr != client.sin_addr.s_addr) {
+            client = from;
+            for (ii=0; ii<=LOAD_MAX_WINDOW; ii++)
+                recent[ii] = -1;
+        }
+
+        // ack every prefixed datagram, even repeats
+        prefix = (unsigned char)buffer[0];
+        sendto(sock, buffer, 1, 0, (struct sockaddr*)&from, fromLength);
+        if (prefix >= LOAD_PREFIX_MODULUS) {
+            nInvalid++;
+            continue;
+        }
+
+        for (ii=0, isRecent=0; ii<=LOAD_MAX_WINDOW && !isRecent; ii++)
+            isRecent = recent[ii] == prefix;
+
+        if (isRecent) {
+            // the client missed the reply, so send it again
+            nRepeats++;
+            if (replyLengths[prefix] > 0)
+                sendto(sock, replies[prefix], replyLengths[prefix], 0,
+                        (struct sockaddr*)&from, fromLength);
+            continue;
+        }
+
+        if (loadReadGram(buffer+1, nBytes-1) < 0) {
+            nInvalid++;
+            continue;
+        }
+
+        // echo the gram under the server's own prefix
+        nReceived++;
+        recent[nextRecent] = prefix;
+        nextRecent = (nextRecent + 1) % (LOAD_MAX_WINDOW+1);
+        if (replies[prefix] == NULL)
+            replies[prefix] = malloc(LOAD_MAX_DATAGRAM);
+        buffer[0] = (char)sentPrefix;
+        sentPrefix = (sentPrefix + 1) % LOAD_PREFIX_MODULUS;
+        memcpy(replies[prefix], buffer, nBytes);
+        replyLengths[prefix] = nBytes;
+        sendto(sock, buffer, nBytes, 0, (struct sockaddr*)&from, fromLength);
+    }
+
+    fprintf(stderr, "ensembleLoad: server received %ld, repeats %ld, invalid %ld\n",
+            nReceived, nRepeats, nInvalid);
+    for (ii=0; ii<LOAD_PREFIX_MODULUS; ii++)
+        free(replies[ii]);
+    close(sock);
+    return(0);
+}
+
+static void loadSendRequest(int sock, loadRequest *request, loadResults *results) {
+    request->lastSendTime = loadGetSeconds();
+    if (request->nSends == 0)
+        request->firstSendTime = request->lastSendTime;
+    else
+        results->nResends++;
+    request->nSends++;
+    send(sock, request->message, request->length, 0);
+}
+
+// slide the window only past the oldest request still in flight
+//  so no two requests in flight, or in the server's recent prefixes,
+//  can have the same prefix
+static int loadCanStartRequest(const loadRequest *requests, int nWindow, int nextSeq, int lastSeq) {
+    int ii;
+    if (nextSeq >= lastSeq)
+        return(0);
+    for (ii=0; ii<nWindow; ii++)
+        if (requests[ii].seq >= 0 && requests[ii].seq <= nextSeq - nWindow)
+            return(0);
+    return(1);
+}
+
+static void loadStartRequest(int sock, loadRequest *request, int nData, int seq,
+        int *sentPrefix, loadResults *results) {
+    request->seq = seq;
+    request->prefix = *sentPrefix;
+    request->nSends = 0;
+    *sentPrefix = (*sentPrefix + 1) % LOAD_PREFIX_MODULUS;
+    request->message[0] = (char)request->prefix;
+    request->length = 1 + loadWriteGram(request->message+1, nData, seq);
+    loadSendRequest(sock, request, results);
+}
+
+// run transactions with up to nWindow in flight
+static void loadRun(int sock, const loadOptions *options, int nData, int nWindow,
+        int nTransactions, int firstSeq, int *sentPrefix, loadResults *results) {
+
+    static char buffer[LOAD_MAX_DATAGRAM];
+    loadRequest requests[LOAD_MAX_WINDOW];
+    int ii, nBytes, nReady, nextSeq = firstSeq, lastSeq = firstSeq + nTransactions;
+    int dataOffset, seq, waitMsecs;
+    double now, deadline, startTime;
+    struct pollfd pollFD;
+
+    memset(requests, 0, sizeof(requests));
+    for (ii=0; ii<nWindow; ii++) {
+        requests[ii].seq = -1;
+        requests[ii].message = malloc(LOAD_MAX_DATAGRAM);
+    }
+
+    results->nDone = results->nFailed = results->nResends = 0;
+    pollFD.fd = sock;
+    pollFD.events = POLLIN;
+    startTime = loadGetSeconds();
+    while (results->nDone + results->nFailed < nTransactions && !loadIsStopped) {
+
+        // fill the window with new requests
+        for (ii=0; ii<nWindow && loadCanStartRequest(requests, nWindow, nextSeq, lastSeq); ii++)
+            if (requests[ii].seq < 0)
+                loadStartRequest(sock, &requests[ii], nData, nextSeq++, sentPrefix, results);
+
+        // sleep until a reply arrives or the oldest request times out
+        deadline = HUGE_VAL;
+        for (ii=0; ii<nWindow; ii++)
+            if (requests[ii].seq >= 0 && requests[ii].lastSendTime + options->ackTimeout < deadline)
+                deadline = requests[ii].lastSendTime + options->ackTimeout;
+        waitMsecs = (int)ceil(1000*(deadline - loadGetSeconds()));
+        if (waitMsecs < 0)
+            waitMsecs = 0;
+
+        poll(&pollFD, 1, waitMsecs);
+
+        // take what's ready now, then go back and refill the window
+        //  each request gets an ack and a reply
+        for (nReady=0; nReady<2*nWindow; nReady++) {
+            nBytes = recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (nBytes < 0)
+                break;
+
+            // acks for requests only show the server is alive
+            if (nBytes <= 1)
+                continue;
+
+            // ack the reply, like any other message
+            send(sock, buffer, 1, 0);
+            dataOffset = loadReadGram(buffer+1, nBytes-1);
+            if (dataOffset < 0)
+                continue;
+
+            // match the reply to its request, ignoring repeats
+            seq = (int)loadReadInt32(buffer+1+dataOffset);
+            now = loadGetSeconds();
+            for (ii=0; ii<nWindow; ii++) {
+                if (requests[ii].seq == seq) {
+                    results->latencies[results->nDone++] = now - requests[ii].firstSendTime;
+                    requests[ii].seq = -1;
+
+                    // keep the window full
+                    if (loadCanStartRequest(requests, nWindow, nextSeq, lastSeq))
+                        loadStartRequest(sock, &requests[ii], nData, nextSeq++, sentPrefix, results);
+                    break;
+                }
+            }
+        }
+
+        // resend whatever timed out, or give up on it
+        now = loadGetSeconds();
+        for (ii=0; ii<nWindow; ii++) {
+            if (requests[ii].seq < 0 || now < requests[ii].lastSendTime + options->ackTimeout)
+                continue;
+            if (requests[ii].nSends > options->sendRetries) {
+                results->nFailed++;
+                requests[ii].seq = -1;
+            } else
+                loadSendRequest(sock, &requests[ii], results);
+        }
+    }
+    results->seconds = loadGetSeconds() - startTime;
+
+    for (ii=0; ii<nWindow; ii++)
+        free(requests[ii].message);
+}
+
+static int loadCompareDoubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return((x > y) - (x < y));
+}
+
+// nearest-rank percentile of sorted values, in microseconds
+static void loadPrintPercentile(FILE *out, const double *sorted, int n, double p) {
+    int index = (int)ceil(p*n) - 1;
+    if (n < 1) {
+        fprintf(out, ",NaN");
+        return;
+    }
+    if (index < 0)
+        index = 0;
+    if (index > n-1)
+        index = n-1;
+    fprintf(out, ",%.1f", 1e6*sorted[index]);
+}
+
+static void loadPrintResults(FILE *out, int nData, int nWindow, loadResults *results) {
+    int head = nData + LOAD_GRAM_HEAD > LOAD_GRAM_HEAD_MAX ? LOAD_GRAM_WIDE_HEAD : LOAD_GRAM_HEAD;
+
+    qsort(results->latencies, results->nDone, sizeof(double), loadCompareDoubles);
+    fprintf(out, "%d,%d,%d,%d,%d,%d,%.6f,%.1f",
+            nData, 1 + head + nData, nWindow,
+            results->nDone, results->nFailed, results->nResends,
+            results->seconds, results->nDone / results->seconds);
+    loadPrintPercentile(out, results->latencies, results->nDone, 0.50);
+    loadPrintPercentile(out, results->latencies, results->nDone, 0.99);
+    loadPrintPercentile(out, results->latencies, results->nDone, 0.999);
+    loadPrintPercentile(out, results->latencies, results->nDone, 1.0);
+    fprintf(out, "\n");
+}
+
+static int loadClient(const loadOptions *options) {
+    int ii, jj, sentPrefix = 0, seq = 0, nData;
+    loadResults results, warmup;
+    FILE *out = stdout;
+
+    int sock = loadOpenSocket(options->host, options->port, 0);
+    if (sock < 0) {
+        fprintf(stderr, "ensembleLoad: client can't connect to %s:%d (%s)\n",
+                options->host, options->port, strerror(errno));
+        return(1);
+    }
+
+    if (options->outName != NULL) {
+        out = fopen(options->outName, "w");
+        if (out == NULL) {
+            fprintf(stderr, "ensembleLoad: can't write %s (%s)\n",
+                    options->outName, strerror(errno));
+            close(sock);
+            return(1);
+        }
+    }
+
+    results.latencies = malloc(options->nTransactions * sizeof(double));
+    warmup.latencies = malloc((options->nWarmup+1) * sizeof(double));
+    fprintf(out, "payloadBytes,datagramBytes,window,transactions,failed,resends,"
+            "seconds,tps,p50Usec,p99Usec,p999Usec,maxUsec\n");
+
+    for (ii=0; ii<options->nSizes && !loadIsStopped; ii++) {
+        // the payload includes the transaction number
+        nData = options->sizes[ii] < LOAD_SEQ_BYTES ? LOAD_SEQ_BYTES : options->sizes[ii];
+        for (jj=0; jj<options->nWindows && !loadIsStopped; jj++) {
+            loadRun(sock, options, nData, options->windows[jj],
+                    options->nWarmup, seq, &sentPrefix, &warmup);
+            seq += options->nWarmup;
+
+            loadRun(sock, options, nData, options->windows[jj],
+                    options->nTransactions, seq, &sentPrefix, &results);
+            seq += options->nTransactions;
+
+            loadPrintResults(out, nData, options->windows[jj], &results);
+            fflush(out);
+        }
+    }
+
+    free(results.latencies);
+    free(warmup.latencies);
+    if (out != stdout)
+        fclose(out);
+    close(sock);
+    return(0);
+}
+
+// parse a comma-separated list of positive integers
+static int loadParseList(const char *string, int *values, int maxValues, int maxValue) {
+    int n = 0;
+    char *end;
+    long value;
+
+    while (*string && n < maxValues) {
+        value = strtol(string, &end, 10);
+        if (end == string || value < 1 || value > maxValue)
+            return(-1);
+        values[n++] = (int)value;
+        string = *end == ',' ? end+1 : end;
+        if (*end && *end != ',')
+            return(-1);
+    }
+    return(*string ? -1 : n);
+}
+
+static void loadPrintUsage(void) {
+    fprintf(stderr,
+            "usage: ensembleLoad [-server | -client] [-host ip] [-port n]\n"
+            "         [-sizes 16,1024,...] [-windows 1,8,...] [-n transactions]\n"
+            "         [-warmup transactions] [-timeout seconds] [-retries n] [-o file.csv]\n"
+            "  with neither -server nor -client, forks a loopback server and runs the client\n"
+            "  payload sizes are in bytes, up to %d; windows are up to %d\n",
+            LOAD_MAX_PAYLOAD, LOAD_MAX_WINDOW);
+}
+
+static int loadParseOptions(int argc, char **argv, loadOptions *options) {
+    int ii;
+    const char *value;
+
+    memset(options, 0, sizeof(loadOptions));
+    options->host = "127.0.0.1";
+    options->port = 49350;
+    options->nSizes = loadParseList("16,256,1024,8192,32768", options->sizes, LOAD_MAX_CONFIGS, LOAD_MAX_PAYLOAD);
+    options->nWindows = loadParseList("1,4,16,64", options->windows, LOAD_MAX_CONFIGS, LOAD_MAX_WINDOW);
+    options->nTransactions = 10000;
+    options->nWarmup = 100;
+    options->ackTimeout = 0.05;
+    options->sendRetries = 20;
+
+    for (ii=1; ii<argc; ii++) {
+        if (!strcmp(argv[ii], "-server")) {
+            options->isServer = 1;
+            continue;
+        } else if (!strcmp(argv[ii], "-client")) {
+            options->isClient = 1;
+            continue;
+        }
+
+        // everything else takes a value
+        if (ii+1 >= argc)
+            return(-1);
+        value = argv[++ii];
+        if (!strcmp(argv[ii-1], "-host"))
+            options->host = value;
+        else if (!strcmp(argv[ii-1], "-port"))
+            options->port = atoi(value);
+        else if (!strcmp(argv[ii-1], "-sizes"))
+            options->nSizes = loadParseList(value, options->sizes, LOAD_MAX_CONFIGS, LOAD_MAX_PAYLOAD);
+        else if (!strcmp(argv[ii-1], "-windows"))
+            options->nWindows = loadParseList(value, options->windows, LOAD_MAX_CONFIGS, LOAD_MAX_WINDOW);
+        else if (!strcmp(argv[ii-1], "-n"))
+            options->nTransactions = atoi(value);
+        else if (!strcmp(argv[ii-1], "-warmup"))
+            options->nWarmup = atoi(value);
+        else if (!strcmp(argv[ii-1], "-timeout"))
+            options->ackTimeout = atof(value);
+        else if (!strcmp(argv[ii-1], "-retries"))
+            options->sendRetries = atoi(value);
+        else if (!strcmp(argv[ii-1], "-o"))
+            options->outName = value;
+        else
+            return(-1);
+    }
+
+    if (options->nSizes < 1 || options->nWindows < 1 || options->nTransactions < 1
+            || options->nWarmup < 0 || options->ackTimeout <= 0 || options->sendRetries < 0
+            || options->port < 1 || options->port > 65535
+            || (options->isServer && options->isClient))
+        return(-1);
+    return(0);
+}
+
+int main(int argc, char **argv) {
+    loadOptions options;
+    pid_t server;
+    int sock, status;
+
+    if (loadParseOptions(argc, argv, &options) < 0) {
+        loadPrintUsage();
+        return(2);
+    }
+
+    signal(SIGINT, loadStop);
+    signal(SIGTERM, loadStop);
+
+    if (options.isClient)
+        return(loadClient(&options));
+
+    // bind before forking, so the client can't send too soon
+    sock = loadOpenSocket(options.host, options.port, 1);
+    if (sock < 0) {
+        fprintf(stderr, "ensembleLoad: server can't bind %s:%d (%s)\n",
+                options.host, options.port, strerror(errno));
+        return(1);
+    }
+    if (options.isServer)
+        return(loadServe(sock));
+
+    // run both sides over loopback, in one process tree
+    server = fork();
+    if (server < 0) {
+        fprintf(stderr, "ensembleLoad: can't fork server (%s)\n", strerror(errno));
+        return(1);
+    } else if (server == 0)
+        return(loadServe(sock));
+
+    close(sock);
+    status = loadClient(&options);
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    return(status);
+}